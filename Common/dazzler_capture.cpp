@@ -0,0 +1,556 @@
+// -----------------------------------------------------------------------------
+// Cromemco Dazzler emulation - frame capture to video/image files
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#include <string.h>
+#include <vector>
+#include "dazzler_capture.h"
+
+#define R(c) ((c) & 0xFF)
+#define G(c) (((c) >> 8) & 0xFF)
+#define B(c) (((c) >> 16) & 0xFF)
+
+
+// --------------------------------------------------- Y4M ---------------------------------------------------------
+
+
+static bool y4m_start(dazzler_capture *c)
+{
+  c->f = fopen(c->fname, "wb");
+  if( c->f==NULL ) return false;
+
+  fprintf(c->f, "YUV4MPEG2 W%i H%i F%i:1 Ip A1:1 C444\n", DAZ_WIDTH, DAZ_HEIGHT, c->fps);
+  return true;
+}
+
+
+static void y4m_frame(dazzler_capture *c, const uint8_t *pixels, uint64_t t0, uint64_t t1)
+{
+  // the frame covers all output frames whose start time lies in [t0, t1)
+  uint64_t n = (t1 - c->start_us) * c->fps / 1000000;
+  if( n<=c->out_frames ) return;
+
+  // BT.601 limited range
+  uint8_t yuv[3][32];
+  for(int i=0; i<32; i++)
+    {
+      int r = R(c->palette[i]), g = G(c->palette[i]), b = B(c->palette[i]);
+      yuv[0][i] = (uint8_t) (16  + (  65.738*r + 129.057*g +  25.064*b) / 256);
+      yuv[1][i] = (uint8_t) (128 + ( -37.945*r -  74.494*g + 112.439*b) / 256);
+      yuv[2][i] = (uint8_t) (128 + ( 112.439*r -  94.154*g -  18.285*b) / 256);
+    }
+
+  for(int p=0; p<3; p++)
+    for(int i=0; i<DAZ_WIDTH*DAZ_HEIGHT; i++)
+      c->planes[p][i] = yuv[p][pixels[i] & 31];
+
+  for(; c->out_frames<n; c->out_frames++)
+    {
+      fputs("FRAME\n", c->f);
+      fwrite(c->planes, 1, sizeof(c->planes), c->f);
+    }
+
+  c->frames_written++;
+}
+
+
+// --------------------------------------------------- PNG ---------------------------------------------------------
+
+
+struct crc32_table
+{
+  uint32_t t[256];
+
+  crc32_table()
+  {
+    for(uint32_t i=0; i<256; i++)
+      {
+        uint32_t v = i;
+        for(int k=0; k<8; k++) v = (v & 1) ? 0xEDB88320u ^ (v >> 1) : v >> 1;
+        t[i] = v;
+      }
+  }
+};
+
+static uint32_t crc32_update(uint32_t crc, const uint8_t *data, size_t len)
+{
+  // built once, on first use by any capture thread
+  static const crc32_table table;
+
+  crc = ~crc;
+  for(size_t i=0; i<len; i++) crc = table.t[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+  return ~crc;
+}
+
+
+static void put_be32(std::vector<uint8_t> &v, uint32_t x)
+{
+  v.push_back(x >> 24); v.push_back(x >> 16); v.push_back(x >> 8); v.push_back(x);
+}
+
+
+// bit writer for deflate (least significant bit first)
+struct bitwriter
+{
+  std::vector<uint8_t> *out;
+  uint32_t bits;
+  int      n;
+};
+
+static void put_bits(bitwriter *w, uint32_t v, int n)
+{
+  w->bits |= v << w->n;
+  w->n    += n;
+  while( w->n>=8 )
+    {
+      w->out->push_back(w->bits & 0xFF);
+      w->bits >>= 8;
+      w->n     -= 8;
+    }
+}
+
+// Huffman codes are sent most significant bit first
+static void put_code(bitwriter *w, uint32_t code, int n)
+{
+  uint32_t r = 0;
+  for(int i=0; i<n; i++) r |= ((code >> i) & 1) << (n-1-i);
+  put_bits(w, r, n);
+}
+
+static void put_literal(bitwriter *w, int v)
+{
+  // fixed Huffman code (RFC 1951, 3.2.6)
+  if( v<144 )      put_code(w, 0x30+v, 8);
+  else if( v<256 ) put_code(w, 0x190+v-144, 9);
+  else if( v<280 ) put_code(w, v-256, 7);
+  else             put_code(w, 0xC0+v-280, 8);
+}
+
+static void put_match(bitwriter *w, int len, int dist)
+{
+  static const uint16_t len_base[29] = {3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258};
+  static const uint8_t  len_extra[29] = {0,0,0,0,0,0,0,0,1,1,1,1,2,2,2,2,3,3,3,3,4,4,4,4,5,5,5,5,0};
+  static const uint16_t dist_base[30] = {1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,257,385,513,769,1025,1537,2049,3073,4097,6145,8193,12289,16385,24577};
+  static const uint8_t  dist_extra[30] = {0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13};
+
+  int l = 28;
+  while( len_base[l]>len ) l--;
+  put_literal(w, 257+l);
+  put_bits(w, len-len_base[l], len_extra[l]);
+
+  int d = 29;
+  while( dist_base[d]>dist ) d--;
+  put_code(w, d, 5);
+  put_bits(w, dist-dist_base[d], dist_extra[d]);
+}
+
+
+// zlib stream with one fixed-Huffman deflate block and greedy LZ77 matching,
+// good enough for the large single-color areas of Dazzler pictures
+static void zlib_compress(const uint8_t *data, int len, int head[4096], std::vector<uint8_t> &out)
+{
+  out.push_back(0x78);
+  out.push_back(0x01);
+
+  bitwriter w = {&out, 0, 0};
+  put_bits(&w, 1, 1);  // final block
+  put_bits(&w, 1, 2);  // fixed Huffman codes
+
+  memset(head, 0xFF, 4096*sizeof(int));
+
+  int i = 0;
+  while( i<len )
+    {
+      int best = 0, dist = 0;
+      if( i+3<=len )
+        {
+          int h = ((data[i] << 8) ^ (data[i+1] << 4) ^ data[i+2]) & 4095;
+          int p = head[h];
+          head[h] = i;
+
+          // also try the previous byte (runs) and the previous row (129 bytes per PNG row)
+          int cand[3] = {p, i-1, i-129};
+          for(int k=0; k<3; k++)
+            {
+              int q = cand[k];
+              if( q<0 || q>=i || i-q>32768 ) continue;
+              int n = 0;
+              while( n<258 && i+n<len && data[q+n]==data[i+n] ) n++;
+              if( n>best ) { best = n; dist = i-q; }
+            }
+        }
+
+      if( best>=3 )
+        {
+          put_match(&w, best, dist);
+          i += best;
+        }
+      else
+        put_literal(&w, data[i++]);
+    }
+
+  put_literal(&w, 256);
+  if( w.n>0 ) out.push_back(w.bits & 0xFF);
+
+  uint32_t a = 1, b = 0;
+  for(int k=0; k<len; k++) { a = (a + data[k]) % 65521; b = (b + a) % 65521; }
+  put_be32(out, (b << 16) | a);
+}
+
+
+static void png_chunk(FILE *f, const char *type, const std::vector<uint8_t> &data)
+{
+  uint32_t len = (uint32_t) data.size();
+  uint32_t crc = crc32_update(crc32_update(0, (const uint8_t *) type, 4), data.data(), len);
+  uint8_t  hdr[4] = {(uint8_t) (len >> 24), (uint8_t) (len >> 16), (uint8_t) (len >> 8), (uint8_t) len};
+  uint8_t  trl[4] = {(uint8_t) (crc >> 24), (uint8_t) (crc >> 16), (uint8_t) (crc >> 8), (uint8_t) crc};
+
+  fwrite(hdr, 1, 4, f);
+  fwrite(type, 1, 4, f);
+  fwrite(data.data(), 1, len, f);
+  fwrite(trl, 1, 4, f);
+}
+
+
+static bool png_start(dazzler_capture *c)
+{
+  char fname[300];
+  snprintf(fname, sizeof(fname), "%s.ffconcat", c->fname);
+  c->list = fopen(fname, "w");
+  if( c->list==NULL ) return false;
+
+  fputs("ffconcat version 1.0\n", c->list);
+  return true;
+}
+
+
+static void png_frame(dazzler_capture *c, const uint8_t *pixels, uint64_t t0, uint64_t t1)
+{
+  // file names in the list are relative to the list file
+  char fname[300];
+  const char *base = c->fname + strlen(c->fname);
+  while( base>c->fname && base[-1]!='/' && base[-1]!='\\' ) base--;
+  snprintf(fname, sizeof(fname), "%s_%06lu.png", c->fname, (unsigned long) (c->out_frames+1));
+
+  FILE *f = fopen(fname, "wb");
+  if( f==NULL ) return;
+
+  static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', 0x0D, 0x0A, 0x1A, 0x0A};
+  fwrite(signature, 1, 8, f);
+
+  // 8 bit palette image
+  std::vector<uint8_t> chunk;
+  put_be32(chunk, DAZ_WIDTH);
+  put_be32(chunk, DAZ_HEIGHT);
+  chunk.push_back(8); chunk.push_back(3); chunk.push_back(0); chunk.push_back(0); chunk.push_back(0);
+  png_chunk(f, "IHDR", chunk);
+
+  chunk.clear();
+  for(int i=0; i<32; i++)
+    { chunk.push_back(R(c->palette[i])); chunk.push_back(G(c->palette[i])); chunk.push_back(B(c->palette[i])); }
+  png_chunk(f, "PLTE", chunk);
+
+  // each row starts with filter type 0 (none)
+  uint8_t *raw = c->raw;
+  for(int y=0; y<DAZ_HEIGHT; y++)
+    {
+      raw[y*(DAZ_WIDTH+1)] = 0;
+      for(int x=0; x<DAZ_WIDTH; x++) raw[y*(DAZ_WIDTH+1)+1+x] = pixels[y*DAZ_WIDTH+x] & 31;
+    }
+
+  chunk.clear();
+  zlib_compress(raw, sizeof(c->raw), c->zhead, chunk);
+  png_chunk(f, "IDAT", chunk);
+  chunk.clear();
+  png_chunk(f, "IEND", chunk);
+  fclose(f);
+
+  c->out_frames++;
+  fprintf(c->list, "file '%s_%06lu.png'\nduration %.6f\n", base, (unsigned long) c->out_frames, (t1-t0) / 1e6);
+  c->frames_written++;
+}
+
+
+// --------------------------------------------------- GIF ---------------------------------------------------------
+
+
+static bool gif_start(dazzler_capture *c)
+{
+  c->f = fopen(c->fname, "wb");
+  if( c->f==NULL ) return false;
+
+  // header and logical screen descriptor with 32 entry global color table
+  uint8_t hdr[13] = {'G', 'I', 'F', '8', '9', 'a', DAZ_WIDTH, 0, DAZ_HEIGHT, 0, 0xF4, 0, 0};
+  fwrite(hdr, 1, 13, c->f);
+  for(int i=0; i<32; i++)
+    {
+      uint8_t rgb[3] = {(uint8_t) R(c->palette[i]), (uint8_t) G(c->palette[i]), (uint8_t) B(c->palette[i])};
+      fwrite(rgb, 1, 3, c->f);
+    }
+
+  // loop forever
+  static const uint8_t loop[19] = {0x21, 0xFF, 0x0B, 'N', 'E', 'T', 'S', 'C', 'A', 'P', 'E', '2', '.', '0', 0x03, 0x01, 0x00, 0x00, 0x00};
+  fwrite(loop, 1, 19, c->f);
+  return true;
+}
+
+
+// collects LZW codes and writes them in 255 byte sub-blocks
+struct gifwriter
+{
+  FILE    *f;
+  uint8_t  block[256];
+  int      n;
+  uint32_t bits;
+  int      nbits;
+};
+
+static void gif_code(gifwriter *w, int code, int size)
+{
+  w->bits  |= (uint32_t) code << w->nbits;
+  w->nbits += size;
+  while( w->nbits>=8 )
+    {
+      w->block[1+w->n++] = w->bits & 0xFF;
+      w->bits >>= 8;
+      w->nbits -= 8;
+      if( w->n==255 ) { w->block[0] = 255; fwrite(w->block, 1, 256, w->f); w->n = 0; }
+    }
+}
+
+static void gif_flush(gifwriter *w)
+{
+  if( w->nbits>0 ) gif_code(w, 0, 8-w->nbits);
+  if( w->n>0 ) { w->block[0] = w->n; fwrite(w->block, 1, w->n+1, w->f); }
+  fputc(0, w->f);
+}
+
+
+static void gif_frame(dazzler_capture *c, const uint8_t *pixels, uint64_t t0, uint64_t t1)
+{
+  // GIF delays are in 1/100s, keep the sum of all delays in sync with the real time
+  uint32_t end_cs = (uint32_t) ((t1 - c->start_us) / 10000);
+  if( end_cs<=c->out_cs ) return;
+  uint32_t delay = end_cs - c->out_cs;
+  if( delay>0xFFFF ) delay = 0xFFFF;
+  c->out_cs += delay;
+
+  // graphic control extension and image descriptor
+  uint8_t gce[8] = {0x21, 0xF9, 0x04, 0x00, (uint8_t) delay, (uint8_t) (delay >> 8), 0x00, 0x00};
+  uint8_t desc[10] = {0x2C, 0, 0, 0, 0, DAZ_WIDTH, 0, DAZ_HEIGHT, 0, 0x00};
+  fwrite(gce, 1, 8, c->f);
+  fwrite(desc, 1, 10, c->f);
+
+  // LZW with 5 bit minimum code size (32 colors)
+  const int clear = 32, eoi = 33;
+  int size = 6, next = 34;
+  gifwriter w = {c->f, {0}, 0, 0, 0};
+  fputc(5, c->f);
+  memset(c->lzw, 0, sizeof(c->lzw));
+  gif_code(&w, clear, size);
+
+  int cur = pixels[0] & 31;
+  for(int i=1; i<DAZ_WIDTH*DAZ_HEIGHT; i++)
+    {
+      int p = pixels[i] & 31;
+      if( c->lzw[cur][p] )
+        cur = c->lzw[cur][p];
+      else
+        {
+          gif_code(&w, cur, size);
+          c->lzw[cur][p] = next++;
+          if( next > (1 << size) ) size++;
+          if( next==4095 )
+            {
+              gif_code(&w, clear, size);
+              memset(c->lzw, 0, sizeof(c->lzw));
+              size = 6;
+              next = 34;
+            }
+          cur = p;
+        }
+    }
+
+  gif_code(&w, cur, size);
+  gif_code(&w, eoi, size);
+  gif_flush(&w);
+  c->frames_written++;
+}
+
+
+// --------------------------------------------------- Capture thread ---------------------------------------------------------
+
+
+static void capture_frame(dazzler_capture *c, const uint8_t *pixels, uint64_t t0, uint64_t t1)
+{
+  switch( c->format )
+    {
+    case DAZ_CAPTURE_Y4M: y4m_frame(c, pixels, t0, t1); break;
+    case DAZ_CAPTURE_PNG: png_frame(c, pixels, t0, t1); break;
+    case DAZ_CAPTURE_GIF: gif_frame(c, pixels, t0, t1); break;
+    }
+}
+
+
+static void capture_thread(dazzler_capture *c)
+{
+  // a frame is written when the next one arrives (then its duration is known)
+  dazzler_capture_frame &pending = c->pending, &cur = c->cur;
+  bool have_pending = false;
+
+  while( true )
+    {
+      {
+        std::unique_lock<std::mutex> lock(c->mutex);
+        c->cond.wait(lock, [c] { return c->count>0 || c->stop; });
+        if( c->count==0 ) break;
+
+        memcpy(&cur, &c->queue[c->head], sizeof(cur));
+        c->head = (c->head+1) % DAZ_CAPTURE_QUEUE;
+        c->count--;
+      }
+
+      if( c->wait ) c->cond.notify_all();
+
+      if( !have_pending )
+        c->start_us = cur.time_us;
+      else
+        capture_frame(c, pending.pixels, pending.time_us, cur.time_us);
+
+      memcpy(&pending, &cur, sizeof(cur));
+      have_pending = true;
+    }
+
+  if( have_pending )
+    {
+      uint64_t end = pending.time_us + 1000000 / c->fps;
+      capture_frame(c, pending.pixels, pending.time_us, c->stop_us>end ? c->stop_us : end);
+    }
+}
+
+
+int dazzler_capture_format(const char *fname)
+{
+  const char *ext = strrchr(fname, '.');
+  if( ext==NULL ) return -1;
+
+  char e[5];
+  int i;
+  for(i=0; i<4 && ext[i+1]; i++) e[i] = (char) (ext[i+1] | 0x20);
+  e[i] = 0;
+
+  if( strcmp(e, "y4m")==0 ) return DAZ_CAPTURE_Y4M;
+  if( strcmp(e, "png")==0 ) return DAZ_CAPTURE_PNG;
+  if( strcmp(e, "gif")==0 ) return DAZ_CAPTURE_GIF;
+  return -1;
+}
+
+
+dazzler_capture *dazzler_capture_start(const char *fname, int format, const uint32_t palette[32], int fps)
+{
+  dazzler_capture *c = new dazzler_capture;
+  c->format = format;
+  c->wait   = false;
+  c->fps    = fps>0 ? fps : 30;
+  c->f      = NULL;
+  c->list   = NULL;
+  memcpy(c->palette, palette, sizeof(c->palette));
+
+  // for PNG the name is a prefix, drop the extension
+  snprintf(c->fname, sizeof(c->fname), "%s", fname);
+  if( format==DAZ_CAPTURE_PNG && dazzler_capture_format(c->fname)==DAZ_CAPTURE_PNG )
+    *strrchr(c->fname, '.') = 0;
+
+  bool ok = false;
+  switch( format )
+    {
+    case DAZ_CAPTURE_Y4M: ok = y4m_start(c); break;
+    case DAZ_CAPTURE_PNG: ok = png_start(c); break;
+    case DAZ_CAPTURE_GIF: ok = gif_start(c); break;
+    }
+
+  if( !ok )
+    {
+      delete c;
+      return NULL;
+    }
+
+  c->have_last  = false;
+  c->head       = 0;
+  c->count      = 0;
+  c->stop       = false;
+  c->start_us   = 0;
+  c->out_frames = 0;
+  c->out_cs     = 0;
+  c->frames_in  = c->frames_same = c->frames_dropped = c->frames_written = 0;
+  c->stop_us    = 0;
+  c->thread = std::thread(capture_thread, c);
+  return c;
+}
+
+
+void dazzler_capture_add(dazzler_capture *c, const uint8_t *pixels, uint64_t time_us)
+{
+  c->frames_in++;
+
+  // skip frames that did not change
+  if( c->have_last && memcmp(c->last, pixels, sizeof(c->last))==0 )
+    {
+      c->frames_same++;
+      return;
+    }
+
+  std::unique_lock<std::mutex> lock(c->mutex);
+  if( c->wait )
+    c->cond.wait(lock, [c] { return c->count<DAZ_CAPTURE_QUEUE; });
+  else if( c->count==DAZ_CAPTURE_QUEUE )
+    {
+      // encoder can not keep up => drop (and compare the next frame
+      // against what was actually queued)
+      c->frames_dropped++;
+      return;
+    }
+
+  dazzler_capture_frame *f = &c->queue[(c->head+c->count) % DAZ_CAPTURE_QUEUE];
+  memcpy(f->pixels, pixels, sizeof(f->pixels));
+  f->time_us = time_us;
+  c->count++;
+  lock.unlock();
+  c->cond.notify_all();
+
+  memcpy(c->last, pixels, sizeof(c->last));
+  c->have_last = true;
+}
+
+
+void dazzler_capture_stop(dazzler_capture *c, uint64_t time_us)
+{
+  {
+    std::unique_lock<std::mutex> lock(c->mutex);
+    c->stop_us = time_us;
+    c->stop = true;
+  }
+
+  c->cond.notify_all();
+  c->thread.join();
+
+  if( c->format==DAZ_CAPTURE_GIF ) fputc(0x3B, c->f);
+  if( c->f!=NULL ) fclose(c->f);
+  if( c->list!=NULL ) fclose(c->list);
+  delete c;
+}
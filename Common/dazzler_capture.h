@@ -0,0 +1,101 @@
+// -----------------------------------------------------------------------------
+// Cromemco Dazzler emulation - frame capture to video/image files
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#ifndef DAZZLER_CAPTURE_H
+#define DAZZLER_CAPTURE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "dazzler_render.h"
+
+// output formats
+#define DAZ_CAPTURE_Y4M 0   // raw YUV 4:4:4 video at a constant frame rate (for ffmpeg)
+#define DAZ_CAPTURE_PNG 1   // one PNG per distinct frame plus an ffmpeg concat list
+#define DAZ_CAPTURE_GIF 2   // animated GIF, each frame shown as long as it was on screen
+
+// number of frames that can wait for the encoder
+#define DAZ_CAPTURE_QUEUE 32
+
+struct dazzler_capture_frame
+{
+  uint8_t  pixels[DAZ_WIDTH*DAZ_HEIGHT];  // palette indices (see dazzler_render_indexed)
+  uint64_t time_us;
+};
+
+
+// Frames are handed over by the video (or replay) thread and encoded by a
+// background thread. Handing over a frame never blocks: identical frames
+// are skipped and frames are dropped if the queue is full (unless "wait"
+// was set after starting, e.g. when replaying a trace). Each frame
+// that is written lasts until the next distinct frame arrives.
+struct dazzler_capture
+{
+  int      format, fps;
+  bool     wait;            // wait for room in the queue instead of dropping (offline use)
+  char     fname[260];
+  uint32_t palette[32];
+
+  // producer side
+  uint8_t  last[DAZ_WIDTH*DAZ_HEIGHT];
+  bool     have_last;
+
+  // queue
+  dazzler_capture_frame queue[DAZ_CAPTURE_QUEUE];
+  int      head, count;
+  bool     stop;
+  uint64_t stop_us;
+  std::mutex mutex;
+  std::condition_variable cond;
+  std::thread thread;
+
+  // encoder side
+  FILE    *f, *list;
+  uint64_t start_us;
+  uint64_t out_frames;    // Y4M: frames written, PNG: files written
+  uint32_t out_cs;        // GIF: centiseconds written
+  uint16_t lzw[4096][32]; // GIF: LZW dictionary
+  dazzler_capture_frame pending, cur;  // frame waiting for its end time, frame taken from the queue
+  uint8_t  planes[3][DAZ_WIDTH*DAZ_HEIGHT];    // Y4M: YUV planes
+  uint8_t  raw[DAZ_HEIGHT*(DAZ_WIDTH+1)];      // PNG: filtered rows
+  int      zhead[4096];                        // PNG: deflate match hash
+
+  // statistics
+  uint64_t frames_in, frames_same, frames_dropped, frames_written;
+};
+
+
+// guess the format from the file name extension (.y4m, .png, .gif), -1 if unknown
+int dazzler_capture_format(const char *fname);
+
+// start capturing. For PNG, fname is used as a prefix: frames are written to
+// <prefix>_000001.png etc. and the list of frames to <prefix>.ffconcat.
+// "palette" maps palette indices to RGBA (see dazzler_render_palette),
+// "fps" is the frame rate of Y4M output. Returns NULL on error.
+dazzler_capture *dazzler_capture_start(const char *fname, int format, const uint32_t palette[32], int fps);
+
+// hand over a frame (only blocks if c->wait is set)
+void dazzler_capture_add(dazzler_capture *c, const uint8_t *pixels, uint64_t time_us);
+
+// encode everything still queued, close the files and free the capture
+void dazzler_capture_stop(dazzler_capture *c, uint64_t time_us);
+
+#endif
@@ -0,0 +1,67 @@
+// -----------------------------------------------------------------------------
+// Cromemco Dazzler emulation - chunked frame transfers
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#include <string.h>
+#include "dazzler_chunk.h"
+
+// unchanged bytes worth including in a slice rather than starting a new
+// one (the size of a slice header)
+#define CHUNK_GAP 4
+
+
+void dazzler_chunker_start(dazzler_chunker *c, const uint8_t *prev, const uint8_t *next,
+                           int len, int buffer, int max_slice)
+{
+  c->prev      = prev;
+  c->next      = next;
+  c->len       = len;
+  c->buffer    = buffer;
+  c->max_slice = max_slice<1 ? 1 : (max_slice>256 ? 256 : max_slice);
+  c->pos       = 0;
+}
+
+
+static int chunk_find_change(const dazzler_chunker *c, int pos)
+{
+  while( pos<c->len && c->prev[pos]==c->next[pos] ) pos++;
+  return pos;
+}
+
+
+int dazzler_chunker_next(dazzler_chunker *c, uint8_t *out)
+{
+  int start = chunk_find_change(c, c->pos);
+  if( start>=c->len ) { c->pos = c->len; return 0; }
+
+  // extend the slice up to the last change that is no more than
+  // CHUNK_GAP unchanged bytes away from the previous one
+  int end = start+1, limit = start+c->max_slice < c->len ? start+c->max_slice : c->len;
+  for(int i=end; i<limit && i<=end+CHUNK_GAP; i++)
+    if( c->prev[i]!=c->next[i] ) end = i+1;
+
+  c->pos = chunk_find_change(c, end);
+  int n = end-start;
+
+  out[0] = DAZ_CHUNK | (c->buffer ? 0x08 : 0) | (c->pos>=c->len ? DAZ_CHUNK_LAST : 0);
+  out[1] = start >> 8;
+  out[2] = start & 0xFF;
+  out[3] = n & 0xFF;
+  memcpy(out+4, c->next+start, n);
+  return 4+n;
+}
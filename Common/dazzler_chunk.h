@@ -0,0 +1,46 @@
+// -----------------------------------------------------------------------------
+// Cromemco Dazzler emulation - chunked frame transfers
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#ifndef DAZZLER_CHUNK_H
+#define DAZZLER_CHUNK_H
+
+#include <stdint.h>
+#include "dazzler_proto.h"
+
+// Splits the change of one buffer from "prev" to "next" into DAZ_CHUNK
+// slices that cover only the changed bytes, so the computer can send
+// other commands (audio) between them. prev/next must stay valid until
+// the last slice has been taken.
+struct dazzler_chunker
+{
+  const uint8_t *prev, *next;
+  int buffer, len, max_slice;
+  int pos;                    // where to look for the next change
+};
+
+// "len" is 512 or 2048, "max_slice" the largest slice payload (1-256)
+void dazzler_chunker_start(dazzler_chunker *c, const uint8_t *prev, const uint8_t *next,
+                           int len, int buffer, int max_slice);
+
+// Write the next slice to "out" (DAZ_CHUNK_MAXSIZE bytes), returns its
+// size or 0 if the frame is complete. The last slice is marked with
+// DAZ_CHUNK_LAST. Returns 0 right away if nothing changed.
+int dazzler_chunker_next(dazzler_chunker *c, uint8_t *out);
+
+#endif
@@ -0,0 +1,41 @@
+// -----------------------------------------------------------------------------
+// Cromemco Dazzler emulation - CRC-16 for framed transfers
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#ifndef DAZZLER_CRC_H
+#define DAZZLER_CRC_H
+
+#include <stdint.h>
+
+// CRC-16 with polynomial 0x1021, initial value 0xFFFF, no bit reflection
+// (CRC-16/CCITT-FALSE, check value 0x29B1 for "123456789"). This is what
+// the CRC engines in microcontrollers (e.g. the PIC32MZ DMA) compute when
+// set up for a 16-bit polynomial, the PIC32 firmware uses the same table.
+#define DAZ_CRC16_INIT 0xFFFF
+
+extern const uint16_t dazzler_crc16_table[256];
+
+inline uint16_t dazzler_crc16_byte(uint16_t crc, uint8_t b)
+{
+  return (uint16_t) ((crc << 8) ^ dazzler_crc16_table[(crc >> 8) ^ b]);
+}
+
+// continue "crc" over "n" bytes
+uint16_t dazzler_crc16(uint16_t crc, const uint8_t *data, int n);
+
+#endif
@@ -0,0 +1,55 @@
+// -----------------------------------------------------------------------------
+// Cromemco Dazzler emulation - host-side flow control
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#include "dazzler_credit.h"
+
+
+void dazzler_credit_init(dazzler_credit *c, uint16_t features)
+{
+  c->enabled     = (features & FEAT_CREDIT)!=0;
+  c->sent        = 0;
+  c->consumed    = 0;
+  c->num_credits = 0;
+}
+
+
+int dazzler_credit_available(const dazzler_credit *c)
+{
+  if( !c->enabled ) return DAZ_CREDIT_WINDOW;
+
+  uint64_t in_flight = c->sent - c->consumed;
+  return in_flight<DAZ_CREDIT_WINDOW ? (int) (DAZ_CREDIT_WINDOW - in_flight) : 0;
+}
+
+
+void dazzler_credit_sent(dazzler_credit *c, int n)
+{
+  c->sent += n;
+}
+
+
+void dazzler_credit_received(dazzler_credit *c, uint8_t b0, uint8_t b1)
+{
+  // the message holds the low 12 bits of the consumed count, which is
+  // unambiguous because at most DAZ_CREDIT_WINDOW (<4096) bytes are in flight
+  uint32_t n = (b0 & 0x0F) * 256 + b1;
+  uint64_t consumed = c->sent - ((c->sent - n) & 0xFFF);
+  if( consumed > c->consumed ) c->consumed = consumed;
+  c->num_credits++;
+}
@@ -0,0 +1,50 @@
+// -----------------------------------------------------------------------------
+// Cromemco Dazzler emulation - host-side flow control
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#ifndef DAZZLER_CREDIT_H
+#define DAZZLER_CREDIT_H
+
+#include <stdint.h>
+#include "dazzler_proto.h"
+
+// Computer side of DAZ_CREDIT flow control: counts the bytes sent since
+// DAZ_VERSION and the bytes the Dazzler reported as consumed.
+struct dazzler_credit
+{
+  bool     enabled;         // Dazzler reported FEAT_CREDIT
+  uint64_t sent, consumed;
+  uint64_t num_credits;
+};
+
+
+// call when sending DAZ_VERSION (or the memory data of DAZ_STATE, which
+// restarts the count as well), "features" is the Dazzler's reply (if it
+// does not include FEAT_CREDIT, sending is never limited)
+void dazzler_credit_init(dazzler_credit *c, uint16_t features);
+
+// number of bytes that may be sent now
+int dazzler_credit_available(const dazzler_credit *c);
+
+// account for "n" bytes sent after DAZ_VERSION
+void dazzler_credit_sent(dazzler_credit *c, int n);
+
+// a DAZ_CREDIT message (b0, b1) was received
+void dazzler_credit_received(dazzler_credit *c, uint8_t b0, uint8_t b1);
+
+#endif
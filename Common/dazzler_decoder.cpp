@@ -0,0 +1,667 @@
+// -----------------------------------------------------------------------------
+// Cromemco Dazzler emulation - protocol decoder
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#include <string.h>
+#include "dazzler_decoder.h"
+#include "dazzler_crc.h"
+#include "dazzler_rect.h"
+
+// receive status while the data bytes of a DAZ_MEMBLOCK or DAZ_CHUNK
+// command or the samples of a DAZ_DACBURST command arrive
+#define DAZ_MEMBLOCK_DATA (DAZ_MEMBLOCK | 0x01)
+#define DAZ_DACBURST_DATA (DAZ_DACBURST | 0x01)
+#define DAZ_CHUNK_DATA    (DAZ_CHUNK | 0x01)
+#define DAZ_STATE_DATA    (DAZ_STATE | 0x01)
+
+void dazzler_decoder_init(dazzler_decoder *d, uint8_t *mem, uint16_t features,
+                          const dazzler_decoder_callbacks *cb, void *ctx)
+{
+  static const dazzler_decoder_callbacks no_callbacks = {};
+
+  d->mem              = mem;
+  d->ctrl             = 0;
+  d->picture_ctrl     = 0;
+  d->computer_version = 0;
+  d->features         = features;
+  d->cb               = cb!=NULL ? cb : &no_callbacks;
+  d->ctx              = ctx;
+  d->num_bytes        = 0;
+  d->num_commands     = 0;
+  d->credit_base      = 0;
+  d->credit_sent      = 0;
+  d->num_frames       = 0;
+  d->num_frame_errors = 0;
+  d->num_frames_lost  = 0;
+  d->num_state_skipped = 0;
+  dazzler_dirty_set_all(&d->dirty);
+  dazzler_decoder_reset(d);
+}
+
+
+static void dazzler_decoder_reset_command(dazzler_decoder *d)
+{
+  d->recv_status  = 0;
+  d->recv_bytes   = 0;
+  d->recv_ptr     = 0;
+  d->recv_run     = 0;
+  d->chunk_buffer = -1;
+}
+
+
+void dazzler_decoder_reset(dazzler_decoder *d)
+{
+  dazzler_decoder_reset_command(d);
+  d->framed     = false;
+  d->frame_len  = 0;
+  d->frame_seq  = 0;
+  d->frame_lost = 0;
+  d->state_wait = 0;
+}
+
+
+static void dazzler_decoder_command_done(dazzler_decoder *d)
+{
+  const dazzler_decoder_callbacks *cb = d->cb;
+  uint8_t *buf = d->buf;
+
+  switch( d->recv_status )
+    {
+    case DAZ_MEMBYTE:
+      {
+        int a = buf[0]*256+buf[1];
+        if( d->mem[a]!=buf[2] ) { d->mem[a] = buf[2]; dazzler_dirty_set(&d->dirty, a); }
+        if( cb->membyte ) cb->membyte(d->ctx, a, buf[2]);
+        break;
+      }
+
+    case DAZ_DAC:
+      {
+        if( cb->dac ) cb->dac(d->ctx, buf[0] == 0 ? 0 : 1, buf[1] + buf[2] * 256, buf[3]);
+        break;
+      }
+
+    case DAZ_CTRL:
+      {
+        // computer version 0 only supports a single buffer but bit 0
+        // may be on or off
+        if( d->computer_version < 1 ) buf[0] &= 0x80;
+
+        if( (d->ctrl&0x81) != (buf[0]&0x81) )
+          {
+            d->ctrl = buf[0];
+            dazzler_dirty_set_all(&d->dirty);
+            if( cb->ctrl ) cb->ctrl(d->ctx, d->ctrl);
+          }
+        break;
+      }
+
+    case DAZ_CTRLPIC:
+      {
+        // bit 7 is unused, bits 0-3 (color) are only used if bit 6 (high-res) is set
+        buf[0] = (buf[0] & 0x40) ? (buf[0] & 0x7f) : (buf[0] & 0x70);
+        if( buf[0]!=d->picture_ctrl )
+          {
+            d->picture_ctrl = buf[0];
+            dazzler_dirty_set_all(&d->dirty);
+            if( cb->ctrlpic ) cb->ctrlpic(d->ctx, d->picture_ctrl);
+          }
+        break;
+      }
+
+    case DAZ_FULLFRAME:
+    case DAZ_DELTA:
+      {
+        // recv_ptr now points to the end of the received frame
+        int len = d->buf[0] ? 2048 : 512;
+        if( cb->fullframe ) cb->fullframe(d->ctx, d->recv_ptr-len, len);
+        break;
+      }
+
+    case DAZ_MEMBLOCK:
+      {
+        // header complete => receive the data straight into video memory
+        d->recv_status = DAZ_MEMBLOCK_DATA;
+        d->recv_ptr    = buf[0]*256+buf[1];
+        d->recv_bytes  = buf[2]==0 ? 256 : buf[2];
+        return;
+      }
+
+    case DAZ_DACBURST:
+      {
+        // header complete => samples follow
+        d->recv_status = DAZ_DACBURST_DATA;
+        d->recv_bytes  = buf[3]==0 ? 256 : buf[3];
+        return;
+      }
+
+    case DAZ_CHUNK:
+      {
+        // header complete => receive the data into the frame copy, the
+        // first slice (or one for the other buffer) starts a new frame
+        int b = (buf[0] & 0x08) ? 1 : 0;
+        if( d->chunk_buffer!=b )
+          {
+            memcpy(d->chunk, d->mem+b*DAZ_MEMSIZE, DAZ_MEMSIZE);
+            d->chunk_buffer = b;
+          }
+
+        d->recv_status = DAZ_CHUNK_DATA;
+        d->recv_ptr    = (buf[1]&0x07)*256+buf[2];
+        d->recv_bytes  = buf[3]==0 ? 256 : buf[3];
+        return;
+      }
+
+    case DAZ_CHUNK_DATA:
+      {
+        // buf still holds the header
+        if( buf[0] & DAZ_CHUNK_LAST )
+          {
+            int addr = d->chunk_buffer*DAZ_MEMSIZE;
+            dazzler_dirty_copy(&d->dirty, d->mem, addr, d->chunk, DAZ_MEMSIZE);
+            d->chunk_buffer = -1;
+            if( cb->fullframe ) cb->fullframe(d->ctx, addr, DAZ_MEMSIZE);
+          }
+        break;
+      }
+
+    case DAZ_STATE:
+      {
+        // header complete => receive both buffers straight into memory
+        if( buf[1]!=DAZ_STATE_SYNC1 || buf[2]!=DAZ_STATE_SYNC2 ) break;
+        d->recv_status = DAZ_STATE_DATA;
+        d->recv_ptr    = 0;
+        d->recv_bytes  = 2*DAZ_MEMSIZE;
+        return;
+      }
+
+    case DAZ_STATE_DATA:
+      {
+        // buf still holds the header, the state replaces any unfinished
+        // DAZ_CHUNK frame too
+        d->computer_version = buf[0];
+        d->ctrl             = d->computer_version < 1 ? (buf[3] & 0x80) : buf[3];
+        d->picture_ctrl     = (buf[4] & 0x40) ? (buf[4] & 0x7f) : (buf[4] & 0x70);
+        d->chunk_buffer     = -1;
+        dazzler_dirty_set_all(&d->dirty);
+        if( cb->version )   cb->version(d->ctx, d->computer_version);
+        if( cb->ctrlpic )   cb->ctrlpic(d->ctx, d->picture_ctrl);
+        if( cb->ctrl )      cb->ctrl(d->ctx, d->ctrl);
+        if( cb->fullframe ) cb->fullframe(d->ctx, 0, DAZ_MEMSIZE);
+        if( cb->fullframe ) cb->fullframe(d->ctx, DAZ_MEMSIZE, DAZ_MEMSIZE);
+        break;
+      }
+
+    case DAZ_RECT:
+      {
+        dazzler_rect_execute(&d->dirty, d->mem, buf[0], buf+1);
+        break;
+      }
+
+    case DAZ_PING:
+      {
+        uint8_t b[5] = {DAZ_PONG, buf[0], buf[1], buf[2], buf[3]};
+        if( cb->send ) cb->send(d->ctx, b, 5);
+        break;
+      }
+
+    case DAZ_MEMBLOCK_DATA:
+      {
+        // buf still holds the header
+        if( cb->memblock ) cb->memblock(d->ctx, buf[0]*256+buf[1], buf[2]==0 ? 256 : buf[2]);
+        break;
+      }
+    }
+
+  d->num_commands++;
+  d->recv_status = 0;
+}
+
+
+static int dazzler_decoder_delta(dazzler_decoder *d, const uint8_t *data, int size)
+{
+  // recv_bytes is the number of frame bytes not yet covered by a token,
+  // recv_ptr the memory address the next token applies to
+  int i = 0;
+  while( i<size && d->recv_bytes>0 )
+    {
+      if( d->recv_run==0 )
+        {
+          uint8_t t = data[i++];
+          if( t & 0x80 )
+            {
+              d->recv_token = t;
+              d->recv_run   = (t & 0x3F) + 1;
+              if( d->recv_run > d->recv_bytes ) d->recv_run = d->recv_bytes;
+            }
+          else
+            {
+              int n = (t==0 || t > d->recv_bytes) ? d->recv_bytes : t;
+              d->recv_ptr   += n;
+              d->recv_bytes -= n;
+            }
+        }
+      else if( d->recv_token & 0x40 )
+        {
+          // one byte XOR-ed into the whole run
+          uint8_t v[64];
+          memset(v, data[i++], d->recv_run);
+          dazzler_dirty_xor(&d->dirty, d->mem, d->recv_ptr, v, d->recv_run);
+          d->recv_ptr   += d->recv_run;
+          d->recv_bytes -= d->recv_run;
+          d->recv_run    = 0;
+        }
+      else
+        {
+          int n = d->recv_run < size-i ? d->recv_run : size-i;
+          dazzler_dirty_xor(&d->dirty, d->mem, d->recv_ptr, data+i, n);
+          d->recv_ptr   += n;
+          d->recv_bytes -= n;
+          d->recv_run   -= n;
+          i             += n;
+        }
+    }
+
+  if( d->recv_bytes==0 )
+    dazzler_decoder_command_done(d);
+
+  return i;
+}
+
+
+// Process commands, returns the number of bytes used (less than "size"
+// if a DAZ_FRAMED command switched to framed mode). "pos" is the stream
+// position of data[0] or, for the payload of a frame, of the frame's end.
+static int dazzler_decoder_commands(dazzler_decoder *d, const uint8_t *data, int size, uint64_t pos, bool in_frame)
+{
+  const dazzler_decoder_callbacks *cb = d->cb;
+
+  int i = 0;
+  while( i<size )
+    {
+      if( d->recv_status==DAZ_DELTA )
+        i += dazzler_decoder_delta(d, data+i, size-i);
+      else if( d->recv_bytes>0 )
+        {
+          int n = d->recv_bytes > (size-i) ? (size-i) : d->recv_bytes;
+
+          if( d->recv_status==DAZ_FULLFRAME || d->recv_status==DAZ_MEMBLOCK_DATA || d->recv_status==DAZ_STATE_DATA )
+            {
+              // memory blocks wrap around at the end of video memory
+              if( d->recv_ptr==2*DAZ_MEMSIZE ) d->recv_ptr = 0;
+              if( n > 2*DAZ_MEMSIZE-d->recv_ptr ) n = 2*DAZ_MEMSIZE-d->recv_ptr;
+              dazzler_dirty_copy(&d->dirty, d->mem, d->recv_ptr, data+i, n);
+            }
+          else if( d->recv_status==DAZ_CHUNK_DATA )
+            {
+              // slices wrap around at the end of the buffer
+              if( d->recv_ptr==DAZ_MEMSIZE ) d->recv_ptr = 0;
+              if( n > DAZ_MEMSIZE-d->recv_ptr ) n = DAZ_MEMSIZE-d->recv_ptr;
+              memcpy(d->chunk+d->recv_ptr, data+i, n);
+            }
+          else if( d->recv_status==DAZ_DACBURST_DATA )
+            {
+              // buf still holds the header
+              int ch = d->buf[0] == 0 ? 0 : 1;
+              uint16_t interval = d->buf[1] + d->buf[2]*256;
+              if( cb->dacburst )
+                cb->dacburst(d->ctx, ch, interval, data+i, n);
+              else if( cb->dac )
+                for(int j=0; j<n; j++) cb->dac(d->ctx, ch, interval, data[i+j]);
+            }
+          else
+            memcpy(d->buf+d->recv_ptr, data+i, n);
+
+          d->recv_bytes -= n;
+          d->recv_ptr   += n;
+          i             += n;
+
+          if( d->recv_bytes == 0 )
+            {
+              dazzler_decoder_command_done(d);
+
+              // DAZ_STATE counts like DAZ_VERSION for DAZ_CREDIT, from
+              // its memory data on
+              if( d->recv_status==DAZ_STATE_DATA && d->recv_ptr==0 )
+                d->credit_base = d->credit_sent = in_frame ? pos : pos+i;
+            }
+        }
+      else if( (data[i] & 0xf0)==DAZ_MEMBYTE && i+3<=size )
+        {
+          // fast path for the most common command if it was received
+          // completely (avoids copying it through the receive buffer)
+          int a = (data[i]&0x0F)*256+data[i+1];
+          if( d->mem[a]!=data[i+2] ) { d->mem[a] = data[i+2]; dazzler_dirty_set(&d->dirty, a); }
+          if( cb->membyte ) cb->membyte(d->ctx, a, data[i+2]);
+          d->num_commands++;
+          i += 3;
+        }
+      else
+        {
+          d->recv_status = data[i] & 0xf0;
+          d->recv_bytes  = 0;
+          d->recv_ptr    = 0;
+
+          switch( d->recv_status )
+            {
+            case DAZ_MEMBYTE:
+            case DAZ_MEMBLOCK:
+              d->recv_bytes = 2;
+              d->buf[d->recv_ptr++] = data[i]&0x0F;
+              break;
+
+            case DAZ_DAC:
+              d->recv_bytes = 3;
+              d->buf[d->recv_ptr++] = data[i]&0x0F;
+              break;
+
+            case DAZ_DACBURST:
+            case DAZ_CHUNK:
+              d->recv_bytes = 3;
+              d->buf[d->recv_ptr++] = data[i]&0x0F;
+              break;
+
+            case DAZ_CTRL:
+            case DAZ_CTRLPIC:
+              d->recv_bytes = 1;
+              break;
+
+            case DAZ_RECT:
+              {
+                // FILL, COPY, SCROLL
+                static const int size[3] = {5, 6, 7};
+                if( (data[i]&0x0F) < 3 )
+                  {
+                    d->recv_bytes = size[data[i]&0x0F];
+                    d->buf[d->recv_ptr++] = data[i]&0x0F;
+                  }
+                else
+                  d->recv_status = 0;
+                break;
+              }
+
+            case DAZ_PING:
+              d->recv_bytes = 4;
+              break;
+
+            case DAZ_VERSION:
+              {
+                d->computer_version = data[i] & 0x0F;
+
+                // respond by sending our version to the computer
+                uint8_t b[3];
+                b[0] = DAZ_VERSION | (DAZZLER_VERSION&0x0F);
+                b[1] = d->features & 0xFF;
+                b[2] = d->features >> 8;
+
+                // only computer version 2 or later expects feature information
+                // (computer version 0 does not send DAZ_VERSION)
+                if( cb->send ) cb->send(d->ctx, b, d->computer_version<2 ? 1 : 3);
+                if( cb->version ) cb->version(d->ctx, d->computer_version);
+
+                // start counting consumed bytes for DAZ_CREDIT
+                d->credit_base = d->credit_sent = in_frame ? pos : pos+i+1;
+                d->num_commands++;
+                d->recv_status = 0;
+                break;
+              }
+
+            case DAZ_STATE:
+              d->recv_bytes = 4;
+              d->buf[d->recv_ptr++] = data[i]&0x0F;
+              break;
+
+            case DAZ_FULLFRAME:
+            case DAZ_DELTA:
+              // remember the frame size for the fullframe callback
+              d->buf[0]     = data[i] & 0x01;
+              d->recv_bytes = (data[i] & 0x01) ? 2048 : 512;
+              d->recv_ptr   = (data[i] & 0x08) * 256;
+              d->recv_run   = 0;
+              break;
+
+            case DAZ_FRAMED:
+              // the first frame switches to framed mode (frames within
+              // frames are not allowed)
+              d->recv_status = 0;
+              if( (data[i] & 0x0E)==0 && (d->features & FEAT_FRAMED) && !in_frame )
+                {
+                  d->framed = true;
+                  return i;
+                }
+              break;
+
+            default:
+              d->recv_status = 0;
+              break;
+            }
+
+          i++;
+        }
+    }
+
+  return i;
+}
+
+
+static void dazzler_decoder_frame_lost(dazzler_decoder *d)
+{
+  // ask for the frames from the expected one on, again if we keep
+  // discarding frames (the request may have been lost) but less and
+  // less often, each request makes the computer send everything again
+  int n = d->frame_lost++ / DAZ_RESEND_REPEAT;
+  if( (d->frame_lost-1) % DAZ_RESEND_REPEAT==0 && (n & (n-1))==0 && d->cb->send )
+    {
+      uint8_t b[2] = {DAZ_RESEND, d->frame_seq};
+      d->cb->send(d->ctx, b, 2);
+    }
+}
+
+
+static void dazzler_decoder_frame_done(dazzler_decoder *d, int len, uint64_t pos)
+{
+  uint8_t *f = d->frame;
+  uint16_t crc = dazzler_crc16(DAZ_CRC16_INIT, f, len-2);
+  if( crc != f[len-2]*256+f[len-1] )
+    {
+      // Damaged frame. Its length may have been wrong too, so search for
+      // the next marker in what we received for it.
+      int k;
+      for(k=1; k<d->frame_len; k++)
+        if( (f[k] & 0xFE)==DAZ_FRAMED && (k+1==d->frame_len || f[k+1]==DAZ_FRAMED_SYNC) )
+          break;
+
+      memmove(f, f+k, d->frame_len-k);
+      d->frame_len -= k;
+      d->num_frame_errors++;
+      dazzler_decoder_frame_lost(d);
+      return;
+    }
+
+  if( f[0] & DAZ_FRAMED_START )
+    {
+      dazzler_decoder_reset_command(d);
+      d->frame_seq = f[2];
+    }
+
+  if( f[2]==d->frame_seq )
+    {
+      d->frame_seq++;
+      d->frame_lost = 0;
+      d->num_frames++;
+      dazzler_decoder_commands(d, f+4, len-6, pos, true);
+    }
+  else if( (uint8_t) (f[2]-d->frame_seq) < 128 )
+    {
+      // a frame before this one is missing
+      d->num_frames_lost++;
+      dazzler_decoder_frame_lost(d);
+    }
+
+  // (frames before the expected one are repeats after DAZ_RESEND)
+  memmove(f, f+len, d->frame_len-len);
+  d->frame_len -= len;
+}
+
+
+static void dazzler_decoder_framed(dazzler_decoder *d, const uint8_t *data, int size, uint64_t pos)
+{
+  uint8_t *f = d->frame;
+
+  int i = 0;
+  while( true )
+    {
+      int need = d->frame_len<4 ? 4 : 4 + (f[3]==0 ? 256 : f[3]) + 2;
+
+      if( d->frame_len>=need )
+        {
+          // the frame ends at stream position pos+i (minus anything
+          // left over from a previous damaged frame)
+          dazzler_decoder_frame_done(d, need, pos + i - (d->frame_len-need));
+          continue;
+        }
+
+      if( i>=size )
+        break;
+      else if( d->frame_len==0 )
+        {
+          // search for the start of a frame
+          while( i<size && (data[i] & 0xFE)!=DAZ_FRAMED ) i++;
+          if( i<size ) f[d->frame_len++] = data[i++];
+        }
+      else if( d->frame_len==1 && data[i]!=DAZ_FRAMED_SYNC )
+        d->frame_len = 0;
+      else
+        {
+          int n = need-d->frame_len < size-i ? need-d->frame_len : size-i;
+          memcpy(f+d->frame_len, data+i, n);
+          d->frame_len += n;
+          i += n;
+        }
+    }
+}
+
+
+static void dazzler_decoder_stream(dazzler_decoder *d, const uint8_t *data, int size, uint64_t pos)
+{
+  int i = d->framed ? 0 : dazzler_decoder_commands(d, data, size, pos, false);
+  if( i<size ) dazzler_decoder_framed(d, data+i, size-i, pos+i);
+}
+
+
+// After DAZ_STATE_REQUEST: skip everything up to the DAZ_STATE header
+// or the start of a DAZ_FRAMED sequence and pass those on. Returns the
+// number of bytes used.
+static int dazzler_decoder_state_wait(dazzler_decoder *d, const uint8_t *data, int size, uint64_t pos)
+{
+  int i = 0;
+  while( i<size && d->state_wait>0 )
+    {
+      uint8_t  b = data[i++];
+      uint16_t h = d->state_hist;
+      d->state_hist = (h << 8) | b;
+      d->state_wait--;
+
+      if( (h >> 8)==d->state_cmd && (h & 0xFF)==DAZ_STATE_SYNC1 && b==DAZ_STATE_SYNC2 )
+        {
+          uint8_t hdr[3] = {d->state_cmd, DAZ_STATE_SYNC1, DAZ_STATE_SYNC2};
+          d->state_wait = 0;
+          d->num_state_skipped -= 2;
+          dazzler_decoder_stream(d, hdr, 3, pos+i-3);
+        }
+      else if( (h & 0xFF)==(DAZ_FRAMED | DAZ_FRAMED_START) && b==DAZ_FRAMED_SYNC && (d->features & FEAT_FRAMED) )
+        {
+          uint8_t hdr[2] = {DAZ_FRAMED | DAZ_FRAMED_START, DAZ_FRAMED_SYNC};
+          d->state_wait = 0;
+          d->num_state_skipped -= 1;
+          dazzler_decoder_stream(d, hdr, 2, pos+i-2);
+        }
+      else
+        d->num_state_skipped++;
+    }
+
+  return i;
+}
+
+
+void dazzler_decoder_receive(dazzler_decoder *d, const uint8_t *data, int size)
+{
+  const dazzler_decoder_callbacks *cb = d->cb;
+  uint64_t start = d->num_bytes;
+
+  d->num_bytes += size;
+
+  int i = d->state_wait>0 && !d->framed ? dazzler_decoder_state_wait(d, data, size, start) : 0;
+  if( i<size ) dazzler_decoder_stream(d, data+i, size-i, start+i);
+
+  // everything received so far is consumed, tell the computer
+  if( (d->features & FEAT_CREDIT) && d->computer_version>=3 && d->num_bytes-d->credit_sent>=DAZ_CREDIT_STEP )
+    {
+      uint16_t n = (uint16_t) (d->num_bytes - d->credit_base);
+      uint8_t b[2] = {(uint8_t) (DAZ_CREDIT | ((n >> 8) & 0x0F)), (uint8_t) (n & 0xFF)};
+      if( cb->send ) cb->send(d->ctx, b, 2);
+      d->credit_sent = d->num_bytes;
+    }
+}
+
+
+int dazzler_decoder_keyframe(const dazzler_decoder *d, uint8_t *out)
+{
+  int n = 0;
+  if( d->computer_version>0 ) out[n++] = DAZ_VERSION | d->computer_version;
+  for(int b=0; b<2; b++)
+    {
+      out[n++] = DAZ_FULLFRAME | 0x01 | (b ? 0x08 : 0x00);
+      memcpy(out+n, d->mem+b*DAZ_MEMSIZE, DAZ_MEMSIZE);
+      n += DAZ_MEMSIZE;
+    }
+
+  out[n++] = DAZ_CTRLPIC;
+  out[n++] = d->picture_ctrl;
+  out[n++] = DAZ_CTRL;
+  out[n++] = d->ctrl;
+  return n;
+}
+
+
+int dazzler_decoder_state(const dazzler_decoder *d, uint8_t *out)
+{
+  out[0] = DAZ_STATE | (d->computer_version & 0x0F);
+  out[1] = DAZ_STATE_SYNC1;
+  out[2] = DAZ_STATE_SYNC2;
+  out[3] = d->ctrl;
+  out[4] = d->picture_ctrl;
+  memcpy(out+5, d->mem, 2*DAZ_MEMSIZE);
+  return DAZ_STATE_SIZE;
+}
+
+
+bool dazzler_decoder_request_state(dazzler_decoder *d, int audio_queued)
+{
+  if( d->computer_version<4 || d->cb->send==NULL ) return false;
+
+  if( audio_queued>0xFFF ) audio_queued = 0xFFF;
+  uint8_t b[2] = {(uint8_t) (DAZ_STATE_REQUEST | (audio_queued >> 8)), (uint8_t) (audio_queued & 0xFF)};
+  d->cb->send(d->ctx, b, 2);
+
+  // what arrives first may be the rest of a command we lost the start of
+  d->state_cmd  = DAZ_STATE | d->computer_version;
+  d->state_wait = DAZ_STATE_WAIT;
+  d->state_hist = 0;
+  return true;
+}
@@ -0,0 +1,170 @@
+// -----------------------------------------------------------------------------
+// Cromemco Dazzler emulation - protocol decoder
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#ifndef DAZZLER_DECODER_H
+#define DAZZLER_DECODER_H
+
+#include <stdint.h>
+#include "dazzler_proto.h"
+#include "dazzler_dirty.h"
+
+// The decoder turns the byte stream received from the computer into
+// changes of the display state (video memory, control registers) and
+// reports each decoded command through the callbacks below. It does not
+// depend on any operating system or graphics facilities.
+// Any callback may be NULL. All callbacks are called after the decoder's
+// own state has been updated.
+struct dazzler_decoder_callbacks
+{
+  // one byte of video memory was written (addr is 0..4095)
+  void (*membyte)(void *ctx, int addr, uint8_t value);
+
+  // a full frame (len is 512 or 2048 bytes) was written starting at addr
+  // (by DAZ_FULLFRAME or DAZ_DELTA, or the last slice of a DAZ_CHUNK frame)
+  void (*fullframe)(void *ctx, int addr, int len);
+
+  // the control register changed its on/off or buffer-select state
+  void (*ctrl)(void *ctx, uint8_t ctrl);
+
+  // the picture control register changed
+  void (*ctrlpic)(void *ctx, uint8_t picture_ctrl);
+
+  // audio sample for channel 0 or 1, to be played delay_us after the previous one
+  void (*dac)(void *ctx, int channel, uint16_t delay_us, uint8_t sample);
+
+  // the computer announced its version
+  void (*version)(void *ctx, int computer_version);
+
+  // send data back to the computer (replies to DAZ_VERSION and DAZ_PING,
+  // DAZ_CREDIT, DAZ_RESEND)
+  void (*send)(void *ctx, const uint8_t *data, int size);
+
+  // a block of len bytes (DAZ_MEMBLOCK) was written starting at addr,
+  // addr+len may exceed 4096 if the block wrapped around
+  void (*memblock)(void *ctx, int addr, int len);
+
+  // n audio samples of a DAZ_DACBURST for channel 0 or 1, each to be played
+  // interval_us after the previous one. Called for each piece of the burst
+  // as it arrives. If NULL, the dac callback is called for each sample.
+  void (*dacburst)(void *ctx, int channel, uint16_t interval_us, const uint8_t *samples, int n);
+};
+
+
+struct dazzler_decoder
+{
+  // display state
+  uint8_t *mem;              // video memory, two buffers of DAZ_MEMSIZE bytes
+  uint8_t  ctrl;             // D7: on/off, D0: buffer select
+  uint8_t  picture_ctrl;     // D6: x4 res, D5: 2k mem, D4: color, D3-D0: fg color
+  int      computer_version;
+  uint16_t features;         // features reported in reply to DAZ_VERSION (FEAT_*)
+
+  // bytes of video memory that changed since the renderer last looked,
+  // everything is marked dirty on CTRL/CTRLPIC changes
+  dazzler_dirty dirty;
+
+  // callbacks
+  const dazzler_decoder_callbacks *cb;
+  void *ctx;
+
+  // receive status
+  int     recv_status, recv_bytes, recv_ptr;
+  int     recv_run;          // DAZ_DELTA: bytes left in the current token
+  uint8_t recv_token;        // DAZ_DELTA: current token
+  uint8_t buf[10];
+
+  // chunked frame (DAZ_CHUNK): slices collect in a copy of buffer
+  // chunk_buffer (-1 if no frame is open) until the last one arrives
+  uint8_t  chunk[DAZ_MEMSIZE];
+  int      chunk_buffer;
+
+  // framed mode (DAZ_FRAMED): the frame received so far, the next
+  // expected sequence number and frames discarded since the last error
+  bool     framed;
+  uint8_t  frame[DAZ_FRAMED_MAXSIZE];
+  int      frame_len;
+  uint8_t  frame_seq;
+  int      frame_lost;
+
+  // after DAZ_STATE_REQUEST: bytes left to skip while waiting for the
+  // DAZ_STATE header (0 if not waiting), its first byte and the last
+  // two bytes received
+  int      state_wait;
+  uint8_t  state_cmd;
+  uint16_t state_hist;
+
+  // flow control (DAZ_CREDIT): num_bytes at the computer's DAZ_VERSION
+  // and at the last credit message
+  uint64_t credit_base, credit_sent;
+
+  // statistics
+  uint64_t num_bytes, num_commands;
+  uint64_t num_frames, num_frame_errors, num_frames_lost;
+  uint64_t num_state_skipped;
+};
+
+
+// mem must point to 2*DAZ_MEMSIZE bytes, cb may be NULL
+void dazzler_decoder_init(dazzler_decoder *d, uint8_t *mem, uint16_t features,
+                          const dazzler_decoder_callbacks *cb, void *ctx);
+
+// forget any partially received command and leave framed mode
+// (e.g. after re-connecting, see also dazzler_decoder_request_state)
+void dazzler_decoder_reset(dazzler_decoder *d);
+
+// process "size" bytes received from the computer
+void dazzler_decoder_receive(dazzler_decoder *d, const uint8_t *data, int size);
+
+// true while a DAZ_FULLFRAME or DAZ_DELTA frame (or DAZ_STATE) is only partially received
+// (video memory then holds a mix of the old and new frame)
+inline bool dazzler_decoder_in_frame(const dazzler_decoder *d)
+{
+  return d->recv_status==DAZ_FULLFRAME || d->recv_status==DAZ_DELTA || (d->recv_status & 0xF0)==DAZ_STATE;
+}
+
+// true between commands (and not within a DAZ_CHUNK frame), where a
+// stream can be picked up by starting with dazzler_decoder_keyframe
+inline bool dazzler_decoder_idle(const dazzler_decoder *d)
+{
+  return d->recv_status==0 && d->chunk_buffer<0;
+}
+
+// largest output of dazzler_decoder_keyframe
+#define DAZ_KEYFRAME_SIZE (1 + 2*(1+DAZ_MEMSIZE) + 2 + 2)
+
+// Write commands that bring a Dazzler in any state to the decoder's
+// display state (the computer's DAZ_VERSION if it sent one, both
+// buffers, picture control and control register) to "out", returns
+// the number of bytes
+int dazzler_decoder_keyframe(const dazzler_decoder *d, uint8_t *out);
+
+// Write a DAZ_STATE command with the decoder's display state to "out"
+// (which must hold DAZ_STATE_SIZE bytes), returns the number of bytes.
+// The computer side keeps a decoder of what it sent to answer
+// DAZ_STATE_REQUEST with this.
+int dazzler_decoder_state(const dazzler_decoder *d, uint8_t *out);
+
+// After re-connecting (and dazzler_decoder_reset): send DAZ_STATE_REQUEST
+// if the computer announced version 4 or later, "audio_queued" is the
+// number of audio samples still waiting to be played. Everything up to
+// the computer's DAZ_STATE is then skipped (see DAZ_STATE_WAIT).
+// Returns false if nothing was sent.
+bool dazzler_decoder_request_state(dazzler_decoder *d, int audio_queued);
+
+#endif
@@ -0,0 +1,107 @@
+// -----------------------------------------------------------------------------
+// Cromemco Dazzler emulation - delta frame encoder
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#include <string.h>
+#include "dazzler_delta.h"
+
+
+// length of the run of identical bytes starting at x[i] (at most max)
+static int run_length(const uint8_t *x, int i, int len, int max)
+{
+  int n = 1;
+  while( n<max && i+n<len && x[i+n]==x[i] ) n++;
+  return n;
+}
+
+
+int dazzler_delta_encode(const uint8_t *prev, const uint8_t *next, int len, int buffer, uint8_t *out)
+{
+  uint8_t x[DAZ_MEMSIZE];
+  for(int i=0; i<len; i++) x[i] = prev[i] ^ next[i];
+
+  int o = 0;
+  out[o++] = DAZ_DELTA | (len==2048 ? 0x01 : 0x00) | (buffer ? 0x08 : 0x00);
+
+  int i = 0;
+  while( i<len )
+    {
+      if( x[i]==0 )
+        {
+          int z = run_length(x, i, len, len);
+          if( i+z==len )
+            {
+              // unchanged until the end
+              out[o++] = 0x00;
+              break;
+            }
+
+          while( z>0 )
+            {
+              int n = z<127 ? z : 127;
+              out[o++] = n;
+              i += n;
+              z -= n;
+            }
+        }
+      else if( run_length(x, i, len, 64)>=3 )
+        {
+          // same change for 3 or more bytes => 2 bytes for up to 64
+          int n = run_length(x, i, len, 64);
+          out[o++] = 0xC0 | (n-1);
+          out[o++] = x[i];
+          i += n;
+        }
+      else
+        {
+          // literal run, ends where a repeat, a zero run of 3 or more
+          // (shorter ones cost no more as literals) or the unchanged
+          // remainder of the frame starts
+          int n = 1;
+          while( n<64 && i+n<len )
+            {
+              int j = i+n;
+              int r = run_length(x, j, len, len);
+              if( x[j]!=0 && r>=3 ) break;
+              if( x[j]==0 && (r>=3 || j+r==len) ) break;
+              n++;
+            }
+
+          out[o++] = 0x80 | (n-1);
+          memcpy(out+o, x+i, n);
+          o += n;
+          i += n;
+        }
+    }
+
+  return o;
+}
+
+
+int dazzler_frame_encode(const uint8_t *prev, const uint8_t *next, int len, int buffer, bool use_delta, uint8_t *out)
+{
+  if( use_delta )
+    {
+      int n = dazzler_delta_encode(prev, next, len, buffer, out);
+      if( n < len+1 ) return n;
+    }
+
+  out[0] = DAZ_FULLFRAME | (len==2048 ? 0x01 : 0x00) | (buffer ? 0x08 : 0x00);
+  memcpy(out+1, next, len);
+  return len+1;
+}
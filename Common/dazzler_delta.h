@@ -0,0 +1,41 @@
+// -----------------------------------------------------------------------------
+// Cromemco Dazzler emulation - delta frame encoder
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#ifndef DAZZLER_DELTA_H
+#define DAZZLER_DELTA_H
+
+#include <stdint.h>
+#include "dazzler_proto.h"
+
+// largest possible DAZ_DELTA command for a frame of "len" bytes
+// (command byte plus one literal token per 64 bytes)
+#define DAZ_DELTA_MAXSIZE(len) (1 + (len) + ((len)+63)/64)
+
+// Encode the change from "prev" (what the Dazzler's buffer holds now) to
+// "next" as a DAZ_DELTA command. "len" is 512 or 2048, "buffer" 0 or 1.
+// "out" must hold DAZ_DELTA_MAXSIZE(len) bytes. Returns the command size,
+// if it is not smaller than len+1 a DAZ_FULLFRAME is the better choice.
+int dazzler_delta_encode(const uint8_t *prev, const uint8_t *next, int len, int buffer, uint8_t *out);
+
+// Encode whichever of DAZ_DELTA and DAZ_FULLFRAME is smaller (DAZ_DELTA only
+// if "use_delta" is set, i.e. the Dazzler reported FEAT_DELTA).
+// "out" must hold DAZ_DELTA_MAXSIZE(len) bytes, returns the command size.
+int dazzler_frame_encode(const uint8_t *prev, const uint8_t *next, int len, int buffer, bool use_delta, uint8_t *out);
+
+#endif
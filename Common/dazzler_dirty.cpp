@@ -0,0 +1,111 @@
+// -----------------------------------------------------------------------------
+// Cromemco Dazzler emulation - per-byte dirty tracking of video memory
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#include <string.h>
+#include "dazzler_dirty.h"
+
+
+void dazzler_dirty_set_all(dazzler_dirty *d)
+{
+  for(int i=0; i<2*DAZ_DIRTY_WORDS; i++)
+    d->bits[i].store(0xFFFFFFFF, std::memory_order_release);
+}
+
+
+void dazzler_dirty_clear(dazzler_dirty *d)
+{
+  for(int i=0; i<2*DAZ_DIRTY_WORDS; i++)
+    d->bits[i].store(0, std::memory_order_relaxed);
+}
+
+
+void dazzler_dirty_copy(dazzler_dirty *d, uint8_t *mem, int addr, const uint8_t *src, int n)
+{
+  // work in pieces that fall into a single 32-bit word of the bitmap
+  while( n>0 )
+    {
+      int bit = addr & 31;
+      int len = 32-bit < n ? 32-bit : n;
+      uint8_t *dst = mem+addr;
+
+      uint32_t changed = 0;
+      for(int i=0; i<len; i++)
+        changed |= (uint32_t) (dst[i]!=src[i]) << (bit+i);
+
+      if( changed )
+        {
+          memcpy(dst, src, len);
+          d->bits[addr>>5].fetch_or(changed, std::memory_order_release);
+        }
+
+      addr += len;
+      src  += len;
+      n    -= len;
+    }
+}
+
+
+void dazzler_dirty_xor(dazzler_dirty *d, uint8_t *mem, int addr, const uint8_t *src, int n)
+{
+  while( n>0 )
+    {
+      int bit = addr & 31;
+      int len = 32-bit < n ? 32-bit : n;
+      uint8_t *dst = mem+addr;
+
+      uint32_t changed = 0;
+      for(int i=0; i<len; i++)
+        {
+          dst[i] ^= src[i];
+          changed |= (uint32_t) (src[i]!=0) << (bit+i);
+        }
+
+      if( changed )
+        d->bits[addr>>5].fetch_or(changed, std::memory_order_release);
+
+      addr += len;
+      src  += len;
+      n    -= len;
+    }
+}
+
+
+bool dazzler_dirty_any(dazzler_dirty *d)
+{
+  for(int i=0; i<2*DAZ_DIRTY_WORDS; i++)
+    if( d->bits[i].load(std::memory_order_relaxed) )
+      return true;
+
+  return false;
+}
+
+
+bool dazzler_dirty_take(dazzler_dirty *d, int buffer, uint32_t out[DAZ_DIRTY_WORDS])
+{
+  uint32_t any = 0;
+  std::atomic<uint32_t> *bits = d->bits + buffer*DAZ_DIRTY_WORDS;
+  for(int i=0; i<DAZ_DIRTY_WORDS; i++)
+    {
+      // cheap check first to avoid a locked exchange for clean words
+      out[i] = bits[i].load(std::memory_order_relaxed) ? bits[i].exchange(0, std::memory_order_acquire) : 0;
+      any |= out[i];
+    }
+
+  return any!=0;
+}
@@ -0,0 +1,64 @@
+// -----------------------------------------------------------------------------
+// Cromemco Dazzler emulation - per-byte dirty tracking of video memory
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#ifndef DAZZLER_DIRTY_H
+#define DAZZLER_DIRTY_H
+
+#include <stdint.h>
+#include <atomic>
+#include "dazzler_proto.h"
+
+// number of 32-bit words in the dirty bitmap of one memory buffer
+#define DAZ_DIRTY_WORDS (DAZ_MEMSIZE/32)
+
+// One bit per byte of video memory (both buffers). The decoder sets bits
+// when a byte changes its value, the renderer takes (and clears) them
+// when drawing a frame. Setting and taking may happen on different threads.
+struct dazzler_dirty
+{
+  std::atomic<uint32_t> bits[2*DAZ_DIRTY_WORDS];
+};
+
+
+// mark memory byte "addr" (0..4095) as changed
+inline void dazzler_dirty_set(dazzler_dirty *d, int addr)
+{
+  d->bits[addr>>5].fetch_or(1u << (addr&31), std::memory_order_release);
+}
+
+// mark everything in both buffers as changed (e.g. after a mode change)
+void dazzler_dirty_set_all(dazzler_dirty *d);
+
+// clear all bits without rendering (e.g. at startup)
+void dazzler_dirty_clear(dazzler_dirty *d);
+
+// copy "n" bytes from "src" to mem[addr] and mark the bytes that changed
+void dazzler_dirty_copy(dazzler_dirty *d, uint8_t *mem, int addr, const uint8_t *src, int n);
+
+// XOR "n" bytes from "src" into mem[addr] and mark the bytes that changed
+void dazzler_dirty_xor(dazzler_dirty *d, uint8_t *mem, int addr, const uint8_t *src, int n);
+
+// true if any byte in either buffer is marked as changed
+bool dazzler_dirty_any(dazzler_dirty *d);
+
+// move the dirty bits of one buffer (0 or 1) into "out" and clear them,
+// returns true if any bit was set
+bool dazzler_dirty_take(dazzler_dirty *d, int buffer, uint32_t out[DAZ_DIRTY_WORDS]);
+
+#endif
@@ -0,0 +1,194 @@
+// -----------------------------------------------------------------------------
+// Cromemco Dazzler emulation - update encoder with link cost model
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#include <string.h>
+#include "dazzler_encoder.h"
+
+// maximum number of changed runs in a frame (every other byte changed)
+#define MAX_SEGMENTS (DAZ_MEMSIZE/2+1)
+
+// the receiver's decoder loop handles one command per pass, this is a
+// rough estimate for the PIC32 (the Windows client is much faster)
+#define DEFAULT_CMD_NS 1000
+
+
+void dazzler_link_init(dazzler_link *l, int baud, uint16_t features)
+{
+  l->baud     = baud;
+  l->features = features;
+  l->byte_ns  = baud>0 ? (uint32_t) (10 * 1000000000ull / baud) : 0;
+  l->cmd_ns   = DEFAULT_CMD_NS;
+}
+
+
+uint32_t dazzler_link_cost_us(const dazzler_link *l, int bytes, int commands)
+{
+  uint64_t ns;
+  if( l->baud>0 )
+    ns = (uint64_t) bytes * l->byte_ns;
+  else
+    ns = (uint64_t) ((bytes + DAZ_USB_TRANSFER-1) / DAZ_USB_TRANSFER) * DAZ_USB_FRAME_US * 1000;
+
+  return (uint32_t) ((ns + (uint64_t) commands * l->cmd_ns + 999) / 1000);
+}
+
+
+// runs of changed bytes, merged where sending the unchanged bytes
+// in between is cheaper than starting a new command
+struct segment
+{
+  int start, len;
+};
+
+static int find_segments(const uint8_t *prev, const uint8_t *next, int len, int merge_gap, segment *seg)
+{
+  int n = 0;
+  for(int i=0; i<len; i++)
+    if( prev[i]!=next[i] )
+      {
+        if( n>0 && i-(seg[n-1].start+seg[n-1].len) <= merge_gap && i+1-seg[n-1].start <= 256 )
+          seg[n-1].len = i+1-seg[n-1].start;
+        else
+          {
+            seg[n].start = i;
+            seg[n].len   = 1;
+            n++;
+          }
+      }
+
+  return n;
+}
+
+
+static void count_segments(const segment *seg, int n, bool memblock, int *bytes, int *commands)
+{
+  *bytes = *commands = 0;
+  for(int i=0; i<n; i++)
+    {
+      // a MEMBLOCK header is 3 bytes, a MEMBYTE 3 bytes per byte
+      if( memblock && seg[i].len>1 )
+        { *bytes += 3 + seg[i].len; *commands += 1; }
+      else
+        { *bytes += 3*seg[i].len; *commands += seg[i].len; }
+    }
+}
+
+
+static int emit_segments(const segment *seg, int n, bool memblock, const uint8_t *next, int base, uint8_t *out)
+{
+  int o = 0;
+  for(int i=0; i<n; i++)
+    {
+      int a = base + seg[i].start;
+      if( memblock && seg[i].len>1 )
+        {
+          out[o++] = DAZ_MEMBLOCK | (a >> 8);
+          out[o++] = a & 0xFF;
+          out[o++] = seg[i].len & 0xFF;
+          memcpy(out+o, next+seg[i].start, seg[i].len);
+          o += seg[i].len;
+        }
+      else
+        for(int j=0; j<seg[i].len; j++)
+          {
+            // without merging, all bytes of a segment have changed
+            out[o++] = DAZ_MEMBYTE | ((a+j) >> 8);
+            out[o++] = (a+j) & 0xFF;
+            out[o++] = next[seg[i].start+j];
+          }
+    }
+
+  return o;
+}
+
+
+int dazzler_encode(const dazzler_link *l, const uint8_t *prev, const uint8_t *next, int len, int buffer,
+                   uint8_t *out, dazzler_encode_result *res)
+{
+  dazzler_encode_result r, dummy;
+  if( res==NULL ) res = &dummy;
+
+  // scratch on the stack (about 16K) so links can encode concurrently
+  segment seg[MAX_SEGMENTS], blocks[MAX_SEGMENTS];
+  int nseg = find_segments(prev, next, len, 0, seg);
+  if( nseg==0 )
+    {
+      res->method   = DAZ_ENC_NONE;
+      res->bytes    = res->commands = 0;
+      res->cost_us  = 0;
+      return 0;
+    }
+
+  // FULLFRAME is always possible
+  res->method   = DAZ_ENC_FULLFRAME;
+  res->bytes    = len+1;
+  res->commands = 1;
+  res->cost_us  = dazzler_link_cost_us(l, res->bytes, 1);
+
+  // MEMBYTE commands for each changed byte
+  r.method = DAZ_ENC_MEMBYTE;
+  count_segments(seg, nseg, false, &r.bytes, &r.commands);
+  r.cost_us = dazzler_link_cost_us(l, r.bytes, r.commands);
+  if( r.cost_us<res->cost_us || (r.cost_us==res->cost_us && r.bytes<res->bytes) ) *res = r;
+
+  // MEMBLOCK runs: include up to 3 unchanged bytes (the size of a block
+  // header) plus whatever the receiver's command overhead is worth
+  int nblocks = 0;
+  if( l->features & FEAT_MEMBLOCK )
+    {
+      int gap = 3;
+      if( l->baud>0 && l->byte_ns>0 ) gap += l->cmd_ns / l->byte_ns;
+      nblocks = find_segments(prev, next, len, gap, blocks);
+
+      r.method = DAZ_ENC_MEMBLOCK;
+      count_segments(blocks, nblocks, true, &r.bytes, &r.commands);
+      r.cost_us = dazzler_link_cost_us(l, r.bytes, r.commands);
+      if( r.cost_us<res->cost_us || (r.cost_us==res->cost_us && r.bytes<res->bytes) ) *res = r;
+    }
+
+  // DELTA has to be encoded to know its size, it goes straight into
+  // "out" and is overwritten if another encoding wins
+  int ndelta = 0;
+  if( l->features & FEAT_DELTA )
+    {
+      ndelta = dazzler_delta_encode(prev, next, len, buffer, out);
+
+      r.method   = DAZ_ENC_DELTA;
+      r.bytes    = ndelta;
+      r.commands = 1;
+      r.cost_us  = dazzler_link_cost_us(l, r.bytes, r.commands);
+      if( r.cost_us<res->cost_us || (r.cost_us==res->cost_us && r.bytes<res->bytes) ) *res = r;
+    }
+
+  int base = buffer ? DAZ_MEMSIZE : 0;
+  switch( res->method )
+    {
+    case DAZ_ENC_MEMBYTE:
+      return emit_segments(seg, nseg, false, next, base, out);
+
+    case DAZ_ENC_MEMBLOCK:
+      return emit_segments(blocks, nblocks, true, next, base, out);
+
+    case DAZ_ENC_DELTA:
+      return ndelta;
+
+    default:
+      return dazzler_frame_encode(prev, next, len, buffer, false, out);
+    }
+}
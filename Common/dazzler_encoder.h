@@ -0,0 +1,77 @@
+// -----------------------------------------------------------------------------
+// Cromemco Dazzler emulation - update encoder with link cost model
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#ifndef DAZZLER_ENCODER_H
+#define DAZZLER_ENCODER_H
+
+#include <stdint.h>
+#include "dazzler_proto.h"
+#include "dazzler_delta.h"
+
+// encodings the encoder chooses from
+#define DAZ_ENC_NONE      0   // nothing changed
+#define DAZ_ENC_MEMBYTE   1   // DAZ_MEMBYTE commands only
+#define DAZ_ENC_MEMBLOCK  2   // DAZ_MEMBLOCK runs (DAZ_MEMBYTE for single bytes)
+#define DAZ_ENC_FULLFRAME 3
+#define DAZ_ENC_DELTA     4
+#define DAZ_ENC_METHODS   5
+
+// largest possible output of dazzler_encode for a frame of "len" bytes
+#define DAZ_ENCODE_MAXSIZE(len) DAZ_DELTA_MAXSIZE(len)
+
+// PIC32 firmware USB host: one transfer of up to 8 64-byte packets
+// per 1ms USB frame (see USB_MAX_TRANSFER_SIZE in the firmware)
+#define DAZ_USB_PACKET     64
+#define DAZ_USB_TRANSFER   (8*DAZ_USB_PACKET)
+#define DAZ_USB_FRAME_US   1000
+
+// Describes the link to the Dazzler and what it supports
+struct dazzler_link
+{
+  int      baud;            // serial bits per second (10 bits per byte), 0 for native USB
+  uint16_t features;        // FEAT_* reported by the Dazzler
+  uint32_t byte_ns;         // serial: time per byte on the wire
+  uint32_t cmd_ns;          // receiver time per command (decoder loop overhead)
+};
+
+
+// baud is 9600..1050000 (see set_baud_rate in the Windows client) or 0 for USB
+void dazzler_link_init(dazzler_link *l, int baud, uint16_t features);
+
+// time in microseconds to transfer and process "bytes" bytes in "commands" commands
+uint32_t dazzler_link_cost_us(const dazzler_link *l, int bytes, int commands);
+
+
+struct dazzler_encode_result
+{
+  int      method;          // DAZ_ENC_*
+  int      bytes, commands;
+  uint32_t cost_us;
+};
+
+
+// Emit the cheapest command sequence (by dazzler_link_cost_us, ties go to
+// fewer bytes) that turns buffer "buffer" (0 or 1) from "prev" into "next".
+// "len" is 512 or 2048 (only the first len bytes are compared), "out"
+// must hold DAZ_ENCODE_MAXSIZE(len) bytes. Returns the number of bytes
+// written, details go to "res" if not NULL.
+int dazzler_encode(const dazzler_link *l, const uint8_t *prev, const uint8_t *next, int len, int buffer,
+                   uint8_t *out, dazzler_encode_result *res);
+
+#endif
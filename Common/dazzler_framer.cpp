@@ -0,0 +1,103 @@
+// -----------------------------------------------------------------------------
+// Cromemco Dazzler emulation - computer side of framed transfers
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#include <string.h>
+#include "dazzler_framer.h"
+#include "dazzler_crc.h"
+
+
+void dazzler_framer_init(dazzler_framer *f)
+{
+  f->seq          = 0;
+  f->start        = true;
+  f->sent         = 0;
+  f->frames_since_start = 0;
+  f->num_frames   = 0;
+  f->num_resent   = 0;
+  f->num_restarts = 0;
+}
+
+
+int dazzler_framer_frame(dazzler_framer *f, const uint8_t *data, int len, uint8_t *out)
+{
+  memmove(out+4, data, len);
+  out[0] = DAZ_FRAMED | (f->start ? DAZ_FRAMED_START : 0);
+  out[1] = DAZ_FRAMED_SYNC;
+  out[2] = f->seq;
+  out[3] = (uint8_t) len;
+  uint16_t crc = dazzler_crc16(DAZ_CRC16_INIT, out, len+4);
+  out[len+4] = crc >> 8;
+  out[len+5] = crc & 0xFF;
+  len += 6;
+
+  // keep a copy in the history
+  f->frame_pos[f->seq] = f->sent;
+  for(int i=0; i<len; )
+    {
+      int p = (int) (f->sent & (DAZ_FRAMER_HISTORY-1));
+      int n = len-i < DAZ_FRAMER_HISTORY-p ? len-i : DAZ_FRAMER_HISTORY-p;
+      memcpy(f->history+p, out+i, n);
+      f->sent += n;
+      i += n;
+    }
+
+  f->frames_since_start++;
+  f->seq++;
+  f->start = false;
+  f->num_frames++;
+  return len;
+}
+
+
+int dazzler_framer_resend(dazzler_framer *f, uint8_t seq, uint8_t *out)
+{
+  // number of frames sent since "seq" (0 if it was not sent yet)
+  uint8_t back = f->seq - seq;
+  if( back==0 ) return 0;
+
+  // the frame starting a new sequence is about to be sent anyway
+  if( f->start ) return 0;
+
+  // sequence numbers continue across starts, so a request for a frame
+  // before the start frame means the start frame was lost too
+  if( back>f->frames_since_start && f->frames_since_start<256 )
+    back = (uint8_t) f->frames_since_start;
+
+  uint64_t pos = f->frame_pos[(uint8_t) (f->seq-back)];
+  if( f->sent-pos>DAZ_FRAMER_HISTORY )
+    {
+      // can not go back that far
+      f->start = true;
+      f->frames_since_start = 0;
+      f->num_restarts++;
+      return -1;
+    }
+
+  int len = (int) (f->sent-pos);
+  for(int i=0; i<len; )
+    {
+      int p = (int) ((pos+i) & (DAZ_FRAMER_HISTORY-1));
+      int n = len-i < DAZ_FRAMER_HISTORY-p ? len-i : DAZ_FRAMER_HISTORY-p;
+      memcpy(out+i, f->history+p, n);
+      i += n;
+    }
+
+  f->num_resent += back;
+  return len;
+}
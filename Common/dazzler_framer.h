@@ -0,0 +1,62 @@
+// -----------------------------------------------------------------------------
+// Cromemco Dazzler emulation - computer side of framed transfers
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#ifndef DAZZLER_FRAMER_H
+#define DAZZLER_FRAMER_H
+
+#include <stdint.h>
+#include "dazzler_proto.h"
+
+// bytes of sent frames kept for DAZ_RESEND (must be a power of 2). More
+// than the Dazzler's receive buffer plus what is on the way to it.
+#define DAZ_FRAMER_HISTORY 16384
+
+// Wraps the command stream into DAZ_FRAMED frames and keeps the most
+// recently sent ones so they can be sent again when the Dazzler asks.
+struct dazzler_framer
+{
+  uint8_t  seq;                     // sequence number of the next frame
+  bool     start;                   // next frame starts a new sequence
+  uint8_t  history[DAZ_FRAMER_HISTORY];
+  uint64_t sent;                    // bytes of frames sent
+  uint64_t frame_pos[256];          // "sent" at the start of each sequence number
+  uint64_t frames_since_start;      // frames sent since (and including) the last start frame
+
+  // statistics
+  uint64_t num_frames, num_resent, num_restarts;
+};
+
+
+void dazzler_framer_init(dazzler_framer *f);
+
+// Wrap "len" (1-256) bytes of the command stream into a frame, returns
+// its size (len+6). "out" may be the same as "data" plus 4.
+int dazzler_framer_frame(dazzler_framer *f, const uint8_t *data, int len, uint8_t *out);
+
+// The Dazzler sent DAZ_RESEND for sequence number "seq": copies all frames
+// from that one on to "out" (room for DAZ_FRAMER_HISTORY bytes) and
+// returns the number of bytes. Requests for frames before the last start
+// of a sequence are answered from that start frame on (it got lost as
+// well). Returns -1 if the frames are no longer available,
+// then the next frame starts a new sequence and must begin with
+// commands that restore the complete display state (CTRL, CTRLPIC and
+// DAZ_FULLFRAME for both buffers).
+int dazzler_framer_resend(dazzler_framer *f, uint8_t seq, uint8_t *out);
+
+#endif
@@ -0,0 +1,84 @@
+// -----------------------------------------------------------------------------
+// Cromemco Dazzler emulation - frame handoff between receive and render thread
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#include <string.h>
+#include "dazzler_handoff.h"
+
+
+void dazzler_handoff_init(dazzler_handoff *h)
+{
+  memset(h->frames, 0, sizeof(h->frames));
+
+  // frame 0 is the writer's, frame 1 the middle (not fresh), frame 2 the reader's
+  h->back  = 0;
+  h->front = 2;
+  h->middle.store(1, std::memory_order_relaxed);
+
+  h->seq           = 0;
+  h->num_published = 0;
+  h->num_dropped   = 0;
+
+  // the first frame the reader gets must be drawn completely
+  memset(h->pending, 0xFF, sizeof(h->pending));
+}
+
+
+void dazzler_handoff_publish(dazzler_handoff *h, dazzler_decoder *d)
+{
+  dazzler_frame *f = &h->frames[h->back];
+
+  uint32_t delta[2*DAZ_DIRTY_WORDS];
+  dazzler_dirty_take(&d->dirty, 0, delta);
+  dazzler_dirty_take(&d->dirty, 1, delta+DAZ_DIRTY_WORDS);
+
+  memcpy(f->mem, d->mem, sizeof(f->mem));
+  f->ctrl         = d->ctrl;
+  f->picture_ctrl = d->picture_ctrl;
+  f->seq          = ++h->seq;
+  for(int i=0; i<2*DAZ_DIRTY_WORDS; i++)
+    f->dirty[i] = (h->pending[i] |= delta[i]);
+
+  int old = h->middle.exchange(h->back | DAZ_HANDOFF_FRESH, std::memory_order_acq_rel);
+  h->back = old & 3;
+  h->num_published++;
+
+  if( old & DAZ_HANDOFF_FRESH )
+    {
+      // the previous frame was never taken => the reader is still at an
+      // older frame so keep accumulating dirty bits
+      h->num_dropped++;
+    }
+  else
+    {
+      // the previous frame was taken => the next frame only needs to
+      // carry the changes made since then
+      memcpy(h->pending, delta, sizeof(delta));
+    }
+}
+
+
+const dazzler_frame *dazzler_handoff_take(dazzler_handoff *h)
+{
+  if( !(h->middle.load(std::memory_order_relaxed) & DAZ_HANDOFF_FRESH) )
+    return NULL;
+
+  int old = h->middle.exchange(h->front, std::memory_order_acq_rel);
+  h->front = old & 3;
+  return &h->frames[h->front];
+}
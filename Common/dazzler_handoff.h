@@ -0,0 +1,73 @@
+// -----------------------------------------------------------------------------
+// Cromemco Dazzler emulation - frame handoff between receive and render thread
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#ifndef DAZZLER_HANDOFF_H
+#define DAZZLER_HANDOFF_H
+
+#include <stdint.h>
+#include <atomic>
+#include "dazzler_decoder.h"
+
+// set in dazzler_handoff::middle if the middle frame has not been taken yet
+#define DAZ_HANDOFF_FRESH 4
+
+// A consistent snapshot of the display state
+struct dazzler_frame
+{
+  uint8_t  mem[2*DAZ_MEMSIZE];
+  uint8_t  ctrl, picture_ctrl;
+  uint32_t seq;                           // number of the publish that produced it
+
+  // bytes that changed since the frame the reader took before this one
+  uint32_t dirty[2*DAZ_DIRTY_WORDS];
+};
+
+
+// Triple buffer: the receive thread (writer) fills its back frame and swaps
+// it with the middle one, the render thread (reader) swaps its front frame
+// with the middle one if that is newer. Neither side ever waits for the
+// other, the reader always gets the newest complete frame and frames the
+// reader did not get to are dropped (their dirty bits carry over).
+struct dazzler_handoff
+{
+  dazzler_frame frames[3];
+  std::atomic<int> middle;                // index of middle frame | DAZ_HANDOFF_FRESH
+
+  // writer side
+  int      back;
+  uint32_t seq;
+  uint32_t pending[2*DAZ_DIRTY_WORDS];    // dirty since the last frame known taken
+  uint64_t num_published, num_dropped;
+
+  // reader side
+  int      front;
+};
+
+
+void dazzler_handoff_init(dazzler_handoff *h);
+
+// writer: publish the decoder's current state (memory, ctrl, picture_ctrl)
+// and the dirty bits collected by the decoder since the last publish
+void dazzler_handoff_publish(dazzler_handoff *h, dazzler_decoder *d);
+
+// reader: get the newest published frame or NULL if nothing was published
+// since the last call. The frame stays valid until the next call.
+const dazzler_frame *dazzler_handoff_take(dazzler_handoff *h);
+
+#endif
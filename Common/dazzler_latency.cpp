@@ -0,0 +1,129 @@
+// -----------------------------------------------------------------------------
+// Cromemco Dazzler emulation - latency histograms
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#include <string.h>
+#include "dazzler_latency.h"
+
+
+static int bucket(uint32_t us)
+{
+  if( us<DAZ_LATENCY_SUB ) return us;
+
+  int e = 31;
+  while( (us & (1u << e))==0 ) e--;
+  return (e-3)*DAZ_LATENCY_SUB + ((us >> (e-4)) & (DAZ_LATENCY_SUB-1));
+}
+
+
+// largest value that goes into bucket "b"
+static uint32_t bucket_max(int b)
+{
+  if( b<DAZ_LATENCY_SUB ) return b;
+
+  int e = b/DAZ_LATENCY_SUB + 3;
+  uint64_t lo = ((uint64_t) (DAZ_LATENCY_SUB + b%DAZ_LATENCY_SUB)) << (e-4);
+  return (uint32_t) (lo + (1ull << (e-4)) - 1);
+}
+
+
+void dazzler_latency_init(dazzler_latency *h)
+{
+  memset(h->count, 0, sizeof(h->count));
+  h->n   = 0;
+  h->sum = 0;
+  h->min = 0xFFFFFFFF;
+  h->max = 0;
+}
+
+
+void dazzler_latency_add(dazzler_latency *h, uint32_t us)
+{
+  h->count[bucket(us)]++;
+  h->n++;
+  h->sum += us;
+  if( us<h->min ) h->min = us;
+  if( us>h->max ) h->max = us;
+}
+
+
+uint32_t dazzler_latency_percentile(const dazzler_latency *h, double p)
+{
+  if( h->n==0 ) return 0;
+
+  // number of samples at or below the percentile (at least one)
+  uint64_t target = (uint64_t) (h->n * p / 100.0 + 0.5);
+  if( target<1 ) target = 1;
+
+  uint64_t c = 0;
+  for(int b=0; b<DAZ_LATENCY_BUCKETS; b++)
+    {
+      c += h->count[b];
+      if( c>=target )
+        return bucket_max(b) < h->max ? bucket_max(b) : h->max;
+    }
+
+  return h->max;
+}
+
+
+void dazzler_latency_print(const dazzler_latency *h, FILE *f, const char *name, bool bars)
+{
+  if( h->n==0 )
+    {
+      fprintf(f, "%s: no samples\n", name);
+      return;
+    }
+
+  fprintf(f, "%s: %lu samples, min %u, avg %.0f, p50 %u, p90 %u, p99 %u, p99.9 %u, max %u us\n",
+          name, (unsigned long) h->n, h->min, (double) h->sum / h->n,
+          dazzler_latency_percentile(h, 50), dazzler_latency_percentile(h, 90),
+          dazzler_latency_percentile(h, 99), dazzler_latency_percentile(h, 99.9), h->max);
+
+  if( !bars ) return;
+
+  // samples per power of two
+  uint64_t pow2[33] = {0}, most = 0;
+  for(int b=0; b<DAZ_LATENCY_BUCKETS; b++)
+    if( h->count[b]>0 )
+      {
+        uint32_t v = bucket_max(b);
+        int e = 0;
+        while( e<32 && (v >> e)>1 ) e++;
+        pow2[v==0 ? 0 : e+1] += h->count[b];
+      }
+
+  int first = 32, last = 0;
+  for(int e=0; e<33; e++)
+    if( pow2[e]>0 )
+      {
+        if( e<first ) first = e;
+        last = e;
+        if( pow2[e]>most ) most = pow2[e];
+      }
+
+  for(int e=first; e<=last; e++)
+    {
+      char bar[51];
+      int len = (int) ((pow2[e]*50 + most-1) / most);
+      memset(bar, '#', len);
+      bar[len] = 0;
+      unsigned long lo = e==0 ? 0 : 1ul << (e-1), hi = e==0 ? 0 : (1ul << e) - 1;
+      fprintf(f, "  %9lu-%-9lu us %10lu %s\n", lo, hi, (unsigned long) pow2[e], bar);
+    }
+}
@@ -0,0 +1,53 @@
+// -----------------------------------------------------------------------------
+// Cromemco Dazzler emulation - latency histograms
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#ifndef DAZZLER_LATENCY_H
+#define DAZZLER_LATENCY_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+// Latencies are counted in buckets 1/16 of a power of two wide (exact
+// below 16us), so percentiles are at most 6.25% off. Min, max and average
+// are exact.
+#define DAZ_LATENCY_SUB     16
+#define DAZ_LATENCY_BUCKETS ((32-3)*DAZ_LATENCY_SUB)
+
+struct dazzler_latency
+{
+  uint64_t count[DAZ_LATENCY_BUCKETS];
+  uint64_t n, sum;
+  uint32_t min, max;
+};
+
+
+void dazzler_latency_init(dazzler_latency *h);
+
+// add one sample (microseconds)
+void dazzler_latency_add(dazzler_latency *h, uint32_t us);
+
+// latency that "p" percent (0-100) of the samples did not exceed
+// (upper end of its bucket, never more than the maximum)
+uint32_t dazzler_latency_percentile(const dazzler_latency *h, double p);
+
+// one summary line (count, min, average, p50, p90, p99, p99.9, max)
+// and, if "bars" is set, a bar chart with one line per power of two
+void dazzler_latency_print(const dazzler_latency *h, FILE *f, const char *name, bool bars);
+
+#endif
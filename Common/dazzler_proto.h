@@ -0,0 +1,199 @@
+// -----------------------------------------------------------------------------
+// Cromemco Dazzler emulation - protocol definitions
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#ifndef DAZZLER_PROTO_H
+#define DAZZLER_PROTO_H
+
+// dazzler commands received from the Altair simulator
+// (upper 4 bits of the first byte, lower 4 bits are command parameters)
+#define DAZ_MEMBYTE   0x10
+#define DAZ_FULLFRAME 0x20
+#define DAZ_CTRL      0x30
+#define DAZ_CTRLPIC   0x40
+#define DAZ_DAC       0x50
+#define DAZ_MEMBLOCK  0x60
+#define DAZ_DELTA     0x70
+#define DAZ_DACBURST  0x80
+#define DAZ_RECT      0x90
+#define DAZ_CHUNK     0xA0
+#define DAZ_PING      0xB0
+#define DAZ_FRAMED    0xC0
+#define DAZ_STATE     0xD0
+#define DAZ_VERSION   0xF0
+
+// DAZ_MEMBLOCK writes a block of 1-256 bytes to video memory:
+//   0x6H, LL, NN, NN data bytes
+// H/LL is the 12-bit start address (0x800-0xFFF is buffer 2), NN the
+// number of bytes (0 means 256). Blocks wrap around at the end of memory.
+// Only sent to a Dazzler that reports FEAT_MEMBLOCK.
+
+// DAZ_DELTA updates a full frame by XOR-ing changes into the buffer's
+// current contents. Bits 0 and 3 of the command byte select size and
+// buffer as for DAZ_FULLFRAME, then tokens follow until the frame is
+// complete:
+//   0x00       skip to the end of the frame (unchanged)
+//   0x01-0x7F  skip 1-127 bytes
+//   0x80-0xBF  XOR the following 1-64 bytes into memory
+//   0xC0-0xFF  XOR the following single byte into 1-64 bytes of memory
+// Only sent to a Dazzler that reports FEAT_DELTA (see dazzler_delta.h).
+
+// DAZ_DACBURST plays a burst of audio samples at a fixed interval:
+//   0x8C, DL, DH, NN, NN samples
+// C is the channel (0 or 1, as for DAZ_DAC), DH/DL the interval in
+// microseconds before each sample (the first one counts from the previous
+// sample, as the DAZ_DAC delay), NN the number of samples (0 means 256).
+// Only sent to a Dazzler that reports FEAT_DACBURST.
+
+// DAZ_RECT fills, copies or scrolls a rectangle of video memory bytes
+// (see dazzler_rect.h for how a buffer maps to a grid of 32x64 bytes):
+//   0x90, X, Y, W, H, V          FILL: set all bytes to V
+//   0x91, X, Y, W, H, X2, Y2     COPY: copy to the rectangle at X2/Y2
+//   0x92, X, Y, W, H, DX, DY, V  SCROLL: move the contents right by DX and
+//                                down by DY bytes (signed), bytes moved in are V
+// Bits 0-4 of X (X2) are the column, bit 7 selects buffer 2, Y (Y2) is
+// the row (0-63), W/H the size in bytes. Rectangles are clipped at the
+// edge of the grid, COPY works for overlapping rectangles.
+// Only sent to a Dazzler that reports FEAT_RECT.
+
+// DAZ_CHUNK sends a frame in slices that other commands (e.g. DAZ_DAC)
+// can be interleaved with:
+//   0xAB, OH, OL, NN, NN data bytes
+// Bit 3 of B selects the buffer (as for DAZ_FULLFRAME), bit 0 marks the
+// last slice of the frame. OH/OL is the 11-bit offset within the buffer,
+// NN the number of bytes (0 means 256), slices wrap around at the end of
+// the buffer. The first slice starts the frame as a copy of the buffer's
+// current contents, the slices only change that copy. The last slice
+// replaces the buffer contents with it at once, so the display never
+// shows a partial frame. Slices only need to cover what changed.
+// A slice for the other buffer drops an unfinished frame. Only sent to a
+// Dazzler that reports FEAT_CHUNK.
+#define DAZ_CHUNK_LAST    0x01
+#define DAZ_CHUNK_MAXSIZE (4+256)
+
+// DAZ_PING (0xB0, T0, T1, T2, T3) asks the Dazzler to send DAZ_PONG with
+// the same four bytes back as soon as it gets to the command. The bytes
+// are usually a timestamp of the computer, to measure round trip times.
+// Only sent to a Dazzler that reports FEAT_PING.
+
+// DAZ_FRAMED wraps a group of commands into a frame that is protected
+// by a sequence number and CRC:
+//   0xC0 or 0xC1, 0xA5, SS, NN, NN payload bytes, CH, CL
+// SS is the sequence number (incremented by one per frame), NN the payload
+// size (0 means 256), CH/CL the CRC-16 (see dazzler_crc.h) of all bytes
+// from the first one up to the end of the payload. The payload is just
+// a piece of the regular command stream, commands may be split across
+// frames. Bit 0 of the first byte (DAZ_FRAMED_START) starts a new
+// sequence: the Dazzler forgets any partially received command and
+// takes SS as the next expected sequence number.
+// Once a Dazzler that reports FEAT_FRAMED has seen a frame it ignores
+// everything outside of frames until re-connected and searches for the
+// next 0xC0/0xC1, 0xA5 marker after any error. It only processes frames
+// in sequence. If a frame is missing or damaged it discards the following
+// ones and sends DAZ_RESEND with the expected sequence number, the
+// computer then sends all frames again starting with that one (or, if
+// it can not, a DAZ_FRAMED_START frame that restores the full display
+// state). Sequence numbers are only 8 bits, so less than 128 frames may
+// be on the way to the Dazzler (including repeated ones) at any time.
+// For DAZ_CREDIT, a DAZ_VERSION inside a frame counts as sent at the end
+// of the frame.
+#define DAZ_FRAMED_SYNC    0xA5
+#define DAZ_FRAMED_START   0x01
+#define DAZ_FRAMED_MAXSIZE (4+256+2)
+
+// DAZ_STATE restores the complete display state in one command:
+//   0xDV, 0xA5, 0x5A, CC, PP, 4096 bytes of video memory (buffer 1, then 2)
+// V is the computer's version (as in its DAZ_VERSION command), CC the
+// control register, PP the picture control register. For DAZ_CREDIT it
+// counts like DAZ_VERSION (the Dazzler counts consumed bytes from the
+// video memory data on). The computer sends it when the Dazzler asks with
+// DAZ_STATE_REQUEST, at the next command boundary of its stream, and may
+// send it whenever it thinks the Dazzler lost track (e.g. after re-opening
+// its port). A Dazzler that asked skips everything up to the three header
+// bytes (or up to the 0xC1, 0xA5 of a DAZ_FRAMED_START frame, in framed
+// mode the state goes into a new frame sequence like any other command)
+// since what it receives first may be the rest of a command it lost the
+// start of. It gives up after DAZ_STATE_WAIT bytes. A DAZ_STATE with the
+// wrong sync bytes is ignored: its 5 header bytes are dropped and the
+// next byte is taken as a command.
+// Only sent to a Dazzler that reports FEAT_STATE.
+#define DAZ_STATE_SYNC1 0xA5
+#define DAZ_STATE_SYNC2 0x5A
+#define DAZ_STATE_SIZE  (5 + 2*DAZ_MEMSIZE)
+#define DAZ_STATE_WAIT  16384
+
+// dazzler commands sent to the Altair simulator
+#define DAZ_JOY1      0x10
+#define DAZ_JOY2      0x20
+#define DAZ_KEY       0x30
+#define DAZ_VSYNC     0x40
+#define DAZ_CREDIT    0x50
+#define DAZ_RESEND    0x60
+#define DAZ_PONG      0x70
+#define DAZ_STATE_REQUEST 0x80
+
+// DAZ_CREDIT (0x5H, LL) reports the number of bytes (mod 4096) the
+// Dazzler has taken out of its receive buffer since the computer's
+// DAZ_VERSION command. A computer may have at most DAZ_CREDIT_WINDOW
+// bytes sent but not yet reported, then it can never overrun the
+// Dazzler. Sent every DAZ_CREDIT_STEP bytes by a Dazzler that reports
+// FEAT_CREDIT, and only to computers of version 3 or later.
+#define DAZ_CREDIT_WINDOW 3840
+#define DAZ_CREDIT_STEP   256
+
+// DAZ_RESEND (0x60, SS) asks the computer to send the frames starting with
+// sequence number SS again (see DAZ_FRAMED). Repeated after 1, 2, 4, 8...
+// times DAZ_RESEND_REPEAT discarded frames in case it got lost.
+#define DAZ_RESEND_REPEAT 16
+
+// DAZ_STATE_REQUEST (0x8H, LL) asks the computer for DAZ_STATE. Sent by
+// a Dazzler whose connection was reset (e.g. USB re-plugged), which
+// drops whatever was in its receive buffer and may have missed commands
+// sent in the meantime, if the computer announced version 4 or later
+// before. H/LL is the 12-bit number of audio samples the Dazzler still
+// has queued (both channels), so the computer knows how much audio
+// survived the reset.
+
+// features
+#define FEAT_VIDEO    0x01
+#define FEAT_JOYSTICK 0x02
+#define FEAT_DUAL_BUF 0x04
+#define FEAT_VSYNC    0x08
+#define FEAT_DAC      0x10
+#define FEAT_KEYBOARD 0x20
+#define FEAT_FRAMEBUF 0x40
+#define FEAT_STATE    0x80
+
+// features reported in the third byte of the DAZ_VERSION reply
+// (the upper byte of the 16-bit feature set)
+#define FEAT_MEMBLOCK 0x0100
+#define FEAT_DELTA    0x0200
+#define FEAT_CREDIT   0x0400
+#define FEAT_FRAMED   0x0800
+#define FEAT_PING     0x1000
+#define FEAT_DACBURST 0x2000
+#define FEAT_RECT     0x4000
+#define FEAT_CHUNK    0x8000
+
+// computer/dazzler version
+#define DAZZLER_VERSION 0x02
+
+// size of one dazzler memory buffer (the display keeps two of them)
+#define DAZ_MEMSIZE   2048
+
+#endif
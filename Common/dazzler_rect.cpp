@@ -0,0 +1,147 @@
+// -----------------------------------------------------------------------------
+// Cromemco Dazzler emulation - rectangle fill, copy and scroll
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#include <string.h>
+#include "dazzler_rect.h"
+
+
+static void rect_read_row(const uint8_t *mem, int x, int y, int w, uint8_t *row)
+{
+  for(int c=0; c<w; c++)
+    row[c] = mem[dazzler_rect_addr(x+c, y)];
+}
+
+
+static void rect_write_row(dazzler_dirty *dirty, uint8_t *mem, int base, int x, int y, int w, const uint8_t *row)
+{
+  // at most two pieces: left and right quadrant
+  while( w>0 )
+    {
+      int n = (x<16 && x+w>16) ? 16-x : w;
+      dazzler_dirty_copy(dirty, mem, base+dazzler_rect_addr(x, y), row, n);
+      row += n;
+      x   += n;
+      w   -= n;
+    }
+}
+
+
+void dazzler_rect_execute(dazzler_dirty *dirty, uint8_t *mem, int op, const uint8_t *p)
+{
+  // destination rectangle
+  int db = (p[0] & 0x80) ? DAZ_MEMSIZE : 0;
+  int dx = p[0] & 31, dy = p[1] & 63;
+  int w  = p[2], h = p[3];
+
+  // source rectangle, each destination row r comes from source row r-sy
+  // shifted right by sx bytes (bytes from outside the source are "v")
+  int sb = db, sx = dx, sy = dy, shift_x = 0, shift_y = 0;
+  bool have_source = true;
+  uint8_t v = 0;
+
+  switch( op )
+    {
+    case 0: // FILL
+      v = p[4];
+      have_source = false;
+      break;
+
+    case 1: // COPY
+      sb = db; sx = dx; sy = dy;
+      db = (p[4] & 0x80) ? DAZ_MEMSIZE : 0;
+      dx = p[4] & 31; dy = p[5] & 63;
+      if( w > DAZ_RECT_COLS-sx ) w = DAZ_RECT_COLS-sx;
+      if( h > DAZ_RECT_ROWS-sy ) h = DAZ_RECT_ROWS-sy;
+      break;
+
+    case 2: // SCROLL
+      shift_x = (int8_t) p[4];
+      shift_y = (int8_t) p[5];
+      v = p[6];
+      break;
+
+    default:
+      return;
+    }
+
+  if( w > DAZ_RECT_COLS-dx ) w = DAZ_RECT_COLS-dx;
+  if( h > DAZ_RECT_ROWS-dy ) h = DAZ_RECT_ROWS-dy;
+  if( w<=0 || h<=0 ) return;
+
+  // go bottom up if a destination row could overwrite a source row
+  // that is still needed
+  bool up = have_source && sb==db && dy-sy+shift_y > 0;
+
+  uint8_t src[DAZ_RECT_COLS], row[DAZ_RECT_COLS];
+  for(int i=0; i<h; i++)
+    {
+      int r = up ? h-1-i : i;
+      int sr = r-shift_y;
+
+      memset(row, v, w);
+      if( have_source && sr>=0 && sr<h )
+        {
+          rect_read_row(mem+sb, sx, sy+sr, w, src);
+          int c0 = shift_x>0 ? shift_x : 0;
+          int c1 = shift_x<0 ? w+shift_x : w;
+          if( c1>c0 ) memcpy(row+c0, src+c0-shift_x, c1-c0);
+        }
+
+      rect_write_row(dirty, mem, db, dx, dy+r, w, row);
+    }
+}
+
+
+int dazzler_rect_fill(uint8_t *out, int buffer, int x, int y, int w, int h, uint8_t v)
+{
+  out[0] = DAZ_RECT | 0;
+  out[1] = (buffer ? 0x80 : 0) | x;
+  out[2] = y;
+  out[3] = w;
+  out[4] = h;
+  out[5] = v;
+  return 6;
+}
+
+
+int dazzler_rect_copy(uint8_t *out, int buffer, int x, int y, int w, int h, int buffer2, int x2, int y2)
+{
+  out[0] = DAZ_RECT | 1;
+  out[1] = (buffer ? 0x80 : 0) | x;
+  out[2] = y;
+  out[3] = w;
+  out[4] = h;
+  out[5] = (buffer2 ? 0x80 : 0) | x2;
+  out[6] = y2;
+  return 7;
+}
+
+
+int dazzler_rect_scroll(uint8_t *out, int buffer, int x, int y, int w, int h, int dx, int dy, uint8_t v)
+{
+  out[0] = DAZ_RECT | 2;
+  out[1] = (buffer ? 0x80 : 0) | x;
+  out[2] = y;
+  out[3] = w;
+  out[4] = h;
+  out[5] = (uint8_t) dx;
+  out[6] = (uint8_t) dy;
+  out[7] = v;
+  return 8;
+}
@@ -0,0 +1,54 @@
+// -----------------------------------------------------------------------------
+// Cromemco Dazzler emulation - rectangle fill, copy and scroll
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#ifndef DAZZLER_RECT_H
+#define DAZZLER_RECT_H
+
+#include <stdint.h>
+#include "dazzler_proto.h"
+#include "dazzler_dirty.h"
+
+// DAZ_RECT sees each memory buffer as a grid of 32x64 bytes: four
+// quadrants of 16 columns by 32 rows (top left, top right, bottom left,
+// bottom right, as the display scans them). A rectangle of bytes may
+// span quadrants. A 512-byte buffer is the top left quadrant.
+#define DAZ_RECT_COLS 32
+#define DAZ_RECT_ROWS 64
+
+// largest DAZ_RECT command (SCROLL)
+#define DAZ_RECT_MAXSIZE 8
+
+// offset within a buffer of the byte in column x, row y
+inline int dazzler_rect_addr(int x, int y)
+{
+  return (y&31)*16 + (x&15) + ((x&16) ? 512 : 0) + ((y&32) ? 1024 : 0);
+}
+
+// Execute DAZ_RECT operation "op" (lower 4 bits of the command byte) with
+// parameters "p" (the bytes following the command byte) on video memory
+// "mem" (both buffers), marking the bytes that changed in "dirty".
+void dazzler_rect_execute(dazzler_dirty *dirty, uint8_t *mem, int op, const uint8_t *p);
+
+// Encode DAZ_RECT commands into "out" (DAZ_RECT_MAXSIZE bytes), return
+// the command size. "buffer" is 0 or 1, x/y/w/h in bytes of the grid.
+int dazzler_rect_fill(uint8_t *out, int buffer, int x, int y, int w, int h, uint8_t v);
+int dazzler_rect_copy(uint8_t *out, int buffer, int x, int y, int w, int h, int buffer2, int x2, int y2);
+int dazzler_rect_scroll(uint8_t *out, int buffer, int x, int y, int w, int h, int dx, int dy, uint8_t v);
+
+#endif
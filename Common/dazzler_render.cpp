@@ -0,0 +1,257 @@
+// -----------------------------------------------------------------------------
+// Cromemco Dazzler emulation - CPU framebuffer renderer
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#include <string.h>
+#include "dazzler_render.h"
+
+
+// bit masks for the pixels of a 4x2 block in x4 resolution mode
+// (same bit order as in the PIC32 firmware's get_pixel_128x128)
+static const uint8_t x4_bitmasks[2][4] = {{0x01, 0x02, 0x10, 0x20}, {0x04, 0x08, 0x40, 0x80}};
+
+
+void dazzler_render_palette(uint32_t palette[32])
+{
+  static const uint8_t colors[16][3] =
+    {{0x00,0x00,0x00}, {0x80,0x00,0x00}, {0x00,0x80,0x00}, {0x80,0x80,0x00},
+     {0x00,0x00,0x80}, {0x80,0x00,0x80}, {0x00,0x80,0x80}, {0x80,0x80,0x80},
+     {0x00,0x00,0x00}, {0xff,0x00,0x00}, {0x00,0xff,0x00}, {0xff,0xff,0x00},
+     {0x00,0x00,0xff}, {0xff,0x00,0xff}, {0x00,0xff,0xff}, {0xff,0xff,0xff}};
+
+  for(int i=0; i<16; i++)
+    {
+      palette[i]    = DAZ_RGBA(17*i, 17*i, 17*i);
+      palette[16+i] = DAZ_RGBA(colors[i][0], colors[i][1], colors[i][2]);
+    }
+}
+
+
+void dazzler_render_init(dazzler_renderer *r)
+{
+  dazzler_render_palette(&r->palette[0][0]);
+
+  r->lut_pc        = -1;
+  r->x4            = dazzler_x4_select();
+  r->cells_redrawn = 0;
+  r->dirty_y0      = 0;
+  r->dirty_y1      = 0;
+}
+
+
+void dazzler_render_use_bgra(dazzler_renderer *r)
+{
+  for(int p=0; p<2; p++)
+    for(int i=0; i<16; i++)
+      {
+        uint32_t c = r->palette[p][i];
+        r->palette[p][i] = (c & 0xFF00FF00u) | ((c >> 16) & 0xFF) | ((c & 0xFF) << 16);
+      }
+
+  r->lut_pc = -1;
+}
+
+
+void dazzler_render_set_mode(dazzler_renderer *r, uint8_t pc)
+{
+  const uint32_t *palette = r->palette[(pc & 0x10) ? 1 : 0];
+
+  // 2k memory => 4x2 pixels per byte, 512 bytes => 8x4 pixels per byte
+  int s = (pc & 0x20) ? 1 : 2;
+  r->block_w = 4*s;
+  r->block_h = 2*s;
+
+  for(int b=0; b<256; b++)
+    {
+      uint32_t *block = r->lut[b];
+      for(int y=0; y<r->block_h; y++)
+        for(int x=0; x<r->block_w; x++)
+          {
+            uint32_t c;
+            if( pc & 0x40 )
+              {
+                // 4x resolution, common color
+                c = (b & x4_bitmasks[y/s][x/s]) ? palette[pc & 0x0f] : palette[0];
+              }
+            else
+              {
+                // normal resolution, individual color (low nibble is left pixel)
+                c = palette[(x < 2*s) ? (b & 0x0f) : (b >> 4)];
+              }
+
+            block[y*r->block_w + x] = c;
+          }
+    }
+
+  r->lut_pc = pc;
+}
+
+
+static inline void render_block(const dazzler_renderer *r, uint8_t b, uint32_t *out, int stride)
+{
+  const uint32_t *block = r->lut[b];
+  for(int y=0; y<r->block_h; y++)
+    memcpy(out+y*stride, block+y*r->block_w, r->block_w*sizeof(uint32_t));
+}
+
+
+static void render_quadrant(const dazzler_renderer *r, const uint8_t *mem, uint32_t *out, int stride)
+{
+  // one quadrant (or the full screen for 512 byte memory) is 32 rows of 16 bytes
+  int bw = r->block_w, bh = r->block_h;
+  for(int row=0; row<32; row++)
+    {
+      uint32_t *line = out + row*bh*stride;
+      for(int col=0; col<16; col++)
+        {
+          const uint32_t *block = r->lut[*mem++];
+          if( bw==4 )
+            {
+              memcpy(line,        block,   4*sizeof(uint32_t));
+              memcpy(line+stride, block+4, 4*sizeof(uint32_t));
+            }
+          else
+            {
+              for(int y=0; y<bh; y++)
+                memcpy(line+y*stride, block+y*bw, 8*sizeof(uint32_t));
+            }
+          line += bw;
+        }
+    }
+}
+
+
+void dazzler_render_frame(dazzler_renderer *r, const uint8_t *mem, uint8_t pc, uint32_t *out, int stride)
+{
+  r->cells_redrawn = (pc & 0x20) ? 2048 : 512;
+  r->dirty_y0      = 0;
+  r->dirty_y1      = DAZ_HEIGHT;
+
+  if( (pc & 0x60)==0x60 )
+    {
+      // 2k memory, x4 resolution => expand whole frame in one pass
+      const uint32_t *palette = r->palette[(pc & 0x10) ? 1 : 0];
+      r->x4->expand_rgba(mem, palette[pc & 0x0f], palette[0], out, stride);
+      return;
+    }
+
+  if( r->lut_pc!=pc ) dazzler_render_set_mode(r, pc);
+
+  if( pc & 0x20 )
+    {
+      // 2k memory => render the four quadrants
+      render_quadrant(r, mem,          out,                 stride);
+      render_quadrant(r, mem + 0x200,  out + 64,            stride);
+      render_quadrant(r, mem + 0x400,  out + 64*stride,     stride);
+      render_quadrant(r, mem + 0x600,  out + 64*stride+64,  stride);
+    }
+  else
+    render_quadrant(r, mem, out, stride);
+}
+
+
+int dazzler_render_update(dazzler_renderer *r, const uint8_t *mem, uint8_t pc,
+                          const uint32_t dirty[DAZ_DIRTY_WORDS], uint32_t *out, int stride)
+{
+  // 512 byte memory only shows the first 512 bytes of the buffer
+  int nwords = (pc & 0x20) ? DAZ_DIRTY_WORDS : 512/32;
+
+  int n = 0;
+  for(int w=0; w<nwords; w++)
+    {
+      // count set bits
+      uint32_t v = dirty[w];
+      while( v ) { v &= v-1; n++; }
+    }
+
+  // if more than half of the cells changed then a full render is cheaper
+  // (especially in x4 mode where the full render uses SIMD kernels)
+  if( 2*n > nwords*32 )
+    {
+      dazzler_render_frame(r, mem, pc, out, stride);
+      return r->cells_redrawn;
+    }
+
+  if( r->lut_pc!=pc ) dazzler_render_set_mode(r, pc);
+
+  int y0 = DAZ_HEIGHT, y1 = 0;
+  for(int w=0; w<nwords; w++)
+    for(uint32_t v=dirty[w]; v; v &= v-1)
+      {
+        int bit = 0;
+        while( !(v & (1u<<bit)) ) bit++;
+        int a = w*32 + bit;
+
+        // quadrant => 64x64 pixel area for 2k memory, full screen for 512 bytes
+        int q = a >> 9, i = a & 0x1ff;
+        int x = (q & 1)*64 + (i & 15)*r->block_w;
+        int y = (q >> 1)*64 + (i >> 4)*r->block_h;
+
+        render_block(r, mem[a], out + y*stride + x, stride);
+        if( y<y0 ) y0 = y;
+        if( y+r->block_h>y1 ) y1 = y+r->block_h;
+      }
+
+  r->cells_redrawn = n;
+  r->dirty_y0      = n>0 ? y0 : 0;
+  r->dirty_y1      = n>0 ? y1 : 0;
+  return n;
+}
+
+
+void dazzler_render_indexed(dazzler_renderer *r, const uint8_t *mem, uint8_t pc, uint8_t *out)
+{
+  uint8_t base = (pc & 0x10) ? 16 : 0;
+
+  if( (pc & 0x60)==0x60 )
+    {
+      // 2k memory, x4 resolution (cleared pixels are black in both palettes)
+      r->x4->expand_indexed(mem, base + (pc & 0x0f), out);
+      return;
+    }
+
+  // 2k memory => 4x2 pixels per byte, 512 bytes => 8x4 pixels per byte
+  int s = (pc & 0x20) ? 1 : 2;
+  int n = (pc & 0x20) ? 2048 : 512;
+  for(int a=0; a<n; a++)
+    {
+      int q = a >> 9, i = a & 0x1ff;
+      uint8_t *block = out + ((q >> 1)*64 + (i >> 4)*2*s)*DAZ_WIDTH + (q & 1)*64 + (i & 15)*4*s;
+      uint8_t b = mem[a];
+
+      for(int y=0; y<2*s; y++)
+        for(int x=0; x<4*s; x++)
+          {
+            uint8_t c;
+            if( pc & 0x40 )
+              c = (b & x4_bitmasks[y/s][x/s]) ? base + (pc & 0x0f) : 0;
+            else
+              c = base + ((x < 2*s) ? (b & 0x0f) : (b >> 4));
+
+            block[y*DAZ_WIDTH + x] = c;
+          }
+    }
+}
+
+
+void dazzler_render_clear(uint32_t *out, int stride)
+{
+  for(int y=0; y<DAZ_HEIGHT; y++)
+    for(int x=0; x<DAZ_WIDTH; x++)
+      out[y*stride+x] = DAZ_RGBA(0, 0, 0);
+}
@@ -0,0 +1,89 @@
+// -----------------------------------------------------------------------------
+// Cromemco Dazzler emulation - CPU framebuffer renderer
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#ifndef DAZZLER_RENDER_H
+#define DAZZLER_RENDER_H
+
+#include <stdint.h>
+#include "dazzler_x4.h"
+#include "dazzler_dirty.h"
+
+// size of the rendered picture in pixels
+#define DAZ_WIDTH  128
+#define DAZ_HEIGHT 128
+
+// packed RGBA8888 pixel (bytes in memory are R,G,B,A on little-endian machines)
+#define DAZ_RGBA(r, g, b) ((uint32_t) (r) | ((uint32_t) (g) << 8) | ((uint32_t) (b) << 16) | 0xFF000000u)
+
+// The renderer turns Dazzler video memory into a 128x128 RGBA picture.
+// Each memory byte becomes a block of pixels whose size depends on the
+// memory size (4x2 pixels for 2K, 8x4 pixels for 512 bytes). The blocks
+// for all 256 byte values are precomputed whenever the picture control
+// register changes, so rendering a frame is just a series of block copies.
+// The x4 resolution 2K mode is expanded by the fastest SIMD kernel the
+// CPU supports instead.
+struct dazzler_renderer
+{
+  uint32_t palette[2][16];   // [0]=grayscale, [1]=color
+  const dazzler_x4_kernel *x4;
+
+  int      lut_pc;           // picture control the table was built for (-1=none)
+  int      block_w, block_h; // size in pixels of the block for one memory byte
+  uint32_t lut[256][32];     // byte value -> block_h rows of block_w pixels
+
+  // result of the last dazzler_render_frame/dazzler_render_update call
+  int      cells_redrawn;    // number of memory bytes that were expanded
+  int      dirty_y0, dirty_y1; // rows [dirty_y0, dirty_y1) of "out" that changed
+};
+
+
+void dazzler_render_init(dazzler_renderer *r);
+
+// get the standard RGBA palette (0-15 grayscale, 16-31 color), the same
+// as r->palette after dazzler_render_init
+void dazzler_render_palette(uint32_t palette[32]);
+
+// (re-)build the byte-to-block table for the given picture control value
+// (called automatically by dazzler_render_frame when necessary)
+void dazzler_render_set_mode(dazzler_renderer *r, uint8_t picture_ctrl);
+
+// render one buffer (2048 bytes) of video memory into "out" which must hold
+// 128 rows of "stride" pixels (stride>=128)
+void dazzler_render_frame(dazzler_renderer *r, const uint8_t *mem, uint8_t picture_ctrl,
+                          uint32_t *out, int stride);
+
+// re-render only the memory bytes whose bit is set in "dirty" (as returned
+// by dazzler_dirty_take for this buffer). "out" must hold the picture
+// rendered from the same buffer in the same mode before. Falls back to
+// dazzler_render_frame if most of the memory changed. Returns the number
+// of cells redrawn (also in r->cells_redrawn).
+int dazzler_render_update(dazzler_renderer *r, const uint8_t *mem, uint8_t picture_ctrl,
+                          const uint32_t dirty[DAZ_DIRTY_WORDS], uint32_t *out, int stride);
+
+// render one buffer into 128x128 palette indices ("out" holds 128*128 bytes),
+// indices 0-15 select r->palette[0] (grayscale), 16-31 r->palette[1] (color)
+void dazzler_render_indexed(dazzler_renderer *r, const uint8_t *mem, uint8_t picture_ctrl, uint8_t *out);
+
+// produce B,G,R,A byte order instead of R,G,B,A (as used by Direct2D bitmaps)
+void dazzler_render_use_bgra(dazzler_renderer *r);
+
+// fill the picture with black (used when the Dazzler is turned off)
+void dazzler_render_clear(uint32_t *out, int stride);
+
+#endif
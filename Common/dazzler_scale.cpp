@@ -0,0 +1,139 @@
+// -----------------------------------------------------------------------------
+// Cromemco Dazzler emulation - integer scaling of the rendered picture
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#include <string.h>
+#include "dazzler_scale.h"
+
+
+static void build_runs(dazzler_scaler *sc)
+{
+  for(int c=0; c<32; c++)
+    for(int i=0; i<DAZ_SCALE_MAX; i++)
+      sc->runs[c][i] = sc->palette[c];
+}
+
+
+void dazzler_scale_init(dazzler_scaler *sc, const uint32_t palette[32])
+{
+  memcpy(sc->palette, palette, sizeof(sc->palette));
+  build_runs(sc);
+
+  sc->out_w = sc->out_h = -1;
+  sc->aspect = -1;
+  sc->sx = sc->sy = 1;
+  sc->x0 = sc->y0 = 0;
+  sc->w  = sc->h  = 0;
+}
+
+
+static int clamp_scale(int s)
+{
+  return s<1 ? 1 : (s>DAZ_SCALE_MAX ? DAZ_SCALE_MAX : s);
+}
+
+
+bool dazzler_scale_set_geometry(dazzler_scaler *sc, int out_w, int out_h, int aspect)
+{
+  if( out_w==sc->out_w && out_h==sc->out_h && aspect==sc->aspect )
+    return false;
+
+  int fx = out_w / DAZ_WIDTH, fy = out_h / DAZ_HEIGHT;
+  switch( aspect )
+    {
+    case DAZ_ASPECT_WIN:
+      sc->sx = clamp_scale(fx);
+      sc->sy = clamp_scale(fy);
+      break;
+
+    case DAZ_ASPECT_43:
+      {
+        // largest sy for which the rounded 4:3 width still fits
+        sc->sx = sc->sy = 1;
+        for(int sy=DAZ_SCALE_MAX; sy>1; sy--)
+          {
+            int sx = (sy*4+1)/3;
+            if( sx<=DAZ_SCALE_MAX && sx<=fx && sy<=fy ) { sc->sx = sx; sc->sy = sy; break; }
+          }
+        break;
+      }
+
+    default:
+      sc->sx = sc->sy = clamp_scale(fx<fy ? fx : fy);
+      break;
+    }
+
+  // center the picture, clip it if the output is smaller than 128x128
+  sc->w  = DAZ_WIDTH*sc->sx;
+  sc->h  = DAZ_HEIGHT*sc->sy;
+  sc->x0 = sc->w<out_w ? (out_w-sc->w)/2 : 0;
+  sc->y0 = sc->h<out_h ? (out_h-sc->h)/2 : 0;
+  if( sc->w>out_w ) sc->w = out_w;
+  if( sc->h>out_h ) sc->h = out_h;
+
+  sc->out_w  = out_w;
+  sc->out_h  = out_h;
+  sc->aspect = aspect;
+  return true;
+}
+
+
+void dazzler_scale_rows(const dazzler_scaler *sc, const uint8_t *src, int y0, int y1,
+                        uint32_t *out, int stride)
+{
+  int sx = sc->sx, sy = sc->sy;
+  int cols = sc->w / sx;                  // source columns that are fully visible
+  int rest = sc->w - cols*sx;             // output pixels of a partially visible column
+  size_t run_bytes = sx*sizeof(uint32_t);
+
+  for(int y=y0; y<y1; y++)
+    {
+      int oy = y*sy;
+      if( oy>=sc->h ) break;
+
+      // column replication: one run of sx pixels per source pixel
+      const uint8_t *s = src + y*DAZ_WIDTH;
+      uint32_t *first = out + (sc->y0+oy)*stride + sc->x0, *d = first;
+      for(int x=0; x<cols; x++, d += sx)
+        memcpy(d, sc->runs[s[x] & 31], run_bytes);
+      if( rest>0 )
+        memcpy(d, sc->runs[s[cols] & 31], rest*sizeof(uint32_t));
+
+      // row replication
+      int n = oy+sy<=sc->h ? sy : sc->h-oy;
+      for(int i=1; i<n; i++)
+        memcpy(first + i*stride, first, sc->w*sizeof(uint32_t));
+    }
+}
+
+
+void dazzler_scale_borders(const dazzler_scaler *sc, uint32_t *out, int stride)
+{
+  uint32_t black = DAZ_RGBA(0, 0, 0);
+  for(int y=0; y<sc->out_h; y++)
+    {
+      uint32_t *line = out + y*stride;
+      if( y<sc->y0 || y>=sc->y0+sc->h )
+        for(int x=0; x<sc->out_w; x++) line[x] = black;
+      else
+        {
+          for(int x=0; x<sc->x0; x++) line[x] = black;
+          for(int x=sc->x0+sc->w; x<sc->out_w; x++) line[x] = black;
+        }
+    }
+}
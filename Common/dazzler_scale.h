@@ -0,0 +1,69 @@
+// -----------------------------------------------------------------------------
+// Cromemco Dazzler emulation - integer scaling of the rendered picture
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#ifndef DAZZLER_SCALE_H
+#define DAZZLER_SCALE_H
+
+#include <stdint.h>
+#include "dazzler_render.h"
+
+// pixel aspect ratio settings (same values as the Windows client's settings)
+#define DAZ_ASPECT_11  0   // square pixels
+#define DAZ_ASPECT_43  1   // pixels 4:3 wider than high
+#define DAZ_ASPECT_WIN 2   // horizontal and vertical scale chosen independently
+
+#define DAZ_SCALE_MAX 16
+
+// The scaler places the 128x128 picture into an output area of any size,
+// scaled by whole numbers (nearest neighbour, 1x up to 16x in each
+// direction) and centered with black borders. The geometry is only
+// recomputed if the output size or aspect setting changes. Scaling is
+// done from the indexed picture (see dazzler_render_indexed): each source
+// row is expanded once using precomputed runs of sx pixels per color and
+// then copied sy-1 times.
+struct dazzler_scaler
+{
+  // geometry (valid after dazzler_scale_set_geometry)
+  int out_w, out_h, aspect;  // output area and setting the geometry is for
+  int sx, sy;                // size of one Dazzler pixel in output pixels
+  int x0, y0;                // top left corner of the picture in the output
+  int w, h;                  // visible size of the picture (clipped to output)
+
+  // column replication: palette index -> sx pixels
+  uint32_t runs[32][DAZ_SCALE_MAX];
+  uint32_t palette[32];
+};
+
+
+void dazzler_scale_init(dazzler_scaler *sc, const uint32_t palette[32]);
+
+// compute the geometry for an output area of out_w x out_h pixels,
+// returns false (and does nothing) if the geometry did not change
+bool dazzler_scale_set_geometry(dazzler_scaler *sc, int out_w, int out_h, int aspect);
+
+// scale rows y0..y1-1 of the indexed picture "src" (128x128 bytes) into
+// "out" (out_h rows of "stride" pixels)
+void dazzler_scale_rows(const dazzler_scaler *sc, const uint8_t *src, int y0, int y1,
+                        uint32_t *out, int stride);
+
+// fill the area outside of the picture with black (only needed after
+// the geometry changed)
+void dazzler_scale_borders(const dazzler_scaler *sc, uint32_t *out, int stride);
+
+#endif
@@ -0,0 +1,120 @@
+// -----------------------------------------------------------------------------
+// Cromemco Dazzler emulation - video frame pacing and frame time statistics
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#include <string.h>
+#include "dazzler_sched.h"
+
+#define WINDOW_US 1000000
+
+
+void dazzler_sched_init(dazzler_sched *s, int rate)
+{
+  memset(s, 0, sizeof(dazzler_sched));
+  dazzler_sched_set_rate(s, rate);
+}
+
+
+void dazzler_sched_set_rate(dazzler_sched *s, int rate)
+{
+  s->rate = rate;
+  if( rate==DAZ_SCHED_GRID )
+    s->period_us = DAZ_VSYNC_PERIOD_US;
+  else if( rate>0 )
+    s->period_us = 1000000 / rate;
+  else
+    s->period_us = 0;
+}
+
+
+uint32_t dazzler_sched_wait_us(const dazzler_sched *s, uint64_t now_us)
+{
+  if( s->period_us==0 || s->last_us==0 ) return 0;
+
+  uint64_t next = s->last_us + s->period_us;
+  if( s->rate==DAZ_SCHED_GRID )
+    {
+      // next grid point at or after both "now" and one period after the last frame
+      uint64_t t = next>now_us ? next : now_us;
+      next = (t + s->period_us - 1) / s->period_us * s->period_us;
+    }
+
+  return next>now_us ? (uint32_t) (next-now_us) : 0;
+}
+
+
+static uint32_t percentile(const uint32_t *hist, int frames, int pct)
+{
+  int n = (frames*pct + 99) / 100, sum = 0;
+  for(int i=0; i<DAZ_SCHED_BUCKETS; i++)
+    {
+      sum += hist[i];
+      if( sum>=n ) return (i+1)*DAZ_SCHED_BUCKET_US;
+    }
+
+  return DAZ_SCHED_BUCKETS*DAZ_SCHED_BUCKET_US;
+}
+
+
+void dazzler_sched_frame(dazzler_sched *s, uint64_t start_us, uint64_t end_us)
+{
+  // in GRID mode remember the grid point this frame belongs to so
+  // late wakeups do not shift the grid
+  if( s->rate==DAZ_SCHED_GRID )
+    s->last_us = start_us - start_us % s->period_us;
+  else
+    s->last_us = start_us;
+
+  uint32_t t = (uint32_t) (end_us-start_us);
+  int b = t / DAZ_SCHED_BUCKET_US;
+  s->hist[b<DAZ_SCHED_BUCKETS ? b : DAZ_SCHED_BUCKETS-1]++;
+  if( t>s->window_max_us ) s->window_max_us = t;
+  s->window_frames++;
+
+  if( s->window_start_us==0 )
+    s->window_start_us = start_us;
+  else if( end_us-s->window_start_us >= WINDOW_US )
+    {
+      dazzler_sched_stats st;
+      st.end_us = end_us;
+      st.frames = s->window_frames;
+      st.fps    = s->window_frames * 1e6 / (double) (end_us-s->window_start_us);
+      // percentiles are bucket upper bounds, never report more than the maximum
+      st.p50_us = percentile(s->hist, s->window_frames, 50);
+      st.p99_us = percentile(s->hist, s->window_frames, 99);
+      if( st.p50_us>s->window_max_us ) st.p50_us = s->window_max_us;
+      if( st.p99_us>s->window_max_us ) st.p99_us = s->window_max_us;
+      st.max_us = s->window_max_us;
+      s->stats  = st;
+
+      s->window_start_us = end_us;
+      s->window_frames   = 0;
+      s->window_max_us   = 0;
+      memset(s->hist, 0, sizeof(s->hist));
+    }
+}
+
+
+void dazzler_sched_get_stats(const dazzler_sched *s, uint64_t now_us, dazzler_sched_stats *stats)
+{
+  *stats = s->stats;
+
+  // if nothing was drawn for a while then the frame rate is zero
+  if( now_us - stats->end_us > 2*WINDOW_US && now_us - s->last_us > WINDOW_US )
+    memset(stats, 0, sizeof(dazzler_sched_stats));
+}
@@ -0,0 +1,83 @@
+// -----------------------------------------------------------------------------
+// Cromemco Dazzler emulation - video frame pacing and frame time statistics
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#ifndef DAZZLER_SCHED_H
+#define DAZZLER_SCHED_H
+
+#include <stdint.h>
+
+// refresh rate settings (anything else is a rate in Hz)
+#define DAZ_SCHED_UNLIMITED  0    // draw as soon as new data arrives
+#define DAZ_SCHED_GRID      -1    // draw on a fixed ~60.3Hz grid (DAZ_VSYNC_PERIOD_US)
+
+// frame period of the PIC32 firmware's VGA output
+// (630 lines at 37854Hz = 16.59ms, i.e. ~60.3Hz), DAZ_VSYNC is sent at this rate
+#define DAZ_VSYNC_PERIOD_US 16590
+
+// render time histogram: 100us buckets, the last one collects everything longer
+#define DAZ_SCHED_BUCKET_US 100
+#define DAZ_SCHED_BUCKETS   256
+
+// statistics over one window of (about) one second
+struct dazzler_sched_stats
+{
+  uint64_t end_us;          // time the window ended
+  int      frames;          // frames drawn in the window
+  double   fps;
+  uint32_t p50_us, p99_us, max_us; // render time percentiles
+};
+
+
+// The scheduler does not sleep itself, it tells the video thread how long
+// to wait before drawing the next frame so that frames are drawn at most
+// at the target rate (or on a fixed grid in GRID mode). The video thread
+// only wakes up at all if there is something new to draw.
+struct dazzler_sched
+{
+  int      rate;            // DAZ_SCHED_UNLIMITED, DAZ_SCHED_GRID or Hz
+  uint32_t period_us;
+  uint64_t last_us;         // start time of the last frame (0=none)
+
+  // current statistics window
+  uint64_t window_start_us;
+  int      window_frames;
+  uint32_t window_max_us;
+  uint32_t hist[DAZ_SCHED_BUCKETS];
+
+  // statistics of the last complete window
+  dazzler_sched_stats stats;
+};
+
+
+void dazzler_sched_init(dazzler_sched *s, int rate);
+
+// change the refresh rate setting
+void dazzler_sched_set_rate(dazzler_sched *s, int rate);
+
+// microseconds to wait from "now_us" before the next frame may be drawn (0=now)
+uint32_t dazzler_sched_wait_us(const dazzler_sched *s, uint64_t now_us);
+
+// a frame was drawn, rendering started at start_us and ended at end_us
+void dazzler_sched_frame(dazzler_sched *s, uint64_t start_us, uint64_t end_us);
+
+// get the statistics of the last complete window (all zero if no frame
+// was drawn recently)
+void dazzler_sched_get_stats(const dazzler_sched *s, uint64_t now_us, dazzler_sched_stats *stats);
+
+#endif
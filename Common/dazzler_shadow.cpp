@@ -0,0 +1,94 @@
+// -----------------------------------------------------------------------------
+// Cromemco Dazzler emulation - shadow of the Dazzler's video memory
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#include <string.h>
+#include "dazzler_shadow.h"
+
+
+void dazzler_shadow_init(dazzler_shadow *s, const uint8_t *mem)
+{
+  memset(s, 0, sizeof(dazzler_shadow));
+  memcpy(s->mem, mem, 2*DAZ_MEMSIZE);
+}
+
+
+void dazzler_shadow_write(dazzler_shadow *s, int addr, uint8_t value)
+{
+  addr &= 2*DAZ_MEMSIZE-1;
+  s->num_writes++;
+
+  if( s->pending[addr] )
+    {
+      // only the last value before the flush counts
+      s->value[addr] = value;
+      s->num_coalesced++;
+    }
+  else if( s->mem[addr]==value )
+    s->num_suppressed++;
+  else
+    {
+      s->value[addr] = value;
+      s->pending[addr] = true;
+      s->order[s->num_pending++] = addr;
+    }
+}
+
+
+int dazzler_shadow_flush(dazzler_shadow *s, uint8_t *out)
+{
+  int n = 0;
+  for(int i=0; i<s->num_pending; i++)
+    {
+      int addr = s->order[i];
+      if( !s->pending[addr] ) continue;
+      s->pending[addr] = false;
+
+      if( s->value[addr]!=s->mem[addr] )
+        {
+          s->mem[addr] = s->value[addr];
+          out[n++] = DAZ_MEMBYTE | (addr >> 8);
+          out[n++] = addr & 0xFF;
+          out[n++] = s->value[addr];
+          s->num_sent++;
+        }
+      else
+        {
+          // changed back to what the Dazzler has
+          s->num_suppressed++;
+        }
+    }
+
+  s->num_pending = 0;
+  return n;
+}
+
+
+void dazzler_shadow_set(dazzler_shadow *s, int addr, const uint8_t *data, int len)
+{
+  for(int i=0; i<len; i++)
+    {
+      int a = (addr+i) & (2*DAZ_MEMSIZE-1);
+      s->mem[a] = data[i];
+      if( s->pending[a] )
+        {
+          s->pending[a] = false;
+          s->num_coalesced++;
+        }
+    }
+}
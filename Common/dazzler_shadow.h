@@ -0,0 +1,72 @@
+// -----------------------------------------------------------------------------
+// Cromemco Dazzler emulation - shadow of the Dazzler's video memory
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#ifndef DAZZLER_SHADOW_H
+#define DAZZLER_SHADOW_H
+
+#include <stdint.h>
+#include "dazzler_proto.h"
+
+// Computer side: a copy of what the Dazzler's two buffers hold, so that
+// writes into the computer's video memory only become DAZ_MEMBYTE
+// commands if they change something. Writes are collected until
+// dazzler_shadow_flush (at every DAZ_VSYNC period), several writes to
+// the same byte in between only send the last value, and none at all if
+// that is the value the Dazzler already has (e.g. a sprite erased and
+// drawn again at the same place). Flush before sending any other
+// command that depends on video memory (e.g. a DAZ_CTRL buffer switch).
+
+// largest possible output of dazzler_shadow_flush
+#define DAZ_SHADOW_MAXFLUSH (3*2*DAZ_MEMSIZE)
+
+struct dazzler_shadow
+{
+  uint8_t  mem[2*DAZ_MEMSIZE];      // what the Dazzler has
+  uint8_t  value[2*DAZ_MEMSIZE];    // last value written since the last flush
+  bool     pending[2*DAZ_MEMSIZE];  // byte was written since the last flush
+  uint16_t order[2*DAZ_MEMSIZE];    // pending addresses, in order of first write
+  int      num_pending;
+
+  // statistics (num_writes = num_suppressed + num_coalesced + num_sent
+  // + writes still pending)
+  uint64_t num_writes;              // dazzler_shadow_write calls
+  uint64_t num_suppressed;          // writes of the value the Dazzler already had
+  uint64_t num_coalesced;           // writes replaced by a later one (or by
+                                    // dazzler_shadow_set) before the flush
+  uint64_t num_sent;                // DAZ_MEMBYTE commands sent
+};
+
+
+// "mem" is what the Dazzler's buffers hold now (2*DAZ_MEMSIZE bytes),
+// e.g. after sending both as DAZ_FULLFRAME
+void dazzler_shadow_init(dazzler_shadow *s, const uint8_t *mem);
+
+// the computer wrote "value" to video memory address "addr" (0..4095)
+void dazzler_shadow_write(dazzler_shadow *s, int addr, uint8_t value);
+
+// Write DAZ_MEMBYTE commands for all pending changes to "out" (room for
+// DAZ_SHADOW_MAXFLUSH bytes) and take them into the copy. Returns the
+// number of bytes written.
+int dazzler_shadow_flush(dazzler_shadow *s, uint8_t *out);
+
+// "len" bytes starting at "addr" were sent to the Dazzler some other way
+// (DAZ_FULLFRAME, DAZ_MEMBLOCK...), pending writes there are dropped
+void dazzler_shadow_set(dazzler_shadow *s, int addr, const uint8_t *data, int len);
+
+#endif
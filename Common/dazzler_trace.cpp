@@ -0,0 +1,121 @@
+// -----------------------------------------------------------------------------
+// Cromemco Dazzler emulation - protocol trace files
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#include <string.h>
+#include "dazzler_trace.h"
+
+
+static int put_varint(uint8_t *buf, uint64_t v)
+{
+  int n = 0;
+  while( v>=0x80 )
+    {
+      buf[n++] = (uint8_t) (v | 0x80);
+      v >>= 7;
+    }
+
+  buf[n++] = (uint8_t) v;
+  return n;
+}
+
+
+static bool get_varint(dazzler_trace_reader *r, uint64_t *v)
+{
+  *v = 0;
+  for(int shift=0; shift<64; shift+=7)
+    {
+      if( r->p>=r->end ) return false;
+      uint8_t b = *r->p++;
+      *v |= (uint64_t) (b & 0x7F) << shift;
+      if( !(b & 0x80) ) return true;
+    }
+
+  return false;
+}
+
+
+bool dazzler_trace_start(dazzler_trace_writer *w, FILE *f, uint64_t now_us)
+{
+  w->f           = f;
+  w->last_us     = now_us;
+  w->num_records = 0;
+  w->num_bytes   = 0;
+  return fwrite(DAZ_TRACE_MAGIC, 1, DAZ_TRACE_MAGIC_LEN, f)==DAZ_TRACE_MAGIC_LEN;
+}
+
+
+void dazzler_trace_write(dazzler_trace_writer *w, uint64_t now_us, const uint8_t *data, int size)
+{
+  if( w->f==NULL || size<=0 ) return;
+
+  uint8_t hdr[20];
+  int n = put_varint(hdr, now_us>w->last_us ? now_us-w->last_us : 0);
+  n += put_varint(hdr+n, size);
+  fwrite(hdr, 1, n, w->f);
+  fwrite(data, 1, size, w->f);
+
+  w->last_us = now_us;
+  w->num_records++;
+  w->num_bytes += size;
+}
+
+
+void dazzler_trace_stop(dazzler_trace_writer *w)
+{
+  if( w->f!=NULL ) fclose(w->f);
+  w->f = NULL;
+}
+
+
+bool dazzler_trace_is_trace(const uint8_t *data, size_t size)
+{
+  return size>=DAZ_TRACE_MAGIC_LEN && memcmp(data, DAZ_TRACE_MAGIC, DAZ_TRACE_MAGIC_LEN)==0;
+}
+
+
+bool dazzler_trace_open(dazzler_trace_reader *r, const uint8_t *data, size_t size)
+{
+  if( !dazzler_trace_is_trace(data, size) ) return false;
+
+  r->data = data;
+  r->end  = data+size;
+  dazzler_trace_rewind(r);
+  return true;
+}
+
+
+void dazzler_trace_rewind(dazzler_trace_reader *r)
+{
+  r->p       = r->data + DAZ_TRACE_MAGIC_LEN;
+  r->time_us = 0;
+}
+
+
+int dazzler_trace_next(dazzler_trace_reader *r, const uint8_t **data, uint64_t *time_us)
+{
+  uint64_t delta, size;
+  if( !get_varint(r, &delta) || !get_varint(r, &size) ) return -1;
+  if( size > (uint64_t) (r->end - r->p) || size > 0x7FFFFFFF ) return -1;
+
+  r->time_us += delta;
+  *time_us = r->time_us;
+  *data    = r->p;
+  r->p    += size;
+  return (int) size;
+}
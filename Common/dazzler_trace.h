@@ -0,0 +1,77 @@
+// -----------------------------------------------------------------------------
+// Cromemco Dazzler emulation - protocol trace files
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#ifndef DAZZLER_TRACE_H
+#define DAZZLER_TRACE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+// A trace file records the raw byte stream received from the computer,
+// exactly in the pieces it was received, together with the receive time.
+// Format:
+//   8 bytes  "DAZTRC01"
+//   records: varint time since previous record (microseconds)
+//            varint number of bytes
+//            the bytes
+// Varints are 7 bits per byte, least significant group first, bit 7 set
+// in all but the last byte.
+#define DAZ_TRACE_MAGIC "DAZTRC01"
+#define DAZ_TRACE_MAGIC_LEN 8
+
+
+struct dazzler_trace_writer
+{
+  FILE    *f;
+  uint64_t last_us;
+  uint64_t num_records, num_bytes;
+};
+
+// start writing a trace to an open file (written in binary mode),
+// "now_us" is the time base for the first record
+bool dazzler_trace_start(dazzler_trace_writer *w, FILE *f, uint64_t now_us);
+
+// append one received piece of data
+void dazzler_trace_write(dazzler_trace_writer *w, uint64_t now_us, const uint8_t *data, int size);
+
+// finish writing and close the file
+void dazzler_trace_stop(dazzler_trace_writer *w);
+
+
+struct dazzler_trace_reader
+{
+  const uint8_t *data, *end, *p;
+  uint64_t time_us;           // time of the last record returned
+};
+
+// check whether a buffer (e.g. a mapped file) holds a trace
+bool dazzler_trace_is_trace(const uint8_t *data, size_t size);
+
+// read from a trace held in memory, returns false if it is not a trace
+bool dazzler_trace_open(dazzler_trace_reader *r, const uint8_t *data, size_t size);
+
+// restart at the first record
+void dazzler_trace_rewind(dazzler_trace_reader *r);
+
+// get the next record, returns its size (>=0) or -1 at the end of the
+// trace (or if the trace is truncated/corrupt)
+int dazzler_trace_next(dazzler_trace_reader *r, const uint8_t **data, uint64_t *time_us);
+
+#endif
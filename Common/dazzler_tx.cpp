@@ -0,0 +1,378 @@
+// -----------------------------------------------------------------------------
+// Cromemco Dazzler emulation - prioritized transmit scheduler
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#include <string.h>
+#include "dazzler_tx.h"
+
+
+void dazzler_tx_init(dazzler_tx *tx, int baud, uint16_t features, uint32_t slice_us)
+{
+  memset(tx, 0, sizeof(dazzler_tx));
+  tx->byte_ns  = baud>0 ? (uint32_t) (10ull * 1000000000 / baud) : 0;
+  tx->slice_ns = slice_us * 1000;
+  dazzler_tx_set_features(tx, features);
+}
+
+
+void dazzler_tx_set_features(dazzler_tx *tx, uint16_t features)
+{
+  tx->features = features;
+
+  // slice payload that takes about slice_ns including its header
+  int n = tx->byte_ns>0 ? (int) (tx->slice_ns / tx->byte_ns) - 4 : 256;
+  tx->slice = n<16 ? 16 : (n>256 ? 256 : n);
+}
+
+
+static int tx_queue_of(uint8_t cmd)
+{
+  switch( cmd & 0xF0 )
+    {
+    case DAZ_DAC:
+    case DAZ_DACBURST:
+      return DAZ_TX_AUDIO;
+
+    case DAZ_MEMBYTE:
+    case DAZ_FULLFRAME:
+    case DAZ_MEMBLOCK:
+    case DAZ_DELTA:
+    case DAZ_RECT:
+    case DAZ_CHUNK:
+    case DAZ_STATE:
+      return DAZ_TX_VIDEO;
+
+    default:
+      return DAZ_TX_CONTROL;
+    }
+}
+
+
+// size of the command starting with cur[0..cur_len-1],
+// 0 if that can not be told yet
+static int tx_cmd_size(const uint8_t *cur, int cur_len)
+{
+  uint8_t cmd = cur[0];
+  switch( cmd & 0xF0 )
+    {
+    case DAZ_MEMBYTE:   return 3;
+    case DAZ_FULLFRAME: return 1 + ((cmd & 0x01) ? 2048 : 512);
+    case DAZ_CTRL:      return 2;
+    case DAZ_CTRLPIC:   return 2;
+    case DAZ_DAC:       return 4;
+    case DAZ_MEMBLOCK:  return cur_len<3 ? 0 : 3 + (cur[2]==0 ? 256 : cur[2]);
+    case DAZ_DACBURST:  return cur_len<4 ? 0 : 4 + (cur[3]==0 ? 256 : cur[3]);
+    case DAZ_CHUNK:     return cur_len<4 ? 0 : 4 + (cur[3]==0 ? 256 : cur[3]);
+    case DAZ_RECT:      return (cmd & 0x0F)<3 ? 6 + (cmd & 0x0F) : 1;
+    case DAZ_PING:      return 5;
+    case DAZ_STATE:     return DAZ_STATE_SIZE;
+    default:            return 1;
+    }
+}
+
+
+static bool tx_enqueue(dazzler_tx *tx, const uint8_t *data, int len)
+{
+  dazzler_tx_queue *q = &tx->q[tx_queue_of(data[0])];
+  if( q->tail-q->head >= DAZ_TX_CMDS || DAZ_TX_QUEUE-(q->data_tail-q->data_head) < (uint32_t) len )
+    return false;
+
+  uint32_t i = q->tail++ & (DAZ_TX_CMDS-1);
+  q->pos[i] = q->data_tail;
+  q->len[i] = len;
+  q->seq[i] = tx->seq++;
+  for(int k=0; k<len; k++)
+    q->data[(q->data_tail+k) & (DAZ_TX_QUEUE-1)] = data[k];
+  q->data_tail += len;
+  return true;
+}
+
+
+int dazzler_tx_put(dazzler_tx *tx, const uint8_t *data, int size)
+{
+  int i = 0;
+  while( true )
+    {
+      // a complete command waits for room in its queue
+      if( tx->cur_len>0 && tx->cur_len==tx->cur_need )
+        {
+          if( !tx_enqueue(tx, tx->cur, tx->cur_len) ) return i;
+          tx->cur_len = tx->cur_need = 0;
+        }
+
+      if( i>=size ) return i;
+
+      if( tx->cur_len==0 && (data[i] & 0xF0)==DAZ_DELTA )
+        {
+          tx->delta_left = (data[i] & 0x01) ? 2048 : 512;
+          tx->delta_run  = 0;
+        }
+
+      if( tx->cur_need>0 )
+        {
+          // size known => take as much as is there
+          int n = tx->cur_need-tx->cur_len < size-i ? tx->cur_need-tx->cur_len : size-i;
+          memcpy(tx->cur+tx->cur_len, data+i, n);
+          tx->cur_len += n;
+          i += n;
+        }
+      else if( (tx->cur[0] & 0xF0)==DAZ_DELTA && tx->cur_len>0 )
+        {
+          // follow the tokens until the frame is covered
+          uint8_t t = tx->cur[tx->cur_len++] = data[i++];
+          if( tx->delta_run>0 )
+            {
+              // data byte of the current token
+              tx->delta_run--;
+              tx->delta_left--;
+            }
+          else if( t & 0x80 )
+            {
+              int run = (t & 0x3F) + 1;
+              if( run>tx->delta_left ) run = tx->delta_left;
+              if( t & 0x40 )
+                {
+                  // run of one byte, the value follows
+                  tx->delta_run  = 1;
+                  tx->delta_left -= run-1;
+                }
+              else
+                tx->delta_run = run;
+            }
+          else
+            tx->delta_left -= (t==0 || t>tx->delta_left) ? tx->delta_left : t;
+
+          // (a valid frame always ends within DAZ_TX_MAXPIECE, anything
+          // longer goes out as it is)
+          if( (tx->delta_left==0 && tx->delta_run==0) || tx->cur_len==DAZ_TX_MAXPIECE )
+            tx->cur_need = tx->cur_len;
+        }
+      else
+        {
+          tx->cur[tx->cur_len++] = data[i++];
+          if( (tx->cur[0] & 0xF0)!=DAZ_DELTA ) tx->cur_need = tx_cmd_size(tx->cur, tx->cur_len);
+        }
+    }
+}
+
+
+static void tx_copy(const dazzler_tx_queue *q, uint32_t pos, int len, uint8_t *out)
+{
+  for(int k=0; k<len; k++)
+    out[k] = q->data[(pos+k) & (DAZ_TX_QUEUE-1)];
+}
+
+
+static void tx_pop(dazzler_tx_queue *q)
+{
+  uint32_t i = q->head++ & (DAZ_TX_CMDS-1);
+  q->data_head = q->pos[i] + q->len[i];
+}
+
+
+static int tx_get_audio(dazzler_tx *tx, uint8_t *out)
+{
+  dazzler_tx_queue *q = &tx->q[DAZ_TX_AUDIO];
+  uint32_t i = q->head & (DAZ_TX_CMDS-1);
+  int len = q->len[i];
+  tx_copy(q, q->pos[i], len, out);
+  tx_pop(q);
+
+  if( (out[0] & 0xF0)==DAZ_DAC && (tx->features & FEAT_DACBURST) )
+    {
+      // following samples for the same channel with the same delay
+      // go into one DAZ_DACBURST
+      uint8_t s[4];
+      int n = 1;
+      out[4] = out[3];
+      while( q->head!=q->tail && n<256 )
+        {
+          i = q->head & (DAZ_TX_CMDS-1);
+          if( q->len[i]!=4 ) break;
+          tx_copy(q, q->pos[i], 4, s);
+          if( s[0]!=out[0] || s[1]!=out[1] || s[2]!=out[2] ) break;
+          out[4+n++] = s[3];
+          tx_pop(q);
+        }
+
+      if( n>1 )
+        {
+          out[0] = DAZ_DACBURST | (out[0] & 0x0F);
+          out[3] = n & 0xFF;
+          len = 4+n;
+          tx->num_merged += n;
+        }
+    }
+
+  return len;
+}
+
+
+static int tx_get_video(dazzler_tx *tx, uint8_t *out)
+{
+  dazzler_tx_queue *q = &tx->q[DAZ_TX_VIDEO];
+  uint32_t i = q->head & (DAZ_TX_CMDS-1);
+  uint8_t cmd = q->data[q->pos[i] & (DAZ_TX_QUEUE-1)];
+
+  if( (cmd & 0xF0)==DAZ_FULLFRAME && (tx->features & FEAT_CHUNK) )
+    {
+      // next slice of the frame, the last one commits it
+      int size = (cmd & 0x01) ? 2048 : 512;
+      int n = size-tx->chunk_pos < tx->slice ? size-tx->chunk_pos : tx->slice;
+      bool last = tx->chunk_pos+n==size;
+      out[0] = DAZ_CHUNK | (cmd & 0x08) | (last ? DAZ_CHUNK_LAST : 0);
+      out[1] = tx->chunk_pos >> 8;
+      out[2] = tx->chunk_pos & 0xFF;
+      out[3] = n & 0xFF;
+      tx_copy(q, q->pos[i]+1+tx->chunk_pos, n, out+4);
+      tx->num_slices++;
+
+      tx->chunk_pos += n;
+      if( last )
+        {
+          tx->chunk_pos = 0;
+          tx_pop(q);
+        }
+      return 4+n;
+    }
+
+  int len = q->len[i];
+  tx_copy(q, q->pos[i], len, out);
+  tx_pop(q);
+  return len;
+}
+
+
+static uint64_t tx_head_seq(const dazzler_tx_queue *q)
+{
+  return q->head==q->tail ? (uint64_t) -1 : q->seq[q->head & (DAZ_TX_CMDS-1)];
+}
+
+
+// link time of the video command at the head of the queue if it can
+// not be split and takes longer than a slice, 0 otherwise
+static uint64_t tx_video_long(const dazzler_tx *tx)
+{
+  const dazzler_tx_queue *q = &tx->q[DAZ_TX_VIDEO];
+  if( q->head==q->tail ) return 0;
+
+  uint32_t i = q->head & (DAZ_TX_CMDS-1);
+  uint8_t cmd = q->data[q->pos[i] & (DAZ_TX_QUEUE-1)];
+  uint64_t t = (uint64_t) q->len[i] * tx->byte_ns;
+  bool split = (cmd & 0xF0)==DAZ_FULLFRAME && (tx->features & FEAT_CHUNK);
+  return split || t<=tx->slice_ns ? 0 : t;
+}
+
+
+// true if the video command at the head of the queue would keep the
+// Dazzler's audio buffer from being refilled in time and should wait
+static bool tx_hold_video(dazzler_tx *tx, uint64_t now_ns)
+{
+  uint64_t t = tx_video_long(tx);
+  if( t==0 || tx->audio_end_ns<=tx->busy_ns || tx->busy_ns+t<=tx->audio_end_ns )
+    {
+      tx->hold_ns = 0;
+      return false;
+    }
+
+  if( tx->hold_ns==0 )
+    {
+      tx->hold_ns = now_ns + DAZ_TX_MAXHOLD_US*1000ull;
+      tx->num_held++;
+    }
+
+  if( now_ns<tx->hold_ns ) return true;
+
+  // waited long enough, the audio gap can not be avoided
+  tx->hold_ns = 0;
+  return false;
+}
+
+
+int dazzler_tx_get(dazzler_tx *tx, uint64_t now_us, uint8_t *out)
+{
+  // the link still has more than a slice time to send
+  uint64_t now_ns = now_us*1000;
+  if( tx->busy_ns<now_ns ) tx->busy_ns = now_ns;
+  if( tx->byte_ns>0 && tx->busy_ns-now_ns > tx->slice_ns ) return 0;
+
+  // audio goes first, except that while the Dazzler is not playing it
+  // does not overtake a long video command (and control commands before
+  // it) written earlier
+  dazzler_tx_queue *qa = &tx->q[DAZ_TX_AUDIO], *qc = &tx->q[DAZ_TX_CONTROL];
+  uint64_t sa = tx_head_seq(qa), sc = tx_head_seq(qc), sv = tx_head_seq(&tx->q[DAZ_TX_VIDEO]);
+  bool wait = tx->audio_end_ns<=tx->busy_ns && sv<sa && tx_video_long(tx)>0;
+  int q, len;
+  if( qa->head!=qa->tail && !wait )
+    {
+      q = DAZ_TX_AUDIO;
+      len = tx_get_audio(tx, out);
+    }
+  else if( sc<sv )
+    {
+      q = DAZ_TX_CONTROL;
+      len = qc->len[qc->head & (DAZ_TX_CMDS-1)];
+      tx_copy(qc, qc->pos[qc->head & (DAZ_TX_CMDS-1)], len, out);
+      tx_pop(qc);
+    }
+  else if( sv!=(uint64_t) -1 )
+    {
+      if( tx_hold_video(tx, now_ns) ) return 0;
+      q = DAZ_TX_VIDEO;
+      len = tx_get_video(tx, out);
+    }
+  else
+    return 0;
+
+  tx->num_bytes[q] += len;
+  tx->num_commands[q]++;
+  tx->busy_ns += (uint64_t) len * tx->byte_ns;
+
+  if( q==DAZ_TX_AUDIO && tx->byte_ns>0 )
+    {
+      // the samples play from when they arrive (after a lead if the
+      // Dazzler was not playing) for the sum of their delays
+      uint64_t d = out[1] + out[2]*256;
+      if( (out[0] & 0xF0)==DAZ_DACBURST ) d *= out[3]==0 ? 256 : out[3];
+      if( tx->audio_end_ns<tx->busy_ns ) tx->audio_end_ns = tx->busy_ns + DAZ_TX_AUDIO_LEAD_US*1000ull;
+      tx->audio_end_ns += d*1000;
+    }
+
+  return len;
+}
+
+
+uint32_t dazzler_tx_wait_us(const dazzler_tx *tx, uint64_t now_us)
+{
+  uint64_t now_ns = now_us*1000;
+  if( tx->byte_ns==0 ) return 0;
+
+  // until the link has room, and a held video command its time
+  uint64_t t = tx->busy_ns > now_ns+tx->slice_ns ? tx->busy_ns-tx->slice_ns : now_ns;
+  const dazzler_tx_queue *qv = &tx->q[DAZ_TX_VIDEO];
+  if( tx->hold_ns>t && qv->head!=qv->tail ) t = tx->hold_ns;
+  return (uint32_t) ((t - now_ns + 999) / 1000);
+}
+
+
+bool dazzler_tx_empty(const dazzler_tx *tx)
+{
+  for(int i=0; i<3; i++)
+    if( tx->q[i].head!=tx->q[i].tail ) return false;
+  return tx->cur_len==0;
+}
@@ -0,0 +1,136 @@
+// -----------------------------------------------------------------------------
+// Cromemco Dazzler emulation - prioritized transmit scheduler
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#ifndef DAZZLER_TX_H
+#define DAZZLER_TX_H
+
+#include <stdint.h>
+#include "dazzler_proto.h"
+
+// Computer side: takes the command stream as the computer writes it and
+// decides what goes on the link next. Commands are sorted into three
+// queues: audio (DAZ_DAC, DAZ_DACBURST), control (DAZ_CTRL, DAZ_CTRLPIC,
+// DAZ_VERSION, DAZ_PING) and video (everything else). Audio goes
+// first. Control and video keep their order among each other (a buffer
+// switch must not overtake the frame it shows) and control goes first
+// where that does not change the order.
+// Output is paced to the link's byte rate so that only about one slice
+// time worth of data waits in the serial driver at any time, otherwise
+// audio would still queue up behind video there. If the Dazzler supports
+// them, DAZ_FULLFRAME commands are sent as DAZ_CHUNK slices of at most
+// one slice time (so audio only waits that long) and runs of DAZ_DAC
+// samples with the same channel and delay are sent as one DAZ_DACBURST.
+// Other video commands are never split (DAZ_DELTA may take a while).
+// Instead, while the Dazzler is playing audio, such a command waits
+// (at most DAZ_TX_MAXHOLD_US) until it can go out before the audio sent
+// so far runs out. While no audio is playing, audio does not overtake
+// video and control commands written before it: a frame then goes out
+// before playing starts and the samples queued behind it give the
+// Dazzler's audio buffer room for the next one.
+// The scheduler works on the plain command stream, DAZ_FRAMED framing
+// (dazzler_framer.h) goes around its output.
+
+// queue sizes (bytes and commands, powers of 2)
+#define DAZ_TX_QUEUE 65536
+#define DAZ_TX_CMDS  4096
+
+// largest piece dazzler_tx_get returns (a whole DAZ_STATE command, a
+// DAZ_DELTA command may take up to 1+2*2048 bytes if it is not minimally
+// encoded)
+#define DAZ_TX_MAXPIECE DAZ_STATE_SIZE
+
+// the Dazzler starts playing audio this long after the first sample
+// arrives (190 lines in the firmware)
+#define DAZ_TX_AUDIO_LEAD_US 5000
+
+// longest time a video command that can not be split waits for the
+// Dazzler's audio buffer
+#define DAZ_TX_MAXHOLD_US 50000
+
+// queues
+#define DAZ_TX_AUDIO   0
+#define DAZ_TX_CONTROL 1
+#define DAZ_TX_VIDEO   2
+
+struct dazzler_tx_queue
+{
+  uint8_t  data[DAZ_TX_QUEUE];
+  uint32_t data_head, data_tail;
+  uint32_t pos[DAZ_TX_CMDS], len[DAZ_TX_CMDS];
+  uint64_t seq[DAZ_TX_CMDS];      // order among all queued commands
+  uint32_t head, tail;
+};
+
+struct dazzler_tx
+{
+  uint16_t features;              // FEAT_* reported by the Dazzler
+  uint32_t byte_ns;               // link time per byte (0: not limited)
+  uint32_t slice_ns;              // longest time audio should wait
+  int      slice;                 // DAZ_CHUNK slice payload size
+
+  dazzler_tx_queue q[3];
+  uint64_t seq;
+
+  // command being put together by dazzler_tx_put
+  uint8_t  cur[DAZ_TX_MAXPIECE];
+  int      cur_len, cur_need;     // cur_need: 0 if not known yet
+  int      delta_left, delta_run; // parsing DAZ_DELTA tokens
+
+  // position in the DAZ_FULLFRAME at the head of the video queue
+  // while it goes out as DAZ_CHUNK slices
+  int      chunk_pos;
+
+  // time until which the link is busy with what was returned so far
+  uint64_t busy_ns;
+
+  // time until which the Dazzler has audio to play (estimated from the
+  // delays of the samples sent) and until which video waits for it (0: not)
+  uint64_t audio_end_ns, hold_ns;
+
+  // statistics
+  uint64_t num_bytes[3], num_commands[3], num_slices, num_merged, num_held;
+};
+
+
+// "baud" is the serial link rate (10 bits per byte) or 0 for a link
+// that does not need pacing, "slice_us" how long audio may have to wait
+// behind a video command that can be split (e.g. 2000)
+void dazzler_tx_init(dazzler_tx *tx, int baud, uint16_t features, uint32_t slice_us);
+
+// the Dazzler's features (reply to DAZ_VERSION) changed
+void dazzler_tx_set_features(dazzler_tx *tx, uint16_t features);
+
+// Queue "size" bytes of the command stream (commands may be split
+// across calls). Returns the number of bytes taken, less than "size"
+// if a queue is full (then try the rest again after sending).
+int dazzler_tx_put(dazzler_tx *tx, const uint8_t *data, int size);
+
+// Get the next piece to send at time "now_us" into "out" (room for
+// DAZ_TX_MAXPIECE bytes). Returns its size, 0 if there is nothing to
+// send or the link is still busy (see dazzler_tx_wait_us). Call again
+// until it returns 0.
+int dazzler_tx_get(dazzler_tx *tx, uint64_t now_us, uint8_t *out);
+
+// microseconds from "now_us" until dazzler_tx_get may return more
+uint32_t dazzler_tx_wait_us(const dazzler_tx *tx, uint64_t now_us);
+
+// true if nothing is queued
+bool dazzler_tx_empty(const dazzler_tx *tx);
+
+#endif
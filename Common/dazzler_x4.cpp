@@ -0,0 +1,345 @@
+// -----------------------------------------------------------------------------
+// Cromemco Dazzler emulation - x4 resolution bit-plane expansion kernels
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#include <string.h>
+#include "dazzler_x4.h"
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define HAVE_X86 1
+#include <emmintrin.h>
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#else
+#define HAVE_X86 0
+#endif
+
+// gcc/clang need to be told that a function may use AVX2 instructions,
+// MSVC allows intrinsics for any instruction set
+#if HAVE_X86 && defined(__GNUC__)
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#else
+#define TARGET_AVX2
+#define TARGET_SSE2
+#endif
+
+
+// top-left pixel of the four quadrants
+#define QUADRANT_OFFSET(q) (((q)&1)*64 + ((q)>>1)*64*128)
+
+
+// -------------------------------------------------- scalar ---------------------------------------------------------
+
+
+static void x4_indexed_scalar(const uint8_t *mem, uint8_t color, uint8_t *out)
+{
+  for(int q=0; q<4; q++)
+    {
+      uint8_t *qout = out + QUADRANT_OFFSET(q);
+      for(int row=0; row<32; row++)
+        {
+          uint8_t *lp = qout + row*2*128;
+          for(int col=0; col<16; col++)
+            {
+              uint8_t b = *mem++;
+              lp[0    ] = b & 0x01 ? color : 0;
+              lp[1    ] = b & 0x02 ? color : 0;
+              lp[2    ] = b & 0x10 ? color : 0;
+              lp[3    ] = b & 0x20 ? color : 0;
+              lp[0+128] = b & 0x04 ? color : 0;
+              lp[1+128] = b & 0x08 ? color : 0;
+              lp[2+128] = b & 0x40 ? color : 0;
+              lp[3+128] = b & 0x80 ? color : 0;
+              lp += 4;
+            }
+        }
+    }
+}
+
+
+static void x4_rgba_scalar(const uint8_t *mem, uint32_t fg, uint32_t bg, uint32_t *out, int stride)
+{
+  for(int q=0; q<4; q++)
+    {
+      uint32_t *qout = out + (q&1)*64 + (q>>1)*64*stride;
+      for(int row=0; row<32; row++)
+        {
+          uint32_t *lp = qout + row*2*stride;
+          for(int col=0; col<16; col++)
+            {
+              uint8_t b = *mem++;
+              lp[0       ] = b & 0x01 ? fg : bg;
+              lp[1       ] = b & 0x02 ? fg : bg;
+              lp[2       ] = b & 0x10 ? fg : bg;
+              lp[3       ] = b & 0x20 ? fg : bg;
+              lp[0+stride] = b & 0x04 ? fg : bg;
+              lp[1+stride] = b & 0x08 ? fg : bg;
+              lp[2+stride] = b & 0x40 ? fg : bg;
+              lp[3+stride] = b & 0x80 ? fg : bg;
+              lp += 4;
+            }
+        }
+    }
+}
+
+
+static const dazzler_x4_kernel kernel_scalar = {"scalar", x4_indexed_scalar, x4_rgba_scalar};
+
+
+#if HAVE_X86
+
+// -------------------------------------------------- SSE2 -----------------------------------------------------------
+
+
+// Expand one quadrant row (16 bytes) into 2x64 pixel masks (0x00/0xFF per pixel).
+// Each byte is replicated 4 times, then the replicas are tested against the
+// bit masks of the top and bottom row of its 4x2 block.
+TARGET_SSE2 static inline void x4_masks_sse2(const uint8_t *mem, __m128i top[4], __m128i bottom[4])
+{
+  const __m128i m0 = _mm_set1_epi32(0x20100201); // bytes 01 02 10 20
+  const __m128i m1 = _mm_set1_epi32((int) 0x80400804); // bytes 04 08 40 80
+
+  __m128i v = _mm_loadu_si128((const __m128i *) mem);
+  __m128i a = _mm_unpacklo_epi8(v, v);
+  __m128i b = _mm_unpackhi_epi8(v, v);
+  __m128i x[4];
+  x[0] = _mm_unpacklo_epi16(a, a);
+  x[1] = _mm_unpackhi_epi16(a, a);
+  x[2] = _mm_unpacklo_epi16(b, b);
+  x[3] = _mm_unpackhi_epi16(b, b);
+
+  for(int k=0; k<4; k++)
+    {
+      top[k]    = _mm_cmpeq_epi8(_mm_and_si128(x[k], m0), m0);
+      bottom[k] = _mm_cmpeq_epi8(_mm_and_si128(x[k], m1), m1);
+    }
+}
+
+
+TARGET_SSE2 static void x4_indexed_sse2(const uint8_t *mem, uint8_t color, uint8_t *out)
+{
+  const __m128i c = _mm_set1_epi8((char) color);
+  __m128i top[4], bottom[4];
+
+  for(int q=0; q<4; q++)
+    {
+      uint8_t *qout = out + QUADRANT_OFFSET(q);
+      for(int row=0; row<32; row++, mem+=16)
+        {
+          uint8_t *lp = qout + row*2*128;
+          x4_masks_sse2(mem, top, bottom);
+          for(int k=0; k<4; k++)
+            {
+              _mm_storeu_si128((__m128i *) (lp+16*k),     _mm_and_si128(top[k], c));
+              _mm_storeu_si128((__m128i *) (lp+128+16*k), _mm_and_si128(bottom[k], c));
+            }
+        }
+    }
+}
+
+
+// select fg/bg for 16 pixels given their byte masks
+TARGET_SSE2 static inline void x4_store_rgba_sse2(uint32_t *lp, __m128i m, __m128i bg, __m128i diff)
+{
+  __m128i lo = _mm_unpacklo_epi8(m, m);
+  __m128i hi = _mm_unpackhi_epi8(m, m);
+  _mm_storeu_si128((__m128i *) (lp+ 0), _mm_xor_si128(bg, _mm_and_si128(diff, _mm_unpacklo_epi16(lo, lo))));
+  _mm_storeu_si128((__m128i *) (lp+ 4), _mm_xor_si128(bg, _mm_and_si128(diff, _mm_unpackhi_epi16(lo, lo))));
+  _mm_storeu_si128((__m128i *) (lp+ 8), _mm_xor_si128(bg, _mm_and_si128(diff, _mm_unpacklo_epi16(hi, hi))));
+  _mm_storeu_si128((__m128i *) (lp+12), _mm_xor_si128(bg, _mm_and_si128(diff, _mm_unpackhi_epi16(hi, hi))));
+}
+
+
+TARGET_SSE2 static void x4_rgba_sse2(const uint8_t *mem, uint32_t fg, uint32_t bg, uint32_t *out, int stride)
+{
+  const __m128i vbg   = _mm_set1_epi32((int) bg);
+  const __m128i vdiff = _mm_set1_epi32((int) (fg ^ bg));
+  __m128i top[4], bottom[4];
+
+  for(int q=0; q<4; q++)
+    {
+      uint32_t *qout = out + (q&1)*64 + (q>>1)*64*stride;
+      for(int row=0; row<32; row++, mem+=16)
+        {
+          uint32_t *lp = qout + row*2*stride;
+          x4_masks_sse2(mem, top, bottom);
+          for(int k=0; k<4; k++)
+            {
+              x4_store_rgba_sse2(lp+16*k,        top[k],    vbg, vdiff);
+              x4_store_rgba_sse2(lp+stride+16*k, bottom[k], vbg, vdiff);
+            }
+        }
+    }
+}
+
+
+static const dazzler_x4_kernel kernel_sse2 = {"sse2", x4_indexed_sse2, x4_rgba_sse2};
+
+
+// -------------------------------------------------- AVX2 -----------------------------------------------------------
+
+
+// Expand 8 bytes into 2x32 pixel masks. The 8 bytes are broadcast to both
+// 128-bit lanes so a single in-lane shuffle can replicate each byte 4 times.
+TARGET_AVX2 static inline void x4_masks_avx2(const uint8_t *mem, __m256i *top, __m256i *bottom)
+{
+  const __m256i idx = _mm256_setr_epi8(0,0,0,0, 1,1,1,1, 2,2,2,2, 3,3,3,3,
+                                       4,4,4,4, 5,5,5,5, 6,6,6,6, 7,7,7,7);
+  const __m256i m0 = _mm256_set1_epi32(0x20100201);
+  const __m256i m1 = _mm256_set1_epi32((int) 0x80400804);
+
+  int64_t bytes;
+  memcpy(&bytes, mem, 8);
+  __m256i x = _mm256_shuffle_epi8(_mm256_set1_epi64x(bytes), idx);
+  *top    = _mm256_cmpeq_epi8(_mm256_and_si256(x, m0), m0);
+  *bottom = _mm256_cmpeq_epi8(_mm256_and_si256(x, m1), m1);
+}
+
+
+TARGET_AVX2 static void x4_indexed_avx2(const uint8_t *mem, uint8_t color, uint8_t *out)
+{
+  const __m256i c = _mm256_set1_epi8((char) color);
+  __m256i top, bottom;
+
+  for(int q=0; q<4; q++)
+    {
+      uint8_t *qout = out + QUADRANT_OFFSET(q);
+      for(int row=0; row<32; row++)
+        {
+          uint8_t *lp = qout + row*2*128;
+          for(int k=0; k<2; k++, mem+=8)
+            {
+              x4_masks_avx2(mem, &top, &bottom);
+              _mm256_storeu_si256((__m256i *) (lp+32*k),     _mm256_and_si256(top, c));
+              _mm256_storeu_si256((__m256i *) (lp+128+32*k), _mm256_and_si256(bottom, c));
+            }
+        }
+    }
+}
+
+
+// select fg/bg for 32 pixels given their byte masks
+TARGET_AVX2 static inline void x4_store_rgba_avx2(uint32_t *lp, __m256i m, __m256i bg, __m256i fg)
+{
+  __m128i lo = _mm256_castsi256_si128(m);
+  __m128i hi = _mm256_extracti128_si256(m, 1);
+  _mm256_storeu_si256((__m256i *) (lp+ 0), _mm256_blendv_epi8(bg, fg, _mm256_cvtepi8_epi32(lo)));
+  _mm256_storeu_si256((__m256i *) (lp+ 8), _mm256_blendv_epi8(bg, fg, _mm256_cvtepi8_epi32(_mm_srli_si128(lo, 8))));
+  _mm256_storeu_si256((__m256i *) (lp+16), _mm256_blendv_epi8(bg, fg, _mm256_cvtepi8_epi32(hi)));
+  _mm256_storeu_si256((__m256i *) (lp+24), _mm256_blendv_epi8(bg, fg, _mm256_cvtepi8_epi32(_mm_srli_si128(hi, 8))));
+}
+
+
+TARGET_AVX2 static void x4_rgba_avx2(const uint8_t *mem, uint32_t fg, uint32_t bg, uint32_t *out, int stride)
+{
+  const __m256i vbg = _mm256_set1_epi32((int) bg);
+  const __m256i vfg = _mm256_set1_epi32((int) fg);
+  __m256i top, bottom;
+
+  for(int q=0; q<4; q++)
+    {
+      uint32_t *qout = out + (q&1)*64 + (q>>1)*64*stride;
+      for(int row=0; row<32; row++)
+        {
+          uint32_t *lp = qout + row*2*stride;
+          for(int k=0; k<2; k++, mem+=8)
+            {
+              x4_masks_avx2(mem, &top, &bottom);
+              x4_store_rgba_avx2(lp+32*k,        top,    vbg, vfg);
+              x4_store_rgba_avx2(lp+stride+32*k, bottom, vbg, vfg);
+            }
+        }
+    }
+}
+
+
+static const dazzler_x4_kernel kernel_avx2 = {"avx2", x4_indexed_avx2, x4_rgba_avx2};
+
+
+// --------------------------------------------- feature detection ---------------------------------------------------
+
+
+static bool cpu_has_sse2()
+{
+#if defined(__x86_64__) || defined(_M_X64)
+  return true;
+#elif defined(_MSC_VER)
+  int info[4];
+  __cpuid(info, 1);
+  return (info[3] & (1<<26))!=0;
+#else
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("sse2");
+#endif
+}
+
+
+static bool cpu_has_avx2()
+{
+#if defined(_MSC_VER)
+  int info[4];
+  __cpuid(info, 0);
+  if( info[0]<7 ) return false;
+
+  // the OS must save the AVX registers on context switches
+  __cpuid(info, 1);
+  if( (info[2] & (1<<27))==0 || (_xgetbv(0) & 6)!=6 ) return false;
+
+  __cpuidex(info, 7, 0);
+  return (info[1] & (1<<5))!=0;
+#else
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif
+
+
+const dazzler_x4_kernel *const *dazzler_x4_supported(int *num)
+{
+  static const dazzler_x4_kernel *kernels[3];
+  static int n = 0;
+
+  if( n==0 )
+    {
+      // only publish the count once the list is complete
+      int m = 0;
+      kernels[m++] = &kernel_scalar;
+#if HAVE_X86
+      if( cpu_has_sse2() ) kernels[m++] = &kernel_sse2;
+      if( cpu_has_avx2() ) kernels[m++] = &kernel_avx2;
+#endif
+      n = m;
+    }
+
+  *num = n;
+  return kernels;
+}
+
+
+const dazzler_x4_kernel *dazzler_x4_select()
+{
+  // kernels are listed from slowest to fastest
+  int n;
+  const dazzler_x4_kernel *const *kernels = dazzler_x4_supported(&n);
+  return kernels[n-1];
+}
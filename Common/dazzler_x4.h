@@ -0,0 +1,50 @@
+// -----------------------------------------------------------------------------
+// Cromemco Dazzler emulation - x4 resolution bit-plane expansion kernels
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#ifndef DAZZLER_X4_H
+#define DAZZLER_X4_H
+
+#include <stdint.h>
+
+// In x4 resolution mode with 2K memory each memory byte holds a 4x2 pixel
+// block with bit order 0x01,0x02,0x10,0x20 (top row) / 0x04,0x08,0x40,0x80
+// (bottom row), and the memory is split into four 64x64 pixel quadrants.
+// These kernels expand a whole 2048-byte frame into 128x128 pixels in one
+// pass. All kernels produce bit-identical results.
+struct dazzler_x4_kernel
+{
+  const char *name;
+
+  // indexed output: "out" receives 128x128 bytes, set pixels become "color",
+  // cleared pixels become 0
+  void (*expand_indexed)(const uint8_t *mem, uint8_t color, uint8_t *out);
+
+  // RGBA output: "out" receives 128 rows of "stride" pixels, set pixels
+  // become "fg", cleared pixels become "bg"
+  void (*expand_rgba)(const uint8_t *mem, uint32_t fg, uint32_t bg, uint32_t *out, int stride);
+};
+
+
+// the fastest kernel supported by the CPU we are running on
+const dazzler_x4_kernel *dazzler_x4_select();
+
+// all kernels supported by this CPU, the first one is the scalar reference
+const dazzler_x4_kernel *const *dazzler_x4_supported(int *num);
+
+#endif
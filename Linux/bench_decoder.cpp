@@ -0,0 +1,272 @@
+// -----------------------------------------------------------------------------
+// Cromemco Dazzler emulation - protocol decoder throughput benchmark
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+// Usage: bench_decoder [-c chunksize] [-n megabytes] [-w trace] [recorded-stream ...]
+//
+// Without file arguments the benchmark runs a set of synthetic streams.
+// Any file given on the command line is taken as a recorded raw byte
+// stream (as received from the computer) and decoded instead. Trace
+// files (see ../Common/dazzler_trace.h) are decoded in the pieces they
+// were received in (-c is ignored for them).
+// With -w the synthetic mixed stream is also written as a trace file,
+// timed as if received at 1050000 baud in pieces of "chunksize" bytes.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+#include "../Common/dazzler_decoder.h"
+#include "../Common/dazzler_trace.h"
+
+
+static uint8_t dazzler_mem[2*DAZ_MEMSIZE];
+static unsigned long callback_count = 0;
+
+
+static void count_membyte(void *ctx, int addr, uint8_t value) { callback_count++; }
+static void count_fullframe(void *ctx, int addr, int len) { callback_count++; }
+static void count_memblock(void *ctx, int addr, int len) { callback_count++; }
+static void count_ctrl(void *ctx, uint8_t ctrl) { callback_count++; }
+static void count_dac(void *ctx, int channel, uint16_t delay_us, uint8_t sample) { callback_count++; }
+static void count_dacburst(void *ctx, int channel, uint16_t interval_us, const uint8_t *samples, int n) { callback_count++; }
+
+static const dazzler_decoder_callbacks bench_callbacks =
+  {count_membyte, count_fullframe, count_ctrl, count_ctrl, count_dac, NULL, NULL, count_memblock, count_dacburst};
+
+
+static double now_seconds()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static void gen_membyte(std::vector<uint8_t> &s, size_t size)
+{
+  while( s.size()+3<=size )
+    {
+      int a = rand() & 0xFFF;
+      s.push_back(DAZ_MEMBYTE | (a>>8));
+      s.push_back(a & 0xFF);
+      s.push_back(rand() & 0xFF);
+    }
+}
+
+
+static void gen_fullframe(std::vector<uint8_t> &s, size_t size)
+{
+  while( s.size()+2049<=size )
+    {
+      s.push_back(DAZ_FULLFRAME | 0x01 | (rand() & 0x08));
+      for(int i=0; i<2048; i++) s.push_back(rand() & 0xFF);
+    }
+}
+
+
+static void gen_memblock(std::vector<uint8_t> &s, size_t size)
+{
+  // rows of 16 bytes (one quadrant line), as sent when scrolling
+  while( s.size()+19<=size )
+    {
+      int a = rand() & 0xFF0;
+      s.push_back(DAZ_MEMBLOCK | (a>>8));
+      s.push_back(a & 0xFF);
+      s.push_back(16);
+      for(int i=0; i<16; i++) s.push_back(rand() & 0xFF);
+    }
+}
+
+
+static void gen_dacburst(std::vector<uint8_t> &s, size_t size)
+{
+  // 16kHz audio (62us per sample) in bursts of 64 samples, i.e. one
+  // burst per channel per 4ms
+  while( s.size()+68<=size )
+    {
+      s.push_back(DAZ_DACBURST | (rand() & 1));
+      s.push_back(62);
+      s.push_back(0);
+      s.push_back(64);
+      for(int i=0; i<64; i++) s.push_back(rand() & 0xFF);
+    }
+}
+
+
+static void gen_mixed(std::vector<uint8_t> &s, size_t size)
+{
+  // roughly what a game produces: mostly memory writes, some
+  // audio samples and occasional mode changes
+  while( s.size()+4<=size )
+    {
+      int r = rand() % 100;
+      if( r<80 )
+        {
+          int a = rand() & 0x7FF;
+          s.push_back(DAZ_MEMBYTE | (a>>8));
+          s.push_back(a & 0xFF);
+          s.push_back(rand() & 0xFF);
+        }
+      else if( r<98 )
+        {
+          s.push_back(DAZ_DAC | (rand() & 1));
+          s.push_back(rand() & 0xFF);
+          s.push_back(0);
+          s.push_back(rand() & 0xFF);
+        }
+      else if( r<99 )
+        {
+          s.push_back(DAZ_CTRL);
+          s.push_back(0x80 | (rand() & 1));
+        }
+      else
+        {
+          s.push_back(DAZ_CTRLPIC);
+          s.push_back(rand() & 0x7F);
+        }
+    }
+}
+
+
+static bool read_file(const char *fname, std::vector<uint8_t> &s)
+{
+  FILE *f = fopen(fname, "rb");
+  if( f==NULL ) return false;
+
+  uint8_t buf[65536];
+  size_t n;
+  while( (n=fread(buf, 1, sizeof(buf), f))>0 )
+    s.insert(s.end(), buf, buf+n);
+
+  fclose(f);
+  return true;
+}
+
+
+static void run(const char *name, const std::vector<uint8_t> &s, int chunksize, size_t total)
+{
+  dazzler_decoder d;
+  dazzler_decoder_init(&d, dazzler_mem, FEAT_VIDEO | FEAT_MEMBLOCK, &bench_callbacks, NULL);
+  callback_count = 0;
+
+  if( s.empty() ) return;
+
+  dazzler_trace_reader trace;
+  bool is_trace = dazzler_trace_open(&trace, s.data(), s.size());
+
+  double t0 = now_seconds();
+  size_t done = 0;
+  while( done<total )
+    {
+      if( is_trace )
+        {
+          const uint8_t *p;
+          uint64_t t;
+          int n;
+          dazzler_trace_rewind(&trace);
+          while( (n=dazzler_trace_next(&trace, &p, &t))>=0 )
+            dazzler_decoder_receive(&d, p, n);
+        }
+      else
+        for(size_t i=0; i<s.size(); i+=chunksize)
+          {
+            int n = (int) (s.size()-i < (size_t) chunksize ? s.size()-i : chunksize);
+            dazzler_decoder_receive(&d, s.data()+i, n);
+          }
+
+      done += s.size();
+    }
+  double t = now_seconds()-t0;
+
+  printf("%-24s %10.1f MB/s %12.1f Mcmd/s  (%lu callbacks)\n", name,
+         (double) d.num_bytes / t / 1e6, (double) d.num_commands / t / 1e6, callback_count);
+}
+
+
+static bool write_trace(const char *fname, const std::vector<uint8_t> &s, int chunksize)
+{
+  FILE *f = fopen(fname, "wb");
+  dazzler_trace_writer w;
+  if( f==NULL || !dazzler_trace_start(&w, f, 0) ) return false;
+
+  // 10 bits per byte at 1050000 baud
+  for(size_t i=0; i<s.size(); i+=chunksize)
+    {
+      int n = (int) (s.size()-i < (size_t) chunksize ? s.size()-i : chunksize);
+      dazzler_trace_write(&w, (uint64_t) (i+n) * 10 * 1000000 / 1050000, s.data()+i, n);
+    }
+
+  dazzler_trace_stop(&w);
+  return true;
+}
+
+
+int main(int argc, char **argv)
+{
+  int chunksize = 100;
+  size_t megabytes = 256;
+  const char *trace_fname = NULL;
+
+  int i;
+  for(i=1; i<argc && argv[i][0]=='-'; i++)
+    {
+      if( strcmp(argv[i], "-c")==0 && i+1<argc )
+        chunksize = atoi(argv[++i]);
+      else if( strcmp(argv[i], "-n")==0 && i+1<argc )
+        megabytes = atoi(argv[++i]);
+      else if( strcmp(argv[i], "-w")==0 && i+1<argc )
+        trace_fname = argv[++i];
+      else
+        {
+          fprintf(stderr, "usage: %s [-c chunksize] [-n megabytes] [-w trace] [recorded-stream ...]\n", argv[0]);
+          return 1;
+        }
+    }
+
+  if( chunksize<1 ) chunksize = 1;
+  size_t total = megabytes * 1024 * 1024;
+  printf("chunk size %i bytes, %lu MB per stream\n", chunksize, (unsigned long) megabytes);
+
+  if( i<argc )
+    {
+      for(; i<argc; i++)
+        {
+          std::vector<uint8_t> s;
+          if( read_file(argv[i], s) )
+            run(argv[i], s, chunksize, total);
+          else
+            fprintf(stderr, "can not read %s\n", argv[i]);
+        }
+    }
+  else
+    {
+      std::vector<uint8_t> s;
+      srand(1);
+      gen_membyte(s, 1024*1024);   run("synthetic MEMBYTE", s, chunksize, total); s.clear();
+      gen_fullframe(s, 1024*1024); run("synthetic FULLFRAME", s, chunksize, total); s.clear();
+      gen_memblock(s, 1024*1024);  run("synthetic MEMBLOCK", s, chunksize, total); s.clear();
+      gen_dacburst(s, 1024*1024);  run("synthetic DACBURST", s, chunksize, total); s.clear();
+      gen_mixed(s, 1024*1024);     run("synthetic mixed", s, chunksize, total);
+      if( trace_fname!=NULL && !write_trace(trace_fname, s, chunksize) )
+        fprintf(stderr, "can not write %s\n", trace_fname);
+    }
+
+  return 0;
+}
@@ -0,0 +1,260 @@
+// -----------------------------------------------------------------------------
+// Cromemco Dazzler emulation - delta frame encoding benchmark
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+// Usage: bench_delta [recorded-stream ...]
+//
+// Measures how many bytes per frame the DAZ_DELTA command needs compared
+// to DAZ_FULLFRAME. Each input (trace file or raw byte stream, see
+// bench_decoder) is run through the decoder. At every frame boundary
+// (full frame, control register change or 16.59ms of stream time) each
+// buffer that changed since the previous boundary is encoded as a delta
+// against its previous contents. Every delta is decoded again and checked
+// against the real memory contents.
+// Without arguments two synthetic double-buffered animations are used:
+// sprites moving over a static background and a scrolling background.
+// Exits with 1 if any delta does not decode correctly.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+#include "../Common/dazzler_decoder.h"
+#include "../Common/dazzler_delta.h"
+#include "../Common/dazzler_sched.h"
+#include "../Common/dazzler_trace.h"
+
+
+static uint8_t dazzler_mem[2*DAZ_MEMSIZE], shadow_mem[2*DAZ_MEMSIZE], check_mem[2*DAZ_MEMSIZE];
+static dazzler_decoder decoder, checker;
+
+struct delta_stats
+{
+  uint64_t frames, fullframe_bytes, delta_bytes, best_bytes, errors;
+  double   encode_seconds;
+};
+
+static delta_stats st;
+
+
+static double now_seconds()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static void end_frame()
+{
+  int len = (decoder.picture_ctrl & 0x20) ? 2048 : 512;
+  bool changed = false;
+
+  for(int b=0; b<2; b++)
+    {
+      uint8_t *prev = shadow_mem + b*DAZ_MEMSIZE, *next = dazzler_mem + b*DAZ_MEMSIZE;
+      if( memcmp(prev, next, len)==0 ) continue;
+
+      static uint8_t out[DAZ_DELTA_MAXSIZE(DAZ_MEMSIZE)];
+      double t0 = now_seconds();
+      int n = dazzler_delta_encode(prev, next, len, b, out);
+      st.encode_seconds += now_seconds()-t0;
+
+      st.fullframe_bytes += len+1;
+      st.delta_bytes     += n;
+      st.best_bytes      += n < len+1 ? n : len+1;
+
+      // the delta must turn the old contents into the new ones
+      memcpy(check_mem, shadow_mem, sizeof(check_mem));
+      dazzler_decoder_receive(&checker, out, n);
+      if( checker.recv_status!=0 || memcmp(check_mem+b*DAZ_MEMSIZE, next, len)!=0 )
+        st.errors++;
+
+      memcpy(prev, next, len);
+      changed = true;
+    }
+
+  if( changed ) st.frames++;
+}
+
+
+// the decoder's memory is consistent when these are called
+static void bench_boundary(void *ctx, int addr, int len) { end_frame(); }
+static void bench_ctrl(void *ctx, uint8_t ctrl) { end_frame(); }
+
+static const dazzler_decoder_callbacks bench_callbacks =
+  {NULL, bench_boundary, bench_ctrl, bench_ctrl, NULL, NULL, NULL};
+
+
+static void run(const char *name, const std::vector<uint8_t> &s)
+{
+  memset(&st, 0, sizeof(st));
+  memset(dazzler_mem, 0, sizeof(dazzler_mem));
+  memset(shadow_mem, 0, sizeof(shadow_mem));
+  dazzler_decoder_init(&decoder, dazzler_mem, 0, &bench_callbacks, NULL);
+  dazzler_decoder_init(&checker, check_mem, FEAT_DELTA, NULL, NULL);
+
+  dazzler_trace_reader trace;
+  bool is_trace = dazzler_trace_open(&trace, s.data(), s.size());
+
+  // raw streams are taken as received at 1050000 baud in pieces of 100 bytes
+  const uint8_t *p;
+  uint64_t t = 0, next_frame = DAZ_VSYNC_PERIOD_US;
+  size_t pos = 0;
+  int n;
+  while( true )
+    {
+      if( is_trace )
+        n = dazzler_trace_next(&trace, &p, &t);
+      else
+        {
+          n = pos<s.size() ? (int) (s.size()-pos < 100 ? s.size()-pos : 100) : -1;
+          p = s.data()+pos;
+          pos += n;
+          t = (uint64_t) pos * 10 * 1000000 / 1050000;
+        }
+      if( n<0 ) break;
+
+      dazzler_decoder_receive(&decoder, p, n);
+
+      // changes by single byte writes are collected over one frame period
+      if( t>=next_frame && !dazzler_decoder_in_frame(&decoder) )
+        {
+          end_frame();
+          next_frame = t + DAZ_VSYNC_PERIOD_US;
+        }
+    }
+  end_frame();
+
+  double f = st.frames ? (double) st.frames : 1;
+  printf("%-24s %7lu frames, bytes/frame: stream %7.1f  FULLFRAME %7.1f  DELTA %7.1f  best %7.1f (%.1f%%)  %.0f MB/s%s\n",
+         name, (unsigned long) st.frames, decoder.num_bytes/f, st.fullframe_bytes/f, st.delta_bytes/f, st.best_bytes/f,
+         st.fullframe_bytes ? 100.0*st.best_bytes/st.fullframe_bytes : 0.0,
+         st.encode_seconds>0 ? st.fullframe_bytes / st.encode_seconds / 1e6 : 0.0,
+         st.errors ? "  DECODE ERRORS" : "");
+
+  if( st.errors ) exit(1);
+}
+
+
+static void put_frame(std::vector<uint8_t> &s, const uint8_t *frame, int buffer)
+{
+  // draw into the hidden buffer, then show it
+  s.push_back(DAZ_FULLFRAME | 0x01 | (buffer ? 0x08 : 0x00));
+  s.insert(s.end(), frame, frame+DAZ_MEMSIZE);
+  s.push_back(DAZ_CTRL);
+  s.push_back(0x80 | buffer);
+}
+
+
+static void gen_sprites(std::vector<uint8_t> &s, int frames)
+{
+  // 2K color mode, fixed background, eight 4x8 byte sprites bouncing around
+  uint8_t bg[DAZ_MEMSIZE], frame[DAZ_MEMSIZE];
+  for(int i=0; i<DAZ_MEMSIZE; i++) bg[i] = ((i>>4) & 1) ? 0x11 : 0x00;
+
+  int x[8], y[8], dx[8], dy[8];
+  for(int k=0; k<8; k++) { x[k] = rand()%28; y[k] = rand()%56; dx[k] = 1; dy[k] = (k&1) ? 1 : -1; }
+
+  s.push_back(DAZ_CTRLPIC);
+  s.push_back(0x30);
+  for(int f=0; f<frames; f++)
+    {
+      memcpy(frame, bg, sizeof(frame));
+      for(int k=0; k<8; k++)
+        {
+          x[k] += dx[k]; if( x[k]<=0 || x[k]>=28 ) dx[k] = -dx[k];
+          y[k] += dy[k]; if( y[k]<=0 || y[k]>=56 ) dy[k] = -dy[k];
+          for(int j=0; j<8; j++)
+            for(int i=0; i<4; i++)
+              {
+                // byte address of column x, row y in quadrant layout
+                int cx = x[k]+i, cy = y[k]+j;
+                frame[(cy/32)*1024 + (cx/16)*512 + (cy%32)*16 + cx%16] = 0x99 + k*0x11;
+              }
+        }
+
+      put_frame(s, frame, f & 1);
+    }
+}
+
+
+static void gen_scroll(std::vector<uint8_t> &s, int frames)
+{
+  // 2K color mode, random landscape scrolling left by one byte per frame
+  uint8_t land[DAZ_MEMSIZE*2], frame[DAZ_MEMSIZE];
+  for(size_t i=0; i<sizeof(land); i++) land[i] = (rand()%4)==0 ? (rand() & 0xFF) : 0x22;
+
+  s.push_back(DAZ_CTRLPIC);
+  s.push_back(0x30);
+  for(int f=0; f<frames; f++)
+    {
+      for(int y=0; y<64; y++)
+        for(int x=0; x<32; x++)
+          frame[(y/32)*1024 + (x/16)*512 + (y%32)*16 + x%16] = land[y*64 + (x+f)%64];
+
+      put_frame(s, frame, f & 1);
+    }
+}
+
+
+static bool read_file(const char *fname, std::vector<uint8_t> &s)
+{
+  FILE *f = fopen(fname, "rb");
+  if( f==NULL ) return false;
+
+  uint8_t buf[65536];
+  size_t n;
+  while( (n=fread(buf, 1, sizeof(buf), f))>0 )
+    s.insert(s.end(), buf, buf+n);
+
+  fclose(f);
+  return true;
+}
+
+
+int main(int argc, char **argv)
+{
+  if( argc>1 && argv[1][0]=='-' )
+    {
+      fprintf(stderr, "usage: %s [recorded-stream ...]\n", argv[0]);
+      return 1;
+    }
+
+  if( argc>1 )
+    {
+      for(int i=1; i<argc; i++)
+        {
+          std::vector<uint8_t> s;
+          if( read_file(argv[i], s) )
+            run(argv[i], s);
+          else
+            fprintf(stderr, "can not read %s\n", argv[i]);
+        }
+    }
+  else
+    {
+      std::vector<uint8_t> s;
+      srand(1);
+      gen_sprites(s, 1000); run("synthetic sprites", s); s.clear();
+      gen_scroll(s, 1000);  run("synthetic scroll", s);
+    }
+
+  return 0;
+}
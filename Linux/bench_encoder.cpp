@@ -0,0 +1,314 @@
+// -----------------------------------------------------------------------------
+// Cromemco Dazzler emulation - update encoder benchmark
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+// Usage: bench_encoder [recorded-stream ...]
+//
+// Runs the update encoder (../Common/dazzler_encoder.h) over a sequence of
+// frames for several link speeds and feature sets and reports encode time
+// and bytes per frame, the link time per frame according to the cost
+// model and how often each encoding was chosen. Frames are taken from
+// traces or raw streams the same way as in bench_delta, without
+// arguments from three synthetic animations (sprites, scrolling and a
+// few bytes per frame). Every encoded frame is decoded again and checked.
+// Exits with 1 if any frame does not decode correctly.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+#include "../Common/dazzler_decoder.h"
+#include "../Common/dazzler_encoder.h"
+#include "../Common/dazzler_sched.h"
+#include "../Common/dazzler_trace.h"
+
+
+struct frame
+{
+  int     buffer, len;
+  uint8_t mem[DAZ_MEMSIZE];
+};
+
+static std::vector<frame> frames;
+static uint8_t dazzler_mem[2*DAZ_MEMSIZE], shadow_mem[2*DAZ_MEMSIZE];
+static dazzler_decoder decoder;
+
+
+static double now_seconds()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static void add_frame(const uint8_t *mem, int buffer, int len)
+{
+  frame f;
+  f.buffer = buffer;
+  f.len    = len;
+  memcpy(f.mem, mem, DAZ_MEMSIZE);
+  frames.push_back(f);
+}
+
+
+// ------------------------------------------ frames from streams ------------------------------------------
+
+
+static void end_frame()
+{
+  int len = (decoder.picture_ctrl & 0x20) ? 2048 : 512;
+  for(int b=0; b<2; b++)
+    if( memcmp(shadow_mem+b*DAZ_MEMSIZE, dazzler_mem+b*DAZ_MEMSIZE, len)!=0 )
+      {
+        add_frame(dazzler_mem+b*DAZ_MEMSIZE, b, len);
+        memcpy(shadow_mem+b*DAZ_MEMSIZE, dazzler_mem+b*DAZ_MEMSIZE, DAZ_MEMSIZE);
+      }
+}
+
+static void bench_boundary(void *ctx, int addr, int len) { end_frame(); }
+static void bench_ctrl(void *ctx, uint8_t ctrl) { end_frame(); }
+
+static const dazzler_decoder_callbacks bench_callbacks =
+  {NULL, bench_boundary, bench_ctrl, bench_ctrl, NULL, NULL, NULL};
+
+
+static void frames_from_stream(const std::vector<uint8_t> &s)
+{
+  memset(dazzler_mem, 0, sizeof(dazzler_mem));
+  memset(shadow_mem, 0, sizeof(shadow_mem));
+  dazzler_decoder_init(&decoder, dazzler_mem, 0, &bench_callbacks, NULL);
+
+  dazzler_trace_reader trace;
+  bool is_trace = dazzler_trace_open(&trace, s.data(), s.size());
+
+  // raw streams are taken as received at 1050000 baud in pieces of 100 bytes
+  const uint8_t *p;
+  uint64_t t = 0, next_frame = DAZ_VSYNC_PERIOD_US;
+  size_t pos = 0;
+  int n;
+  while( true )
+    {
+      if( is_trace )
+        n = dazzler_trace_next(&trace, &p, &t);
+      else
+        {
+          n = pos<s.size() ? (int) (s.size()-pos < 100 ? s.size()-pos : 100) : -1;
+          p = s.data()+pos;
+          pos += n;
+          t = (uint64_t) pos * 10 * 1000000 / 1050000;
+        }
+      if( n<0 ) break;
+
+      dazzler_decoder_receive(&decoder, p, n);
+      if( t>=next_frame && !dazzler_decoder_in_frame(&decoder) )
+        {
+          end_frame();
+          next_frame = t + DAZ_VSYNC_PERIOD_US;
+        }
+    }
+  end_frame();
+}
+
+
+// ------------------------------------------ synthetic frames ------------------------------------------
+
+
+static int byte_addr(int x, int y)
+{
+  // byte column x (0-31), row y (0-63) in 2K mode quadrant layout
+  return (y/32)*1024 + (x/16)*512 + (y%32)*16 + x%16;
+}
+
+
+static void frames_sprites(int n)
+{
+  // fixed background, eight 4x8 byte sprites bouncing around, double-buffered
+  uint8_t bg[DAZ_MEMSIZE], mem[DAZ_MEMSIZE];
+  for(int i=0; i<DAZ_MEMSIZE; i++) bg[i] = ((i>>4) & 1) ? 0x11 : 0x00;
+
+  int x[8], y[8], dx[8], dy[8];
+  for(int k=0; k<8; k++) { x[k] = rand()%28; y[k] = rand()%56; dx[k] = 1; dy[k] = (k&1) ? 1 : -1; }
+
+  for(int f=0; f<n; f++)
+    {
+      memcpy(mem, bg, sizeof(mem));
+      for(int k=0; k<8; k++)
+        {
+          x[k] += dx[k]; if( x[k]<=0 || x[k]>=28 ) dx[k] = -dx[k];
+          y[k] += dy[k]; if( y[k]<=0 || y[k]>=56 ) dy[k] = -dy[k];
+          for(int j=0; j<8; j++)
+            for(int i=0; i<4; i++)
+              mem[byte_addr(x[k]+i, y[k]+j)] = 0x99 + k*0x11;
+        }
+
+      add_frame(mem, f & 1, 2048);
+    }
+}
+
+
+static void frames_scroll(int n)
+{
+  // random landscape scrolling left by one byte per frame, double-buffered
+  uint8_t land[64*64], mem[DAZ_MEMSIZE];
+  for(size_t i=0; i<sizeof(land); i++) land[i] = (rand()%4)==0 ? (rand() & 0xFF) : 0x22;
+
+  for(int f=0; f<n; f++)
+    {
+      for(int y=0; y<64; y++)
+        for(int x=0; x<32; x++)
+          mem[byte_addr(x, y)] = land[y*64 + (x+f)%64];
+
+      add_frame(mem, f & 1, 2048);
+    }
+}
+
+
+static void frames_sparse(int n)
+{
+  // single buffer, a 2-byte wide "ball" moving and a few random bytes changing
+  uint8_t mem[DAZ_MEMSIZE];
+  memset(mem, 0, sizeof(mem));
+
+  int x = 0, y = 0, dx = 1, dy = 1;
+  for(int f=0; f<n; f++)
+    {
+      mem[byte_addr(x, y)] = mem[byte_addr(x+1, y)] = 0;
+      x += dx; if( x<=0 || x>=30 ) dx = -dx;
+      y += dy; if( y<=0 || y>=63 ) dy = -dy;
+      mem[byte_addr(x, y)] = mem[byte_addr(x+1, y)] = 0xFF;
+      for(int i=0; i<4; i++) mem[rand() & 0x7FF] = rand() & 0xFF;
+
+      add_frame(mem, 0, 2048);
+    }
+}
+
+
+// ------------------------------------------ benchmark ------------------------------------------
+
+
+static int run(const char *name)
+{
+  static const int bauds[] = {9600, 115200, 1050000, 0};
+  static const uint16_t feats[] = {0, FEAT_MEMBLOCK, FEAT_DELTA, FEAT_MEMBLOCK | FEAT_DELTA};
+  static const char *feat_names[] = {"base", "+MEMBLOCK", "+DELTA", "+both"};
+  int errors = 0;
+
+  printf("%s: %lu frames\n", name, (unsigned long) frames.size());
+  printf("  %-8s %-10s %9s %9s %10s %8s   %s\n", "link", "features", "enc us", "bytes", "link us", "fps", "MEMBYTE/MEMBLOCK/FULLFRAME/DELTA");
+  for(int b=0; b<4; b++)
+    for(int fs=0; fs<4; fs++)
+      {
+        dazzler_link link;
+        dazzler_link_init(&link, bauds[b], feats[fs]);
+
+        uint8_t prev[2*DAZ_MEMSIZE], check[2*DAZ_MEMSIZE];
+        memset(prev, 0, sizeof(prev));
+        dazzler_decoder checker;
+        dazzler_decoder_init(&checker, check, 0, NULL, NULL);
+
+        uint64_t bytes = 0, cost = 0, methods[DAZ_ENC_METHODS] = {0};
+        double enc = 0;
+        for(size_t i=0; i<frames.size(); i++)
+          {
+            const frame &f = frames[i];
+            uint8_t *p = prev + f.buffer*DAZ_MEMSIZE;
+
+            static uint8_t out[DAZ_ENCODE_MAXSIZE(DAZ_MEMSIZE)];
+            dazzler_encode_result res;
+            double t0 = now_seconds();
+            int n = dazzler_encode(&link, p, f.mem, f.len, f.buffer, out, &res);
+            enc += now_seconds()-t0;
+
+            // decode again starting from the previous contents
+            memcpy(check, prev, sizeof(check));
+            dazzler_decoder_receive(&checker, out, n);
+            if( n!=res.bytes || checker.recv_status!=0 || memcmp(check + f.buffer*DAZ_MEMSIZE, f.mem, f.len)!=0 )
+              errors++;
+
+            memcpy(p, f.mem, f.len);
+            bytes += n;
+            cost  += res.cost_us;
+            methods[res.method]++;
+          }
+
+        double nf = frames.empty() ? 1 : (double) frames.size();
+        char link_name[16];
+        if( bauds[b] ) snprintf(link_name, sizeof(link_name), "%i", bauds[b]); else strcpy(link_name, "USB");
+        printf("  %-8s %-10s %9.2f %9.1f %10.0f %8.1f   %lu/%lu/%lu/%lu\n", link_name, feat_names[fs],
+               enc / nf * 1e6, bytes / nf, cost / nf, cost ? 1e6 * nf / cost : 0.0,
+               (unsigned long) methods[DAZ_ENC_MEMBYTE], (unsigned long) methods[DAZ_ENC_MEMBLOCK],
+               (unsigned long) methods[DAZ_ENC_FULLFRAME], (unsigned long) methods[DAZ_ENC_DELTA]);
+      }
+
+  if( errors ) printf("  %i FRAMES DID NOT DECODE CORRECTLY\n", errors);
+  frames.clear();
+  return errors;
+}
+
+
+static bool read_file(const char *fname, std::vector<uint8_t> &s)
+{
+  FILE *f = fopen(fname, "rb");
+  if( f==NULL ) return false;
+
+  uint8_t buf[65536];
+  size_t n;
+  while( (n=fread(buf, 1, sizeof(buf), f))>0 )
+    s.insert(s.end(), buf, buf+n);
+
+  fclose(f);
+  return true;
+}
+
+
+int main(int argc, char **argv)
+{
+  int errors = 0;
+
+  if( argc>1 && argv[1][0]=='-' )
+    {
+      fprintf(stderr, "usage: %s [recorded-stream ...]\n", argv[0]);
+      return 1;
+    }
+
+  if( argc>1 )
+    {
+      for(int i=1; i<argc; i++)
+        {
+          std::vector<uint8_t> s;
+          if( read_file(argv[i], s) )
+            {
+              frames_from_stream(s);
+              errors += run(argv[i]);
+            }
+          else
+            fprintf(stderr, "can not read %s\n", argv[i]);
+        }
+    }
+  else
+    {
+      srand(1);
+      frames_sprites(1000); errors += run("synthetic sprites");
+      frames_scroll(1000);  errors += run("synthetic scroll");
+      frames_sparse(1000);  errors += run("synthetic sparse");
+    }
+
+  return errors ? 1 : 0;
+}
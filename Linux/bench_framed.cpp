@@ -0,0 +1,340 @@
+// -----------------------------------------------------------------------------
+// Cromemco Dazzler emulation - framed transfer error recovery benchmark
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+// Usage: bench_framed [-e error-rate] [-f payload] [-b baud] [-l latency_us] [-n frames] [-s seed]
+//
+// Sends a synthetic double-buffered animation (full frames, sprites
+// drawn with MEMBYTE, MEMBLOCK rows, buffer switches) in DAZ_FRAMED
+// frames of "payload" bytes (1-256) over a simulated serial link into
+// the decoder. The link damages bytes with the given probability per
+// byte (flipped bit, byte lost or extra byte inserted) and also loses
+// messages sent back to the computer. DAZ_RESEND messages reach the
+// computer "latency_us" after they were sent. The computer answers
+// them from its frame history or, if that is not possible, with a
+// keyframe (full display state in a new sequence). After the last
+// frame it repeats the last frame until the Dazzler has everything
+// (as a computer would after an idle timeout).
+// Reports the resulting overhead, how far after each damage the decoder
+// was back in sync (next frame with a correct CRC found) and checks that the final
+// display state is correct. Also measures CRC-16 throughput.
+// Exits with 1 if the final display state is wrong.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+#include <deque>
+#include "../Common/dazzler_decoder.h"
+#include "../Common/dazzler_framer.h"
+#include "../Common/dazzler_crc.h"
+
+
+struct upstream_msg
+{
+  uint64_t arrival;   // in bytes sent downstream
+  uint8_t  seq;
+};
+
+static uint8_t dazzler_mem[2*DAZ_MEMSIZE], ref_mem[2*DAZ_MEMSIZE], end_mem[2*DAZ_MEMSIZE];
+static dazzler_decoder decoder, ref, end_ref;
+static std::deque<upstream_msg> upstream;
+static uint64_t now_bytes, latency_bytes, num_resend_msgs, num_upstream_lost;
+static double error_rate;
+
+// times at which the decoder found a frame with a correct CRC
+static std::vector<uint64_t> frames_found;
+
+
+static double now_seconds()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static double random01()
+{
+  return rand() / (RAND_MAX + 1.0);
+}
+
+
+static void dazzler_send(void *ctx, const uint8_t *data, int size)
+{
+  if( data[0]==DAZ_RESEND )
+    {
+      num_resend_msgs++;
+      if( random01() < error_rate*size )
+        num_upstream_lost++;
+      else
+        {
+          upstream_msg m = {now_bytes + latency_bytes, data[1]};
+          upstream.push_back(m);
+        }
+    }
+}
+
+static const dazzler_decoder_callbacks decoder_callbacks =
+  {NULL, NULL, NULL, NULL, NULL, NULL, dazzler_send, NULL};
+
+
+static void gen_animation(std::vector<uint8_t> &s, int frames)
+{
+  s.push_back(DAZ_VERSION | 3);
+  s.push_back(DAZ_CTRLPIC);
+  s.push_back(0x30);
+
+  for(int f=0; f<frames; f++)
+    {
+      int b = f & 1;
+      if( (f % 8)==0 )
+        {
+          // new background
+          s.push_back(DAZ_FULLFRAME | 0x01 | (b ? 0x08 : 0x00));
+          for(int i=0; i<DAZ_MEMSIZE; i++) s.push_back(rand() & 0xFF);
+        }
+
+      // a few rows scrolled in
+      for(int r=0; r<4; r++)
+        {
+          int a = b*DAZ_MEMSIZE + (rand() & 0x7F0);
+          s.push_back(DAZ_MEMBLOCK | (a >> 8));
+          s.push_back(a & 0xFF);
+          s.push_back(16);
+          for(int i=0; i<16; i++) s.push_back(rand() & 0xFF);
+        }
+
+      // sprites
+      for(int i=0; i<100; i++)
+        {
+          int a = b*DAZ_MEMSIZE + (rand() & 0x7FF);
+          s.push_back(DAZ_MEMBYTE | (a >> 8));
+          s.push_back(a & 0xFF);
+          s.push_back(rand() & 0xFF);
+        }
+
+      s.push_back(DAZ_CTRL);
+      s.push_back(0x80 | b);
+    }
+}
+
+
+// send bytes over the (damaging) link, returns the number of errors
+static int link_send(const uint8_t *data, int size, std::vector<uint64_t> &errors)
+{
+  uint8_t buf[2*DAZ_FRAMER_HISTORY];
+  int n = 0, num_errors = 0;
+  for(int i=0; i<size; i++)
+    {
+      if( random01() < error_rate )
+        {
+          errors.push_back(now_bytes + n);
+          num_errors++;
+          int r = rand() % 10;
+          if( r<8 )
+            buf[n++] = data[i] ^ (1 << (rand() & 7));
+          else if( r<9 )
+            continue;
+          else
+            {
+              buf[n++] = rand() & 0xFF;
+              buf[n++] = data[i];
+            }
+        }
+      else
+        buf[n++] = data[i];
+    }
+
+  // deliver in small pieces (as a serial port would, but finer so the
+  // time a frame is found is known well enough)
+  for(int i=0; i<n; i+=16)
+    {
+      uint64_t found = decoder.num_frames + decoder.num_frames_lost;
+      dazzler_decoder_receive(&decoder, buf+i, n-i < 16 ? n-i : 16);
+      now_bytes += n-i < 16 ? n-i : 16;
+      if( decoder.num_frames + decoder.num_frames_lost != found ) frames_found.push_back(now_bytes);
+    }
+
+  return num_errors;
+}
+
+
+static void frame_and_send(dazzler_framer *fr, const uint8_t *data, int len, int payload, std::vector<uint64_t> &errors)
+{
+  uint8_t out[DAZ_FRAMED_MAXSIZE];
+  for(int i=0; i<len; i+=payload)
+    {
+      int n = len-i < payload ? len-i : payload;
+      int m = dazzler_framer_frame(fr, data+i, n, out);
+      link_send(out, m, errors);
+    }
+}
+
+
+static double crc_throughput()
+{
+  static uint8_t buf[65536];
+  for(size_t i=0; i<sizeof(buf); i++) buf[i] = rand() & 0xFF;
+
+  uint16_t crc = DAZ_CRC16_INIT;
+  double t0 = now_seconds();
+  for(int i=0; i<1024; i++)
+    crc = dazzler_crc16(crc, buf, sizeof(buf));
+  double t = now_seconds()-t0;
+
+  // use the result so the loop is not optimized away
+  if( crc==0x1234 ) printf(" ");
+  return 1024.0 * sizeof(buf) / t / 1e6;
+}
+
+
+int main(int argc, char **argv)
+{
+  int payload = 128, baud = 1050000, frames = 200, seed = 1;
+  double latency_us = 10000;
+  error_rate = 1e-4;
+
+  for(int i=1; i<argc; i++)
+    {
+      if( strcmp(argv[i], "-e")==0 && i+1<argc )
+        error_rate = atof(argv[++i]);
+      else if( strcmp(argv[i], "-f")==0 && i+1<argc )
+        payload = atoi(argv[++i]);
+      else if( strcmp(argv[i], "-b")==0 && i+1<argc )
+        baud = atoi(argv[++i]);
+      else if( strcmp(argv[i], "-l")==0 && i+1<argc )
+        latency_us = atof(argv[++i]);
+      else if( strcmp(argv[i], "-n")==0 && i+1<argc )
+        frames = atoi(argv[++i]);
+      else if( strcmp(argv[i], "-s")==0 && i+1<argc )
+        seed = atoi(argv[++i]);
+      else
+        {
+          fprintf(stderr, "usage: %s [-e error-rate] [-f payload] [-b baud] [-l latency_us] [-n frames] [-s seed]\n", argv[0]);
+          return 1;
+        }
+    }
+
+  if( payload<1 ) payload = 1;
+  if( payload>256 ) payload = 256;
+  if( baud<1 ) baud = 1;
+  latency_bytes = (uint64_t) (latency_us * baud / 10 / 1e6);
+
+  // frames on the way during a round trip
+  if( 2*latency_bytes / (payload+6) >= 128 )
+    printf("warning: more than 127 frames on the way, sequence numbers are ambiguous\n");
+
+  std::vector<uint8_t> s;
+  srand(seed);
+  gen_animation(s, frames);
+
+  // what the display should show in the end
+  dazzler_decoder_init(&end_ref, end_mem, 0, NULL, NULL);
+  dazzler_decoder_receive(&end_ref, s.data(), (int) s.size());
+
+  // "ref" is the computer's view of the display state for keyframes
+  dazzler_decoder_init(&decoder, dazzler_mem, FEAT_FRAMED, &decoder_callbacks, NULL);
+  dazzler_decoder_init(&ref, ref_mem, 0, NULL, NULL);
+  static dazzler_framer fr;
+  dazzler_framer_init(&fr);
+
+  std::vector<uint64_t> errors;
+  static uint8_t out[DAZ_FRAMER_HISTORY];
+  size_t pos = 0;
+  int idle = 0;
+  uint64_t keyframes = 0;
+  uint8_t frame[DAZ_FRAMED_MAXSIZE];
+  while( pos<s.size() || decoder.frame_seq!=fr.seq )
+    {
+      // handle DAZ_RESEND messages that have arrived
+      while( !upstream.empty() && upstream.front().arrival<=now_bytes )
+        {
+          int n = dazzler_framer_resend(&fr, upstream.front().seq, out);
+          upstream.pop_front();
+          if( n>0 )
+            link_send(out, n, errors);
+          else if( n<0 )
+            {
+              // finish the current command, then restore the display state
+              while( pos<s.size() && ref.recv_status!=0 )
+                dazzler_decoder_receive(&ref, s.data()+pos++, 1);
+
+              uint8_t k[DAZ_KEYFRAME_SIZE];
+              frame_and_send(&fr, k, dazzler_decoder_keyframe(&ref, k), payload, errors);
+              keyframes++;
+            }
+        }
+
+      if( pos<s.size() )
+        {
+          int n = s.size()-pos < (size_t) payload ? (int) (s.size()-pos) : payload;
+          dazzler_decoder_receive(&ref, s.data()+pos, n);
+          int m = dazzler_framer_frame(&fr, s.data()+pos, n, frame);
+          link_send(frame, m, errors);
+          pos += n;
+        }
+      else if( !upstream.empty() )
+        now_bytes = upstream.front().arrival;
+      else if( decoder.frame_seq!=fr.seq )
+        {
+          // idle timeout: repeat the last frame so the Dazzler notices
+          // anything missing
+          if( ++idle>1000 ) break;
+          now_bytes += latency_bytes;
+          int n = dazzler_framer_resend(&fr, fr.seq-1, out);
+          if( n>0 ) link_send(out, n, errors);
+        }
+    }
+
+  // how long after each error did the decoder find a good frame again
+  // (frames repeated after DAZ_RESEND and not needed are not counted,
+  // so this is on the high side)
+  uint64_t resync_sum = 0, resync_max = 0, resync_n = 0;
+  size_t j = 0;
+  for(size_t i=0; i<errors.size(); i++)
+    {
+      while( j<frames_found.size() && frames_found[j]<=errors[i] ) j++;
+      if( j==frames_found.size() ) break;
+      uint64_t d = frames_found[j]-errors[i];
+      resync_sum += d;
+      if( d>resync_max ) resync_max = d;
+      resync_n++;
+    }
+
+  printf("%lu bytes in %i-byte frames at %i baud, error rate %g, latency %.1fms\n",
+         (unsigned long) s.size(), payload, baud, error_rate, latency_us/1000);
+  printf("sent %lu bytes (%.1f%% overhead), %lu errors injected\n",
+         (unsigned long) now_bytes, 100.0*now_bytes/s.size()-100, (unsigned long) errors.size());
+  printf("frames: %lu sent, %lu accepted, %lu damaged, %lu discarded, %lu resent, %lu keyframes\n",
+         (unsigned long) fr.num_frames, (unsigned long) decoder.num_frames, (unsigned long) decoder.num_frame_errors,
+         (unsigned long) decoder.num_frames_lost, (unsigned long) fr.num_resent, (unsigned long) keyframes);
+  printf("DAZ_RESEND: %lu sent, %lu lost\n", (unsigned long) num_resend_msgs, (unsigned long) num_upstream_lost);
+  if( resync_n>0 )
+    printf("back in sync after damage: %.1f bytes average, %lu maximum (frame size %i)\n",
+           (double) resync_sum/resync_n, (unsigned long) resync_max, payload+6);
+  printf("CRC-16: %.1f MB/s\n", crc_throughput());
+
+  bool ok = memcmp(dazzler_mem, end_mem, sizeof(end_mem))==0 && decoder.ctrl==end_ref.ctrl &&
+    decoder.picture_ctrl==end_ref.picture_ctrl;
+  if( decoder.frame_seq!=fr.seq )
+    printf("gave up, the Dazzler is still missing frames (error rate too high for the frame size and latency)\n");
+  printf("display state %s\n", ok ? "correct" : "WRONG");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,151 @@
+// -----------------------------------------------------------------------------
+// Cromemco Dazzler emulation - frame handoff stress test
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+// Usage: bench_handoff [-n frames]
+//
+// A writer thread decodes a stream of full frames (every byte of frame k
+// has value k) interleaved with MEMBYTE commands and publishes the state
+// after each full frame. A reader thread takes frames as fast as it can
+// and checks that
+//  - no frame is torn (all bytes of the full frame area are equal),
+//  - frames arrive in order,
+//  - applying only the dirty bytes of each frame to a private copy
+//    reproduces the frame exactly (i.e. dirty bits of dropped frames
+//    are carried over).
+// Exits with 1 if any check fails.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include "../Common/dazzler_handoff.h"
+
+
+static uint8_t dazzler_mem[2*DAZ_MEMSIZE];
+static dazzler_decoder decoder;
+static dazzler_handoff handoff;
+static std::atomic<bool> done(false);
+
+
+static double now_seconds()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static void publish_fullframe(void *ctx, int addr, int len)
+{
+  dazzler_handoff_publish(&handoff, &decoder);
+}
+
+
+static void reader(long *taken, long *errors)
+{
+  static uint8_t shadow[2*DAZ_MEMSIZE];
+  uint32_t last_seq = 0;
+
+  while( true )
+    {
+      bool finished = done.load();
+      const dazzler_frame *f = dazzler_handoff_take(&handoff);
+      if( f==NULL )
+        {
+          if( finished ) break;
+          continue;
+        }
+
+      (*taken)++;
+      if( f->seq<=last_seq ) (*errors)++;
+      last_seq = f->seq;
+
+      // buffer 1 gets full frames, all bytes must be equal
+      for(int i=1; i<DAZ_MEMSIZE; i++)
+        if( f->mem[DAZ_MEMSIZE+i]!=f->mem[DAZ_MEMSIZE] ) { (*errors)++; break; }
+
+      // apply dirty bytes only, must reproduce the frame
+      for(int i=0; i<2*DAZ_MEMSIZE; i++)
+        if( f->dirty[i>>5] & (1u << (i&31)) )
+          shadow[i] = f->mem[i];
+
+      if( memcmp(shadow, f->mem, sizeof(shadow))!=0 ) (*errors)++;
+    }
+}
+
+
+int main(int argc, char **argv)
+{
+  int frames = 200000;
+
+  for(int i=1; i<argc; i++)
+    {
+      if( strcmp(argv[i], "-n")==0 && i+1<argc )
+        frames = atoi(argv[++i]);
+      else
+        {
+          fprintf(stderr, "usage: %s [-n frames]\n", argv[0]);
+          return 1;
+        }
+    }
+
+  static const dazzler_decoder_callbacks callbacks = {NULL, publish_fullframe, NULL, NULL, NULL, NULL, NULL};
+  dazzler_decoder_init(&decoder, dazzler_mem, 0, &callbacks, NULL);
+  dazzler_handoff_init(&handoff);
+
+  // each chunk: a few random MEMBYTEs into buffer 0, then a 2K full frame into buffer 1
+  std::vector<uint8_t> chunk;
+  long taken = 0, errors = 0;
+  std::thread reader_thread(reader, &taken, &errors);
+
+  srand(1);
+  double t0 = now_seconds();
+  for(int k=1; k<=frames; k++)
+    {
+      chunk.clear();
+      for(int j=0; j<4; j++)
+        {
+          int a = rand() & 0x7FF;
+          chunk.push_back(DAZ_MEMBYTE | (a>>8));
+          chunk.push_back(a & 0xFF);
+          chunk.push_back(rand() & 0xFF);
+        }
+
+      chunk.push_back(DAZ_FULLFRAME | 0x09);
+      chunk.insert(chunk.end(), DAZ_MEMSIZE, (uint8_t) k);
+
+      // feed in pieces like the serial thread does
+      for(size_t i=0; i<chunk.size(); i+=100)
+        dazzler_decoder_receive(&decoder, chunk.data()+i, chunk.size()-i < 100 ? chunk.size()-i : 100);
+    }
+  double t = now_seconds()-t0;
+
+  done.store(true);
+  reader_thread.join();
+
+  printf("%lu frames published in %.2fs (%.2f us/publish), %li taken, %lu dropped\n",
+         (unsigned long) handoff.num_published, t, t * 1e6 / handoff.num_published,
+         taken, (unsigned long) handoff.num_dropped);
+  printf("%li errors\n", errors);
+
+  return errors ? 1 : 0;
+}
@@ -0,0 +1,235 @@
+// -----------------------------------------------------------------------------
+// Cromemco Dazzler emulation - DAZ_RECT benchmark and check
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+// Usage: bench_rect [-n commands] [-s seed]
+//
+// Checks DAZ_RECT (FILL, COPY, SCROLL) in the decoder against a simple
+// model that keeps each buffer as 64 rows of 32 bytes, located in memory
+// the way get_pixel_128x128() in the firmware finds them. Random commands
+// (many of them spanning quadrants, overlapping COPYs, SCROLLs in all
+// directions) are decoded and memory and dirty bits are compared after
+// each one. Then compares the link bytes of typical operations as
+// DAZ_RECT with the cheapest encoding without it (../Common/dazzler_encoder.h
+// at 1050000 baud) and times the decoder for each of them.
+// Exits with 1 on any mismatch.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../Common/dazzler_decoder.h"
+#include "../Common/dazzler_encoder.h"
+#include "../Common/dazzler_rect.h"
+
+
+static uint8_t dazzler_mem[2*DAZ_MEMSIZE], prev_mem[2*DAZ_MEMSIZE];
+static uint8_t model[2][DAZ_RECT_ROWS][DAZ_RECT_COLS];
+
+
+static double now_seconds()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+// memory address of the byte holding x4 resolution pixel x/y (0-127),
+// as get_pixel_128x128() in the firmware computes it
+static int pixel_addr(int x, int y)
+{
+  int addr = (y&62)*8 + ((x&63)/4);
+  if( x>=64 ) addr += 512;
+  if( y>=64 ) addr += 1024;
+  return addr;
+}
+
+
+static int model_addr(int buffer, int col, int row)
+{
+  // each byte covers 4x2 pixels
+  return buffer*DAZ_MEMSIZE + pixel_addr(col*4, row*2);
+}
+
+
+static void model_rect(const uint8_t *cmd)
+{
+  int op = cmd[0] & 0x0F;
+  int b = cmd[1]>>7, x = cmd[1]&31, y = cmd[2]&63, w = cmd[3], h = cmd[4];
+  static uint8_t tmp[DAZ_RECT_ROWS][DAZ_RECT_COLS];
+
+  if( op==0 )
+    {
+      for(int r=y; r<y+h && r<DAZ_RECT_ROWS; r++)
+        for(int c=x; c<x+w && c<DAZ_RECT_COLS; c++)
+          model[b][r][c] = cmd[5];
+    }
+  else if( op==1 )
+    {
+      int b2 = cmd[5]>>7, x2 = cmd[5]&31, y2 = cmd[6]&63;
+      memcpy(tmp, model[b], sizeof(tmp));
+      for(int r=0; r<h && y+r<DAZ_RECT_ROWS && y2+r<DAZ_RECT_ROWS; r++)
+        for(int c=0; c<w && x+c<DAZ_RECT_COLS && x2+c<DAZ_RECT_COLS; c++)
+          model[b2][y2+r][x2+c] = tmp[y+r][x+c];
+    }
+  else
+    {
+      int dx = (int8_t) cmd[5], dy = (int8_t) cmd[6];
+      memcpy(tmp, model[b], sizeof(tmp));
+      for(int r=y; r<y+h && r<DAZ_RECT_ROWS; r++)
+        for(int c=x; c<x+w && c<DAZ_RECT_COLS; c++)
+          {
+            int sr = r-dy, sc = c-dx;
+            bool inside = sr>=y && sr<y+h && sr<DAZ_RECT_ROWS && sc>=x && sc<x+w && sc<DAZ_RECT_COLS;
+            model[b][r][c] = inside ? tmp[sr][sc] : cmd[7];
+          }
+    }
+}
+
+
+static bool check(dazzler_decoder *d)
+{
+  bool ok = true;
+  for(int b=0; b<2; b++)
+    for(int r=0; r<DAZ_RECT_ROWS; r++)
+      for(int c=0; c<DAZ_RECT_COLS; c++)
+        {
+          int a = model_addr(b, c, r);
+          if( dazzler_mem[a]!=model[b][r][c] ) ok = false;
+
+          // every byte that changed must be marked dirty
+          bool dirty = (d->dirty.bits[a>>5].load() >> (a&31)) & 1;
+          if( dazzler_mem[a]!=prev_mem[a] && !dirty ) ok = false;
+        }
+
+  dazzler_dirty_clear(&d->dirty);
+  memcpy(prev_mem, dazzler_mem, sizeof(dazzler_mem));
+  return ok;
+}
+
+
+static int random_cmd(uint8_t *cmd)
+{
+  int b = rand()&1, x = rand()&31, y = rand()&63;
+  int w = 1+rand()%32, h = 1+rand()%64;
+  switch( rand()%3 )
+    {
+    case 0:  return dazzler_rect_fill(cmd, b, x, y, w, h, rand() & 0xFF);
+    case 1:
+      {
+        // mostly overlapping copies within the same buffer
+        int b2 = (rand()%4)==0 ? !b : b;
+        int x2 = (x + rand()%9-4) & 31, y2 = (y + rand()%9-4) & 63;
+        return dazzler_rect_copy(cmd, b, x, y, w, h, b2, x2, y2);
+      }
+    default: return dazzler_rect_scroll(cmd, b, x, y, w, h, rand()%11-5, rand()%11-5, rand() & 0xFF);
+    }
+}
+
+
+struct rect_case
+{
+  const char *name;
+  uint8_t cmd[DAZ_RECT_MAXSIZE];
+  int len;
+};
+
+
+int main(int argc, char **argv)
+{
+  int n = 100000;
+  for(int i=1; i<argc; i++)
+    {
+      if( strcmp(argv[i], "-n")==0 && i+1<argc )
+        n = atoi(argv[++i]);
+      else if( strcmp(argv[i], "-s")==0 && i+1<argc )
+        srand(atoi(argv[++i]));
+      else
+        {
+          fprintf(stderr, "usage: %s [-n commands] [-s seed]\n", argv[0]);
+          return 1;
+        }
+    }
+
+  dazzler_decoder d;
+  dazzler_decoder_init(&d, dazzler_mem, FEAT_VIDEO | FEAT_RECT, NULL, NULL);
+  for(int a=0; a<2*DAZ_MEMSIZE; a++) dazzler_mem[a] = rand() & 0xFF;
+  for(int b=0; b<2; b++)
+    for(int r=0; r<DAZ_RECT_ROWS; r++)
+      for(int c=0; c<DAZ_RECT_COLS; c++)
+        model[b][r][c] = dazzler_mem[model_addr(b, c, r)];
+  memcpy(prev_mem, dazzler_mem, sizeof(dazzler_mem));
+
+  // random commands, fed in pieces of random size
+  int errors = 0;
+  for(int i=0; i<n; i++)
+    {
+      uint8_t cmd[DAZ_RECT_MAXSIZE];
+      int len = random_cmd(cmd);
+      for(int p=0; p<len; )
+        {
+          int k = 1 + rand()%(len-p);
+          dazzler_decoder_receive(&d, cmd+p, k);
+          p += k;
+        }
+
+      model_rect(cmd);
+      if( !check(&d) && errors++ < 10 )
+        printf("mismatch after command %i: %02X %02X %02X %02X %02X\n", i, cmd[0], cmd[1], cmd[2], cmd[3], cmd[4]);
+    }
+  printf("%i random commands: %i mismatches\n", n, errors);
+
+  // typical operations, on random contents (worst case for the other encodings)
+  rect_case cases[5];
+  cases[0].name = "clear 16x32 centered";
+  cases[0].len  = dazzler_rect_fill(cases[0].cmd, 0, 8, 16, 16, 32, 0);
+  cases[1].name = "clear buffer";
+  cases[1].len  = dazzler_rect_fill(cases[1].cmd, 0, 0, 0, 32, 64, 0);
+  cases[2].name = "scroll screen up 1 row";
+  cases[2].len  = dazzler_rect_scroll(cases[2].cmd, 0, 0, 0, 32, 64, 0, -1, 0);
+  cases[3].name = "scroll 24x40 left 1";
+  cases[3].len  = dazzler_rect_scroll(cases[3].cmd, 0, 4, 12, 24, 40, -1, 0, 0);
+  cases[4].name = "copy 4x8 sprite";
+  cases[4].len  = dazzler_rect_copy(cases[4].cmd, 1, 0, 0, 4, 8, 0, 14, 30);
+
+  dazzler_link link;
+  dazzler_link_init(&link, 1050000, FEAT_MEMBLOCK | FEAT_DELTA);
+  static uint8_t out[DAZ_ENCODE_MAXSIZE(DAZ_MEMSIZE)];
+
+  printf("\n%-24s %6s %12s %14s\n", "operation", "RECT", "best other", "decode us/op");
+  for(int i=0; i<5; i++)
+    {
+      for(int a=0; a<2*DAZ_MEMSIZE; a++) dazzler_mem[a] = rand() & 0xFF;
+      memcpy(prev_mem, dazzler_mem, sizeof(dazzler_mem));
+      dazzler_decoder_receive(&d, cases[i].cmd, cases[i].len);
+
+      dazzler_encode_result res;
+      dazzler_encode(&link, prev_mem, dazzler_mem, DAZ_MEMSIZE, 0, out, &res);
+
+      int loops = 20000;
+      double t0 = now_seconds();
+      for(int k=0; k<loops; k++)
+        dazzler_decoder_receive(&d, cases[i].cmd, cases[i].len);
+      double t = now_seconds()-t0;
+
+      printf("%-24s %6i %12i %14.2f\n", cases[i].name, cases[i].len, res.bytes, t/loops*1e6);
+    }
+
+  return errors>0 ? 1 : 0;
+}
@@ -0,0 +1,252 @@
+// -----------------------------------------------------------------------------
+// Cromemco Dazzler emulation - framebuffer renderer benchmark
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+// Usage: bench_render [-n frames] [-p prefix]
+//
+// Renders random video memory in all graphics modes and reports the
+// time per frame. With -p, the last frame of each mode is also written
+// to <prefix>-<mode>.ppm for visual inspection.
+// Afterwards, each x4 expansion kernel supported by this CPU is checked
+// to be bit-exact against the scalar kernel and timed on its own.
+// Then incremental redraw is timed with a few bytes changing per
+// frame and checked against a full render of the same memory.
+// Finally the indexed renderer is checked against the RGBA renderer and
+// integer scaling of the indexed picture is timed for common output sizes.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+#include "../Common/dazzler_proto.h"
+#include "../Common/dazzler_render.h"
+#include "../Common/dazzler_scale.h"
+
+
+static double now_seconds()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static void write_ppm(const char *fname, const uint32_t *frame)
+{
+  FILE *f = fopen(fname, "wb");
+  if( f==NULL ) return;
+
+  fprintf(f, "P6\n%i %i\n255\n", DAZ_WIDTH, DAZ_HEIGHT);
+  for(int i=0; i<DAZ_WIDTH*DAZ_HEIGHT; i++)
+    {
+      uint8_t rgb[3] = {(uint8_t) frame[i], (uint8_t) (frame[i]>>8), (uint8_t) (frame[i]>>16)};
+      fwrite(rgb, 1, 3, f);
+    }
+
+  fclose(f);
+}
+
+
+int main(int argc, char **argv)
+{
+  static const struct { uint8_t pc; const char *name; } modes[] =
+    {{0x30, "2k-normal-color"},  {0x20, "2k-normal-gray"},
+     {0x10, "512-normal-color"}, {0x00, "512-normal-gray"},
+     {0x7B, "2k-x4-color"},      {0x6F, "2k-x4-gray"},
+     {0x5B, "512-x4-color"},     {0x4F, "512-x4-gray"}};
+
+  int frames = 20000;
+  const char *prefix = NULL;
+
+  for(int i=1; i<argc; i++)
+    {
+      if( strcmp(argv[i], "-n")==0 && i+1<argc )
+        frames = atoi(argv[++i]);
+      else if( strcmp(argv[i], "-p")==0 && i+1<argc )
+        prefix = argv[++i];
+      else
+        {
+          fprintf(stderr, "usage: %s [-n frames] [-p prefix]\n", argv[0]);
+          return 1;
+        }
+    }
+
+  // a few different memory images so the renderer can't cache anything
+  static uint8_t mem[8][DAZ_MEMSIZE];
+  srand(1);
+  for(int i=0; i<8; i++)
+    for(int j=0; j<DAZ_MEMSIZE; j++)
+      mem[i][j] = rand() & 0xFF;
+
+  static uint32_t frame[DAZ_WIDTH*DAZ_HEIGHT];
+  dazzler_renderer r;
+  dazzler_render_init(&r);
+
+  for(unsigned m=0; m<sizeof(modes)/sizeof(modes[0]); m++)
+    {
+      uint32_t check = 0;
+      double t0 = now_seconds();
+      for(int i=0; i<frames; i++)
+        {
+          dazzler_render_frame(&r, mem[i&7], modes[m].pc, frame, DAZ_WIDTH);
+          check += frame[(i*37) & (DAZ_WIDTH*DAZ_HEIGHT-1)];
+        }
+      double t = now_seconds()-t0;
+
+      printf("%-18s %8.2f us/frame  (check %08x)\n", modes[m].name, t * 1e6 / frames, check);
+
+      if( prefix!=NULL )
+        {
+          char fname[256];
+          snprintf(fname, sizeof(fname), "%s-%s.ppm", prefix, modes[m].name);
+          write_ppm(fname, frame);
+        }
+    }
+
+  // check and time the x4 resolution kernels
+  int nkernels;
+  const dazzler_x4_kernel *const *kernels = dazzler_x4_supported(&nkernels);
+  static uint8_t  ref_idx[DAZ_WIDTH*DAZ_HEIGHT], idx[DAZ_WIDTH*DAZ_HEIGHT];
+  static uint32_t ref_rgba[DAZ_WIDTH*DAZ_HEIGHT];
+  int errors = 0;
+
+  printf("\nx4 kernels (best: %s)\n", dazzler_x4_select()->name);
+  for(int k=0; k<nkernels; k++)
+    {
+      int mismatches = 0;
+      for(int i=0; i<8; i++)
+        {
+          uint8_t color = (uint8_t) (i*5+3) & 0x0F;
+          uint32_t fg = DAZ_RGBA(i*30, 255-i*30, i*7), bg = DAZ_RGBA(0, i, 0);
+          kernels[0]->expand_indexed(mem[i], color, ref_idx);
+          kernels[k]->expand_indexed(mem[i], color, idx);
+          if( memcmp(ref_idx, idx, sizeof(idx))!=0 ) mismatches++;
+          kernels[0]->expand_rgba(mem[i], fg, bg, ref_rgba, DAZ_WIDTH);
+          kernels[k]->expand_rgba(mem[i], fg, bg, frame, DAZ_WIDTH);
+          if( memcmp(ref_rgba, frame, sizeof(frame))!=0 ) mismatches++;
+        }
+
+      double t0 = now_seconds();
+      for(int i=0; i<frames; i++) kernels[k]->expand_indexed(mem[i&7], 0x0F, idx);
+      double t1 = now_seconds();
+      for(int i=0; i<frames; i++) kernels[k]->expand_rgba(mem[i&7], DAZ_RGBA(255,255,255), DAZ_RGBA(0,0,0), frame, DAZ_WIDTH);
+      double t2 = now_seconds();
+
+      printf("%-18s %8.2f us/frame indexed %8.2f us/frame rgba  %s\n", kernels[k]->name,
+             (t1-t0) * 1e6 / frames, (t2-t1) * 1e6 / frames, mismatches ? "MISMATCH" : "bit-exact");
+      errors += mismatches;
+    }
+
+  // incremental redraw, 8 bytes change per frame (typical for games)
+  static uint32_t full[DAZ_WIDTH*DAZ_HEIGHT];
+  static uint8_t  imem[DAZ_MEMSIZE];
+  static dazzler_dirty dirty;
+  uint32_t bits[DAZ_DIRTY_WORDS];
+
+  printf("\nincremental redraw (8 bytes changed per frame)\n");
+  for(unsigned m=0; m<sizeof(modes)/sizeof(modes[0]); m++)
+    {
+      uint8_t pc = modes[m].pc;
+      memcpy(imem, mem[0], DAZ_MEMSIZE);
+      dazzler_dirty_clear(&dirty);
+      dazzler_render_frame(&r, imem, pc, frame, DAZ_WIDTH);
+
+      long cells = 0;
+      double t = 0;
+      for(int i=0; i<frames; i++)
+        {
+          for(int j=0; j<8; j++)
+            {
+              int a = rand() % ((pc & 0x20) ? DAZ_MEMSIZE : 512);
+              imem[a] = rand() & 0xFF;
+              dazzler_dirty_set(&dirty, a);
+            }
+
+          double t0 = now_seconds();
+          dazzler_dirty_take(&dirty, 0, bits);
+          cells += dazzler_render_update(&r, imem, pc, bits, frame, DAZ_WIDTH);
+          t += now_seconds()-t0;
+        }
+
+      dazzler_render_frame(&r, imem, pc, full, DAZ_WIDTH);
+      bool ok = memcmp(full, frame, sizeof(frame))==0;
+      printf("%-18s %8.2f us/frame %6.2f cells/frame  %s\n", modes[m].name,
+             t * 1e6 / frames, (double) cells / frames, ok ? "ok" : "MISMATCH");
+      if( !ok ) errors++;
+    }
+
+  // indexed rendering and scaling
+  static uint8_t  indexed[DAZ_WIDTH*DAZ_HEIGHT];
+  const uint32_t *palette = &r.palette[0][0];
+
+  printf("\nindexed render\n");
+  for(unsigned m=0; m<sizeof(modes)/sizeof(modes[0]); m++)
+    {
+      dazzler_render_frame(&r, mem[m], modes[m].pc, frame, DAZ_WIDTH);
+      dazzler_render_indexed(&r, mem[m], modes[m].pc, indexed);
+
+      bool ok = true;
+      for(int i=0; i<DAZ_WIDTH*DAZ_HEIGHT && ok; i++)
+        ok = palette[indexed[i]]==frame[i];
+
+      printf("%-18s %s\n", modes[m].name, ok ? "ok" : "MISMATCH");
+      if( !ok ) errors++;
+    }
+
+  static const struct { int w, h, aspect; const char *name; } outputs[] =
+    {{512, 512, DAZ_ASPECT_11, "512x512 1:1"}, {1920, 1080, DAZ_ASPECT_11, "1920x1080 1:1"},
+     {1920, 1080, DAZ_ASPECT_43, "1920x1080 4:3"}, {3840, 2160, DAZ_ASPECT_11, "3840x2160 1:1"},
+     {3840, 2160, DAZ_ASPECT_WIN, "3840x2160 stretch"}, {100, 90, DAZ_ASPECT_11, "100x90 (clipped)"}};
+
+  dazzler_render_indexed(&r, mem[0], 0x30, indexed);
+  dazzler_scaler sc;
+  dazzler_scale_init(&sc, palette);
+
+  printf("\ninteger scaling (full frame / 8 rows)\n");
+  for(unsigned o=0; o<sizeof(outputs)/sizeof(outputs[0]); o++)
+    {
+      int w = outputs[o].w, h = outputs[o].h;
+      std::vector<uint32_t> out(w*h, 0x12345678);
+      dazzler_scale_set_geometry(&sc, w, h, outputs[o].aspect);
+      dazzler_scale_borders(&sc, out.data(), w);
+
+      int n = frames/100 > 10 ? frames/100 : 10;
+      double t0 = now_seconds();
+      for(int i=0; i<n; i++) dazzler_scale_rows(&sc, indexed, 0, DAZ_HEIGHT, out.data(), w);
+      double t1 = now_seconds();
+      for(int i=0; i<n; i++) dazzler_scale_rows(&sc, indexed, 60, 68, out.data(), w);
+      double t2 = now_seconds();
+
+      bool ok = true;
+      for(int y=0; y<h && ok; y++)
+        for(int x=0; x<w && ok; x++)
+          {
+            uint32_t expected = DAZ_RGBA(0, 0, 0);
+            if( x>=sc.x0 && x<sc.x0+sc.w && y>=sc.y0 && y<sc.y0+sc.h )
+              expected = palette[indexed[((y-sc.y0)/sc.sy)*DAZ_WIDTH + (x-sc.x0)/sc.sx]];
+            ok = out[y*w+x]==expected;
+          }
+
+      printf("%-18s %2ix%-2i %8.2f us/frame %8.2f us/8 rows  %s\n", outputs[o].name, sc.sx, sc.sy,
+             (t1-t0) * 1e6 / n, (t2-t1) * 1e6 / n, ok ? "ok" : "MISMATCH");
+      if( !ok ) errors++;
+    }
+
+  return errors ? 1 : 0;
+}
@@ -0,0 +1,367 @@
+// -----------------------------------------------------------------------------
+// Cromemco Dazzler emulation - shadow memory benchmark
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+// Usage: bench_shadow [-n frames] [trace ...]
+//
+// Sends the video memory writes of each trace file (see dazzler_replay)
+// through the shadow memory (../Common/dazzler_shadow.h), flushing every
+// DAZ_VSYNC_PERIOD_US of trace time and before any other command. Without
+// arguments it uses three synthetic games: one that redraws its whole
+// playfield every frame and moves sprites over it, one that clears and
+// redraws its back buffer every frame and flips buffers, and one that
+// rewrites its score line every frame although it rarely changes.
+// The result is decoded again and must give the same video memory as
+// the original stream at every flush. Reports how many writes were
+// suppressed (value already there) or coalesced (overwritten before the
+// flush), stream bytes with and without the shadow and the time per
+// write. Exits with 1 on a mismatch.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+#include "../Common/dazzler_decoder.h"
+#include "../Common/dazzler_trace.h"
+#include "../Common/dazzler_sched.h"
+#include "../Common/dazzler_shadow.h"
+
+struct record
+{
+  uint64_t t_us;
+  std::vector<uint8_t> data;
+};
+
+static uint8_t in_mem[2*DAZ_MEMSIZE], out_mem[2*DAZ_MEMSIZE];
+static dazzler_decoder in, out;
+static dazzler_shadow shadow;
+static std::vector<uint8_t> out_stream;
+static std::vector<int> writes;    // address or -1 for a flush, for timing
+static uint64_t mismatches;
+
+
+static double now_seconds()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static void emit(const uint8_t *data, int n)
+{
+  out_stream.insert(out_stream.end(), data, data+n);
+  dazzler_decoder_receive(&out, data, n);
+}
+
+
+static void flush()
+{
+  static uint8_t buf[DAZ_SHADOW_MAXFLUSH];
+  emit(buf, dazzler_shadow_flush(&shadow, buf));
+  writes.push_back(-1);
+
+  if( memcmp(in_mem, out_mem, sizeof(in_mem))!=0 )
+    {
+      if( mismatches++==0 )
+        for(int i=0; i<2*DAZ_MEMSIZE; i++)
+          if( in_mem[i]!=out_mem[i] )
+            {
+              printf("  mismatch at %03X: %02X instead of %02X\n", i, out_mem[i], in_mem[i]);
+              break;
+            }
+    }
+}
+
+
+static void cb_membyte(void *ctx, int addr, uint8_t value)
+{
+  dazzler_shadow_write(&shadow, addr, value);
+  writes.push_back((addr << 8) | value);
+}
+
+
+static void cb_fullframe(void *ctx, int addr, int len)
+{
+  // DAZ_DELTA and DAZ_CHUNK frames also go on as DAZ_FULLFRAME
+  uint8_t cmd = DAZ_FULLFRAME | (len==DAZ_MEMSIZE ? 0x01 : 0) | (addr>=DAZ_MEMSIZE ? 0x08 : 0);
+  dazzler_shadow_set(&shadow, addr, in_mem+addr, len);
+  flush();
+  emit(&cmd, 1);
+  emit(in_mem+addr, len);
+}
+
+
+static void cb_memblock(void *ctx, int addr, int len)
+{
+  uint8_t buf[3+256];
+  buf[0] = DAZ_MEMBLOCK | ((addr >> 8) & 0x0F);
+  buf[1] = addr & 0xFF;
+  buf[2] = len & 0xFF;
+  for(int i=0; i<len; i++)
+    buf[3+i] = in_mem[(addr+i) & (2*DAZ_MEMSIZE-1)];
+  dazzler_shadow_set(&shadow, addr, buf+3, len);
+  flush();
+  emit(buf, 3+len);
+}
+
+
+static void cb_ctrl(void *ctx, uint8_t ctrl)
+{
+  uint8_t buf[2] = {DAZ_CTRL, ctrl};
+  flush();
+  emit(buf, 2);
+}
+
+
+static void cb_ctrlpic(void *ctx, uint8_t picture_ctrl)
+{
+  uint8_t buf[2] = {DAZ_CTRLPIC, picture_ctrl};
+  flush();
+  emit(buf, 2);
+}
+
+
+static void cb_dac(void *ctx, int channel, uint16_t delay_us, uint8_t sample)
+{
+  uint8_t buf[4] = {(uint8_t) (DAZ_DAC | channel), (uint8_t) (delay_us & 0xFF), (uint8_t) (delay_us >> 8), sample};
+  emit(buf, 4);
+}
+
+
+static const dazzler_decoder_callbacks in_callbacks =
+  {cb_membyte, cb_fullframe, cb_ctrl, cb_ctrlpic, cb_dac, NULL, NULL, cb_memblock, NULL};
+
+
+static bool run(const char *name, const std::vector<record> &src)
+{
+  memset(in_mem, 0, sizeof(in_mem));
+  memset(out_mem, 0, sizeof(out_mem));
+  dazzler_decoder_init(&in, in_mem, FEAT_VIDEO | FEAT_MEMBLOCK | FEAT_DELTA | FEAT_CHUNK, &in_callbacks, NULL);
+  dazzler_decoder_init(&out, out_mem, FEAT_VIDEO | FEAT_MEMBLOCK, NULL, NULL);
+  dazzler_shadow_init(&shadow, in_mem);
+  out_stream.clear();
+  writes.clear();
+  mismatches = 0;
+
+  uint64_t in_bytes = 0, vsync_us = 0, frames = 0;
+  for(size_t i=0; i<src.size(); i++)
+    {
+      if( src[i].t_us>=vsync_us )
+        {
+          if( i>0 ) { flush(); frames++; }
+          vsync_us = (src[i].t_us/DAZ_VSYNC_PERIOD_US + 1) * DAZ_VSYNC_PERIOD_US;
+        }
+
+      dazzler_decoder_receive(&in, src[i].data.data(), (int) src[i].data.size());
+      in_bytes += src[i].data.size();
+    }
+  flush();
+  frames++;
+
+  // time the shadow alone on the same writes
+  int loops = (int) (2000000 / (writes.size()+1)) + 1;
+  static uint8_t buf[DAZ_SHADOW_MAXFLUSH];
+  dazzler_shadow s;
+  double t0 = now_seconds();
+  for(int l=0; l<loops; l++)
+    {
+      dazzler_shadow_init(&s, shadow.mem);
+      for(size_t i=0; i<writes.size(); i++)
+        if( writes[i]<0 )
+          dazzler_shadow_flush(&s, buf);
+        else
+          dazzler_shadow_write(&s, writes[i] >> 8, writes[i] & 0xFF);
+    }
+  double t = now_seconds()-t0;
+
+  uint64_t w = shadow.num_writes;
+  printf("%s: %lu flushes, %lu writes\n", name, (unsigned long) frames, (unsigned long) w);
+  printf("  suppressed %lu (%.1f%%), coalesced %lu (%.1f%%), sent %lu (%.1f%%)\n",
+         (unsigned long) shadow.num_suppressed, w ? 100.0*shadow.num_suppressed/w : 0.0,
+         (unsigned long) shadow.num_coalesced, w ? 100.0*shadow.num_coalesced/w : 0.0,
+         (unsigned long) shadow.num_sent, w ? 100.0*shadow.num_sent/w : 0.0);
+  printf("  stream bytes %lu -> %lu (%.1f%%), %.1f ns per write\n",
+         (unsigned long) in_bytes, (unsigned long) out_stream.size(),
+         in_bytes ? 100.0*out_stream.size()/in_bytes : 0.0,
+         writes.size() ? t*1e9/((double) loops*writes.size()) : 0.0);
+
+  if( mismatches>0 )
+    printf("  %lu flushes with wrong video memory\n", (unsigned long) mismatches);
+
+  return mismatches==0;
+}
+
+
+// synthetic games, one record per VSYNC period
+
+static void put_membyte(record &r, int addr, uint8_t value)
+{
+  r.data.push_back(DAZ_MEMBYTE | ((addr >> 8) & 0x0F));
+  r.data.push_back(addr & 0xFF);
+  r.data.push_back(value);
+}
+
+
+static void gen_playfield(std::vector<record> &src, int frames)
+{
+  // playfield redrawn completely every frame, 8 sprites of 2x2 bytes
+  // erased (playfield drawn again) and drawn at their new place
+  uint8_t playfield[DAZ_MEMSIZE];
+  for(int i=0; i<DAZ_MEMSIZE; i++) playfield[i] = (i & 0x40) ? 0x11 * (i & 7) : 0;
+
+  int sx[8], sy[8];
+  for(int k=0; k<8; k++) { sx[k] = rand() % 31; sy[k] = rand() % 63; }
+
+  for(int f=0; f<frames; f++)
+    {
+      record r;
+      r.t_us = (uint64_t) f * DAZ_VSYNC_PERIOD_US;
+      for(int i=0; i<DAZ_MEMSIZE; i++) put_membyte(r, i, playfield[i]);
+      for(int k=0; k<8; k++)
+        {
+          if( (f+k)%4==0 ) { sx[k] = (sx[k]+1) % 31; sy[k] = (sy[k]+1) % 63; }
+          for(int j=0; j<4; j++)
+            {
+              int x = sx[k] + (j&1), y = sy[k] + (j>>1);
+              put_membyte(r, (y&31)*16 + (x&15) + ((x&16) ? 512 : 0) + ((y&32) ? 1024 : 0), 0xEE);
+            }
+        }
+      src.push_back(r);
+    }
+}
+
+
+static void gen_double_buffer(std::vector<record> &src, int frames)
+{
+  // back buffer cleared and redrawn (a few lines of terrain that
+  // scroll slowly, a ship), then shown
+  for(int f=0; f<frames; f++)
+    {
+      record r;
+      int b = f & 1;
+      r.t_us = (uint64_t) f * DAZ_VSYNC_PERIOD_US;
+      for(int i=0; i<DAZ_MEMSIZE; i++) put_membyte(r, b*DAZ_MEMSIZE+i, 0);
+      for(int x=0; x<32; x++)
+        {
+          int h = 4 + ((x + f/8) % 7);
+          for(int y=64-h; y<64; y++)
+            put_membyte(r, b*DAZ_MEMSIZE + (y&31)*16 + (x&15) + ((x&16) ? 512 : 0) + ((y&32) ? 1024 : 0), 0x22);
+        }
+      for(int i=0; i<6; i++) put_membyte(r, b*DAZ_MEMSIZE + 300 + i, 0x99);
+      r.data.push_back(DAZ_CTRL);
+      r.data.push_back(0x80 | b);
+      src.push_back(r);
+    }
+}
+
+
+static void gen_score(std::vector<record> &src, int frames)
+{
+  // 64 bytes of score line rewritten every frame, changing every 30
+  // frames, plus a ball (one byte) moving every frame
+  int score = 0, ball = 1024;
+  for(int f=0; f<frames; f++)
+    {
+      record r;
+      r.t_us = (uint64_t) f * DAZ_VSYNC_PERIOD_US;
+      if( f%30==0 ) score++;
+      for(int i=0; i<64; i++) put_membyte(r, i, (uint8_t) ((score >> (i/16)) * 0x37 + i));
+      put_membyte(r, ball, 0);
+      ball = 1024 + ((ball+17) & 1023);
+      put_membyte(r, ball, 0xFF);
+      src.push_back(r);
+    }
+}
+
+
+static bool read_trace(const char *fname, std::vector<record> &src)
+{
+  FILE *f = fopen(fname, "rb");
+  if( f==NULL ) return false;
+
+  std::vector<uint8_t> s;
+  uint8_t buf[65536];
+  size_t n;
+  while( (n=fread(buf, 1, sizeof(buf), f))>0 )
+    s.insert(s.end(), buf, buf+n);
+  fclose(f);
+
+  dazzler_trace_reader trace;
+  if( !dazzler_trace_open(&trace, s.data(), s.size()) ) return false;
+
+  const uint8_t *p;
+  uint64_t t;
+  int k;
+  while( (k=dazzler_trace_next(&trace, &p, &t))>=0 )
+    {
+      record r;
+      r.t_us = t;
+      r.data.assign(p, p+k);
+      src.push_back(r);
+    }
+  return true;
+}
+
+
+int main(int argc, char **argv)
+{
+  int frames = 600;
+
+  int i;
+  for(i=1; i<argc && argv[i][0]=='-'; i++)
+    {
+      if( strcmp(argv[i], "-n")==0 && i+1<argc )
+        frames = atoi(argv[++i]);
+      else
+        {
+          fprintf(stderr, "usage: %s [-n frames] [trace ...]\n", argv[0]);
+          return 1;
+        }
+    }
+  if( frames<1 ) frames = 1;
+
+  bool ok = true;
+  if( i<argc )
+    {
+      for(; i<argc; i++)
+        {
+          std::vector<record> src;
+          if( read_trace(argv[i], src) )
+            ok = run(argv[i], src) && ok;
+          else
+            fprintf(stderr, "can not read trace %s\n", argv[i]);
+        }
+    }
+  else
+    {
+      std::vector<record> src;
+      srand(1);
+      gen_playfield(src, frames);
+      ok = run("playfield redrawn every frame", src) && ok;
+      src.clear();
+      gen_double_buffer(src, frames);
+      ok = run("back buffer cleared and redrawn", src) && ok;
+      src.clear();
+      gen_score(src, frames);
+      ok = run("score line rewritten", src) && ok;
+    }
+
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,565 @@
+// -----------------------------------------------------------------------------
+// Cromemco Dazzler emulation - shared memory transport benchmark
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+// Usage: bench_shm [-n frames] [-u]
+//
+// Compares three ways of getting a simulated game from the simulator to
+// a display on the same machine, each with a producer and a consumer
+// thread:
+//   stream/cmd    DAZ_MEMBYTE, DAZ_CTRL(PIC) and DAZ_DAC commands over a
+//                 socket pair, one write() per command (as the simulator
+//                 sends them when the program does its OUT instructions),
+//                 the consumer decodes and renders whenever a frame is
+//                 complete
+//   stream/frame  the same stream, one write() per frame
+//   shm           shared memory (dazzler_shm.h), the consumer sleeps on
+//                 the frame counter and renders straight out of the mapping
+// The game double buffers: it draws moving sprites and a score line into
+// the back buffer, redraws its playfield every second, flips buffers at
+// VSYNC and plays 8kHz audio. Frames are produced at 60Hz (-u: as fast
+// as possible). Reports producer CPU time per command, consumer CPU time
+// per frame and the time from VSYNC to the rendered picture, and checks
+// that memory, picture and audio at the consumer are what was produced.
+// Exits with 1 on a mismatch.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include "../Common/dazzler_decoder.h"
+#include "../Common/dazzler_render.h"
+#include "../Common/dazzler_latency.h"
+#include "dazzler_shm.h"
+
+#define OP_WRITE    0
+#define OP_CTRL     1
+#define OP_CTRLPIC  2
+#define OP_DAC      3
+
+#define FRAME_US    16667
+
+#define MODE_CMD    0
+#define MODE_FRAME  1
+#define MODE_SHM    2
+
+struct op
+{
+  uint8_t  kind;
+  uint8_t  value;
+  uint16_t arg;              // address or delay_us
+};
+
+struct frame_ops
+{
+  std::vector<op> ops;
+};
+
+struct result
+{
+  double   producer_ns_per_op;
+  double   consumer_us_per_frame;
+  uint64_t frames_rendered, bytes;
+  uint64_t torn;             // shm: frames rendered while the producer was writing
+  dazzler_latency latency;
+  bool     ok;
+};
+
+static std::vector<frame_ops> game;
+static uint64_t num_ops;
+static uint8_t  ref_mem[2*DAZ_MEMSIZE], ref_ctrl, ref_picture_ctrl;
+static std::vector<dazzler_shm_sample> ref_audio;
+
+// stream: bytes sent up to the end of each frame (including DAZ_VERSION)
+static std::vector<uint64_t> frame_end;
+
+// time each frame was published by the producer and rendered by the consumer
+static std::vector<uint64_t> publish_us, render_us;
+
+
+static uint64_t now_us()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+static uint64_t thread_cpu_ns()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+static void make_game(int frames)
+{
+  srand(1);
+  game.resize(frames);
+
+  const int num_sprites = 6;
+  int sx[num_sprites], sy[num_sprites], dx[num_sprites], dy[num_sprites];
+  for(int i=0; i<num_sprites; i++)
+    {
+      sx[i] = rand() % 60; sy[i] = rand() % 56;
+      dx[i] = rand() % 2 ? 1 : -1; dy[i] = rand() % 2 ? 1 : -1;
+    }
+
+  uint8_t playfield[DAZ_MEMSIZE];
+  for(int i=0; i<DAZ_MEMSIZE; i++) playfield[i] = (i/64) & 1 ? 0x11 : 0x00;
+
+  // 8kHz audio: 133 or 134 samples per frame, spread over the frame
+  uint64_t audio_t = 0;
+  int score = 0;
+  for(int f=0; f<frames; f++)
+    {
+      std::vector<op> &ops = game[f].ops;
+      int b = (f+1) & 1;      // back buffer
+      int base = b*DAZ_MEMSIZE;
+      std::vector<op> draw;
+
+      if( f==0 ) draw.push_back({OP_CTRLPIC, 0x30, 0});
+
+      // playfield: everything once a second, otherwise under the sprites
+      if( f % 60 < 2 )
+        {
+          if( f % 60==0 ) for(int i=0; i<DAZ_MEMSIZE; i++) playfield[i] = rand() & 0x77;
+          for(int i=0; i<DAZ_MEMSIZE; i++) draw.push_back({OP_WRITE, playfield[i], (uint16_t) (base+i)});
+        }
+      else
+        for(int i=0; i<num_sprites; i++)
+          for(int y=0; y<8; y++)
+            for(int x=0; x<4; x++)
+              {
+                // erase at the position of two frames ago (same buffer)
+                int a = (sy[i]-2*dy[i]+y) * 32 + (sx[i]-2*dx[i]+x)/2;
+                if( a>=0 && a<DAZ_MEMSIZE ) draw.push_back({OP_WRITE, playfield[a], (uint16_t) (base+a)});
+              }
+
+      for(int i=0; i<num_sprites; i++)
+        {
+          for(int y=0; y<8; y++)
+            for(int x=0; x<4; x++)
+              {
+                int a = (sy[i]+y) * 32 + (sx[i]+x)/2;
+                draw.push_back({OP_WRITE, (uint8_t) (0x99 + i*0x11), (uint16_t) (base+a)});
+              }
+
+          sx[i] += dx[i]; sy[i] += dy[i];
+          if( sx[i]<=2 || sx[i]>=56 ) dx[i] = -dx[i];
+          if( sy[i]<=2 || sy[i]>=54 ) dy[i] = -dy[i];
+        }
+
+      // the score line is rewritten every frame although it rarely changes
+      if( rand() % 20==0 ) score++;
+      for(int x=0; x<32; x++)
+        draw.push_back({OP_WRITE, (uint8_t) ((score >> (x & 7)) & 1 ? 0xFF : 0x00), (uint16_t) (base+62*32+x)});
+
+      // interleave the audio samples with the drawing
+      int n = (int) ((audio_t + FRAME_US) / 125 - audio_t / 125);
+      audio_t += FRAME_US;
+      size_t k = 0;
+      for(int i=0; i<n; i++)
+        {
+          size_t e = draw.size() * (i+1) / n;
+          while( k<e ) ops.push_back(draw[k++]);
+          ops.push_back({OP_DAC, (uint8_t) (rand() & 0xFF), 125});
+        }
+      while( k<draw.size() ) ops.push_back(draw[k++]);
+
+      // flip buffers at the end of the frame
+      ops.push_back({OP_CTRL, (uint8_t) (0x80 | b), 0});
+      num_ops += ops.size();
+
+      for(const op &o : ops)
+        switch( o.kind )
+          {
+          case OP_WRITE:   ref_mem[o.arg] = o.value; break;
+          case OP_CTRL:    ref_ctrl = o.value; break;
+          case OP_CTRLPIC: ref_picture_ctrl = o.value; break;
+          case OP_DAC:     ref_audio.push_back({o.arg, 0, o.value}); break;
+          }
+    }
+}
+
+
+static int encode(const op &o, uint8_t *out)
+{
+  switch( o.kind )
+    {
+    case OP_WRITE:
+      out[0] = DAZ_MEMBYTE | (o.arg >> 8);
+      out[1] = o.arg & 0xFF;
+      out[2] = o.value;
+      return 3;
+
+    case OP_CTRL:
+    case OP_CTRLPIC:
+      out[0] = o.kind==OP_CTRL ? DAZ_CTRL : DAZ_CTRLPIC;
+      out[1] = o.value;
+      return 2;
+
+    case OP_DAC:
+      out[0] = DAZ_DAC;
+      out[1] = o.arg & 0xFF;
+      out[2] = o.arg >> 8;
+      out[3] = o.value;
+      return 4;
+    }
+
+  return 0;
+}
+
+
+static void write_all(int fd, const uint8_t *data, int size)
+{
+  while( size>0 )
+    {
+      ssize_t n = write(fd, data, size);
+      if( n<=0 ) { perror("write"); exit(1); }
+      data += n;
+      size -= n;
+    }
+}
+
+
+// paced: wait until frame "f" is due
+static void frame_start(int f, bool paced, uint64_t start)
+{
+  if( paced )
+    {
+      uint64_t t = start + (uint64_t) f * FRAME_US;
+      struct timespec ts = {(time_t) (t / 1000000), (long) (t % 1000000 * 1000)};
+      clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+    }
+}
+
+
+static bool check_picture(const uint8_t *mem, uint8_t ctrl, uint8_t picture_ctrl, const uint32_t *picture)
+{
+  static uint32_t expected[DAZ_WIDTH*DAZ_HEIGHT];
+  dazzler_renderer r;
+  dazzler_render_init(&r);
+  dazzler_render_frame(&r, mem + (ctrl&1)*DAZ_MEMSIZE, picture_ctrl, expected, DAZ_WIDTH);
+  return memcmp(expected, picture, sizeof(expected))==0;
+}
+
+
+static bool check_audio(const std::vector<dazzler_shm_sample> &audio)
+{
+  if( audio.size()!=ref_audio.size() ) return false;
+  for(size_t i=0; i<audio.size(); i++)
+    if( audio[i].delay_us!=ref_audio[i].delay_us || audio[i].channel!=ref_audio[i].channel ||
+        audio[i].sample!=ref_audio[i].sample )
+      return false;
+  return true;
+}
+
+
+// ---------------------------------------------------------------------------
+// byte stream
+
+
+static std::vector<dazzler_shm_sample> received_audio;
+
+static void stream_dac(void *ctx, int channel, uint16_t delay_us, uint8_t sample)
+{
+  received_audio.push_back({delay_us, (uint8_t) channel, sample});
+}
+
+
+static void stream_producer(int fd, int mode, bool paced, result *res)
+{
+  uint8_t version = DAZ_VERSION | 0x02;
+  write_all(fd, &version, 1);
+
+  std::vector<uint8_t> buf;
+  uint64_t cpu = 0, start = now_us();
+  for(size_t f=0; f<game.size(); f++)
+    {
+      frame_start(f, paced, start);
+
+      uint64_t c = thread_cpu_ns();
+      buf.clear();
+      for(const op &o : game[f].ops)
+        {
+          uint8_t cmd[4];
+          int n = encode(o, cmd);
+          if( mode==MODE_CMD )
+            write_all(fd, cmd, n);
+          else
+            buf.insert(buf.end(), cmd, cmd+n);
+        }
+
+      if( mode==MODE_FRAME ) write_all(fd, buf.data(), buf.size());
+      cpu += thread_cpu_ns() - c;
+      publish_us[f] = now_us();
+    }
+
+  res->producer_ns_per_op = (double) cpu / num_ops;
+}
+
+
+static void stream_consumer(int fd, result *res)
+{
+  static const dazzler_decoder_callbacks cb = {NULL, NULL, NULL, NULL, stream_dac, NULL, NULL, NULL, NULL};
+  static uint8_t mem[2*DAZ_MEMSIZE];
+  static uint32_t picture[DAZ_WIDTH*DAZ_HEIGHT];
+  static dazzler_decoder d;
+  memset(mem, 0, sizeof(mem));
+  received_audio.clear();
+  dazzler_decoder_init(&d, mem, 0, &cb, NULL);
+
+  dazzler_renderer r;
+  dazzler_render_init(&r);
+  dazzler_render_frame(&r, mem, d.picture_ctrl, picture, DAZ_WIDTH);
+  dazzler_dirty_clear(&d.dirty);
+
+  uint8_t buf[65536];
+  size_t next = 0;
+  uint64_t cpu = 0;
+  while( next<game.size() )
+    {
+      struct pollfd p = {fd, POLLIN, 0};
+      poll(&p, 1, -1);
+
+      uint64_t c = thread_cpu_ns();
+      ssize_t n = read(fd, buf, sizeof(buf));
+      if( n<=0 ) break;
+      dazzler_decoder_receive(&d, buf, n);
+
+      // render once the end of a frame has arrived
+      size_t first = next;
+      while( next<game.size() && d.num_bytes>=frame_end[next] ) next++;
+      if( next>first )
+        {
+          uint32_t dirty[DAZ_DIRTY_WORDS];
+          int b = d.ctrl & 1;
+          if( dazzler_dirty_take(&d.dirty, b, dirty) )
+            dazzler_render_update(&r, mem + b*DAZ_MEMSIZE, d.picture_ctrl, dirty, picture, DAZ_WIDTH);
+
+          uint64_t t = now_us();
+          for(size_t f=first; f<next; f++) render_us[f] = t;
+          res->frames_rendered++;
+        }
+      cpu += thread_cpu_ns() - c;
+    }
+
+  res->consumer_us_per_frame = (double) cpu / 1000 / game.size();
+  res->bytes = d.num_bytes;
+  res->ok = memcmp(mem, ref_mem, sizeof(ref_mem))==0 && d.ctrl==ref_ctrl && d.picture_ctrl==ref_picture_ctrl &&
+    check_picture(mem, d.ctrl, d.picture_ctrl, picture) && check_audio(received_audio);
+}
+
+
+static void run_stream(int mode, bool paced, result *res)
+{
+  int sv[2];
+  if( socketpair(AF_UNIX, SOCK_STREAM, 0, sv)<0 ) { perror("socketpair"); exit(1); }
+
+  std::thread consumer(stream_consumer, sv[1], res);
+  stream_producer(sv[0], mode, paced, res);
+  consumer.join();
+  close(sv[0]);
+  close(sv[1]);
+}
+
+
+// ---------------------------------------------------------------------------
+// shared memory
+
+
+static void shm_producer(dazzler_shm *s, bool paced, result *res)
+{
+  uint64_t cpu = 0, start = now_us();
+  for(size_t f=0; f<game.size(); f++)
+    {
+      frame_start(f, paced, start);
+
+      uint64_t c = thread_cpu_ns();
+      for(const op &o : game[f].ops)
+        switch( o.kind )
+          {
+          case OP_WRITE:   dazzler_shm_write(s, o.arg, o.value); break;
+          case OP_CTRL:    dazzler_shm_set_ctrl(s, o.value); break;
+          case OP_CTRLPIC: dazzler_shm_set_picture_ctrl(s, o.value); break;
+
+          case OP_DAC:
+            // the consumer takes the samples at every frame, so the
+            // ring never fills up unless the consumer stalls
+            while( !dazzler_shm_dac(s, 0, o.arg, o.value) ) usleep(100);
+            break;
+          }
+
+      publish_us[f] = now_us();
+      dazzler_shm_publish(s);
+      cpu += thread_cpu_ns() - c;
+    }
+
+  res->producer_ns_per_op = (double) cpu / num_ops;
+}
+
+
+static void shm_consumer(dazzler_shm *s, result *res)
+{
+  static uint32_t picture[DAZ_WIDTH*DAZ_HEIGHT];
+  static dazzler_shm_sample samples[DAZ_SHM_AUDIO_SIZE];
+  std::vector<dazzler_shm_sample> audio;
+  dazzler_shm_area *a = s->area;
+
+  dazzler_renderer r;
+  dazzler_render_init(&r);
+  dazzler_render_frame(&r, a->mem, a->picture_ctrl, picture, DAZ_WIDTH);
+  dazzler_dirty_clear(&a->dirty);
+
+  uint64_t cpu = 0;
+  uint32_t first = s->frame;
+  int n;
+  while( s->frame-first<game.size() )
+    {
+      uint32_t prev = s->frame;
+      if( dazzler_shm_wait(s, 1000)<=0 ) break;
+
+      uint64_t c = thread_cpu_ns();
+      while( (n=dazzler_shm_audio(s, samples, DAZ_SHM_AUDIO_SIZE))>0 )
+        audio.insert(audio.end(), samples, samples+n);
+
+      // render straight out of the mapping, bytes written while we do
+      // that are dirty again and drawn with the next frame
+      uint32_t seq = dazzler_shm_read_begin(s);
+      uint32_t dirty[DAZ_DIRTY_WORDS];
+      int b = a->ctrl & 1;
+      if( dazzler_dirty_take(&a->dirty, b, dirty) )
+        dazzler_render_update(&r, a->mem + b*DAZ_MEMSIZE, a->picture_ctrl, dirty, picture, DAZ_WIDTH);
+      if( !dazzler_shm_read_end(s, seq) ) res->torn++;
+
+      uint64_t t = now_us();
+      for(uint32_t f=prev; f!=s->frame; f++) render_us[f-first] = t;
+      res->frames_rendered++;
+      cpu += thread_cpu_ns() - c;
+    }
+
+  // the last frame may have been rendered while the producer was already
+  // past it (unpaced), render what is left now that it has stopped
+  uint32_t dirty[DAZ_DIRTY_WORDS];
+  int b = a->ctrl & 1;
+  if( dazzler_dirty_take(&a->dirty, b, dirty) )
+    dazzler_render_update(&r, a->mem + b*DAZ_MEMSIZE, a->picture_ctrl, dirty, picture, DAZ_WIDTH);
+  while( (n=dazzler_shm_audio(s, samples, DAZ_SHM_AUDIO_SIZE))>0 )
+    audio.insert(audio.end(), samples, samples+n);
+
+  res->consumer_us_per_frame = (double) cpu / 1000 / game.size();
+  res->ok = memcmp(a->mem, ref_mem, sizeof(ref_mem))==0 && a->ctrl==ref_ctrl && a->picture_ctrl==ref_picture_ctrl &&
+    check_picture(a->mem, a->ctrl, a->picture_ctrl, picture) && check_audio(audio);
+}
+
+
+static void run_shm(bool paced, result *res)
+{
+  char name[64];
+  snprintf(name, sizeof(name), "/bench_shm.%d", (int) getpid());
+
+  dazzler_shm producer, consumer;
+  if( !dazzler_shm_create(&producer, name) ) exit(1);
+  if( !dazzler_shm_open(&consumer, name) ) { fprintf(stderr, "can not open %s\n", name); exit(1); }
+
+  std::thread t(shm_consumer, &consumer, res);
+  shm_producer(&producer, paced, res);
+  t.join();
+
+  dazzler_shm_close(&consumer);
+  dazzler_shm_close(&producer);
+}
+
+
+// ---------------------------------------------------------------------------
+
+
+int main(int argc, char **argv)
+{
+  int frames = 300;
+  bool paced = true;
+  for(int i=1; i<argc; i++)
+    {
+      if( strcmp(argv[i], "-n")==0 && i+1<argc )
+        frames = atoi(argv[++i]);
+      else if( strcmp(argv[i], "-u")==0 )
+        paced = false;
+      else
+        {
+          fprintf(stderr, "usage: %s [-n frames] [-u]\n", argv[0]);
+          return 1;
+        }
+    }
+  if( frames<1 ) frames = 1;
+
+  make_game(frames);
+
+  uint64_t bytes = 1;
+  for(int f=0; f<frames; f++)
+    {
+      uint8_t cmd[4];
+      for(const op &o : game[f].ops) bytes += encode(o, cmd);
+      frame_end.push_back(bytes);
+    }
+
+  printf("%d frames%s, %.0f commands per frame, %.0f stream bytes per frame\n\n",
+         frames, paced ? " at 60Hz" : "", (double) num_ops / frames, (double) bytes / frames);
+  printf("%-13s %10s %12s %8s %8s %8s %8s %s\n",
+         "", "prod ns/cmd", "cons us/frame", "rendered", "p50 us", "p99 us", "max us", "result");
+
+  static const char *names[3] = {"stream/cmd", "stream/frame", "shm"};
+  bool ok = true;
+  for(int mode=0; mode<3; mode++)
+    {
+      static result res;
+      memset((void *) &res, 0, sizeof(res));
+      dazzler_latency_init(&res.latency);
+      publish_us.assign(frames, 0);
+      render_us.assign(frames, 0);
+
+      if( mode==MODE_SHM )
+        run_shm(paced, &res);
+      else
+        run_stream(mode, paced, &res);
+
+      // the consumer may finish a frame before the producer has noted
+      // the time it was done with it
+      for(int f=0; f<frames; f++)
+        if( render_us[f]>0 )
+          dazzler_latency_add(&res.latency, render_us[f]>publish_us[f] ? (uint32_t) (render_us[f]-publish_us[f]) : 0);
+
+      printf("%-13s %10.1f %12.1f %8llu %8u %8u %8u %s",
+             names[mode], res.producer_ns_per_op, res.consumer_us_per_frame,
+             (unsigned long long) res.frames_rendered,
+             dazzler_latency_percentile(&res.latency, 50), dazzler_latency_percentile(&res.latency, 99),
+             res.latency.max, res.ok ? "ok" : "MISMATCH");
+      if( mode==MODE_SHM ) printf(" (%llu torn reads)", (unsigned long long) res.torn);
+      printf("\n");
+      ok = ok && res.ok;
+    }
+
+  return ok ? 0 : 1;
+}
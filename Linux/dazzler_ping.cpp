@@ -0,0 +1,424 @@
+// -----------------------------------------------------------------------------
+// Cromemco Dazzler emulation - round trip latency probe
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+// Usage: dazzler_ping [-b baud] [-n count] [-i interval_ms] [-L load] [-H] link
+//
+// Acts as the computer: announces itself with DAZ_VERSION, then sends
+// DAZ_PING with a timestamp every "interval_ms" and measures the time
+// until the matching DAZ_PONG comes back. With -L each ping is preceded
+// by "load" bytes of MEMBYTE commands (drawing into buffer 1), so the
+// ping measures how long a command written now takes until the display
+// gets to it when it has to work through that much drawing first.
+// If the Dazzler reports FEAT_CREDIT its flow control is respected.
+// Prints p50/p90/p99/p99.9/max and, with -H, a histogram.
+//
+// link is one of
+//   /dev/ttyXXX       serial port (-b baud, default 115200, any rate the UART can make)
+//   tcp:host[:port]   connect to a Dazzler (or relay) listening on port (default 8800)
+//   listen[:port]     wait for the Windows client to connect to port (default 8800),
+//                     as it connects to the simulator
+//   exec:command      run a stand-in Dazzler speaking the protocol on stdin/stdout
+//   loop              this program's own decoder, in a thread (measures the overhead
+//                     of this tool and the operating system)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "../Common/dazzler_decoder.h"
+#include "../Common/dazzler_credit.h"
+#include "../Common/dazzler_latency.h"
+#include "dazzler_serial.h"
+
+
+static int link_fd = -1;
+static dazzler_credit credit;
+static dazzler_latency latency;
+static uint16_t features = 0;
+static bool got_version = false;
+static uint64_t pongs = 0, pongs_bad = 0;
+
+
+static uint64_t now_us()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+// ---------------------------------------------------------------- links
+
+static int open_serial(const char *dev, int baud)
+{
+  // this tool writes blocking
+  int fd = dazzler_serial_open(dev, baud);
+  if( fd>=0 ) fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+  return fd;
+}
+
+
+static void no_delay(int fd)
+{
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+
+static int open_tcp(const char *spec)
+{
+  char host[256];
+  const char *port = "8800";
+  snprintf(host, sizeof(host), "%s", spec);
+  char *colon = strrchr(host, ':');
+  if( colon!=NULL ) { *colon = 0; port = colon+1; }
+
+  struct addrinfo hints, *res, *ai;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family   = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  if( getaddrinfo(host, port, &hints, &res)!=0 )
+    {
+      fprintf(stderr, "can not resolve %s\n", host);
+      return -1;
+    }
+
+  int fd = -1;
+  for(ai=res; ai!=NULL && fd<0; ai=ai->ai_next)
+    {
+      fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+      if( fd>=0 && connect(fd, ai->ai_addr, ai->ai_addrlen)<0 ) { close(fd); fd = -1; }
+    }
+
+  freeaddrinfo(res);
+  if( fd<0 )
+    fprintf(stderr, "can not connect to %s:%s\n", host, port);
+  else
+    no_delay(fd);
+
+  return fd;
+}
+
+
+static int open_listen(int port)
+{
+  int s = socket(AF_INET6, SOCK_STREAM, 0), one = 1, zero = 0;
+  setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  setsockopt(s, IPPROTO_IPV6, IPV6_V6ONLY, &zero, sizeof(zero));
+
+  struct sockaddr_in6 addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin6_family = AF_INET6;
+  addr.sin6_port   = htons(port);
+  addr.sin6_addr   = in6addr_any;
+  if( s<0 || bind(s, (struct sockaddr *) &addr, sizeof(addr))<0 || listen(s, 1)<0 )
+    {
+      fprintf(stderr, "can not listen on port %i: %s\n", port, strerror(errno));
+      return -1;
+    }
+
+  printf("waiting for the Dazzler to connect to port %i\n", port);
+  int fd = accept(s, NULL, NULL);
+  close(s);
+  if( fd<0 ) return -1;
+
+  // the Windows client skips the simulator's greeting line
+  char greeting[64];
+  int n = snprintf(greeting, sizeof(greeting), "[connected to dazzler_ping on port %i]\n", port);
+  if( write(fd, greeting, n)!=n ) { close(fd); return -1; }
+
+  no_delay(fd);
+  return fd;
+}
+
+
+static int open_exec(const char *cmd)
+{
+  int sv[2];
+  if( socketpair(AF_UNIX, SOCK_STREAM, 0, sv)<0 ) return -1;
+
+  pid_t pid = fork();
+  if( pid<0 ) return -1;
+  if( pid==0 )
+    {
+      dup2(sv[1], 0);
+      dup2(sv[1], 1);
+      close(sv[0]);
+      close(sv[1]);
+      execl("/bin/sh", "sh", "-c", cmd, (char *) NULL);
+      _exit(127);
+    }
+
+  close(sv[1]);
+  return sv[0];
+}
+
+
+static void loop_send(void *ctx, const uint8_t *data, int size)
+{
+  if( write(*(int *) ctx, data, size)!=size ) return;
+}
+
+static void loop_thread(int fd)
+{
+  static uint8_t mem[2*DAZ_MEMSIZE];
+  static const dazzler_decoder_callbacks cb = {NULL, NULL, NULL, NULL, NULL, NULL, loop_send, NULL};
+  dazzler_decoder d;
+  dazzler_decoder_init(&d, mem, FEAT_VIDEO | FEAT_DUAL_BUF | FEAT_MEMBLOCK | FEAT_PING, &cb, &fd);
+
+  uint8_t buf[4096];
+  int n;
+  while( (n=read(fd, buf, sizeof(buf)))>0 )
+    dazzler_decoder_receive(&d, buf, n);
+}
+
+static int open_loop()
+{
+  int sv[2];
+  if( socketpair(AF_UNIX, SOCK_STREAM, 0, sv)<0 ) return -1;
+  std::thread(loop_thread, sv[1]).detach();
+  return sv[0];
+}
+
+
+static int open_link(const char *spec, int baud)
+{
+  if( strncmp(spec, "tcp:", 4)==0 )
+    return open_tcp(spec+4);
+  else if( strcmp(spec, "listen")==0 )
+    return open_listen(8800);
+  else if( strncmp(spec, "listen:", 7)==0 )
+    return open_listen(atoi(spec+7));
+  else if( strncmp(spec, "exec:", 5)==0 )
+    return open_exec(spec+5);
+  else if( strcmp(spec, "loop")==0 )
+    return open_loop();
+  else
+    return open_serial(spec, baud);
+}
+
+
+// ---------------------------------------------------- upstream messages
+
+// length of a message sent by the Dazzler, by its first byte
+static int upstream_length(uint8_t b)
+{
+  switch( b & 0xF0 )
+    {
+    case DAZ_JOY1:
+    case DAZ_JOY2:    return 3;
+    case DAZ_KEY:
+    case DAZ_CREDIT:
+    case DAZ_RESEND:
+    case DAZ_STATE_REQUEST: return 2;
+    case DAZ_PONG:    return 5;
+    case DAZ_VERSION: return 3; // we announce version 3
+    default:          return 1;
+    }
+}
+
+
+static void handle_message(const uint8_t *m, uint64_t now)
+{
+  switch( m[0] & 0xF0 )
+    {
+    case DAZ_VERSION:
+      features = m[1] | (m[2] << 8);
+      got_version = true;
+      dazzler_credit_init(&credit, features);
+      break;
+
+    case DAZ_CREDIT:
+      dazzler_credit_received(&credit, m[0], m[1]);
+      break;
+
+    case DAZ_PONG:
+      {
+        uint32_t t = m[1] | (m[2] << 8) | (m[3] << 16) | ((uint32_t) m[4] << 24);
+        uint32_t rtt = (uint32_t) now - t;
+        pongs++;
+        if( rtt>60000000 )
+          pongs_bad++;
+        else
+          dazzler_latency_add(&latency, rtt);
+        break;
+      }
+    }
+}
+
+
+// receive and handle messages until "until_us" (or until something
+// arrived if "once" is set), returns false if the link closed
+static bool receive(uint64_t until_us, bool once)
+{
+  static uint8_t buf[256];
+  static int len = 0;
+
+  while( true )
+    {
+      uint64_t now = now_us();
+      int timeout = now>=until_us ? 0 : (int) ((until_us-now+999)/1000);
+      struct pollfd p = {link_fd, POLLIN, 0};
+      int r = poll(&p, 1, timeout);
+      if( r<0 && errno!=EINTR ) return false;
+      if( r<=0 ) return true;
+
+      int n = read(link_fd, buf+len, sizeof(buf)-len);
+      if( n<=0 ) return false;
+      len += n;
+
+      now = now_us();
+      int i = 0;
+      while( i<len && i+upstream_length(buf[i])<=len )
+        {
+          handle_message(buf+i, now);
+          i += upstream_length(buf[i]);
+        }
+
+      memmove(buf, buf+i, len-i);
+      len -= i;
+      if( once ) return true;
+    }
+}
+
+
+// send, waiting for credit if the Dazzler uses flow control
+static bool send(const uint8_t *data, int size)
+{
+  while( size>0 )
+    {
+      int n = dazzler_credit_available(&credit);
+      if( n==0 )
+        {
+          if( !receive(now_us()+1000000, true) ) return false;
+          continue;
+        }
+
+      if( n>size ) n = size;
+      n = write(link_fd, data, n);
+      if( n<=0 ) return false;
+      dazzler_credit_sent(&credit, n);
+      data += n;
+      size -= n;
+    }
+
+  return true;
+}
+
+
+int main(int argc, char **argv)
+{
+  int baud = 115200, count = 1000, load = 0;
+  double interval_ms = 10;
+  bool bars = false;
+  const char *spec = NULL;
+
+  for(int i=1; i<argc; i++)
+    {
+      if( strcmp(argv[i], "-b")==0 && i+1<argc )
+        baud = atoi(argv[++i]);
+      else if( strcmp(argv[i], "-n")==0 && i+1<argc )
+        count = atoi(argv[++i]);
+      else if( strcmp(argv[i], "-i")==0 && i+1<argc )
+        interval_ms = atof(argv[++i]);
+      else if( strcmp(argv[i], "-L")==0 && i+1<argc )
+        load = atoi(argv[++i]);
+      else if( strcmp(argv[i], "-H")==0 )
+        bars = true;
+      else if( argv[i][0]!='-' && spec==NULL )
+        spec = argv[i];
+      else
+        spec = NULL, i = argc;
+    }
+
+  if( spec==NULL || count<1 || interval_ms<0 || load<0 )
+    {
+      fprintf(stderr, "usage: %s [-b baud] [-n count] [-i interval_ms] [-L load] [-H] link\n", argv[0]);
+      fprintf(stderr, "link: /dev/ttyXXX, tcp:host[:port], listen[:port], exec:command or loop\n");
+      return 1;
+    }
+
+  link_fd = open_link(spec, baud);
+  if( link_fd<0 ) return 1;
+
+  dazzler_credit_init(&credit, 0);
+  dazzler_latency_init(&latency);
+
+  // announce ourselves (version 3: we understand FEAT_* and DAZ_CREDIT)
+  uint8_t version = DAZ_VERSION | 3;
+  if( !send(&version, 1) ) return 1;
+  uint64_t t = now_us();
+  while( !got_version && now_us()-t<2000000 )
+    if( !receive(t+2000000, true) ) break;
+
+  if( !got_version )
+    {
+      fprintf(stderr, "no reply to DAZ_VERSION\n");
+      return 1;
+    }
+  else if( !(features & FEAT_PING) )
+    {
+      fprintf(stderr, "the Dazzler does not support DAZ_PING (features %04X)\n", features);
+      return 1;
+    }
+
+  // MEMBYTE load into buffer 1 (the display shows buffer 0 unless told otherwise)
+  std::vector<uint8_t> membytes;
+  for(int i=0; i<load/3; i++)
+    {
+      int a = DAZ_MEMSIZE + (rand() & (DAZ_MEMSIZE-1));
+      membytes.push_back(DAZ_MEMBYTE | (a >> 8));
+      membytes.push_back(a & 0xFF);
+      membytes.push_back(rand() & 0xFF);
+    }
+
+  uint64_t next = now_us();
+  for(int i=0; i<count; i++)
+    {
+      if( !membytes.empty() && !send(membytes.data(), (int) membytes.size()) ) break;
+
+      uint32_t ts = (uint32_t) now_us();
+      uint8_t ping[5] = {DAZ_PING, (uint8_t) ts, (uint8_t) (ts >> 8), (uint8_t) (ts >> 16), (uint8_t) (ts >> 24)};
+      if( !send(ping, 5) ) break;
+
+      next += (uint64_t) (interval_ms*1000);
+      if( !receive(next, false) ) break;
+    }
+
+  // wait for the last replies
+  t = now_us();
+  while( pongs<(uint64_t) count && now_us()-t<1000000 )
+    if( !receive(t+1000000, true) ) break;
+
+  printf("%s: %i pings (%i bytes load each), %lu replies", spec, count, (int) membytes.size(), (unsigned long) pongs);
+  if( pongs_bad>0 ) printf(", %lu with bad timestamps", (unsigned long) pongs_bad);
+  printf("\n");
+  dazzler_latency_print(&latency, stdout, "round trip", bars);
+  return 0;
+}
@@ -0,0 +1,406 @@
+// -----------------------------------------------------------------------------
+// Cromemco Dazzler emulation - Linux serial receiver
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+// Usage: dazzler_recv [-b baud] [-t seconds] device
+//        dazzler_recv [-R rcvbuf] [-t seconds] tcp:host[:port]
+//        dazzler_recv [-b baud] [-t seconds] pty
+//
+// Acts as the Dazzler on a serial port (dazzler_serial.h): decodes what
+// the computer sends (replying to DAZ_VERSION and DAZ_PING) for
+// "seconds" (default: until the port closes or Ctrl-C) and reports bytes,
+// commands, frames and the system calls it took.
+// With tcp:host[:port] it connects to the simulator (or dazzler_server)
+// as the Windows client does, through dazzler_tcp.h with a socket
+// receive buffer of "rcvbuf" bytes, and reconnects whenever the
+// connection closes.
+// With "pty" it tests itself over a pseudo-terminal pair: a thread
+// writes a synthetic stream into the master side at the rate of "baud"
+// (in 1ms pieces, about as a UART delivers them), the slave side is
+// opened as a serial port. The stream is received once with the bulk
+// reads of dazzler_serial_receive and once with reads of at most 100
+// bytes and 5ms timeouts, as the Windows client does. Reports system
+// calls per second, bytes per read and how long bytes took from being
+// written to being decoded (the oldest byte of each piece decoded).
+// Exits with 1 if the decoded video memory or the DAZ_VERSION reply is
+// wrong.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "../Common/dazzler_decoder.h"
+#include "../Common/dazzler_latency.h"
+#include "dazzler_serial.h"
+#include "dazzler_tcp.h"
+
+#define PIECE_US 1000
+
+static volatile sig_atomic_t stop = 0;
+
+
+static uint64_t now_us()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+static void on_signal(int sig)
+{
+  stop = 1;
+}
+
+
+static void send_reply(void *ctx, const uint8_t *data, int size)
+{
+  dazzler_serial_write(*(int *) ctx, data, size);
+}
+
+
+static const dazzler_decoder_callbacks callbacks =
+  {NULL, NULL, NULL, NULL, NULL, NULL, send_reply, NULL, NULL};
+
+static const uint16_t features =
+  FEAT_VIDEO | FEAT_DUAL_BUF | FEAT_DAC | FEAT_STATE | FEAT_MEMBLOCK | FEAT_DELTA | FEAT_PING | FEAT_DACBURST | FEAT_RECT | FEAT_CHUNK;
+
+
+// ---------------------------------------------------------------- device
+
+static int receive_device(const char *dev, int baud, double seconds)
+{
+  static uint8_t mem[2*DAZ_MEMSIZE];
+  static dazzler_serial_reader r;
+  static dazzler_decoder d;
+
+  int fd = dazzler_serial_open(dev, baud);
+  if( fd<0 ) return 1;
+
+  dazzler_decoder_init(&d, mem, features, &callbacks, &fd);
+  dazzler_serial_reader_init(&r, fd, &d);
+  signal(SIGINT, on_signal);
+  signal(SIGTERM, on_signal);
+
+  uint64_t start = now_us(), end = seconds>0 ? start + (uint64_t) (seconds*1000000) : (uint64_t) -1;
+  while( !stop && now_us()<end )
+    if( dazzler_serial_receive(&r, 100)<0 ) break;
+
+  double t = (now_us()-start) / 1e6;
+  printf("%s at %i baud: %lu bytes in %.1fs (%.1f KB/s), %lu commands, %lu frames\n",
+         dev, baud, (unsigned long) r.num_bytes, t, r.num_bytes/t/1000,
+         (unsigned long) d.num_commands, (unsigned long) d.num_frames);
+  printf("  %lu polls, %lu reads (%.0f system calls/s), %.1f bytes per read (max %i)\n",
+         (unsigned long) r.num_polls, (unsigned long) r.num_reads, (r.num_polls+r.num_reads)/t,
+         r.num_reads ? (double) r.num_bytes/r.num_reads : 0.0, r.max_read);
+  close(fd);
+  return 0;
+}
+
+
+// ---------------------------------------------------------------- tcp
+
+static void send_tcp(void *ctx, const uint8_t *data, int size)
+{
+  dazzler_tcp_send((dazzler_tcp *) ctx, data, size);
+}
+
+
+static int receive_tcp(const char *spec, int rcvbuf, double seconds)
+{
+  static uint8_t mem[2*DAZ_MEMSIZE];
+  static dazzler_tcp t;
+  static dazzler_decoder d;
+  static const dazzler_decoder_callbacks cb = {NULL, NULL, NULL, NULL, NULL, NULL, send_tcp, NULL, NULL};
+
+  dazzler_decoder_init(&d, mem, features, &cb, &t);
+  if( !dazzler_tcp_init(&t, spec, rcvbuf, &d) ) return 1;
+  signal(SIGINT, on_signal);
+  signal(SIGTERM, on_signal);
+
+  uint64_t start = now_us(), end = seconds>0 ? start + (uint64_t) (seconds*1000000) : (uint64_t) -1;
+  uint64_t connects = 0;
+  bool greeted = false;
+  while( !stop && now_us()<end )
+    {
+      dazzler_tcp_poll(&t, 100);
+      if( t.num_connects>connects )
+        {
+          connects = t.num_connects;
+          greeted = false;
+          printf("connected to %s:%s\n", t.host, t.port);
+        }
+      if( t.connected && t.greeting_state==2 && !greeted )
+        {
+          if( t.greeting_len>0 ) printf("greeting: %s\n", t.greeting);
+          greeted = true;
+        }
+    }
+
+  double s = (now_us()-start) / 1e6;
+  printf("%s:%s: %lu bytes in %.1fs (%.1f KB/s), %lu commands, %lu frames\n",
+         t.host, t.port, (unsigned long) t.num_bytes, s, t.num_bytes/s/1000,
+         (unsigned long) d.num_commands, (unsigned long) d.num_frames);
+  printf("  %lu connections, %lu failed attempts, %lu reads, %.1f bytes per read\n",
+         (unsigned long) t.num_connects, (unsigned long) t.num_failed, (unsigned long) t.num_reads,
+         t.num_reads ? (double) t.num_bytes/t.num_reads : 0.0);
+  dazzler_tcp_free(&t);
+  return 0;
+}
+
+
+// ---------------------------------------------------------------- pty test
+
+static std::vector<uint8_t> stream;
+static std::vector<uint64_t> piece_written;   // time each piece was written
+static std::atomic<bool> writer_done;
+static int piece_size;
+
+
+static void gen_stream(int size)
+{
+  // DAZ_VERSION, then a mix of drawing, frames, buffer switches and audio
+  stream.clear();
+  stream.push_back(DAZ_VERSION | 3);
+  while( (int) stream.size()<size )
+    {
+      int k = rand() % 100;
+      if( k<2 )
+        {
+          stream.push_back(DAZ_FULLFRAME | 0x01 | ((rand() & 1) ? 0x08 : 0));
+          for(int i=0; i<DAZ_MEMSIZE; i++) stream.push_back(rand() & 0xFF);
+        }
+      else if( k<4 )
+        {
+          stream.push_back(DAZ_CTRL);
+          stream.push_back(0x80 | (rand() & 1));
+        }
+      else if( k<30 )
+        {
+          stream.push_back(DAZ_DAC);
+          stream.push_back(125);
+          stream.push_back(0);
+          stream.push_back(rand() & 0xFF);
+        }
+      else
+        {
+          int a = rand() & (2*DAZ_MEMSIZE-1);
+          stream.push_back(DAZ_MEMBYTE | (a >> 8));
+          stream.push_back(a & 0xFF);
+          stream.push_back(rand() & 0xFF);
+        }
+    }
+}
+
+
+static void writer_thread(int master)
+{
+  uint64_t next = now_us();
+  for(size_t i=0; i<stream.size(); i+=piece_size)
+    {
+      int64_t w = (int64_t) (next - now_us());
+      if( w>0 ) usleep(w);
+      next += PIECE_US;
+
+      int n = stream.size()-i < (size_t) piece_size ? (int) (stream.size()-i) : piece_size;
+      piece_written[i/piece_size] = now_us();
+      if( !dazzler_serial_write(master, stream.data()+i, n) ) break;
+    }
+  writer_done = true;
+}
+
+
+struct pty_result
+{
+  uint64_t polls, reads, bytes;
+  int max_read;
+  double seconds;
+  dazzler_latency latency;
+  bool ok;
+};
+
+
+// latency of the oldest byte of what was just decoded
+static void add_latency(pty_result *res, uint64_t first)
+{
+  uint64_t now = now_us();
+  uint64_t t = piece_written[first/piece_size];
+  dazzler_latency_add(&res->latency, now>t ? (uint32_t) (now-t) : 0);
+}
+
+
+static bool run_pty(int baud, double seconds, bool windows, pty_result *res)
+{
+  static uint8_t mem[2*DAZ_MEMSIZE], ref_mem[2*DAZ_MEMSIZE];
+  static dazzler_serial_reader r;
+  static dazzler_decoder d, ref;
+
+  int master = posix_openpt(O_RDWR | O_NOCTTY);
+  if( master<0 || grantpt(master)<0 || unlockpt(master)<0 )
+    {
+      fprintf(stderr, "can not open a pseudo-terminal: %s\n", strerror(errno));
+      return false;
+    }
+
+  int fd = dazzler_serial_open(ptsname(master), baud);
+  if( fd<0 ) { close(master); return false; }
+
+  piece_size = (int) ((uint64_t) baud * PIECE_US / 10000000);
+  if( piece_size<1 ) piece_size = 1;
+  gen_stream((int) (baud/10 * seconds));
+  piece_written.assign(stream.size()/piece_size+1, 0);
+  writer_done = false;
+
+  memset(mem, 0, sizeof(mem));
+  dazzler_decoder_init(&d, mem, features, &callbacks, &fd);
+  dazzler_serial_reader_init(&r, fd, &d);
+  memset(res, 0, sizeof(pty_result));
+  dazzler_latency_init(&res->latency);
+
+  uint64_t start = now_us(), last = start;
+  std::thread writer(writer_thread, master);
+
+  if( !windows )
+    {
+      while( r.num_bytes<stream.size() && now_us()-last<2000000 )
+        {
+          int n = dazzler_serial_receive(&r, 100);
+          if( n<0 ) break;
+          if( n>0 ) { add_latency(res, r.num_bytes-n); last = now_us(); }
+        }
+      res->polls = r.num_polls;
+      res->reads = r.num_reads;
+      res->bytes = r.num_bytes;
+      res->max_read = r.max_read;
+    }
+  else
+    {
+      // ReadFile of 100 bytes, interval and total timeout 5ms
+      uint8_t buf[100];
+      while( res->bytes<stream.size() && now_us()-last<2000000 )
+        {
+          int n = 0;
+          uint64_t deadline = now_us() + 5000;
+          while( n<100 )
+            {
+              uint64_t now = now_us();
+              if( now>=deadline ) break;
+              struct pollfd p = {fd, POLLIN, 0};
+              res->polls++;
+              if( poll(&p, 1, (int) ((deadline-now+999)/1000))<=0 ) break;
+              res->reads++;
+              int k = read(fd, buf+n, 100-n);
+              if( k>0 ) n += k;
+            }
+
+          if( n>0 )
+            {
+              dazzler_decoder_receive(&d, buf, n);
+              add_latency(res, res->bytes);
+              res->bytes += n;
+              if( n>res->max_read ) res->max_read = n;
+              last = now_us();
+            }
+        }
+    }
+
+  res->seconds = (now_us()-start) / 1e6;
+  writer.join();
+
+  // everything decoded as it should be and DAZ_VERSION answered
+  memset(ref_mem, 0, sizeof(ref_mem));
+  dazzler_decoder_init(&ref, ref_mem, features, NULL, NULL);
+  dazzler_decoder_receive(&ref, stream.data(), (int) stream.size());
+
+  uint8_t reply[3] = {0, 0, 0};
+  fcntl(master, F_SETFL, O_NONBLOCK);
+  int n = read(master, reply, 3);
+  res->ok = res->bytes==stream.size() && memcmp(mem, ref_mem, sizeof(mem))==0
+    && n==3 && reply[0]==(DAZ_VERSION | DAZZLER_VERSION) && reply[1]==(features & 0xFF) && reply[2]==(features >> 8);
+
+  close(fd);
+  close(master);
+  return true;
+}
+
+
+static int test_pty(int baud, double seconds)
+{
+  if( seconds<=0 ) seconds = 5;
+  printf("pty at %i baud, %.1fs:\n", baud, seconds);
+
+  bool ok = true;
+  for(int m=0; m<2; m++)
+    {
+      static pty_result res;
+      srand(1);
+      if( !run_pty(baud, seconds, m==1, &res) ) return 1;
+
+      printf("  %-16s %8.0f syscalls/s, %7.1f bytes/read (max %5i), latency p50 %5u us, p99 %5u us, max %5u us%s\n",
+             m==0 ? "bulk reads" : "100-byte reads", (res.polls+res.reads)/res.seconds,
+             res.reads ? (double) res.bytes/res.reads : 0.0, res.max_read,
+             dazzler_latency_percentile(&res.latency, 50), dazzler_latency_percentile(&res.latency, 99),
+             dazzler_latency_percentile(&res.latency, 100), res.ok ? "" : "  WRONG");
+      ok = ok && res.ok;
+    }
+
+  return ok ? 0 : 1;
+}
+
+
+int main(int argc, char **argv)
+{
+  int baud = 1050000, rcvbuf = 0;
+  double seconds = 0;
+  const char *dev = NULL;
+
+  for(int i=1; i<argc; i++)
+    {
+      if( strcmp(argv[i], "-b")==0 && i+1<argc )
+        baud = atoi(argv[++i]);
+      else if( strcmp(argv[i], "-t")==0 && i+1<argc )
+        seconds = atof(argv[++i]);
+      else if( strcmp(argv[i], "-R")==0 && i+1<argc )
+        rcvbuf = atoi(argv[++i]);
+      else if( argv[i][0]!='-' && dev==NULL )
+        dev = argv[i];
+      else
+        dev = NULL, i = argc;
+    }
+
+  if( dev==NULL || baud<300 )
+    {
+      fprintf(stderr, "usage: %s [-b baud] [-R rcvbuf] [-t seconds] device|tcp:host[:port]|pty\n", argv[0]);
+      return 1;
+    }
+
+  if( strcmp(dev, "pty")==0 )
+    return test_pty(baud, seconds);
+  else if( strncmp(dev, "tcp:", 4)==0 )
+    return receive_tcp(dev+4, rcvbuf, seconds);
+  else
+    return receive_device(dev, baud, seconds);
+}
@@ -0,0 +1,900 @@
+// -----------------------------------------------------------------------------
+// Cromemco Dazzler emulation - fan-out relay
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+// Usage: dazzler_relay [-l port] [-q bytes] [-k ms] [-f features] [host[:port]]
+//        dazzler_relay -t viewers [-s seconds]
+//
+// Connects to the simulator at host:port (default localhost:8800) like
+// a Windows client and serves the stream to any number of viewers
+// (Windows clients or other Dazzler displays) connecting to port
+// "port" (default 8801), all on one thread with epoll.
+// The relay decodes the stream itself, so it answers DAZ_VERSION with
+// "features" (hex, default: what a plain display understands, no
+// DAZ_FRAMED or DAZ_CREDIT) and always knows the display state. A viewer
+// that joins gets that state as a keyframe (both buffers as DAZ_FULLFRAME,
+// picture control and control register) at the next command boundary,
+// then the stream from there. The stream is kept once in a shared ring
+// buffer that each viewer has its own position in. A viewer that falls
+// more than "bytes" (default 262144) behind is taken off the stream at
+// the next command boundary and gets only keyframes, at most one every
+// "ms" (default 250) and only when it has taken the previous one. Once
+// it takes one within a quarter of that time it gets the stream again.
+// Viewers that fall behind by the whole ring buffer are dropped.
+// Joystick and keyboard messages from viewers go to the simulator,
+// anything else they send is ignored.
+// When the simulator connection is made again, a command the old stream
+// stopped within is completed with zero bytes and every viewer gets a
+// keyframe before the new stream.
+// With -t it tests itself: a stand-in simulator sends a synthetic stream
+// of about 100KB/s for "seconds" (default 3), "viewers" viewers join
+// during the first half of it, one of them reads only 50KB/s. Halfway
+// through, the simulator drops the connection within a DAZ_FULLFRAME and
+// starts a new stream once the relay is back. Checks that the relay
+// shows the new stream correctly, that every viewer ends up with the
+// relay's display state and that only the slow one was taken off the
+// stream, and reports the relay's CPU time. Exits with 1 if anything is
+// wrong.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <atomic>
+#include <deque>
+#include <thread>
+#include <vector>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <sys/ioctl.h>
+#include <linux/sockios.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "../Common/dazzler_decoder.h"
+#include "dazzler_tcp.h"
+
+// shared stream buffer (power of 2)
+#define RING (1 << 22)
+
+// viewer states
+#define V_WAIT     0   // keyframe at the next command boundary
+#define V_LIVE     1   // gets the stream
+#define V_DEGRADED 2   // gets keyframes only
+
+struct viewer
+{
+  int      fd, number, state;
+  bool     resume;                // V_WAIT: go on with the stream after the keyframe
+  uint64_t pos, stop_at;          // next stream byte to send, where to leave the stream
+  std::vector<uint8_t> pending;   // greeting/keyframe not yet sent
+  size_t   pending_sent;
+  uint64_t keyframe_us;           // time the last keyframe was queued
+  bool     want_out;              // waiting for EPOLLOUT
+  uint8_t  up[8];                 // partial message from the viewer
+  int      up_len;
+
+  uint64_t num_bytes, num_keyframes, num_degraded;
+};
+
+static uint8_t ring[RING];
+static uint64_t head;                     // stream bytes received so far
+static std::deque<uint64_t> boundaries;   // stream positions between commands
+static uint8_t mem[2*DAZ_MEMSIZE];
+static dazzler_decoder d;
+static dazzler_tcp upstream;
+static std::vector<viewer *> viewers;
+static int epfd, listen_port = 8801, num_viewers, num_waiting;
+static uint64_t queue_limit = 262144, keyframe_period_us = 250000;
+static uint64_t num_dropped;
+
+// totals of closed viewers (for the self test)
+static uint64_t closed_keyframes, closed_degraded_first, closed_degraded_others;
+static volatile sig_atomic_t stop = 0;
+
+
+static uint64_t now_us()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+static void on_signal(int sig)
+{
+  stop = 1;
+}
+
+
+// ---------------------------------------------------------------- viewers
+
+static void set_want_out(viewer *v, bool want)
+{
+  if( v->want_out==want ) return;
+  struct epoll_event ev;
+  ev.events   = EPOLLIN | EPOLLRDHUP | (want ? EPOLLOUT : 0);
+  ev.data.ptr = v;
+  epoll_ctl(epfd, EPOLL_CTL_MOD, v->fd, &ev);
+  v->want_out = want;
+}
+
+
+static void close_viewer(viewer *v)
+{
+  epoll_ctl(epfd, EPOLL_CTL_DEL, v->fd, NULL);
+  close(v->fd);
+  if( v->state==V_WAIT ) num_waiting--;
+  closed_keyframes += v->num_keyframes;
+  if( v->number==1 )
+    closed_degraded_first += v->num_degraded;
+  else
+    closed_degraded_others += v->num_degraded;
+  for(size_t i=0; i<viewers.size(); i++)
+    if( viewers[i]==v ) viewers.erase(viewers.begin()+i);
+  delete v;
+}
+
+
+// bytes the viewer has not taken yet (sent but not acknowledged)
+static int unsent(viewer *v)
+{
+  int n = 0;
+  if( !v->pending.empty() || ioctl(v->fd, SIOCOUTQ, &n)<0 ) return 1;
+  return n;
+}
+
+
+// send what viewer "v" has waiting, returns false if it should be closed
+static bool flush_viewer(viewer *v)
+{
+  while( v->pending_sent<v->pending.size() )
+    {
+      int n = send(v->fd, v->pending.data()+v->pending_sent, v->pending.size()-v->pending_sent, MSG_NOSIGNAL);
+      if( n<0 && errno==EINTR ) continue;
+      if( n<0 && errno==EAGAIN ) { set_want_out(v, true); return true; }
+      if( n<=0 ) return false;
+      v->pending_sent += n;
+      v->num_bytes += n;
+    }
+  v->pending.clear();
+  v->pending_sent = 0;
+
+  if( v->state==V_LIVE )
+    {
+      if( head-v->pos > RING )
+        {
+          // it missed stream bytes that were not sent yet
+          num_dropped++;
+          return false;
+        }
+
+      uint64_t end = head<v->stop_at ? head : v->stop_at;
+      while( v->pos<end )
+        {
+          // up to the end of the ring buffer at a time
+          uint64_t k = end-v->pos, off = v->pos & (RING-1);
+          if( k>RING-off ) k = RING-off;
+          int n = send(v->fd, ring+off, k, MSG_NOSIGNAL);
+          if( n<0 && errno==EINTR ) continue;
+          if( n<0 && errno==EAGAIN ) { set_want_out(v, true); return true; }
+          if( n<=0 ) return false;
+          v->pos += n;
+          v->num_bytes += n;
+        }
+
+      if( v->pos==v->stop_at )
+        {
+          // off the stream, keyframes only from now on
+          v->state = V_DEGRADED;
+          v->keyframe_us = 0;
+          v->num_degraded++;
+        }
+    }
+
+  set_want_out(v, false);
+  return true;
+}
+
+
+// the relay's decoder is between commands: send waiting viewers a keyframe
+static void start_waiting()
+{
+  static uint8_t k[DAZ_KEYFRAME_SIZE];
+  int n = 0;
+  uint64_t now = now_us();
+  for(size_t i=0; i<viewers.size(); i++)
+    {
+      viewer *v = viewers[i];
+      if( v->state!=V_WAIT ) continue;
+
+      if( n==0 ) n = dazzler_decoder_keyframe(&d, k);
+      v->pending.insert(v->pending.end(), k, k+n);
+      v->keyframe_us = now;
+      v->num_keyframes++;
+      if( v->resume )
+        {
+          v->state = V_LIVE;
+          v->keyframe_us = 0;
+          v->pos = head;
+          v->stop_at = (uint64_t) -1;
+        }
+      else
+        v->state = V_DEGRADED;
+    }
+
+  num_waiting = 0;
+}
+
+
+static void add_viewer(int fd)
+{
+  int one = 1, sndbuf = 65536;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+
+  viewer *v = new viewer();
+  v->fd = fd;
+  v->number = ++num_viewers;
+  v->state = V_WAIT;
+  v->resume = true;
+  v->stop_at = (uint64_t) -1;
+  num_waiting++;
+
+  // the Windows client skips everything up to the first newline
+  char g[80];
+  int n = snprintf(g, sizeof(g), "[connected as viewer %i of dazzler_relay on port %i]\r\n", v->number, listen_port);
+  v->pending.assign(g, g+n);
+
+  struct epoll_event ev;
+  ev.events   = EPOLLIN | EPOLLRDHUP;
+  ev.data.ptr = v;
+  epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+  viewers.push_back(v);
+
+  if( dazzler_decoder_idle(&d) ) start_waiting();
+  if( !flush_viewer(v) ) close_viewer(v);
+}
+
+
+static int message_length(uint8_t b)
+{
+  switch( b & 0xF0 )
+    {
+    case DAZ_JOY1:
+    case DAZ_JOY2:    return 3;
+    case DAZ_KEY:
+    case DAZ_CREDIT:
+    case DAZ_RESEND:
+    case DAZ_STATE_REQUEST: return 2;
+    case DAZ_PONG:    return 5;
+    case DAZ_VERSION: return d.computer_version<2 ? 1 : 3;  // as the decoder replies
+    default:          return 1;
+    }
+}
+
+
+// messages from a viewer, returns false if it closed
+static bool read_viewer(viewer *v)
+{
+  uint8_t buf[512];
+  int n = read(v->fd, buf, sizeof(buf));
+  if( n<0 && (errno==EAGAIN || errno==EINTR) ) return true;
+  if( n<=0 ) return false;
+
+  for(int i=0; i<n; i++)
+    {
+      v->up[v->up_len++] = buf[i];
+      if( v->up_len==message_length(v->up[0]) )
+        {
+          // joystick and keyboard go to the simulator (a viewer that
+          // re-connects gets a keyframe anyway, so DAZ_STATE_REQUEST
+          // is not passed on)
+          uint8_t m = v->up[0] & 0xF0;
+          if( m==DAZ_JOY1 || m==DAZ_JOY2 || m==DAZ_KEY )
+            dazzler_tcp_send(&upstream, v->up, v->up_len);
+          v->up_len = 0;
+        }
+    }
+
+  return true;
+}
+
+
+// ---------------------------------------------------------------- upstream
+
+static void ring_put(const uint8_t *data, int size)
+{
+  for(int i=0; i<size; )
+    {
+      uint64_t off = head & (RING-1);
+      int k = size-i < (int) (RING-off) ? size-i : (int) (RING-off);
+      memcpy(ring+off, data+i, k);
+      head += k;
+      i += k;
+    }
+}
+
+
+static bool muted;
+static uint64_t upstream_connects;
+
+// The simulator connection was made again. The old stream may have
+// stopped within a command: complete it with zero bytes (a DAZ_DELTA
+// ends at a 0x00 token) so that the relay and the viewers on the stream
+// are between commands, then start over with a keyframe for every viewer
+// before the new stream.
+static void upstream_reconnected()
+{
+  static const uint8_t zero = 0;
+  muted = true;
+  for(int k=0; k<DAZ_STATE_SIZE && d.recv_status!=0; k++)
+    {
+      ring_put(&zero, 1);
+      dazzler_decoder_receive(&d, &zero, 1);
+    }
+  muted = false;
+  dazzler_decoder_reset(&d);
+  boundaries.clear();
+  boundaries.push_back(head);
+
+  for(size_t i=0; i<viewers.size(); )
+    {
+      viewer *v = viewers[i];
+      if( v->state==V_LIVE )
+        {
+          // the rest of the old stream goes ahead of the keyframe
+          if( head-v->pos > RING ) { num_dropped++; close_viewer(v); continue; }
+          for(; v->pos<head; v->pos++) v->pending.push_back(ring[v->pos & (RING-1)]);
+        }
+
+      if( v->state!=V_WAIT ) num_waiting++;
+      v->state   = V_WAIT;
+      v->resume  = true;
+      v->stop_at = (uint64_t) -1;
+      i++;
+    }
+}
+
+
+static void receive(void *ctx, const uint8_t *data, int size)
+{
+  int i = 0;
+  if( upstream.num_connects!=upstream_connects )
+    {
+      if( upstream_connects>0 ) upstream_reconnected();
+      upstream_connects = upstream.num_connects;
+    }
+
+  while( i<size )
+    {
+      if( num_waiting>0 )
+        {
+          // find the next command boundary one byte at a time
+          if( dazzler_decoder_idle(&d) ) { start_waiting(); continue; }
+          ring_put(data+i, 1);
+          dazzler_decoder_receive(&d, data+i, 1);
+          i++;
+        }
+      else
+        {
+          ring_put(data+i, size-i);
+          dazzler_decoder_receive(&d, data+i, size-i);
+          i = size;
+        }
+    }
+
+  if( dazzler_decoder_idle(&d) )
+    {
+      if( num_waiting>0 ) start_waiting();
+      if( boundaries.empty() || boundaries.back()!=head ) boundaries.push_back(head);
+    }
+  while( !boundaries.empty() && head-boundaries.front() > RING )
+    boundaries.pop_front();
+
+  for(size_t j=0; j<viewers.size(); )
+    {
+      viewer *v = viewers[j];
+      if( v->state==V_LIVE && v->stop_at==(uint64_t) -1 && head-v->pos > queue_limit )
+        {
+          // too far behind: leave the stream at the next boundary
+          for(size_t b=0; b<boundaries.size() && v->stop_at==(uint64_t) -1; b++)
+            if( boundaries[b]>=v->pos ) v->stop_at = boundaries[b];
+        }
+
+      if( !v->want_out && !flush_viewer(v) )
+        close_viewer(v);
+      else
+        j++;
+    }
+}
+
+
+static void send_upstream(void *ctx, const uint8_t *data, int size)
+{
+  // (no replies to the zero bytes that complete a cut-off command)
+  if( !muted ) dazzler_tcp_send(&upstream, data, size);
+}
+
+
+static const dazzler_decoder_callbacks callbacks =
+  {NULL, NULL, NULL, NULL, NULL, NULL, send_upstream, NULL, NULL};
+
+
+// ---------------------------------------------------------------- main loop
+
+static int listen_socket(int port)
+{
+  int s = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0), one = 1;
+  setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port   = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  if( s<0 || bind(s, (struct sockaddr *) &addr, sizeof(addr))<0 || listen(s, 128)<0 )
+    {
+      fprintf(stderr, "can not listen on port %i: %s\n", port, strerror(errno));
+      if( s>=0 ) close(s);
+      return -1;
+    }
+
+  return s;
+}
+
+
+static int socket_port(int s)
+{
+  struct sockaddr_in addr;
+  socklen_t len = sizeof(addr);
+  getsockname(s, (struct sockaddr *) &addr, &len);
+  return ntohs(addr.sin_port);
+}
+
+
+// tokens for the listening socket and the upstream connection in epoll
+static int token_listen, token_upstream;
+
+static void relay_loop(int s, std::atomic<bool> *done)
+{
+  epfd = epoll_create1(0);
+  struct epoll_event ev;
+  ev.events = EPOLLIN;
+  ev.data.ptr = &token_listen;
+  epoll_ctl(epfd, EPOLL_CTL_ADD, s, &ev);
+  ev.data.ptr = &token_upstream;
+  epoll_ctl(epfd, EPOLL_CTL_ADD, upstream.epfd, &ev);
+
+  uint64_t last_tick = 0;
+  while( !stop && (done==NULL || !*done) )
+    {
+      struct epoll_event events[64];
+      int n = epoll_wait(epfd, events, 64, 10);
+      for(int i=0; i<n; i++)
+        {
+          void *p = events[i].data.ptr;
+          if( p==&token_listen )
+            {
+              int fd;
+              while( (fd=accept4(s, NULL, NULL, SOCK_NONBLOCK))>=0 )
+                add_viewer(fd);
+            }
+          else if( p==&token_upstream )
+            dazzler_tcp_poll(&upstream, 0);
+          else
+            {
+              viewer *v = (viewer *) p;
+              bool ok = true;
+              if( events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR) ) ok = read_viewer(v);
+              if( ok && (events[i].events & EPOLLOUT) ) ok = flush_viewer(v);
+              if( !ok ) close_viewer(v);
+            }
+        }
+
+      uint64_t now = now_us();
+      if( now-last_tick>=10000 )
+        {
+          // (re)connect upstream, keyframes for viewers off the stream
+          last_tick = now;
+          if( upstream.fd<0 ) dazzler_tcp_poll(&upstream, 0);
+
+          for(size_t i=0; i<viewers.size(); i++)
+            {
+              viewer *v = viewers[i];
+              if( v->state==V_DEGRADED && v->pending.empty() && now-v->keyframe_us>=keyframe_period_us && unsent(v)==0 )
+                {
+                  v->state = V_WAIT;
+                  v->resume = false;
+                  num_waiting++;
+                }
+            }
+
+          if( num_waiting>0 && dazzler_decoder_idle(&d) )
+            {
+              start_waiting();
+              for(size_t i=0; i<viewers.size(); )
+                if( !viewers[i]->want_out && !flush_viewer(viewers[i]) )
+                  close_viewer(viewers[i]);
+                else
+                  i++;
+            }
+        }
+
+      for(size_t i=0; i<viewers.size(); i++)
+        {
+          // took the last keyframe quickly: back on the stream
+          viewer *v = viewers[i];
+          if( v->state==V_DEGRADED && v->keyframe_us>0 && v->pending.empty() && now-v->keyframe_us < keyframe_period_us/4 && unsent(v)==0 )
+            {
+              v->state = V_WAIT;
+              v->resume = true;
+              num_waiting++;
+            }
+        }
+    }
+
+  while( !viewers.empty() ) close_viewer(viewers[0]);
+  close(epfd);
+}
+
+
+static bool relay_init(const char *spec, uint16_t features)
+{
+  memset(mem, 0, sizeof(mem));
+  dazzler_decoder_init(&d, mem, features, &callbacks, NULL);
+  if( !dazzler_tcp_init(&upstream, spec, 0, NULL) ) return false;
+  upstream.receive = receive;
+  return true;
+}
+
+
+// ---------------------------------------------------------------- self test
+
+struct test_viewer
+{
+  int      fd;
+  bool     slow, greeting;
+  uint8_t  mem[2*DAZ_MEMSIZE];
+  dazzler_decoder d;
+  uint64_t bytes;
+};
+
+static std::atomic<bool> sim_done, test_done;
+static std::atomic<uint64_t> last_viewer_data;
+static uint8_t sim_reply;
+static double relay_cpu;
+
+
+// the synthetic stream, where the first connection breaks off (within a
+// DAZ_FULLFRAME) and where the second one goes on (at the next command)
+static std::vector<uint8_t> sim_stream;
+static size_t sim_cut, sim_rejoin;
+
+
+static int sim_accept(int s)
+{
+  int fd = -1;
+  while( fd<0 && !test_done )
+    {
+      fd = accept4(s, NULL, NULL, 0);
+      if( fd<0 ) usleep(1000);
+    }
+  if( fd<0 ) return -1;
+
+  const char *g = "[connected as 1st client on port 8800]\r\n";
+  if( write(fd, g, strlen(g))<0 ) { close(fd); return -1; }
+  return fd;
+}
+
+
+static void sim_thread(int s, double seconds)
+{
+  // synthetic stream: DAZ_VERSION, then drawing, frames, audio
+  std::vector<uint8_t> &st = sim_stream;
+  st.push_back(DAZ_VERSION | 3);
+  srand(1);
+  while( st.size()<seconds*100000 )
+    {
+      if( sim_cut==0 && st.size()>=seconds*50000 )
+        {
+          // halfway through: a frame the connection breaks off in
+          st.push_back(DAZ_FULLFRAME | 0x01);
+          for(int i=0; i<DAZ_MEMSIZE; i++) st.push_back(rand() & 0xFF);
+          sim_cut    = st.size() - DAZ_MEMSIZE/2;
+          sim_rejoin = st.size();
+        }
+
+      // (the second stream leaves video memory alone so that a relay
+      // that lost track of the commands there shows)
+      int k = rand() % 100;
+      if( sim_cut>0 && k>=3 ) k = 29;
+      if( k<1 && sim_cut==0 )
+        {
+          st.push_back(DAZ_FULLFRAME | 0x01 | ((rand() & 1) ? 0x08 : 0));
+          for(int i=0; i<DAZ_MEMSIZE; i++) st.push_back(rand() & 0xFF);
+        }
+      else if( k<3 )
+        {
+          st.push_back((rand() & 1) ? DAZ_CTRL : DAZ_CTRLPIC);
+          st.push_back(rand() & 0xFF);
+        }
+      else if( k<30 )
+        {
+          st.push_back(DAZ_DAC);
+          st.push_back(125);
+          st.push_back(0);
+          st.push_back(rand() & 0xFF);
+        }
+      else
+        {
+          int a = rand() & (2*DAZ_MEMSIZE-1);
+          st.push_back(DAZ_MEMBYTE | (a >> 8));
+          st.push_back(a & 0xFF);
+          st.push_back(rand() & 0xFF);
+        }
+    }
+
+  int fd = sim_accept(s);
+  if( fd<0 ) return;
+
+  // 1000 bytes every 10ms
+  uint64_t next = now_us();
+  for(size_t i=0; i<st.size(); )
+    {
+      int64_t w = (int64_t) (next-now_us());
+      if( w>0 ) usleep(w);
+      next += 10000;
+      size_t n = st.size()-i < 1000 ? st.size()-i : 1000;
+      if( i<sim_cut && i+n>sim_cut ) n = sim_cut-i;
+      if( write(fd, st.data()+i, n)!=(ssize_t) n ) break;
+      i += n;
+
+      if( i==sim_cut )
+        {
+          // the simulator restarts: the relay has to connect again and
+          // gets a new stream (starting with DAZ_VERSION again)
+          close(fd);
+          fd = sim_accept(s);
+          if( fd<0 ) return;
+          uint8_t v = DAZ_VERSION | 3;
+          if( write(fd, &v, 1)!=1 ) break;
+          i = sim_rejoin;
+          next = now_us();
+        }
+
+      uint8_t r;
+      if( sim_reply==0 && recv(fd, &r, 1, MSG_DONTWAIT)==1 ) sim_reply = r;
+    }
+
+  sim_done = true;
+  while( !test_done ) usleep(10000);
+  close(fd);
+}
+
+
+static void viewers_thread(int port, int n, double seconds)
+{
+  std::vector<test_viewer *> tv;
+  int vep = epoll_create1(0);
+  uint64_t start = now_us();
+  uint64_t slow_next = 0;
+
+  while( !test_done )
+    {
+      // join during the first half of the stream
+      while( (int) tv.size()<n && now_us()-start >= (uint64_t) (seconds*500000) * tv.size() / n )
+        {
+          test_viewer *v = new test_viewer();
+          v->slow = tv.empty();
+          v->greeting = true;
+          v->fd = socket(AF_INET, SOCK_STREAM, 0);
+          if( v->slow )
+            {
+              int rcvbuf = 4096;
+              setsockopt(v->fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+            }
+
+          struct sockaddr_in addr;
+          memset(&addr, 0, sizeof(addr));
+          addr.sin_family = AF_INET;
+          addr.sin_port   = htons(port);
+          addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+          if( connect(v->fd, (struct sockaddr *) &addr, sizeof(addr))<0 ) { perror("connect"); return; }
+          fcntl(v->fd, F_SETFL, O_NONBLOCK);
+          dazzler_decoder_init(&v->d, v->mem, FEAT_VIDEO, NULL, NULL);
+
+          struct epoll_event ev;
+          ev.events   = v->slow ? 0 : EPOLLIN;
+          ev.data.ptr = v;
+          epoll_ctl(vep, EPOLL_CTL_ADD, v->fd, &ev);
+          tv.push_back(v);
+        }
+
+      struct epoll_event events[64];
+      int k = epoll_wait(vep, events, 64, 2);
+      uint64_t now = now_us();
+      std::vector<test_viewer *> ready;
+      for(int i=0; i<k; i++) ready.push_back((test_viewer *) events[i].data.ptr);
+      if( !tv.empty() && now>=slow_next )
+        {
+          // the slow viewer reads 512 bytes every 10ms
+          ready.push_back(tv[0]);
+          slow_next = now + 10000;
+        }
+
+      for(size_t i=0; i<ready.size(); i++)
+        {
+          test_viewer *v = ready[i];
+          uint8_t buf[65536];
+          int r = read(v->fd, buf, v->slow ? 512 : sizeof(buf));
+          if( r<=0 ) continue;
+
+          int j = 0;
+          while( v->greeting && j<r )
+            if( buf[j++]=='\n' ) v->greeting = false;
+          if( j<r ) dazzler_decoder_receive(&v->d, buf+j, r-j);
+          v->bytes += r;
+          last_viewer_data = now;
+        }
+    }
+
+  // check the display state of every viewer against the relay's
+  int wrong = 0;
+  uint64_t bytes = 0;
+  for(size_t i=0; i<tv.size(); i++)
+    {
+      test_viewer *v = tv[i];
+      bytes += v->bytes;
+      if( memcmp(v->mem, mem, sizeof(mem))!=0 || (v->d.ctrl & 0x81)!=(d.ctrl & 0x81) || v->d.picture_ctrl!=d.picture_ctrl )
+        {
+          wrong++;
+          if( wrong==1 )
+            {
+              int diff = 0;
+              for(int a=0; a<2*DAZ_MEMSIZE; a++) diff += v->mem[a]!=mem[a];
+              printf("  viewer %i has the wrong display state (%i bytes, ctrl %02X/%02X, picture ctrl %02X/%02X)\n",
+                     (int) i+1, diff, v->d.ctrl, d.ctrl, v->d.picture_ctrl, d.picture_ctrl);
+            }
+        }
+      close(v->fd);
+      delete v;
+    }
+  close(vep);
+
+  printf("  %i viewers, %i with the wrong display state, %.1f MB received\n", (int) tv.size(), wrong, bytes/1e6);
+  if( wrong>0 ) sim_reply = 0;
+}
+
+
+static int self_test(int n, double seconds)
+{
+  int sim = listen_socket(0), s = listen_socket(0);
+  if( sim<0 || s<0 ) return 1;
+  fcntl(sim, F_SETFL, O_NONBLOCK);
+  listen_port = socket_port(s);
+  queue_limit = 32768;
+
+  char spec[32];
+  snprintf(spec, sizeof(spec), "127.0.0.1:%i", socket_port(sim));
+  uint16_t features = FEAT_VIDEO | FEAT_JOYSTICK | FEAT_DUAL_BUF | FEAT_DAC | FEAT_KEYBOARD;
+  if( !relay_init(spec, features) ) return 1;
+
+  printf("relay self test, %i viewers, %.1fs:\n", n, seconds);
+  std::atomic<bool> relay_done(false);
+  std::thread relay([s, &relay_done]()
+                    {
+                      relay_loop(s, &relay_done);
+                      struct rusage ru;
+                      getrusage(RUSAGE_THREAD, &ru);
+                      relay_cpu = ru.ru_utime.tv_sec + ru.ru_stime.tv_sec + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec)/1e6;
+                    });
+  std::thread simulator(sim_thread, sim, seconds);
+
+  // let the viewers finish after the stream ended (the slow one takes a while)
+  std::atomic<bool> viewers_done(false);
+  std::thread vt([n, seconds, &viewers_done]() { viewers_thread(listen_port, n, seconds); viewers_done = true; });
+  uint64_t start = now_us();
+  while( !sim_done && now_us()-start<(seconds+10)*1000000 ) usleep(10000);
+  while( now_us()-last_viewer_data<1000000 && now_us()-start<(seconds+20)*1000000 ) usleep(10000);
+
+  relay_done = true;
+  relay.join();
+
+  uint8_t reply = sim_reply;
+  test_done = true;
+  vt.join();
+  simulator.join();
+
+  // what the relay should show: the first stream up to the cut, the
+  // cut-off frame completed with zeros, then the second stream
+  static uint8_t ref_mem[2*DAZ_MEMSIZE];
+  dazzler_decoder ref;
+  dazzler_decoder_init(&ref, ref_mem, features, NULL, NULL);
+  dazzler_decoder_receive(&ref, sim_stream.data(), (int) sim_cut);
+  static const uint8_t zero = 0;
+  while( ref.recv_status!=0 ) dazzler_decoder_receive(&ref, &zero, 1);
+  dazzler_decoder_reset(&ref);
+  uint8_t v = DAZ_VERSION | 3;
+  dazzler_decoder_receive(&ref, &v, 1);
+  dazzler_decoder_receive(&ref, sim_stream.data()+sim_rejoin, (int) (sim_stream.size()-sim_rejoin));
+  bool ref_ok = memcmp(ref_mem, mem, sizeof(mem))==0 && ref.ctrl==d.ctrl && ref.picture_ctrl==d.picture_ctrl;
+
+  bool ok = sim_reply!=0 && reply==(DAZ_VERSION | DAZZLER_VERSION) && closed_degraded_first>0 && closed_degraded_others==0 && num_dropped==0
+    && upstream.num_connects==2 && ref_ok;
+  printf("  simulator connected %lu times, relay display state %s\n",
+         (unsigned long) upstream.num_connects, ref_ok ? "correct" : "WRONG");
+  printf("  slow viewer taken off the stream %lu times, others %lu times, %lu keyframes in all\n",
+         (unsigned long) closed_degraded_first, (unsigned long) closed_degraded_others, (unsigned long) closed_keyframes);
+  printf("  relay CPU time %.3fs (%.1f%% of the stream time), %.1f MB stream\n",
+         relay_cpu, 100*relay_cpu/seconds, head/1e6);
+  printf("  DAZ_VERSION reply %02X, %lu viewers dropped\n", reply, (unsigned long) num_dropped);
+  printf("  %s\n", ok ? "ok" : "FAILED");
+  return ok ? 0 : 1;
+}
+
+
+int main(int argc, char **argv)
+{
+  const char *spec = "localhost:8800";
+  uint16_t features = FEAT_VIDEO | FEAT_JOYSTICK | FEAT_DUAL_BUF | FEAT_DAC | FEAT_KEYBOARD;
+  int test = 0;
+  double seconds = 3;
+
+  for(int i=1; i<argc; i++)
+    {
+      if( strcmp(argv[i], "-l")==0 && i+1<argc )
+        listen_port = atoi(argv[++i]);
+      else if( strcmp(argv[i], "-q")==0 && i+1<argc )
+        queue_limit = atoll(argv[++i]);
+      else if( strcmp(argv[i], "-k")==0 && i+1<argc )
+        keyframe_period_us = atoll(argv[++i]) * 1000;
+      else if( strcmp(argv[i], "-f")==0 && i+1<argc )
+        features = (uint16_t) strtol(argv[++i], NULL, 16);
+      else if( strcmp(argv[i], "-t")==0 && i+1<argc )
+        test = atoi(argv[++i]);
+      else if( strcmp(argv[i], "-s")==0 && i+1<argc )
+        seconds = atof(argv[++i]);
+      else if( argv[i][0]!='-' )
+        spec = argv[i];
+      else
+        {
+          fprintf(stderr, "usage: %s [-l port] [-q bytes] [-k ms] [-f features] [host[:port]]\n", argv[0]);
+          fprintf(stderr, "       %s -t viewers [-s seconds]\n", argv[0]);
+          return 1;
+        }
+    }
+
+  if( queue_limit<1024 ) queue_limit = 1024;
+  if( queue_limit>RING/2 ) queue_limit = RING/2;
+  if( test>0 ) return self_test(test, seconds);
+
+  int s = listen_socket(listen_port);
+  if( s<0 || !relay_init(spec, features) ) return 1;
+  signal(SIGINT, on_signal);
+  signal(SIGTERM, on_signal);
+  printf("relaying %s:%s to port %i\n", upstream.host, upstream.port, listen_port);
+  relay_loop(s, NULL);
+  close(s);
+  dazzler_tcp_free(&upstream);
+  return 0;
+}
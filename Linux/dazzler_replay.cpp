@@ -0,0 +1,261 @@
+// -----------------------------------------------------------------------------
+// Cromemco Dazzler emulation - protocol trace replayer
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+// Usage: dazzler_replay [-r] [-s speed] [-l loops] [-p prefix] [-c file] trace-file
+//
+// Feeds a trace recorded with the Windows client (File/Record Trace)
+// through the decoder and renderer, exactly in the pieces it was received.
+// By default the trace is replayed as fast as possible, with -r it is
+// replayed in real time (-s scales the speed). Frames are rendered
+// whenever a full frame or control register change arrives and otherwise
+// every 16.59ms of trace time (the Dazzler's frame period).
+// With -p the last frame is written to <prefix>.ppm. With -c all rendered
+// frames are captured (using trace time) to a .y4m, .gif or .png file
+// (see dazzler_capture.h).
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "../Common/dazzler_decoder.h"
+#include "../Common/dazzler_render.h"
+#include "../Common/dazzler_sched.h"
+#include "../Common/dazzler_trace.h"
+#include "../Common/dazzler_capture.h"
+
+
+static uint8_t dazzler_mem[2*DAZ_MEMSIZE];
+static dazzler_decoder  decoder;
+static dazzler_renderer renderer;
+static uint32_t frame[DAZ_WIDTH*DAZ_HEIGHT];
+static dazzler_capture *capture = NULL;
+
+static bool     frame_boundary = false;
+static int      frame_contents = -1;
+static uint64_t num_frames = 0, num_cells = 0, num_samples = 0, audio_us[2] = {0, 0};
+
+
+static uint64_t now_us()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+static void replay_boundary(void *ctx, int addr, int len) { frame_boundary = true; }
+static void replay_ctrl(void *ctx, uint8_t ctrl) { frame_boundary = true; }
+
+static void replay_dac(void *ctx, int channel, uint16_t delay_us, uint8_t sample)
+{
+  num_samples++;
+  audio_us[channel] += delay_us;
+}
+
+static const dazzler_decoder_callbacks replay_callbacks =
+  {NULL, replay_boundary, replay_ctrl, replay_ctrl, replay_dac, NULL, NULL};
+
+
+static void render(uint64_t t)
+{
+  uint32_t dirty[2][DAZ_DIRTY_WORDS];
+  dazzler_dirty_take(&decoder.dirty, 0, dirty[0]);
+  dazzler_dirty_take(&decoder.dirty, 1, dirty[1]);
+
+  int buffer = decoder.ctrl & 1;
+  const uint8_t *mem = dazzler_mem + DAZ_MEMSIZE*buffer;
+  if( !(decoder.ctrl & 0x80) )
+    {
+      dazzler_render_clear(frame, DAZ_WIDTH);
+      frame_contents = -1;
+    }
+  else if( frame_contents != buffer*256+decoder.picture_ctrl )
+    {
+      dazzler_render_frame(&renderer, mem, decoder.picture_ctrl, frame, DAZ_WIDTH);
+      frame_contents = buffer*256+decoder.picture_ctrl;
+      num_cells += renderer.cells_redrawn;
+    }
+  else
+    num_cells += dazzler_render_update(&renderer, mem, decoder.picture_ctrl, dirty[buffer], frame, DAZ_WIDTH);
+
+  if( capture!=NULL )
+    {
+      static uint8_t pixels[DAZ_WIDTH*DAZ_HEIGHT];
+      if( decoder.ctrl & 0x80 )
+        dazzler_render_indexed(&renderer, mem, decoder.picture_ctrl, pixels);
+      else
+        memset(pixels, 0, sizeof(pixels));
+      dazzler_capture_add(capture, pixels, t);
+    }
+
+  num_frames++;
+}
+
+
+static void write_ppm(const char *fname, const uint32_t *frame)
+{
+  FILE *f = fopen(fname, "wb");
+  if( f==NULL ) return;
+
+  fprintf(f, "P6\n%i %i\n255\n", DAZ_WIDTH, DAZ_HEIGHT);
+  for(int i=0; i<DAZ_WIDTH*DAZ_HEIGHT; i++)
+    {
+      uint8_t rgb[3] = {(uint8_t) frame[i], (uint8_t) (frame[i]>>8), (uint8_t) (frame[i]>>16)};
+      fwrite(rgb, 1, 3, f);
+    }
+
+  fclose(f);
+}
+
+
+int main(int argc, char **argv)
+{
+  bool realtime = false;
+  double speed = 1.0;
+  int loops = 1;
+  const char *prefix = NULL, *fname = NULL, *cname = NULL;
+
+  for(int i=1; i<argc; i++)
+    {
+      if( strcmp(argv[i], "-r")==0 )
+        realtime = true;
+      else if( strcmp(argv[i], "-s")==0 && i+1<argc )
+        speed = atof(argv[++i]);
+      else if( strcmp(argv[i], "-l")==0 && i+1<argc )
+        loops = atoi(argv[++i]);
+      else if( strcmp(argv[i], "-p")==0 && i+1<argc )
+        prefix = argv[++i];
+      else if( strcmp(argv[i], "-c")==0 && i+1<argc )
+        cname = argv[++i];
+      else if( argv[i][0]!='-' && fname==NULL )
+        fname = argv[i];
+      else
+        fname = NULL, i = argc;
+    }
+
+  if( fname==NULL || speed<=0 || loops<1 )
+    {
+      fprintf(stderr, "usage: %s [-r] [-s speed] [-l loops] [-p prefix] [-c file] trace-file\n", argv[0]);
+      return 1;
+    }
+
+  int fd = open(fname, O_RDONLY);
+  struct stat st;
+  if( fd<0 || fstat(fd, &st)<0 || st.st_size==0 )
+    {
+      fprintf(stderr, "can not read %s\n", fname);
+      return 1;
+    }
+
+  const uint8_t *data = (const uint8_t *) mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if( data==MAP_FAILED )
+    {
+      fprintf(stderr, "can not map %s\n", fname);
+      return 1;
+    }
+  madvise((void *) data, st.st_size, MADV_SEQUENTIAL);
+
+  dazzler_trace_reader trace;
+  if( !dazzler_trace_open(&trace, data, st.st_size) )
+    {
+      fprintf(stderr, "%s is not a Dazzler trace\n", fname);
+      return 1;
+    }
+
+  dazzler_decoder_init(&decoder, dazzler_mem, 0, &replay_callbacks, NULL);
+  dazzler_render_init(&renderer);
+
+  if( cname!=NULL )
+    {
+      uint32_t palette[32];
+      dazzler_render_palette(palette);
+      int format = dazzler_capture_format(cname);
+      if( format<0 || (capture=dazzler_capture_start(cname, format, palette, 60))==NULL )
+        {
+          fprintf(stderr, "can not capture to %s\n", cname);
+          return 1;
+        }
+
+      // frames are not real-time here, encode all of them
+      capture->wait = true;
+    }
+
+  uint64_t records = 0, trace_us = 0;
+  uint64_t start = now_us();
+  for(int l=0; l<loops; l++)
+    {
+      const uint8_t *p;
+      uint64_t t, next_frame = 0, loop_start = now_us();
+      int n;
+
+      dazzler_trace_rewind(&trace);
+      while( (n=dazzler_trace_next(&trace, &p, &t))>=0 )
+        {
+          if( realtime )
+            {
+              uint64_t due = loop_start + (uint64_t) (t / speed), now = now_us();
+              if( due>now ) usleep(due-now);
+            }
+
+          dazzler_decoder_receive(&decoder, p, n);
+          records++;
+
+          if( frame_boundary || t>=next_frame )
+            {
+              render(trace_us + t);
+              frame_boundary = false;
+              next_frame = t + DAZ_VSYNC_PERIOD_US;
+            }
+        }
+
+      trace_us += t;
+      if( trace.p!=trace.end ) fprintf(stderr, "warning: trace is truncated or corrupt\n");
+    }
+  double wall = (now_us()-start) / 1e6;
+
+  printf("%lu records, %lu bytes, %lu commands in %.3fs (trace time %.3fs, %.1fx, %.1f MB/s)\n",
+         (unsigned long) records, (unsigned long) decoder.num_bytes, (unsigned long) decoder.num_commands,
+         wall, trace_us / 1e6, trace_us / 1e6 / wall, decoder.num_bytes / wall / 1e6);
+  printf("%lu frames rendered, %.1f cells/frame, %lu audio samples (%.3fs/%.3fs)\n",
+         (unsigned long) num_frames, num_frames ? (double) num_cells / num_frames : 0.0,
+         (unsigned long) num_samples, audio_us[0] / 1e6, audio_us[1] / 1e6);
+
+  if( capture!=NULL )
+    {
+      uint64_t in = capture->frames_in, same = capture->frames_same, dropped = capture->frames_dropped;
+      dazzler_capture_stop(capture, trace_us);
+      printf("%lu frames captured (%lu unchanged, %lu dropped)\n",
+             (unsigned long) (in-same-dropped), (unsigned long) same, (unsigned long) dropped);
+    }
+
+  if( prefix!=NULL )
+    {
+      char fn[256];
+      snprintf(fn, sizeof(fn), "%s.ppm", prefix);
+      write_ppm(fn, frame);
+    }
+
+  munmap((void *) data, st.st_size);
+  close(fd);
+  return 0;
+}
@@ -0,0 +1,138 @@
+// -----------------------------------------------------------------------------
+// Cromemco Dazzler emulation - Linux serial port
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <asm/termbits.h>
+#include "dazzler_serial.h"
+
+// <asm/termbits.h> has termios2 and BOTHER, which <termios.h> does not
+// (and the two can not be included together)
+
+
+bool dazzler_serial_set_baud(int fd, int baud)
+{
+  struct termios2 tio;
+  if( ioctl(fd, TCGETS2, &tio)<0 ) return false;
+
+  tio.c_cflag &= ~CBAUD;
+  tio.c_cflag |= BOTHER;
+  tio.c_ispeed = baud;
+  tio.c_ospeed = baud;
+  return ioctl(fd, TCSETS2, &tio)==0;
+}
+
+
+int dazzler_serial_open(const char *dev, int baud)
+{
+  int fd = open(dev, O_RDWR | O_NOCTTY | O_NONBLOCK);
+  struct termios2 tio;
+  if( fd<0 || ioctl(fd, TCGETS2, &tio)<0 )
+    {
+      fprintf(stderr, "can not open %s: %s\n", dev, strerror(errno));
+      if( fd>=0 ) close(fd);
+      return -1;
+    }
+
+  // raw 8N1, no flow control, reads return whatever is there
+  tio.c_iflag &= ~(IGNBRK | BRKINT | PARMRK | ISTRIP | INLCR | IGNCR | ICRNL | IXON | IXOFF | IXANY);
+  tio.c_oflag &= ~OPOST;
+  tio.c_lflag &= ~(ECHO | ECHONL | ICANON | ISIG | IEXTEN);
+  tio.c_cflag &= ~(CSIZE | PARENB | CSTOPB | CRTSCTS | CBAUD);
+  tio.c_cflag |= CS8 | CLOCAL | CREAD | BOTHER;
+  tio.c_ispeed = baud;
+  tio.c_ospeed = baud;
+  tio.c_cc[VMIN]  = 0;
+  tio.c_cc[VTIME] = 0;
+  if( ioctl(fd, TCSETS2, &tio)<0 )
+    {
+      fprintf(stderr, "can not set %s to %i baud: %s\n", dev, baud, strerror(errno));
+      close(fd);
+      return -1;
+    }
+
+  ioctl(fd, TCFLSH, TCIOFLUSH);
+  return fd;
+}
+
+
+bool dazzler_serial_write(int fd, const uint8_t *data, int size)
+{
+  while( size>0 )
+    {
+      int n = write(fd, data, size);
+      if( n<0 && (errno==EAGAIN || errno==EINTR) )
+        {
+          struct pollfd p = {fd, POLLOUT, 0};
+          poll(&p, 1, 100);
+          continue;
+        }
+      else if( n<=0 )
+        return false;
+
+      data += n;
+      size -= n;
+    }
+
+  return true;
+}
+
+
+void dazzler_serial_reader_init(dazzler_serial_reader *r, int fd, dazzler_decoder *d)
+{
+  r->fd = fd;
+  r->d  = d;
+  r->num_polls = r->num_reads = r->num_bytes = 0;
+  r->max_read = 0;
+}
+
+
+int dazzler_serial_receive(dazzler_serial_reader *r, int timeout_ms)
+{
+  struct pollfd p = {r->fd, POLLIN, 0};
+  r->num_polls++;
+  int res = poll(&p, 1, timeout_ms);
+  if( res<0 ) return errno==EINTR ? 0 : -1;
+  if( res==0 ) return 0;
+  if( (p.revents & (POLLERR | POLLHUP | POLLNVAL)) && !(p.revents & POLLIN) ) return -1;
+
+  // decode each burst as it comes, read again if it filled the buffer
+  int total = 0;
+  while( true )
+    {
+      r->num_reads++;
+      int n = read(r->fd, r->buf, DAZ_SERIAL_BUFSIZE);
+      if( n<0 && errno==EINTR ) continue;
+      if( n<0 && errno==EAGAIN ) break;
+      if( n<=0 ) return total>0 ? total : -1;
+
+      if( n>r->max_read ) r->max_read = n;
+      r->num_bytes += n;
+      total += n;
+      dazzler_decoder_receive(r->d, r->buf, n);
+      if( n<DAZ_SERIAL_BUFSIZE ) break;
+    }
+
+  return total;
+}
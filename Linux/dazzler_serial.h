@@ -0,0 +1,67 @@
+// -----------------------------------------------------------------------------
+// Cromemco Dazzler emulation - Linux serial port
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#ifndef DAZZLER_SERIAL_H
+#define DAZZLER_SERIAL_H
+
+#include <stdint.h>
+#include "../Common/dazzler_decoder.h"
+
+// Serial port for the Linux tools. Any baud rate the UART can make is
+// allowed (e.g. 525000, 750000, 1050000), set with termios2/BOTHER
+// instead of the fixed Bxxx constants. The port is non-blocking and
+// read in bursts as large as the kernel has them: one poll per wakeup,
+// then one read of everything that is there, so at 1050000 baud there are far
+// fewer system calls (and no added latency) compared to fixed-size
+// reads with a timeout.
+
+// largest burst read at once
+#define DAZ_SERIAL_BUFSIZE 65536
+
+struct dazzler_serial_reader
+{
+  int fd;
+  dazzler_decoder *d;
+  uint8_t buf[DAZ_SERIAL_BUFSIZE];
+
+  // statistics
+  uint64_t num_polls, num_reads, num_bytes;
+  int      max_read;
+};
+
+
+// open "dev" raw 8N1 at "baud", returns the file descriptor or -1
+// (with a message on stderr)
+int dazzler_serial_open(const char *dev, int baud);
+
+// change the baud rate of an open port
+bool dazzler_serial_set_baud(int fd, int baud);
+
+// write all "size" bytes (waits while the output buffer is full)
+bool dazzler_serial_write(int fd, const uint8_t *data, int size);
+
+// the decoder gets everything read from "fd"
+void dazzler_serial_reader_init(dazzler_serial_reader *r, int fd, dazzler_decoder *d);
+
+// Wait up to "timeout_ms" (-1: forever) for data, then read and decode
+// everything there is. Returns the number of bytes decoded (0 on
+// timeout) or -1 if the port was closed or failed.
+int dazzler_serial_receive(dazzler_serial_reader *r, int timeout_ms);
+
+#endif
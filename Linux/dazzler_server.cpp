@@ -0,0 +1,468 @@
+// -----------------------------------------------------------------------------
+// Cromemco Dazzler emulation - trace replay server
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+// Usage: dazzler_server [-p port] [-r] [-x bytes] [-n clients] trace ...
+//        dazzler_server -t
+//
+// Stands in for the simulator's TCP port: every client that connects
+// gets the greeting ("[connected as nth client on port 8800]", sent in
+// small pieces a few ms apart, the last one together with the first
+// stream bytes) and then the traces (see dazzler_replay) one after the
+// other, as fast as the client takes them or with -r at the pace they
+// were recorded. Whatever clients send back (DAZ_VERSION replies,
+// joystick and keyboard messages) is counted. -x closes the first
+// connection after that many stream bytes (to see the client
+// reconnect), -n exits after that many clients got everything.
+// With -t it tests the TCP client (dazzler_tcp.h) against itself on the
+// loopback interface: the client starts while the port does not accept
+// connections yet (it must back off and retry), the first connection is
+// closed in the middle of the stream, the second one must deliver a
+// synthetic stream completely. Checks the retries, greeting, decoded
+// video memory and DAZ_VERSION reply. Exits with 1 if anything is wrong.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "../Common/dazzler_decoder.h"
+#include "../Common/dazzler_trace.h"
+#include "dazzler_tcp.h"
+
+struct record
+{
+  uint64_t t_us;
+  std::vector<uint8_t> data;
+};
+
+struct client
+{
+  int      fd, number;
+  uint64_t start_us, next_piece_us;
+  std::vector<uint8_t> greeting;
+  size_t   greeting_pos, rec, pos;
+  uint64_t sent, upstream;
+  uint8_t  first_upstream;
+  bool     done;
+};
+
+static std::vector<record> records;
+static int port = 8800, num_clients = 0, clients_done = 0, max_clients = 0;
+static uint64_t drop_after = 0;
+static bool realtime = false;
+static std::atomic<bool> server_stop;
+
+
+static uint64_t now_us()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+static const char *ordinal(int n)
+{
+  if( n%100>=11 && n%100<=13 ) return "th";
+  return n%10==1 ? "st" : n%10==2 ? "nd" : n%10==3 ? "rd" : "th";
+}
+
+
+static int listen_socket(int port, bool do_listen)
+{
+  int s = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0), one = 1;
+  setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port   = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  if( s<0 || bind(s, (struct sockaddr *) &addr, sizeof(addr))<0 || (do_listen && listen(s, 4)<0) )
+    {
+      fprintf(stderr, "can not listen on port %i: %s\n", port, strerror(errno));
+      if( s>=0 ) close(s);
+      return -1;
+    }
+
+  return s;
+}
+
+
+// send what is due for client "c", returns false if it should be closed
+static bool serve(client *c, uint64_t now)
+{
+  uint8_t buf[16384];
+  int n = 0;
+
+  if( c->greeting_pos<c->greeting.size() )
+    {
+      // greeting in pieces of 1-7 bytes, 2ms apart
+      if( now<c->next_piece_us ) return true;
+      size_t k = 1 + rand() % 7;
+      if( k>c->greeting.size()-c->greeting_pos ) k = c->greeting.size()-c->greeting_pos;
+      memcpy(buf, c->greeting.data()+c->greeting_pos, k);
+      c->greeting_pos += k;
+      c->next_piece_us = now + 2000;
+      n = (int) k;
+      if( c->greeting_pos<c->greeting.size() )
+        {
+          if( send(c->fd, buf, n, MSG_NOSIGNAL)!=n ) return false;
+          return true;
+        }
+    }
+
+  // stream data due by now
+  while( c->rec<records.size() && n<(int) sizeof(buf) )
+    {
+      const record &r = records[c->rec];
+      if( realtime && c->start_us + (r.t_us-records[0].t_us) > now ) break;
+
+      int k = (int) (r.data.size()-c->pos);
+      if( k>(int) sizeof(buf)-n ) k = (int) sizeof(buf)-n;
+      if( drop_after>0 && c->number==1 && c->sent+k>drop_after ) k = (int) (drop_after-c->sent);
+      memcpy(buf+n, r.data.data()+c->pos, k);
+      n += k;
+      c->sent += k;
+      c->pos += k;
+      if( c->pos==r.data.size() ) { c->rec++; c->pos = 0; }
+      if( drop_after>0 && c->number==1 && c->sent>=drop_after ) break;
+    }
+
+  int sent = 0;
+  while( sent<n )
+    {
+      int k = send(c->fd, buf+sent, n-sent, MSG_NOSIGNAL);
+      if( k<0 && errno==EINTR ) continue;
+      if( k<0 && errno==EAGAIN )
+        {
+          // put back what did not go out
+          uint64_t back = n-sent;
+          c->sent -= back;
+          while( back>0 )
+            {
+              if( c->pos==0 ) { c->rec--; c->pos = records[c->rec].data.size(); }
+              uint64_t b = back<c->pos ? back : c->pos;
+              c->pos -= b;
+              back -= b;
+            }
+          return true;
+        }
+      if( k<=0 ) return false;
+      sent += k;
+    }
+
+  if( drop_after>0 && c->number==1 && c->sent>=drop_after ) return false;
+  if( c->rec==records.size() && !c->done )
+    {
+      c->done = true;
+      clients_done++;
+      printf("client %i: sent %lu bytes, got %lu bytes back\n", c->number,
+             (unsigned long) c->sent, (unsigned long) c->upstream);
+    }
+
+  return true;
+}
+
+
+static void close_client(std::vector<client *> &clients, size_t i, int epfd)
+{
+  client *c = clients[i];
+  epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+  close(c->fd);
+  if( !c->done )
+    printf("client %i: closed after %lu bytes\n", c->number, (unsigned long) c->sent);
+  delete c;
+  clients.erase(clients.begin()+i);
+}
+
+
+// serve on listening socket "s" until server_stop is set or max_clients
+// got everything, returns the last client's first upstream byte
+static uint8_t run_server(int s)
+{
+  int epfd = epoll_create1(0);
+  struct epoll_event ev;
+  ev.events  = EPOLLIN;
+  ev.data.ptr = NULL;
+  epoll_ctl(epfd, EPOLL_CTL_ADD, s, &ev);
+
+  std::vector<client *> clients;
+  uint8_t first_upstream = 0;
+  while( !server_stop && (max_clients==0 || clients_done<max_clients) )
+    {
+      // wake up for greeting pieces, real-time replay and clients that wait for room
+      bool busy = false;
+      for(size_t i=0; i<clients.size(); i++)
+        busy = busy || clients[i]->greeting_pos<clients[i]->greeting.size() || (!clients[i]->done && realtime);
+
+      struct epoll_event events[16];
+      int n = epoll_wait(epfd, events, 16, busy ? 1 : 10);
+      for(int i=0; i<n; i++)
+        {
+          client *c = (client *) events[i].data.ptr;
+          if( c==NULL )
+            {
+              int fd = accept4(s, NULL, NULL, SOCK_NONBLOCK);
+              if( fd<0 ) continue;
+              int one = 1;
+              setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+              c = new client();
+              c->fd = fd;
+              c->number = ++num_clients;
+              c->start_us = now_us();
+              char g[64];
+              int k = snprintf(g, sizeof(g), "[connected as %i%s client on port %i]\r\n", c->number, ordinal(c->number), port);
+              c->greeting.assign(g, g+k);
+              clients.push_back(c);
+
+              struct epoll_event cev;
+              cev.events  = EPOLLIN | EPOLLOUT | EPOLLRDHUP;
+              cev.data.ptr = c;
+              epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &cev);
+            }
+          else if( events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR) )
+            {
+              uint8_t buf[256];
+              int k = read(c->fd, buf, sizeof(buf));
+              if( k>0 )
+                {
+                  if( c->upstream==0 ) c->first_upstream = buf[0];
+                  c->upstream += k;
+                }
+              else if( k==0 || errno!=EAGAIN )
+                {
+                  for(size_t j=0; j<clients.size(); j++)
+                    if( clients[j]==c ) close_client(clients, j, epfd);
+                }
+            }
+        }
+
+      uint64_t now = now_us();
+      for(size_t i=0; i<clients.size(); )
+        {
+          if( clients[i]->upstream>0 ) first_upstream = clients[i]->first_upstream;
+          if( !clients[i]->done && !serve(clients[i], now) )
+            close_client(clients, i, epfd);
+          else
+            i++;
+        }
+    }
+
+  while( !clients.empty() ) close_client(clients, 0, epfd);
+  close(epfd);
+  return first_upstream;
+}
+
+
+static bool read_trace(const char *fname)
+{
+  FILE *f = fopen(fname, "rb");
+  if( f==NULL ) return false;
+
+  std::vector<uint8_t> s;
+  uint8_t buf[65536];
+  size_t n;
+  while( (n=fread(buf, 1, sizeof(buf), f))>0 )
+    s.insert(s.end(), buf, buf+n);
+  fclose(f);
+
+  dazzler_trace_reader trace;
+  if( !dazzler_trace_open(&trace, s.data(), s.size()) ) return false;
+
+  // traces after the first one continue where the previous one ended
+  uint64_t base = records.empty() ? 0 : records.back().t_us;
+  const uint8_t *p;
+  uint64_t t, t0 = 0;
+  int k;
+  bool first = true;
+  while( (k=dazzler_trace_next(&trace, &p, &t))>=0 )
+    {
+      if( first ) { t0 = t; first = false; }
+      record r;
+      r.t_us = base + (t-t0);
+      r.data.assign(p, p+k);
+      records.push_back(r);
+    }
+  return true;
+}
+
+
+// ---------------------------------------------------------------- self test
+
+static void test_send(void *ctx, const uint8_t *data, int size)
+{
+  dazzler_tcp_send((dazzler_tcp *) ctx, data, size);
+}
+
+
+static int self_test()
+{
+  // synthetic stream: DAZ_VERSION, then frames, drawing and audio
+  record r;
+  r.t_us = 0;
+  r.data.push_back(DAZ_VERSION | 3);
+  srand(1);
+  while( r.data.size()<2000000 )
+    {
+      int k = rand() % 100;
+      if( k<2 )
+        {
+          r.data.push_back(DAZ_FULLFRAME | 0x01 | ((rand() & 1) ? 0x08 : 0));
+          for(int i=0; i<DAZ_MEMSIZE; i++) r.data.push_back(rand() & 0xFF);
+        }
+      else if( k<20 )
+        {
+          r.data.push_back(DAZ_DAC);
+          r.data.push_back(125);
+          r.data.push_back(0);
+          r.data.push_back(rand() & 0xFF);
+        }
+      else
+        {
+          int a = rand() & (2*DAZ_MEMSIZE-1);
+          r.data.push_back(DAZ_MEMBYTE | (a >> 8));
+          r.data.push_back(a & 0xFF);
+          r.data.push_back(rand() & 0xFF);
+        }
+    }
+  records.push_back(r);
+
+  static uint8_t mem[2*DAZ_MEMSIZE], ref_mem[2*DAZ_MEMSIZE];
+  static dazzler_decoder d, ref;
+  dazzler_decoder_init(&ref, ref_mem, FEAT_VIDEO, NULL, NULL);
+  dazzler_decoder_receive(&ref, r.data.data(), (int) r.data.size());
+
+  // bound but not listening: connections are refused until it does
+  int s = listen_socket(0, false);
+  if( s<0 ) return 1;
+  struct sockaddr_in addr;
+  socklen_t len = sizeof(addr);
+  getsockname(s, (struct sockaddr *) &addr, &len);
+  port = ntohs(addr.sin_port);
+  drop_after = r.data.size()/3;
+
+  static dazzler_tcp t;
+  static const dazzler_decoder_callbacks cb = {NULL, NULL, NULL, NULL, NULL, NULL, test_send, NULL, NULL};
+  char spec[64];
+  snprintf(spec, sizeof(spec), "127.0.0.1:%i", port);
+  dazzler_decoder_init(&d, mem, FEAT_VIDEO, &cb, &t);
+  if( !dazzler_tcp_init(&t, spec, 0, &d) ) return 1;
+
+  uint64_t start = now_us();
+  while( now_us()-start<1000000 )
+    dazzler_tcp_poll(&t, 10);
+  uint64_t failed = t.num_failed;
+  listen(s, 4);
+
+  // the client clears its display for each connection
+  uint8_t reply = 0;
+  std::thread server([s, &reply]() { reply = run_server(s); });
+  uint64_t connects = 0, last = now_us(), reconnect_us = 0, drop_us = 0;
+  while( clients_done<1 || now_us()-last<300000 )
+    {
+      if( t.num_connects>connects )
+        {
+          if( connects==1 ) reconnect_us = now_us()-drop_us;
+          connects = t.num_connects;
+          memset(mem, 0, sizeof(mem));
+        }
+
+      bool was_connected = t.connected;
+      if( dazzler_tcp_poll(&t, 10)>0 ) last = now_us();
+      if( was_connected && !t.connected ) drop_us = now_us();
+      if( now_us()-start>20000000 ) break;
+    }
+
+  server_stop = true;
+  server.join();
+
+  char expected[64];
+  snprintf(expected, sizeof(expected), "[connected as 2nd client on port %i]", port);
+  bool ok_retry = failed>=3 && failed<=6;
+  bool ok_reconnect = t.num_connects==2 && reconnect_us<DAZ_TCP_BACKOFF_MIN*1000+100000;
+  bool ok_greeting = strcmp(t.greeting, expected)==0;
+  bool ok_mem = memcmp(mem, ref_mem, sizeof(mem))==0;
+  bool ok_reply = reply==(DAZ_VERSION | DAZZLER_VERSION);
+
+  printf("TCP client self test on port %i:\n", port);
+  printf("  %lu attempts failed in the first second%s\n", (unsigned long) failed, ok_retry ? "" : "  WRONG");
+  printf("  %lu connections, reconnected %.0f ms after the first one closed%s\n",
+         (unsigned long) t.num_connects, reconnect_us/1000.0, ok_reconnect ? "" : "  WRONG");
+  printf("  greeting \"%s\"%s\n", t.greeting, ok_greeting ? "" : "  WRONG");
+  printf("  %lu bytes in %lu reads, video memory %s\n", (unsigned long) t.num_bytes,
+         (unsigned long) t.num_reads, ok_mem ? "correct" : "WRONG");
+  printf("  DAZ_VERSION reply %02X%s\n", reply, ok_reply ? "" : "  WRONG");
+
+  dazzler_tcp_free(&t);
+  close(s);
+  return ok_retry && ok_reconnect && ok_greeting && ok_mem && ok_reply ? 0 : 1;
+}
+
+
+int main(int argc, char **argv)
+{
+  int i;
+  for(i=1; i<argc && argv[i][0]=='-'; i++)
+    {
+      if( strcmp(argv[i], "-p")==0 && i+1<argc )
+        port = atoi(argv[++i]);
+      else if( strcmp(argv[i], "-r")==0 )
+        realtime = true;
+      else if( strcmp(argv[i], "-x")==0 && i+1<argc )
+        drop_after = atoll(argv[++i]);
+      else if( strcmp(argv[i], "-n")==0 && i+1<argc )
+        max_clients = atoi(argv[++i]);
+      else if( strcmp(argv[i], "-t")==0 )
+        return self_test();
+      else
+        break;
+    }
+
+  if( i>=argc )
+    {
+      fprintf(stderr, "usage: %s [-p port] [-r] [-x bytes] [-n clients] trace ...\n", argv[0]);
+      fprintf(stderr, "       %s -t\n", argv[0]);
+      return 1;
+    }
+
+  for(; i<argc; i++)
+    if( !read_trace(argv[i]) )
+      {
+        fprintf(stderr, "can not read trace %s\n", argv[i]);
+        return 1;
+      }
+
+  int s = listen_socket(port, true);
+  if( s<0 ) return 1;
+  printf("serving %lu trace records on port %i\n", (unsigned long) records.size(), port);
+  run_server(s);
+  close(s);
+  return 0;
+}
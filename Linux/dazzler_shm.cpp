@@ -0,0 +1,252 @@
+// -----------------------------------------------------------------------------
+// Cromemco Dazzler emulation - shared memory transport
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "dazzler_shm.h"
+
+// The futex operations are not "private": the futex word lives in a
+// mapping shared between processes.
+
+
+static long shm_futex(std::atomic<uint32_t> *word, int op, uint32_t val, const struct timespec *timeout)
+{
+  return syscall(SYS_futex, (uint32_t *) word, op, val, timeout, NULL, 0);
+}
+
+
+static uint64_t shm_now_us()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+static dazzler_shm_area *shm_map(const char *name, int flags)
+{
+  int fd = shm_open(name, flags, 0600);
+  if( fd<0 ) return NULL;
+
+  if( (flags & O_CREAT) && ftruncate(fd, sizeof(dazzler_shm_area))<0 )
+    {
+      close(fd);
+      return NULL;
+    }
+
+  struct stat st;
+  void *p = MAP_FAILED;
+  if( fstat(fd, &st)==0 && (size_t) st.st_size>=sizeof(dazzler_shm_area) )
+    p = mmap(NULL, sizeof(dazzler_shm_area), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+  // the mapping stays valid after closing the descriptor
+  close(fd);
+  return p==MAP_FAILED ? NULL : (dazzler_shm_area *) p;
+}
+
+
+bool dazzler_shm_create(dazzler_shm *s, const char *name)
+{
+  memset(s, 0, sizeof(dazzler_shm));
+  snprintf(s->name, sizeof(s->name), "%s", name);
+  s->producer = true;
+
+  // start from a fresh object so a consumer still mapping an old one
+  // does not see it re-initialized under its feet
+  shm_unlink(name);
+  s->area = shm_map(name, O_RDWR | O_CREAT | O_EXCL);
+  if( s->area==NULL )
+    {
+      fprintf(stderr, "can not create shared memory %s: %s\n", name, strerror(errno));
+      return false;
+    }
+
+  // ftruncate filled everything with zeros: display off, memory clear,
+  // nothing dirty, audio ring empty
+  dazzler_shm_area *a = s->area;
+  a->version = DAZ_SHM_VERSION;
+  std::atomic_thread_fence(std::memory_order_release);
+  a->magic = DAZ_SHM_MAGIC;
+  return true;
+}
+
+
+bool dazzler_shm_open(dazzler_shm *s, const char *name)
+{
+  memset(s, 0, sizeof(dazzler_shm));
+  snprintf(s->name, sizeof(s->name), "%s", name);
+
+  // read-write: the consumer takes dirty bits and audio samples
+  s->area = shm_map(name, O_RDWR);
+  if( s->area==NULL ) return false;
+
+  if( s->area->magic!=DAZ_SHM_MAGIC || s->area->version!=DAZ_SHM_VERSION )
+    {
+      munmap(s->area, sizeof(dazzler_shm_area));
+      s->area = NULL;
+      return false;
+    }
+
+  std::atomic_thread_fence(std::memory_order_acquire);
+  s->frame = s->area->frame.load(std::memory_order_acquire);
+  return true;
+}
+
+
+void dazzler_shm_close(dazzler_shm *s)
+{
+  if( s->area==NULL ) return;
+
+  if( s->producer )
+    {
+      s->area->closed.store(1, std::memory_order_release);
+      s->area->frame.fetch_add(1, std::memory_order_seq_cst);
+      shm_futex(&s->area->frame, FUTEX_WAKE, INT32_MAX, NULL);
+      shm_unlink(s->name);
+    }
+
+  munmap(s->area, sizeof(dazzler_shm_area));
+  s->area = NULL;
+}
+
+
+void dazzler_shm_write_block(dazzler_shm *s, int addr, const uint8_t *data, int n)
+{
+  dazzler_shm_begin(s);
+  dazzler_dirty_copy(&s->area->dirty, s->area->mem, addr, data, n);
+}
+
+
+void dazzler_shm_set_ctrl(dazzler_shm *s, uint8_t ctrl)
+{
+  dazzler_shm_begin(s);
+  dazzler_shm_area *a = s->area;
+  if( (a->ctrl&0x81)!=(ctrl&0x81) ) dazzler_dirty_set_all(&a->dirty);
+  a->ctrl = ctrl;
+}
+
+
+void dazzler_shm_set_picture_ctrl(dazzler_shm *s, uint8_t picture_ctrl)
+{
+  // same as the decoder: bit 7 is unused, bits 0-3 (color) are only
+  // used if bit 6 (high-res) is set
+  picture_ctrl = (picture_ctrl & 0x40) ? (picture_ctrl & 0x7f) : (picture_ctrl & 0x70);
+
+  dazzler_shm_begin(s);
+  dazzler_shm_area *a = s->area;
+  if( a->picture_ctrl!=picture_ctrl )
+    {
+      a->picture_ctrl = picture_ctrl;
+      dazzler_dirty_set_all(&a->dirty);
+    }
+}
+
+
+bool dazzler_shm_dac(dazzler_shm *s, int channel, uint16_t delay_us, uint8_t sample)
+{
+  dazzler_shm_area *a = s->area;
+  uint32_t head = a->audio_head.load(std::memory_order_relaxed);
+  if( head - a->audio_tail.load(std::memory_order_acquire) >= DAZ_SHM_AUDIO_SIZE )
+    {
+      a->audio_dropped.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+
+  dazzler_shm_sample &e = a->audio[head & (DAZ_SHM_AUDIO_SIZE-1)];
+  e.delay_us = delay_us;
+  e.channel  = channel ? 1 : 0;
+  e.sample   = sample;
+  a->audio_head.store(head+1, std::memory_order_release);
+  return true;
+}
+
+
+void dazzler_shm_publish(dazzler_shm *s)
+{
+  dazzler_shm_area *a = s->area;
+  if( s->writing )
+    {
+      a->seq.fetch_add(1, std::memory_order_release);
+      s->writing = false;
+    }
+
+  // the consumer increments "sleepers" before checking "frame" and we
+  // increment "frame" before checking "sleepers", so one of the two
+  // always sees the other
+  a->frame.fetch_add(1, std::memory_order_seq_cst);
+  if( a->sleepers.load(std::memory_order_seq_cst)>0 )
+    shm_futex(&a->frame, FUTEX_WAKE, INT32_MAX, NULL);
+}
+
+
+int dazzler_shm_wait(dazzler_shm *s, int timeout_ms)
+{
+  dazzler_shm_area *a = s->area;
+  uint64_t deadline = timeout_ms<0 ? 0 : shm_now_us() + (uint64_t) timeout_ms*1000;
+
+  uint32_t frame = a->frame.load(std::memory_order_acquire);
+  while( frame==s->frame && !a->closed.load(std::memory_order_acquire) )
+    {
+      struct timespec ts, *tp = NULL;
+      if( timeout_ms>=0 )
+        {
+          uint64_t now = shm_now_us();
+          if( now>=deadline ) return 0;
+          ts.tv_sec  = (deadline-now) / 1000000;
+          ts.tv_nsec = (deadline-now) % 1000000 * 1000;
+          tp = &ts;
+        }
+
+      a->sleepers.fetch_add(1, std::memory_order_seq_cst);
+      if( a->frame.load(std::memory_order_seq_cst)==s->frame )
+        shm_futex(&a->frame, FUTEX_WAIT, s->frame, tp);
+      a->sleepers.fetch_sub(1, std::memory_order_seq_cst);
+
+      frame = a->frame.load(std::memory_order_acquire);
+    }
+
+  if( a->closed.load(std::memory_order_acquire) ) return -1;
+
+  int n = (int) (frame - s->frame);
+  s->frame = frame;
+  return n;
+}
+
+
+int dazzler_shm_audio(dazzler_shm *s, dazzler_shm_sample *out, int max)
+{
+  dazzler_shm_area *a = s->area;
+  uint32_t tail = a->audio_tail.load(std::memory_order_relaxed);
+  uint32_t head = a->audio_head.load(std::memory_order_acquire);
+
+  int n = 0;
+  while( n<max && tail!=head )
+    out[n++] = a->audio[tail++ & (DAZ_SHM_AUDIO_SIZE-1)];
+
+  a->audio_tail.store(tail, std::memory_order_release);
+  return n;
+}
@@ -0,0 +1,161 @@
+// -----------------------------------------------------------------------------
+// Cromemco Dazzler emulation - shared memory transport
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#ifndef DAZZLER_SHM_H
+#define DAZZLER_SHM_H
+
+#include <stdint.h>
+#include <atomic>
+#include "../Common/dazzler_proto.h"
+#include "../Common/dazzler_dirty.h"
+
+// Display state in POSIX shared memory, for a simulator and display
+// running on the same machine. Instead of encoding every video memory
+// write into DAZ_MEMBYTE commands and decoding them again, the simulator
+// (producer) writes straight into the mapped video memory and the
+// display (consumer) renders straight out of it.
+//
+// - "seq" is a sequence lock: it is odd while the producer is changing
+//   the state (from its first write after a VSYNC until the next VSYNC),
+//   so a consumer can tell whether what it read is a complete frame.
+//   Reading a frame in progress is what the real Dazzler does as well,
+//   every byte written during the read is marked dirty again and drawn
+//   with the next frame.
+// - "frame" counts VSYNCs. It is also the futex the consumer sleeps on,
+//   the producer only makes the wake-up system call if a consumer is
+//   actually sleeping.
+// - "dirty" is the same bitmap the decoder keeps, so the consumer can
+//   pass it to dazzler_render_update. There should only be one consumer
+//   taking the dirty bits.
+// - audio samples (as DAZ_DAC would carry them) go through a single
+//   producer, single consumer ring, the producer drops samples when the
+//   ring is full.
+
+#define DAZ_SHM_MAGIC      0x4D48535A   // "ZSHM"
+#define DAZ_SHM_VERSION    1
+#define DAZ_SHM_NAME       "/dazzler"
+#define DAZ_SHM_AUDIO_SIZE 4096          // samples, power of 2
+
+struct dazzler_shm_sample
+{
+  uint16_t delay_us;         // to be played delay_us after the previous one
+  uint8_t  channel, sample;
+};
+
+struct dazzler_shm_area
+{
+  uint32_t magic, version;   // magic is set last when the producer is ready
+  std::atomic<uint32_t> seq;
+  std::atomic<uint32_t> frame;
+  std::atomic<uint32_t> sleepers;  // consumers in FUTEX_WAIT
+  std::atomic<uint32_t> closed;    // producer has gone away
+
+  uint8_t  ctrl;             // D7: on/off, D0: buffer select
+  uint8_t  picture_ctrl;     // D6: x4 res, D5: 2k mem, D4: color, D3-D0: fg color
+  uint8_t  mem[2*DAZ_MEMSIZE];
+  dazzler_dirty dirty;
+
+  std::atomic<uint32_t> audio_head, audio_tail;
+  std::atomic<uint32_t> audio_dropped;
+  dazzler_shm_sample audio[DAZ_SHM_AUDIO_SIZE];
+};
+
+struct dazzler_shm
+{
+  char name[64];
+  dazzler_shm_area *area;
+  bool producer;
+  bool writing;              // producer: seq is odd
+  uint32_t frame;            // consumer: last frame seen by dazzler_shm_wait
+};
+
+
+// producer: create (or re-create) the shared memory object "name"
+// (e.g. DAZ_SHM_NAME) with the display turned off and memory cleared
+bool dazzler_shm_create(dazzler_shm *s, const char *name);
+
+// consumer: map the shared memory object "name", false if it does not
+// exist (yet) or was made by an incompatible version
+bool dazzler_shm_open(dazzler_shm *s, const char *name);
+
+// unmap, the producer also removes the object and wakes the consumers
+void dazzler_shm_close(dazzler_shm *s);
+
+
+// producer: mark the start of changes (done by all functions below)
+inline void dazzler_shm_begin(dazzler_shm *s)
+{
+  if( !s->writing )
+    {
+      s->area->seq.fetch_add(1, std::memory_order_acq_rel);
+      s->writing = true;
+    }
+}
+
+// producer: write one byte of video memory (addr is 0..4095)
+inline void dazzler_shm_write(dazzler_shm *s, int addr, uint8_t value)
+{
+  dazzler_shm_begin(s);
+  dazzler_shm_area *a = s->area;
+  if( a->mem[addr]!=value )
+    {
+      a->mem[addr] = value;
+      dazzler_dirty_set(&a->dirty, addr);
+    }
+}
+
+// producer: write "n" bytes of video memory starting at addr (no wrap-around)
+void dazzler_shm_write_block(dazzler_shm *s, int addr, const uint8_t *data, int n);
+
+// producer: set the control and picture control registers
+void dazzler_shm_set_ctrl(dazzler_shm *s, uint8_t ctrl);
+void dazzler_shm_set_picture_ctrl(dazzler_shm *s, uint8_t picture_ctrl);
+
+// producer: queue an audio sample, false if the ring is full
+bool dazzler_shm_dac(dazzler_shm *s, int channel, uint16_t delay_us, uint8_t sample);
+
+// producer: VSYNC, the changes so far make up a frame. Ends the
+// sequence lock, counts the frame and wakes a sleeping consumer.
+void dazzler_shm_publish(dazzler_shm *s);
+
+
+// consumer: wait up to "timeout_ms" (-1: forever) for the next frame.
+// Returns the number of frames published since the last call (more
+// than 1 if the consumer fell behind), 0 on timeout or -1 if the
+// producer closed the object.
+int dazzler_shm_wait(dazzler_shm *s, int timeout_ms);
+
+// consumer: bracket reading the state, dazzler_shm_read_end returns
+// false if the producer changed it in between (or was changing it
+// before), i.e. what was read may mix two frames
+inline uint32_t dazzler_shm_read_begin(const dazzler_shm *s)
+{
+  return s->area->seq.load(std::memory_order_acquire);
+}
+
+inline bool dazzler_shm_read_end(const dazzler_shm *s, uint32_t seq)
+{
+  std::atomic_thread_fence(std::memory_order_acquire);
+  return (seq & 1)==0 && s->area->seq.load(std::memory_order_relaxed)==seq;
+}
+
+// consumer: take up to "max" queued audio samples, returns the number taken
+int dazzler_shm_audio(dazzler_shm *s, dazzler_shm_sample *out, int max);
+
+#endif
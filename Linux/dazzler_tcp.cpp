@@ -0,0 +1,304 @@
+// -----------------------------------------------------------------------------
+// Cromemco Dazzler emulation - Linux TCP client
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "dazzler_tcp.h"
+
+
+static uint64_t tcp_now_us()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+bool dazzler_tcp_init(dazzler_tcp *t, const char *spec, int rcvbuf, dazzler_decoder *d)
+{
+  memset(t, 0, sizeof(dazzler_tcp));
+  snprintf(t->host, sizeof(t->host), "%s", spec);
+  snprintf(t->port, sizeof(t->port), "%s", DAZ_TCP_PORT);
+  char *colon = strrchr(t->host, ':');
+  if( colon!=NULL )
+    {
+      snprintf(t->port, sizeof(t->port), "%s", colon+1);
+      *colon = 0;
+    }
+
+  t->rcvbuf = rcvbuf>0 ? rcvbuf : 65536;
+  t->d = d;
+  t->fd = -1;
+  t->backoff_ms = DAZ_TCP_BACKOFF_MIN;
+  t->buf = (uint8_t *) malloc(t->rcvbuf);
+  t->epfd = epoll_create1(0);
+  return t->buf!=NULL && t->epfd>=0;
+}
+
+
+void dazzler_tcp_free(dazzler_tcp *t)
+{
+  if( t->fd>=0 ) close(t->fd);
+  if( t->epfd>=0 ) close(t->epfd);
+  if( t->addrs!=NULL ) freeaddrinfo(t->addrs);
+  free(t->buf);
+  t->fd = t->epfd = -1;
+  t->buf = NULL;
+}
+
+
+static void tcp_close(dazzler_tcp *t)
+{
+  epoll_ctl(t->epfd, EPOLL_CTL_DEL, t->fd, NULL);
+  close(t->fd);
+  t->fd = -1;
+  t->connected = false;
+}
+
+
+static void tcp_retry_later(dazzler_tcp *t)
+{
+  // a connection that worked retries quickly, failing ones less and less often
+  if( t->got_data )
+    t->backoff_ms = DAZ_TCP_BACKOFF_MIN;
+  else
+    t->num_failed++;
+  t->retry_us = tcp_now_us() + t->backoff_ms*1000ull;
+  t->backoff_ms = t->backoff_ms*2 > DAZ_TCP_BACKOFF_MAX ? DAZ_TCP_BACKOFF_MAX : t->backoff_ms*2;
+}
+
+
+static void tcp_disconnect(dazzler_tcp *t)
+{
+  tcp_close(t);
+  tcp_retry_later(t);
+}
+
+
+// start connecting to the next address the host name resolved to,
+// back off once none is left
+static void tcp_connect_next(dazzler_tcp *t)
+{
+  while( t->addr!=NULL )
+    {
+      struct addrinfo *ai = t->addr;
+      t->addr = ai->ai_next;
+
+      t->fd = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, ai->ai_protocol);
+      if( t->fd<0 ) continue;
+
+      int one = 1;
+      setsockopt(t->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+      setsockopt(t->fd, SOL_SOCKET, SO_RCVBUF, &t->rcvbuf, sizeof(t->rcvbuf));
+
+      struct epoll_event ev;
+      ev.events  = EPOLLIN | EPOLLOUT | EPOLLRDHUP;
+      ev.data.fd = t->fd;
+      if( (connect(t->fd, ai->ai_addr, ai->ai_addrlen)==0 || errno==EINPROGRESS)
+          && epoll_ctl(t->epfd, EPOLL_CTL_ADD, t->fd, &ev)==0 )
+        return;
+
+      close(t->fd);
+      t->fd = -1;
+    }
+
+  freeaddrinfo(t->addrs);
+  t->addrs = NULL;
+  tcp_retry_later(t);
+}
+
+
+static void tcp_connect(dazzler_tcp *t)
+{
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family   = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  t->got_data = false;
+  if( getaddrinfo(t->host, t->port, &hints, &t->addrs)!=0 )
+    {
+      t->addrs = NULL;
+      t->num_failed++;
+      t->retry_us = tcp_now_us() + DAZ_TCP_BACKOFF_MAX*1000ull;
+      return;
+    }
+
+  // e.g. "localhost" may give ::1 first while the simulator only
+  // listens on IPv4, so every address is tried in turn
+  t->addr = t->addrs;
+  tcp_connect_next(t);
+}
+
+
+static void tcp_connected(dazzler_tcp *t)
+{
+  struct epoll_event ev;
+  ev.events  = EPOLLIN | EPOLLRDHUP;
+  ev.data.fd = t->fd;
+  epoll_ctl(t->epfd, EPOLL_CTL_MOD, t->fd, &ev);
+
+  freeaddrinfo(t->addrs);
+  t->addrs = t->addr = NULL;
+
+  t->connected = true;
+  t->greeting_state = 0;
+  t->greeting_len = 0;
+  t->num_connects++;
+  if( t->d!=NULL )
+    {
+      // we may have missed commands while disconnected
+      dazzler_decoder_reset(t->d);
+      dazzler_decoder_request_state(t->d, 0);
+    }
+}
+
+
+static void tcp_deliver(dazzler_tcp *t, const uint8_t *data, int size)
+{
+  if( t->receive!=NULL )
+    t->receive(t->ctx, data, size);
+  else
+    dazzler_decoder_receive(t->d, data, size);
+}
+
+
+// pass received data to the decoder, minus the greeting
+static void tcp_receive(dazzler_tcp *t, const uint8_t *data, int size)
+{
+  int i = 0;
+  if( t->greeting_state==0 && size>0 )
+    t->greeting_state = data[0]=='[' ? 1 : 2;
+
+  while( t->greeting_state==1 && i<size )
+    {
+      char c = data[i++];
+      if( c=='\n' )
+        {
+          if( t->greeting_len>0 && t->greeting[t->greeting_len-1]=='\r' ) t->greeting_len--;
+          t->greeting[t->greeting_len] = 0;
+          t->greeting_state = 2;
+        }
+      else if( t->greeting_len<DAZ_TCP_GREETING_MAX )
+        t->greeting[t->greeting_len++] = c;
+      else
+        {
+          // too long for a greeting: it was data after all
+          t->greeting_state = 2;
+          tcp_deliver(t, (const uint8_t *) t->greeting, t->greeting_len);
+          t->greeting_len = 0;
+          i--;
+        }
+    }
+
+  if( i<size ) tcp_deliver(t, data+i, size-i);
+}
+
+
+int dazzler_tcp_poll(dazzler_tcp *t, int timeout_ms)
+{
+  if( t->fd<0 )
+    {
+      uint64_t now = tcp_now_us();
+      if( now<t->retry_us )
+        {
+          // nothing to wait for but the next attempt
+          uint64_t w = (t->retry_us-now+999)/1000;
+          if( timeout_ms<0 || w<(uint64_t) timeout_ms ) timeout_ms = (int) w;
+          struct epoll_event ev;
+          epoll_wait(t->epfd, &ev, 1, timeout_ms);
+          return 0;
+        }
+
+      tcp_connect(t);
+      if( t->fd<0 ) return 0;
+    }
+
+  struct epoll_event ev;
+  int n = epoll_wait(t->epfd, &ev, 1, timeout_ms);
+  if( n<=0 ) return 0;
+
+  if( !t->connected )
+    {
+      int err = 0;
+      socklen_t len = sizeof(err);
+      if( getsockopt(t->fd, SOL_SOCKET, SO_ERROR, &err, &len)<0 || err!=0 )
+        {
+          tcp_close(t);
+          tcp_connect_next(t);
+          return 0;
+        }
+      tcp_connected(t);
+    }
+
+  // read everything there is
+  int total = 0;
+  while( true )
+    {
+      t->num_reads++;
+      int k = read(t->fd, t->buf, t->rcvbuf);
+      if( k<0 && errno==EINTR ) continue;
+      if( k<0 && errno==EAGAIN ) break;
+      if( k<=0 )
+        {
+          tcp_disconnect(t);
+          break;
+        }
+
+      t->got_data = true;
+      t->num_bytes += k;
+      total += k;
+      tcp_receive(t, t->buf, k);
+      if( k<t->rcvbuf ) break;
+    }
+
+  return total;
+}
+
+
+bool dazzler_tcp_send(dazzler_tcp *t, const uint8_t *data, int size)
+{
+  while( t->connected && size>0 )
+    {
+      int n = send(t->fd, data, size, MSG_NOSIGNAL);
+      if( n<0 && (errno==EAGAIN || errno==EINTR) )
+        {
+          struct pollfd p = {t->fd, POLLOUT, 0};
+          poll(&p, 1, 100);
+          continue;
+        }
+      else if( n<=0 )
+        return false;
+
+      data += n;
+      size -= n;
+    }
+
+  return t->connected;
+}
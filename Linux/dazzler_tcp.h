@@ -0,0 +1,89 @@
+// -----------------------------------------------------------------------------
+// Cromemco Dazzler emulation - Linux TCP client
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#ifndef DAZZLER_TCP_H
+#define DAZZLER_TCP_H
+
+#include <stdint.h>
+#include "../Common/dazzler_decoder.h"
+
+// Connection to the simulator's TCP port (as the Windows client makes
+// when given a host instead of a COM port), on its own epoll event loop.
+// The socket is non-blocking with TCP_NODELAY so that the few bytes of
+// joystick and keyboard messages go out at once. The greeting the
+// simulator sends first ("[connected as nth client on port 8800]") is
+// skipped wherever the reads happen to split it, a stream that does not
+// start with '[' has no greeting. Each address the host name resolves
+// to is tried in turn. If the connection fails or closes it is made
+// again after 100ms, doubling up to 5s while attempts keep failing.
+
+#define DAZ_TCP_PORT          "8800"
+#define DAZ_TCP_GREETING_MAX  128
+#define DAZ_TCP_BACKOFF_MIN   100    // ms
+#define DAZ_TCP_BACKOFF_MAX   5000   // ms
+
+struct dazzler_tcp
+{
+  char host[256], port[16];
+  int  rcvbuf;                    // receive buffer and read size
+  dazzler_decoder *d;
+
+  // if set, the stream (without the greeting) goes here instead of "d"
+  void (*receive)(void *ctx, const uint8_t *data, int size);
+  void *ctx;
+
+  int  epfd, fd;
+  struct addrinfo *addrs, *addr;  // while connecting: all addresses, the next to try
+  bool connected;                 // connect() has finished
+  bool got_data;                  // something arrived on this connection
+  uint64_t retry_us;              // time of the next attempt
+  uint32_t backoff_ms;
+
+  // greeting: 0 waiting for the first byte, 1 in the greeting, 2 done
+  int  greeting_state;
+  char greeting[DAZ_TCP_GREETING_MAX+1];
+  int  greeting_len;
+
+  uint8_t *buf;
+
+  // statistics
+  uint64_t num_connects, num_failed, num_reads, num_bytes;
+};
+
+
+// "spec" is host[:port] (default port 8800), "rcvbuf" the socket
+// receive buffer size (0: 65536). The decoder is reset on every new
+// connection and asks for DAZ_STATE if the simulator supports it (see
+// dazzler_decoder_request_state, "d" may be NULL if "receive" is set
+// after this).
+// Returns false if out of memory or epoll is not available.
+bool dazzler_tcp_init(dazzler_tcp *t, const char *spec, int rcvbuf, dazzler_decoder *d);
+
+void dazzler_tcp_free(dazzler_tcp *t);
+
+// Run the event loop for up to "timeout_ms": (re)connect when due, read
+// and decode everything that arrived. Returns the number of bytes
+// decoded (0 on timeout).
+int dazzler_tcp_poll(dazzler_tcp *t, int timeout_ms);
+
+// send to the simulator (e.g. from the decoder's send callback),
+// false if not connected
+bool dazzler_tcp_send(dazzler_tcp *t, const uint8_t *data, int size);
+
+#endif
@@ -0,0 +1,215 @@
+// -----------------------------------------------------------------------------
+// Cromemco Dazzler emulation - chunked frame transfer simulation
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+// Usage: sim_chunk [-b baud] [-n frames] [-r audio rate] [-a samples per packet] [-s slice size] [-c chunksize]
+//
+// Simulates a computer sending an animation (sprites moving over a
+// background, every 8th frame completely new) into one buffer while it
+// also plays audio (DAZ_DACBURST packets of "samples per packet" samples
+// at "audio rate"). Audio packets go out as soon as they are due, but
+// not in the middle of a command. The frames are sent once as
+// DAZ_FULLFRAME and once as DAZ_CHUNK slices of changed bytes
+// (../Common/dazzler_chunk.h).
+// The stream is decoded in pieces of "chunksize" bytes (what the Windows
+// serial thread reads at once). After each piece the buffer must hold
+// either the previous or the new frame, otherwise the display could show
+// a torn frame. Reports bytes per frame, link time per frame, how late
+// audio packets were (the audio buffer must cover that) and torn states.
+// Exits with 1 if DAZ_CHUNK showed a torn frame or a wrong final frame.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "../Common/dazzler_decoder.h"
+#include "../Common/dazzler_chunk.h"
+
+
+struct sim_params
+{
+  int baud, frames, rate, samples, slice, chunksize;
+};
+
+struct sim_result
+{
+  uint64_t video_bytes, time_ns, max_late_ns, late_sum_ns, packets, torn;
+  bool     final_ok;
+};
+
+
+static void gen_frame(uint8_t *mem, int f)
+{
+  if( f%8==0 )
+    for(int i=0; i<DAZ_MEMSIZE; i++) mem[i] = rand() & 0xFF;
+  else
+    {
+      // 8 sprites of 4x8 bytes each move
+      for(int s=0; s<8; s++)
+        {
+          int x = rand()%28, y = rand()%56;
+          for(int r=0; r<8; r++)
+            for(int c=0; c<4; c++)
+              {
+                int a = ((y+r)&31)*16 + ((x+c)&15) + (((x+c)&16) ? 512 : 0) + (((y+r)&32) ? 1024 : 0);
+                mem[a] = rand() & 0xFF;
+              }
+        }
+    }
+}
+
+
+static sim_result run(const sim_params &p, bool chunked)
+{
+  sim_result res;
+  memset(&res, 0, sizeof(res));
+
+  static uint8_t mem[2*DAZ_MEMSIZE], prev[DAZ_MEMSIZE], next[DAZ_MEMSIZE];
+  memset(mem, 0, sizeof(mem));
+  memset(next, 0, sizeof(next));
+
+  dazzler_decoder d;
+  dazzler_decoder_init(&d, mem, FEAT_VIDEO | FEAT_DACBURST | FEAT_CHUNK, NULL, NULL);
+
+  uint64_t byte_ns = 10ull * 1000000000 / p.baud;
+  uint64_t period_ns = (uint64_t) p.samples * 1000000000 / p.rate;
+  uint64_t t = 0, audio_due = 0;
+  std::vector<uint8_t> units, audio;
+  std::vector<int> unit_len;
+
+  // one audio packet (the samples do not matter)
+  audio.push_back(DAZ_DACBURST);
+  audio.push_back((1000000/p.rate) & 0xFF);
+  audio.push_back((1000000/p.rate) >> 8);
+  audio.push_back(p.samples & 0xFF);
+  audio.resize(4+p.samples, 0x80);
+
+  srand(1);
+  for(int f=0; f<p.frames; f++)
+    {
+      memcpy(prev, next, DAZ_MEMSIZE);
+      gen_frame(next, f);
+
+      // the frame's commands
+      units.clear();
+      unit_len.clear();
+      if( chunked )
+        {
+          dazzler_chunker c;
+          uint8_t out[DAZ_CHUNK_MAXSIZE];
+          int n;
+          dazzler_chunker_start(&c, prev, next, DAZ_MEMSIZE, 0, p.slice);
+          while( (n=dazzler_chunker_next(&c, out))>0 )
+            {
+              units.insert(units.end(), out, out+n);
+              unit_len.push_back(n);
+            }
+        }
+      else
+        {
+          units.push_back(DAZ_FULLFRAME | 0x01);
+          units.insert(units.end(), next, next+DAZ_MEMSIZE);
+          unit_len.push_back(1+DAZ_MEMSIZE);
+        }
+      res.video_bytes += units.size();
+
+      // send, audio packets go first whenever they are due
+      size_t u = 0, pos = 0;
+      while( u<unit_len.size() )
+        {
+          std::vector<uint8_t> piece;
+          if( t>=audio_due )
+            {
+              piece = audio;
+              t += piece.size()*byte_ns;
+              uint64_t late = t-audio_due;
+              if( late>res.max_late_ns ) res.max_late_ns = late;
+              res.late_sum_ns += late;
+              res.packets++;
+              audio_due += period_ns;
+            }
+          else
+            {
+              piece.assign(units.begin()+pos, units.begin()+pos+unit_len[u]);
+              t += piece.size()*byte_ns;
+              pos += unit_len[u++];
+            }
+
+          for(size_t i=0; i<piece.size(); i+=p.chunksize)
+            {
+              int n = (int) (piece.size()-i < (size_t) p.chunksize ? piece.size()-i : p.chunksize);
+              dazzler_decoder_receive(&d, piece.data()+i, n);
+              if( memcmp(mem, prev, DAZ_MEMSIZE)!=0 && memcmp(mem, next, DAZ_MEMSIZE)!=0 )
+                res.torn++;
+            }
+        }
+    }
+
+  res.time_ns  = t;
+  res.final_ok = memcmp(mem, next, DAZ_MEMSIZE)==0;
+  return res;
+}
+
+
+int main(int argc, char **argv)
+{
+  sim_params p = {115200, 200, 4000, 16, 64, 100};
+
+  for(int i=1; i<argc; i++)
+    {
+      if( strcmp(argv[i], "-b")==0 && i+1<argc )
+        p.baud = atoi(argv[++i]);
+      else if( strcmp(argv[i], "-n")==0 && i+1<argc )
+        p.frames = atoi(argv[++i]);
+      else if( strcmp(argv[i], "-r")==0 && i+1<argc )
+        p.rate = atoi(argv[++i]);
+      else if( strcmp(argv[i], "-a")==0 && i+1<argc )
+        p.samples = atoi(argv[++i]);
+      else if( strcmp(argv[i], "-s")==0 && i+1<argc )
+        p.slice = atoi(argv[++i]);
+      else if( strcmp(argv[i], "-c")==0 && i+1<argc )
+        p.chunksize = atoi(argv[++i]);
+      else
+        {
+          fprintf(stderr, "usage: %s [-b baud] [-n frames] [-r audio rate] [-a samples per packet] [-s slice size] [-c chunksize]\n", argv[0]);
+          return 1;
+        }
+    }
+
+  if( p.baud<300 ) p.baud = 300;
+  if( p.rate<1 ) p.rate = 1;
+  if( p.samples<1 || p.samples>256 ) p.samples = 16;
+  if( p.chunksize<1 ) p.chunksize = 1;
+
+  printf("%i baud, %i frames, audio %i Hz in packets of %i samples, slices up to %i bytes\n\n",
+         p.baud, p.frames, p.rate, p.samples, p.slice);
+  printf("%-10s %12s %12s %14s %14s %8s %6s\n", "", "bytes/frame", "ms/frame", "audio late avg", "audio late max", "torn", "final");
+
+  bool ok = true;
+  for(int chunked=0; chunked<2; chunked++)
+    {
+      sim_result r = run(p, chunked!=0);
+      printf("%-10s %12.1f %12.2f %11.2f ms %11.2f ms %8lu %6s\n", chunked ? "CHUNK" : "FULLFRAME",
+             (double) r.video_bytes/p.frames, r.time_ns/1e6/p.frames,
+             r.packets ? r.late_sum_ns/1e6/r.packets : 0.0, r.max_late_ns/1e6,
+             (unsigned long) r.torn, r.final_ok ? "ok" : "WRONG");
+      if( chunked && (r.torn>0 || !r.final_ok) ) ok = false;
+    }
+
+  return ok ? 0 : 1;
+}
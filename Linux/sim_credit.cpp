@@ -0,0 +1,279 @@
+// -----------------------------------------------------------------------------
+// Cromemco Dazzler emulation - flow control simulation
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+// Usage: sim_credit [-b baud] [-n frames] [-p pass_us] [-s stall_us] [-S stall_period_us] [-l latency_us]
+//
+// Simulates a computer sending a "full frame storm" (back-to-back
+// FULLFRAMEs alternating between buffers, each followed by a buffer
+// switch and a burst of MEMBYTE sprite writes) over a serial link into
+// the PIC32 firmware's 4K receive ring buffer. The UART writes into the
+// ring exactly like APP_Tasks (overwriting when full), the main loop
+// takes data out like ringbuffer_process_data (one command per pass
+// every pass_us, FULLFRAME data up to the ring's wrap-around) and does
+// not run at all for stall_us every stall_period_us (interrupt load,
+// USB tasks). DAZ_CREDIT messages travel back to the computer with an
+// extra latency_us (e.g. USB-serial adapter latency).
+// The run is done without and with DAZ_CREDIT flow control. Everything
+// taken out of the ring is decoded, the result is compared with the
+// memory contents the computer intended. The main loop timing is a model,
+// not a measurement: use -p/-s/-S to match what the firmware really does.
+// Exits with 1 if flow control did not prevent all overruns.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "../Common/dazzler_decoder.h"
+#include "../Common/dazzler_credit.h"
+
+
+#define RINGBUFFER_SIZE 0x1000
+
+struct sim_params
+{
+  int      baud, frames;
+  uint64_t pass_ns, stall_ns, stall_period_ns, latency_ns;
+};
+
+struct sim_result
+{
+  uint64_t time_ns, overruns, lost, stalls_ns, credits, max_fill;
+  bool     mem_ok;
+};
+
+
+static void gen_storm(std::vector<uint8_t> &s, int frames)
+{
+  for(int f=0; f<frames; f++)
+    {
+      int b = f & 1;
+      s.push_back(DAZ_FULLFRAME | 0x01 | (b ? 0x08 : 0x00));
+      for(int i=0; i<DAZ_MEMSIZE; i++) s.push_back(rand() & 0xFF);
+      s.push_back(DAZ_CTRL);
+      s.push_back(0x80 | b);
+
+      // sprites drawn into the shown buffer
+      for(int i=0; i<300; i++)
+        {
+          int a = b*DAZ_MEMSIZE + (rand() & 0x7FF);
+          s.push_back(DAZ_MEMBYTE | (a >> 8));
+          s.push_back(a & 0xFF);
+          s.push_back(rand() & 0xFF);
+        }
+    }
+}
+
+
+// command length as seen by ringbuffer_process_data (0 = skip one byte)
+static int command_length(uint8_t cmd)
+{
+  switch( cmd & 0xF0 )
+    {
+    case DAZ_MEMBYTE:   return 3;
+    case DAZ_CTRL:      return 2;
+    case DAZ_CTRLPIC:   return 2;
+    case DAZ_DAC:       return 4;
+    case DAZ_FULLFRAME: return 1;
+    default:            return 0;
+    }
+}
+
+
+static sim_result simulate(const sim_params *p, const std::vector<uint8_t> &s, bool use_credit)
+{
+  static uint8_t ring[RINGBUFFER_SIZE], mem[2*DAZ_MEMSIZE];
+  uint32_t ring_start = 0, ring_end = 0, cnt = 0;
+
+  // decode what the firmware takes out of the ring
+  dazzler_decoder d;
+  memset(mem, 0, sizeof(mem));
+  dazzler_decoder_init(&d, mem, 0, NULL, NULL);
+
+  // the computer sent DAZ_VERSION and got FEAT_CREDIT (or not) back
+  dazzler_credit credit;
+  dazzler_credit_init(&credit, use_credit ? FEAT_CREDIT : 0);
+  uint32_t credit_sent = 0;
+  std::vector<std::pair<uint64_t, uint16_t> > credits_in_flight;
+
+  sim_result r;
+  memset(&r, 0, sizeof(r));
+
+  uint64_t byte_ns = 10 * 1000000000ull / p->baud;
+  uint64_t t = 0, next_byte = 0, next_pass = 0;
+  size_t pos = 0;
+  bool stalled = false;
+  uint64_t stall_start = 0;
+  while( pos<s.size() || ring_start!=ring_end )
+    {
+      // computer: start sending the next byte if the link is free and credit allows
+      if( pos<s.size() && next_byte<=t )
+        {
+          if( dazzler_credit_available(&credit)>0 )
+            {
+              if( stalled ) { r.stalls_ns += t-stall_start; stalled = false; }
+
+              // byte arrives at the UART one byte time later, APP_Tasks
+              // polls often enough that we can enqueue it right away
+              uint32_t fill = (ring_end-ring_start) & (RINGBUFFER_SIZE-1);
+              if( fill==RINGBUFFER_SIZE-1 ) r.overruns++;
+              if( fill+1>r.max_fill ) r.max_fill = fill+1;
+              ring[ring_end] = s[pos++];
+              ring_end = (ring_end+1) & (RINGBUFFER_SIZE-1);
+              dazzler_credit_sent(&credit, 1);
+              next_byte = t + byte_ns;
+            }
+          else if( !stalled )
+            {
+              stalled = true;
+              stall_start = t;
+            }
+        }
+
+      // credit messages arriving at the computer
+      while( !credits_in_flight.empty() && credits_in_flight.front().first<=t )
+        {
+          uint16_t n = credits_in_flight.front().second;
+          dazzler_credit_received(&credit, DAZ_CREDIT | (n >> 8), n & 0xFF);
+          credits_in_flight.erase(credits_in_flight.begin());
+        }
+
+      // main loop pass (unless stalled)
+      if( next_pass<=t && (t % p->stall_period_ns) >= p->stall_ns )
+        {
+          uint32_t available = (ring_end-ring_start) & (RINGBUFFER_SIZE-1);
+          uint32_t start = ring_start;
+          if( cnt==0 && available>0 )
+            {
+              uint8_t cmd = ring[ring_start];
+              int len = command_length(cmd);
+              if( len==0 )
+                ring_start = (ring_start+1) & (RINGBUFFER_SIZE-1);
+              else if( (int) available>=len )
+                {
+                  ring_start = (ring_start+len) & (RINGBUFFER_SIZE-1);
+                  available -= len;
+                  if( (cmd & 0xF0)==DAZ_FULLFRAME ) cnt = (cmd & 0x01) ? 2048 : 512;
+                }
+            }
+
+          if( cnt>0 && available>0 )
+            {
+              uint32_t n = ring_start<=ring_end ? ring_end-ring_start : RINGBUFFER_SIZE-ring_start;
+              if( n>cnt ) n = cnt;
+              cnt -= n;
+              ring_start = (ring_start+n) & (RINGBUFFER_SIZE-1);
+            }
+
+          // decode the bytes taken out
+          for(uint32_t i=start; i!=ring_start; i=(i+1) & (RINGBUFFER_SIZE-1))
+            dazzler_decoder_receive(&d, ring+i, 1);
+
+          // DAZ_CREDIT every DAZ_CREDIT_STEP bytes, 2 bytes upstream plus latency
+          if( use_credit && ((ring_start-credit_sent) & (RINGBUFFER_SIZE-1))>=DAZ_CREDIT_STEP )
+            {
+              uint64_t consumed = d.num_bytes & 0xFFF;
+              credits_in_flight.push_back(std::make_pair(t + 2*byte_ns + p->latency_ns, (uint16_t) consumed));
+              credit_sent = ring_start;
+              r.credits++;
+            }
+
+          next_pass = t + p->pass_ns;
+        }
+
+      // advance to the next event
+      uint64_t next = next_pass>t ? next_pass : t + p->pass_ns;
+      if( pos<s.size() && !stalled && next_byte>t && next_byte<next ) next = next_byte;
+      if( !credits_in_flight.empty() && credits_in_flight.front().first<next ) next = credits_in_flight.front().first;
+      t = next>t ? next : t+1;
+    }
+
+  r.time_ns = t;
+
+  // what the computer meant to show
+  static uint8_t ref[2*DAZ_MEMSIZE];
+  dazzler_decoder rd;
+  memset(ref, 0, sizeof(ref));
+  dazzler_decoder_init(&rd, ref, 0, NULL, NULL);
+  dazzler_decoder_receive(&rd, s.data(), (int) s.size());
+  r.lost   = s.size()-d.num_bytes;
+  r.mem_ok = r.lost==0 && memcmp(ref, mem, sizeof(mem))==0 && d.ctrl==rd.ctrl;
+
+  return r;
+}
+
+
+static void report(const char *name, const sim_result &r, size_t bytes)
+{
+  printf("%-16s %8.3fs  %7.1f KB/s  overruns %4lu (%7lu bytes lost)  max ring fill %4lu  stalled %7.3fs  credits %6lu  memory %s\n",
+         name, r.time_ns/1e9, bytes/(r.time_ns/1e9)/1000, (unsigned long) r.overruns, (unsigned long) r.lost, (unsigned long) r.max_fill,
+         r.stalls_ns/1e9, (unsigned long) r.credits, r.mem_ok ? "ok" : "CORRUPT");
+}
+
+
+int main(int argc, char **argv)
+{
+  sim_params p;
+  p.baud            = 750000;
+  p.frames          = 100;
+  p.pass_ns         = 40000;
+  p.stall_ns        = 60000000;
+  p.stall_period_ns = 500000000;
+  p.latency_ns      = 1000000;
+
+  for(int i=1; i<argc; i++)
+    {
+      if( strcmp(argv[i], "-b")==0 && i+1<argc )
+        p.baud = atoi(argv[++i]);
+      else if( strcmp(argv[i], "-n")==0 && i+1<argc )
+        p.frames = atoi(argv[++i]);
+      else if( strcmp(argv[i], "-p")==0 && i+1<argc )
+        p.pass_ns = atoi(argv[++i]) * 1000ull;
+      else if( strcmp(argv[i], "-s")==0 && i+1<argc )
+        p.stall_ns = atoi(argv[++i]) * 1000ull;
+      else if( strcmp(argv[i], "-S")==0 && i+1<argc )
+        p.stall_period_ns = atoi(argv[++i]) * 1000ull;
+      else if( strcmp(argv[i], "-l")==0 && i+1<argc )
+        p.latency_ns = atoi(argv[++i]) * 1000ull;
+      else
+        {
+          fprintf(stderr, "usage: %s [-b baud] [-n frames] [-p pass_us] [-s stall_us] [-S stall_period_us] [-l latency_us]\n", argv[0]);
+          return 1;
+        }
+    }
+
+  if( p.baud<=0 || p.pass_ns==0 || p.stall_period_ns==0 || p.stall_ns>=p.stall_period_ns )
+    {
+      fprintf(stderr, "invalid parameters\n");
+      return 1;
+    }
+
+  std::vector<uint8_t> s;
+  srand(1);
+  gen_storm(s, p.frames);
+  printf("%i baud, %i frames (%lu bytes), main loop pass %luus, stalled %luus every %luus, credit latency %luus\n",
+         p.baud, p.frames, (unsigned long) s.size(), (unsigned long) (p.pass_ns/1000), (unsigned long) (p.stall_ns/1000),
+         (unsigned long) (p.stall_period_ns/1000), (unsigned long) (p.latency_ns/1000));
+
+  sim_result r1 = simulate(&p, s, false);
+  report("no flow control", r1, s.size());
+  sim_result r2 = simulate(&p, s, true);
+  report("DAZ_CREDIT", r2, s.size());
+
+  return (r2.overruns==0 && r2.mem_ok) ? 0 : 1;
+}
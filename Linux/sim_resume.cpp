@@ -0,0 +1,423 @@
+// -----------------------------------------------------------------------------
+// Cromemco Dazzler emulation - session resume simulation
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+// Usage: sim_resume [-b baud] [-o outage_ms] [-l latency_us] [-a audio_hz] [-n trials]
+//
+// Simulates a computer (version 4) running a double buffered game with
+// audio over a serial link to a Dazzler that loses its connection for
+// outage_ms (USB re-plugged) at a random time. As the PIC32 firmware
+// does on re-attaching, the Dazzler then drops the partially received
+// command and forgets the computer's version, and everything sent during
+// the outage is lost. Two ways of recovering are compared:
+//   none   the old behavior: the picture only gets right again once the
+//          program happens to rewrite everything (and the buffer select
+//          bit of DAZ_CTRL is ignored until the next DAZ_VERSION)
+//   state  the Dazzler sends DAZ_STATE_REQUEST, which reaches the computer
+//          latency_us later, the computer answers with DAZ_STATE at the
+//          next command boundary of its stream
+// The Dazzler's picture (control registers and the shown buffer) is
+// compared with what the computer meant to show every millisecond. The
+// resync time is the time from re-connecting until the picture is right
+// from then on to the end of the run (3s later), "never" if it was wrong
+// during the last second. Also reports the bytes the Dazzler skipped
+// while waiting for DAZ_STATE (the rest of the command that was cut off
+// and what the computer sent before the request reached it) and the
+// audio samples it still had queued when it asked (DAZ_STATE_REQUEST
+// reports them to the computer).
+// Exits with 1 if a "state" run did not resync.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <deque>
+#include <vector>
+#include "../Common/dazzler_decoder.h"
+
+#define FRAME_NS   16666667ull
+#define CHECK_NS   1000000ull
+#define WARMUP_NS  1000000000ull
+#define RUN_NS     3000000000ull
+#define STABLE_NS  1000000000ull
+
+struct sim_params
+{
+  int      baud, audio_hz;
+  uint64_t outage_ns, latency_ns;
+};
+
+struct sim_result
+{
+  bool     resynced;
+  uint64_t resync_ns;
+  int      audio_queued;      // at the time of DAZ_STATE_REQUEST
+  uint64_t state_bytes;       // DAZ_STATE bytes sent
+  uint64_t skipped;           // bytes skipped waiting for DAZ_STATE
+};
+
+typedef std::vector<uint8_t> command;
+
+
+// ---------------------------------------------------------------- the game
+
+struct game
+{
+  uint8_t playfield[DAZ_MEMSIZE];
+  int     sx[4], sy[4], dx[4], dy[4];
+  int     score;
+  uint64_t audio_ns;
+};
+
+
+static void game_init(game *g)
+{
+  for(int i=0; i<4; i++)
+    {
+      g->sx[i] = 4 + rand() % 24; g->sy[i] = 4 + rand() % 56;
+      g->dx[i] = rand() % 2 ? 1 : -1; g->dy[i] = rand() % 2 ? 1 : -1;
+    }
+  g->score = 0;
+  g->audio_ns = 0;
+}
+
+
+static void membyte(std::vector<command> &draw, int a, uint8_t v)
+{
+  command c = {(uint8_t) (DAZ_MEMBYTE | (a >> 8)), (uint8_t) (a & 0xFF), v};
+  draw.push_back(c);
+}
+
+
+// commands for frame "f": draw into the back buffer, then show it
+static void game_frame(game *g, int f, int audio_hz, std::deque<command> &q)
+{
+  std::vector<command> draw;
+  int b = (f+1) & 1, base = b*DAZ_MEMSIZE;
+
+  // a new playfield every 4 seconds (into both buffers in turn),
+  // otherwise sprites that erase themselves from two frames ago
+  if( f % 240 < 2 )
+    {
+      if( f % 240==0 )
+        for(int i=0; i<DAZ_MEMSIZE; i++) g->playfield[i] = rand() & 0x77;
+
+      command c(1+DAZ_MEMSIZE);
+      c[0] = DAZ_FULLFRAME | 0x01 | (b ? 0x08 : 0x00);
+      memcpy(c.data()+1, g->playfield, DAZ_MEMSIZE);
+      draw.push_back(c);
+    }
+  else
+    for(int i=0; i<4; i++)
+      for(int y=0; y<4; y++)
+        for(int x=0; x<4; x++)
+          {
+            int a = (g->sy[i]-2*g->dy[i]+y)*32 + g->sx[i]-2*g->dx[i]+x;
+            membyte(draw, base+a, g->playfield[a]);
+          }
+
+  for(int i=0; i<4; i++)
+    {
+      for(int y=0; y<4; y++)
+        for(int x=0; x<4; x++)
+          membyte(draw, base + (g->sy[i]+y)*32 + g->sx[i]+x, 0x99 + i*0x11);
+
+      g->sx[i] += g->dx[i]; g->sy[i] += g->dy[i];
+      if( g->sx[i]<=2 || g->sx[i]>=26 ) g->dx[i] = -g->dx[i];
+      if( g->sy[i]<=2 || g->sy[i]>=58 ) g->dy[i] = -g->dy[i];
+    }
+
+  if( rand() % 30==0 ) g->score++;
+  for(int x=0; x<16; x++)
+    membyte(draw, base + 63*32 + x, (g->score >> (x & 7)) & 1 ? 0xFF : 0x00);
+
+  // audio samples spread over the frame
+  int n = 0;
+  if( audio_hz>0 )
+    {
+      uint64_t period = 1000000000ull / audio_hz;
+      n = (int) ((g->audio_ns + FRAME_NS) / period - g->audio_ns / period);
+      g->audio_ns += FRAME_NS;
+    }
+
+  size_t k = 0;
+  for(int i=0; i<n; i++)
+    {
+      size_t e = draw.size() * (i+1) / n;
+      while( k<e ) q.push_back(draw[k++]);
+      uint16_t delay = 1000000 / audio_hz;
+      command c = {DAZ_DAC, (uint8_t) (delay & 0xFF), (uint8_t) (delay >> 8), (uint8_t) (rand() & 0xFF)};
+      q.push_back(c);
+    }
+  while( k<draw.size() ) q.push_back(draw[k++]);
+
+  command c = {DAZ_CTRL, (uint8_t) (0x80 | b)};
+  q.push_back(c);
+  if( f==0 )
+    {
+      command p = {DAZ_CTRLPIC, 0x30};
+      q.push_front(p);
+    }
+}
+
+
+// ------------------------------------------------------------- the Dazzler
+
+struct dazzler
+{
+  dazzler_decoder d;
+  uint8_t mem[2*DAZ_MEMSIZE];
+
+  // audio: times the queued samples play (as the firmware's audio buffers)
+  std::deque<uint64_t> audio;
+  uint64_t audio_last, now;
+
+  // upstream messages (arrival time at the computer, bytes)
+  std::deque<std::pair<uint64_t, command> > up;
+  uint64_t up_delay;
+};
+
+
+static void dazzler_dac(void *ctx, int channel, uint16_t delay_us, uint8_t sample)
+{
+  dazzler *z = (dazzler *) ctx;
+
+  // the firmware starts playing 5ms after the first sample arrives
+  uint64_t t = z->audio.empty() ? z->now + 5000000 : z->audio_last + delay_us * 1000ull;
+  z->audio.push_back(t);
+  z->audio_last = t;
+}
+
+
+static void dazzler_send(void *ctx, const uint8_t *data, int size)
+{
+  dazzler *z = (dazzler *) ctx;
+  z->up.push_back(std::make_pair(z->now + z->up_delay, command(data, data+size)));
+}
+
+
+static int dazzler_audio_queued(dazzler *z)
+{
+  while( !z->audio.empty() && z->audio.front()<=z->now ) z->audio.pop_front();
+  return (int) z->audio.size();
+}
+
+
+// the picture the Dazzler shows is the one "ref" describes
+static bool same_picture(const dazzler_decoder *d, const dazzler_decoder *ref)
+{
+  if( (d->ctrl & 0x80)!=(ref->ctrl & 0x80) ) return false;
+  if( (ref->ctrl & 0x80)==0 ) return true;
+  if( (d->ctrl & 0x01)!=(ref->ctrl & 0x01) || d->picture_ctrl!=ref->picture_ctrl ) return false;
+
+  int b = ref->ctrl & 0x01;
+  int len = (ref->picture_ctrl & 0x20) ? DAZ_MEMSIZE : DAZ_MEMSIZE/4;
+  return memcmp(d->mem + b*DAZ_MEMSIZE, ref->mem + b*DAZ_MEMSIZE, len)==0;
+}
+
+
+// ---------------------------------------------------------------- the run
+
+static sim_result simulate(const sim_params *p, unsigned seed, bool use_state)
+{
+  static const dazzler_decoder_callbacks cb = {NULL, NULL, NULL, NULL, dazzler_dac, NULL, dazzler_send, NULL, NULL};
+  static dazzler z;
+  static uint8_t ref_mem[2*DAZ_MEMSIZE];
+  static uint8_t state[DAZ_STATE_SIZE];
+  uint64_t byte_ns = 10 * 1000000000ull / p->baud;
+
+  srand(seed);
+  memset(z.mem, 0, sizeof(z.mem));
+  memset(ref_mem, 0, sizeof(ref_mem));
+  dazzler_decoder_init(&z.d, z.mem, FEAT_VIDEO | FEAT_DUAL_BUF | FEAT_DAC | FEAT_STATE, &cb, &z);
+  z.audio.clear();
+  z.up.clear();
+  z.now = 0;
+  z.up_delay = 2*byte_ns + p->latency_ns;
+
+  // the computer's picture of what it sent
+  dazzler_decoder ref;
+  dazzler_decoder_init(&ref, ref_mem, 0, NULL, NULL);
+
+  game g;
+  game_init(&g);
+
+  sim_result r;
+  memset(&r, 0, sizeof(r));
+
+  uint64_t disconnect = WARMUP_NS + (uint64_t) (rand() % 1000) * 1000000;
+  uint64_t reconnect  = disconnect + p->outage_ns;
+  uint64_t end        = reconnect + RUN_NS;
+  uint64_t last_wrong = reconnect;
+
+  std::deque<command> q;
+  command v = {DAZ_VERSION | 0x04};
+  q.push_back(v);
+  size_t sent = 0;               // bytes of q.front() sent
+  bool connected = true, want_state = false, have_version = false;
+
+  int f = 0;
+  uint64_t next_frame = 0, next_byte = 0, next_check = reconnect;
+  for(uint64_t t=0; t<end; )
+    {
+      z.now = t;
+
+      if( t>=next_frame )
+        {
+          game_frame(&g, f++, p->audio_hz, q);
+          next_frame += FRAME_NS;
+        }
+
+      if( connected && t>=disconnect && t<reconnect )
+        connected = false;
+      else if( !connected && t>=reconnect )
+        {
+          // USB re-attached (see usbTasks in the firmware)
+          dazzler_decoder_reset(&z.d);
+          if( use_state )
+            {
+              r.audio_queued = dazzler_audio_queued(&z);
+              dazzler_decoder_request_state(&z.d, r.audio_queued);
+            }
+          z.d.computer_version = 0;
+          connected = true;
+        }
+
+      // messages from the Dazzler
+      while( !z.up.empty() && z.up.front().first<=t )
+        {
+          const command &m = z.up.front().second;
+          if( (m[0] & 0xF0)==DAZ_VERSION ) have_version = true;
+          if( (m[0] & 0xF0)==DAZ_STATE_REQUEST && have_version ) want_state = true;
+          z.up.pop_front();
+        }
+
+      // computer sends the next byte
+      if( t>=next_byte && !q.empty() )
+        {
+          if( sent==0 && want_state )
+            {
+              // at a command boundary, so "ref" is complete
+              int n = dazzler_decoder_state(&ref, state);
+              q.push_front(command(state, state+n));
+              r.state_bytes += n;
+              want_state = false;
+            }
+
+          uint8_t b = q.front()[sent++];
+          if( sent==q.front().size() ) { q.pop_front(); sent = 0; }
+          dazzler_decoder_receive(&ref, &b, 1);
+          if( connected ) dazzler_decoder_receive(&z.d, &b, 1);
+          next_byte = t + byte_ns;
+        }
+
+      if( t>=next_check )
+        {
+          if( !same_picture(&z.d, &ref) ) last_wrong = t;
+          next_check += CHECK_NS;
+        }
+
+      // advance to the next event
+      uint64_t next = next_frame;
+      if( !q.empty() && next_byte<next ) next = next_byte;
+      if( next_check<next ) next = next_check;
+      if( !connected && reconnect<next ) next = reconnect;
+      if( connected && t<disconnect && disconnect<next ) next = disconnect;
+      if( !z.up.empty() && z.up.front().first<next ) next = z.up.front().first;
+      t = next>t ? next : t+1;
+    }
+
+  r.resynced  = last_wrong + STABLE_NS < end;
+  r.skipped   = z.d.num_state_skipped;
+  r.resync_ns = last_wrong>reconnect ? last_wrong + CHECK_NS - reconnect : 0;
+  return r;
+}
+
+
+int main(int argc, char **argv)
+{
+  sim_params p;
+  p.baud       = 1050000;
+  p.audio_hz   = 8000;
+  p.outage_ns  = 200000000;
+  p.latency_ns = 1000000;
+  int trials = 20;
+
+  for(int i=1; i<argc; i++)
+    {
+      if( strcmp(argv[i], "-b")==0 && i+1<argc )
+        p.baud = atoi(argv[++i]);
+      else if( strcmp(argv[i], "-o")==0 && i+1<argc )
+        p.outage_ns = atoi(argv[++i]) * 1000000ull;
+      else if( strcmp(argv[i], "-l")==0 && i+1<argc )
+        p.latency_ns = atoi(argv[++i]) * 1000ull;
+      else if( strcmp(argv[i], "-a")==0 && i+1<argc )
+        p.audio_hz = atoi(argv[++i]);
+      else if( strcmp(argv[i], "-n")==0 && i+1<argc )
+        trials = atoi(argv[++i]);
+      else
+        {
+          fprintf(stderr, "usage: %s [-b baud] [-o outage_ms] [-l latency_us] [-a audio_hz] [-n trials]\n", argv[0]);
+          return 1;
+        }
+    }
+
+  if( p.baud<=0 || p.audio_hz<0 || p.audio_hz>20000 || trials<1 )
+    {
+      fprintf(stderr, "invalid parameters\n");
+      return 1;
+    }
+
+  printf("%d baud, %d trials, outage %.0fms, request latency %.1fms, %dHz audio\n\n",
+         p.baud, trials, p.outage_ns/1e6, p.latency_ns/1e6, p.audio_hz);
+
+  bool ok = true;
+  for(int s=0; s<2; s++)
+    {
+      int resynced = 0;
+      uint64_t sum = 0, min = (uint64_t) -1, max = 0, bytes = 0, skipped = 0;
+      long audio = 0;
+      for(int i=0; i<trials; i++)
+        {
+          sim_result r = simulate(&p, i+1, s==1);
+          if( r.resynced )
+            {
+              resynced++;
+              sum += r.resync_ns;
+              if( r.resync_ns<min ) min = r.resync_ns;
+              if( r.resync_ns>max ) max = r.resync_ns;
+            }
+          bytes += r.state_bytes;
+          skipped += r.skipped;
+          audio += r.audio_queued;
+        }
+
+      printf("%-6s resynced %3d/%-3d", s ? "state" : "none", resynced, trials);
+      if( resynced>0 )
+        printf("  resync min %7.1fms  avg %7.1fms  max %7.1fms", min/1e6, sum/1e6/resynced, max/1e6);
+      else
+        printf("  resync never%43s", "");
+      if( s==1 )
+        printf("  DAZ_STATE %llu bytes, skipped %llu bytes, audio queued %.0f samples (avg/run)",
+               (unsigned long long) (bytes/trials), (unsigned long long) (skipped/trials), (double) audio/trials);
+      printf("\n");
+
+      if( s==1 && resynced<trials ) ok = false;
+    }
+
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,427 @@
+// -----------------------------------------------------------------------------
+// Cromemco Dazzler emulation - transmit scheduler simulation
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+// Usage: sim_tx [-b baud] [-s slice_us] [-d seconds] [trace ...]
+//
+// Measures how well audio plays when the computer sends a stream over a
+// link of "baud" (10 bits per byte), first in the order the commands
+// were written (as today) and then through the transmit scheduler
+// (../Common/dazzler_tx.h), once with priorities only and once also
+// splitting frames into DAZ_CHUNK slices and merging DAZ_DAC samples into
+// DAZ_DACBURST. The commands come from trace files (see dazzler_replay,
+// the record times are taken as the times the computer wrote them) or,
+// without arguments, a synthetic program that plays 8kHz DAZ_DAC audio
+// and shows 20 double-buffered frames per second with some sprites drawn
+// into them and a new background (DAZ_FULLFRAME) every 4th frame.
+// The receiver is the ../Common decoder and a model of the PIC32
+// firmware's audio output: one sample per video line (26.417us),
+// starting 190 lines (5ms) after the first sample arrives and stopping
+// when the audio buffer runs empty (an underrun). Reports underruns,
+// skipped samples (delay rounded to 0 lines), how far the time between
+// two samples was off from the intended delay (median/99th percentile/
+// maximum, in lines), the silence added by underruns and how long after
+// it was written each sample was played and each frame became visible.
+// Exits with 1 if the final display state differs between the runs.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+#include "../Common/dazzler_decoder.h"
+#include "../Common/dazzler_trace.h"
+#include "../Common/dazzler_tx.h"
+
+#define LINE_NS 26417
+
+struct record
+{
+  uint64_t t_us;
+  std::vector<uint8_t> data;
+};
+
+struct sim_result
+{
+  uint64_t samples, skipped, underruns, silence_lines;
+  std::vector<uint32_t> errors;   // |interval error| in lines per sample
+  std::vector<uint64_t> samples_at; // time each sample was written/played (us)
+  std::vector<uint64_t> frames;   // time each frame became visible
+  uint64_t bytes, end_us;
+  uint8_t  mem[2*DAZ_MEMSIZE], ctrl, picture_ctrl;
+};
+
+
+// receiver side: decoder plus firmware audio model
+struct receiver
+{
+  dazzler_decoder d;
+  uint64_t now_us;
+  sim_result *res;
+  bool written;
+
+  // per channel: DAZ_DAC remainder, DAZ_DACBURST fraction, playing state
+  int      remainder[2];
+  uint32_t frac[2];
+  bool     playing[2];
+  uint64_t last_play[2];
+};
+
+static receiver rx;
+
+
+static void rx_sample(int ch, uint32_t lines)
+{
+  sim_result *r = rx.res;
+  r->samples++;
+  if( rx.written ) { r->samples_at.push_back(rx.now_us); return; }
+  if( lines==0 ) { r->skipped++; r->samples_at.push_back(rx.now_us); return; }
+
+  uint64_t arrival = rx.now_us * 1000 / LINE_NS, play;
+  if( !rx.playing[ch] )
+    {
+      play = arrival + 190;
+      rx.playing[ch] = true;
+    }
+  else if( arrival <= rx.last_play[ch] )
+    {
+      play = rx.last_play[ch] + lines;
+      r->errors.push_back(0);
+    }
+  else
+    {
+      // audio buffer ran empty before this sample arrived
+      play = arrival + 190;
+      r->underruns++;
+      int64_t e = (int64_t) (play - rx.last_play[ch]) - lines;
+      r->errors.push_back((uint32_t) (e<0 ? -e : e));
+      if( e>0 ) r->silence_lines += e;
+    }
+
+  rx.last_play[ch] = play;
+  r->samples_at.push_back(play * LINE_NS / 1000);
+}
+
+
+static void rx_dac(void *ctx, int ch, uint16_t delay_us, uint8_t sample)
+{
+  // the firmware's DAZ_DAC conversion
+  int delay = delay_us + rx.remainder[ch];
+  int lines = (delay * 2000) / 26417;
+  lines = (lines/2) + (lines&1);
+  rx.remainder[ch] = delay - (lines*26417)/1000;
+  rx_sample(ch, lines>0 ? lines : 0);
+}
+
+
+static void rx_dacburst(void *ctx, int ch, uint16_t interval_us, const uint8_t *samples, int n)
+{
+  // the firmware's DAZ_DACBURST conversion
+  uint32_t step = (uint32_t) ((((uint64_t) interval_us) << 16) * 1000 / 26417);
+  for(int i=0; i<n; i++)
+    {
+      rx.frac[ch] += step;
+      rx_sample(ch, rx.frac[ch] >> 16);
+      rx.frac[ch] &= 0xFFFF;
+    }
+}
+
+
+static void rx_fullframe(void *ctx, int addr, int len)
+{
+  rx.res->frames.push_back(rx.now_us);
+}
+
+
+static const dazzler_decoder_callbacks rx_callbacks =
+  {NULL, rx_fullframe, NULL, NULL, rx_dac, NULL, NULL, NULL, rx_dacburst};
+
+
+static void rx_init(sim_result *res, uint8_t *mem)
+{
+  memset((void *) &rx, 0, sizeof(rx));
+  rx.frac[0] = rx.frac[1] = 0x8000;
+  rx.res = res;
+  dazzler_decoder_init(&rx.d, mem, FEAT_VIDEO | FEAT_DACBURST | FEAT_CHUNK, &rx_callbacks, NULL);
+}
+
+
+// the link: bytes leave one after another, pieces arrive when their
+// last byte did (in pieces of at most 64 bytes, about what a serial
+// driver delivers at once)
+static uint64_t link_free_ns;
+
+static void link_send(const uint8_t *data, int n, uint64_t now_us, uint32_t byte_ns)
+{
+  if( link_free_ns < now_us*1000 ) link_free_ns = now_us*1000;
+  for(int i=0; i<n; i+=64)
+    {
+      int k = n-i < 64 ? n-i : 64;
+      link_free_ns += (uint64_t) k * byte_ns;
+      rx.now_us = link_free_ns / 1000;
+      dazzler_decoder_receive(&rx.d, data+i, k);
+      rx.res->bytes += k;
+    }
+}
+
+
+static void run(const std::vector<record> &src, int baud, int mode, uint32_t slice_us, sim_result *res)
+{
+  static uint8_t mem[2*DAZ_MEMSIZE];
+  memset(mem, 0, sizeof(mem));
+  rx_init(res, mem);
+  link_free_ns = 0;
+  uint32_t byte_ns = (uint32_t) (10ull * 1000000000 / baud);
+
+  if( mode==0 )
+    {
+      // in the order written
+      for(size_t i=0; i<src.size(); i++)
+        link_send(src[i].data.data(), (int) src[i].data.size(), src[i].t_us, byte_ns);
+    }
+  else
+    {
+      static dazzler_tx tx;
+      static uint8_t out[DAZ_TX_MAXPIECE];
+      uint16_t features = mode==2 ? (FEAT_VIDEO | FEAT_DACBURST | FEAT_CHUNK) : FEAT_VIDEO;
+      dazzler_tx_init(&tx, baud, features, slice_us);
+
+      size_t i = 0, pos = 0;
+      uint64_t t = 0;
+      while( i<src.size() || !dazzler_tx_empty(&tx) )
+        {
+          // the computer writes everything due by now
+          while( i<src.size() && src[i].t_us<=t )
+            {
+              pos += dazzler_tx_put(&tx, src[i].data.data()+pos, (int) (src[i].data.size()-pos));
+              if( pos<src[i].data.size() ) break;
+              i++; pos = 0;
+            }
+
+          int n;
+          while( (n=dazzler_tx_get(&tx, t, out))>0 )
+            link_send(out, n, t, byte_ns);
+
+          // wait for the link or the next write
+          uint32_t w = dazzler_tx_wait_us(&tx, t);
+          uint64_t next = w>0 ? t+w : (uint64_t) -1;
+          if( i<src.size() && pos==0 && src[i].t_us<next ) next = src[i].t_us;
+          if( next==(uint64_t) -1 ) next = t+1;
+          t = next>t ? next : t+1;
+        }
+    }
+
+  res->end_us = link_free_ns/1000;
+  memcpy(res->mem, mem, sizeof(mem));
+  res->ctrl = rx.d.ctrl;
+  res->picture_ctrl = rx.d.picture_ctrl;
+}
+
+
+static void gen_program(std::vector<record> &src, int seconds)
+{
+  // 8kHz audio, 20 frames per second
+  uint64_t end = (uint64_t) seconds * 1000000;
+  uint64_t next_frame = 0;
+  int f = 0;
+  for(uint64_t t=0; t<end; t+=125)
+    {
+      record r;
+      r.t_us = t;
+      if( t>=next_frame )
+        {
+          // a new background every 4th frame, otherwise only sprites
+          int b = f & 1;
+          if( (f++ & 3)==0 )
+            {
+              r.data.push_back(DAZ_FULLFRAME | 0x01 | (b ? 0x08 : 0));
+              for(int i=0; i<DAZ_MEMSIZE; i++) r.data.push_back(rand() & 0xFF);
+            }
+          r.data.push_back(DAZ_CTRL);
+          r.data.push_back(0x80 | b);
+          for(int i=0; i<100; i++)
+            {
+              int a = b*DAZ_MEMSIZE + (rand() & 0x7FF);
+              r.data.push_back(DAZ_MEMBYTE | (a>>8));
+              r.data.push_back(a & 0xFF);
+              r.data.push_back(rand() & 0xFF);
+            }
+          next_frame += 50000;
+        }
+
+      r.data.push_back(DAZ_DAC);
+      r.data.push_back(125);
+      r.data.push_back(0);
+      r.data.push_back(rand() & 0xFF);
+      src.push_back(r);
+    }
+}
+
+
+static bool read_trace(const char *fname, std::vector<record> &src)
+{
+  FILE *f = fopen(fname, "rb");
+  if( f==NULL ) return false;
+
+  std::vector<uint8_t> s;
+  uint8_t buf[65536];
+  size_t n;
+  while( (n=fread(buf, 1, sizeof(buf), f))>0 )
+    s.insert(s.end(), buf, buf+n);
+  fclose(f);
+
+  dazzler_trace_reader trace;
+  if( !dazzler_trace_open(&trace, s.data(), s.size()) ) return false;
+
+  const uint8_t *p;
+  uint64_t t;
+  int k;
+  while( (k=dazzler_trace_next(&trace, &p, &t))>=0 )
+    {
+      record r;
+      r.t_us = t;
+      r.data.assign(p, p+k);
+      src.push_back(r);
+    }
+  return true;
+}
+
+
+static uint32_t percentile(std::vector<uint32_t> v, double p)
+{
+  if( v.empty() ) return 0;
+  size_t k = (size_t) (p * (v.size()-1));
+  std::nth_element(v.begin(), v.begin()+k, v.end());
+  return v[k];
+}
+
+
+static bool report(const char *name, const std::vector<record> &src, int baud, uint32_t slice_us)
+{
+  // when the computer wrote each frame
+  static sim_result written;
+  static uint8_t mem[2*DAZ_MEMSIZE];
+  memset(mem, 0, sizeof(mem));
+  rx_init(&written, mem);
+  written.frames.clear();
+  written.samples_at.clear();
+  rx.written = true;
+  for(size_t i=0; i<src.size(); i++)
+    {
+      rx.now_us = src[i].t_us;
+      dazzler_decoder_receive(&rx.d, src[i].data.data(), (int) src[i].data.size());
+    }
+  std::vector<uint64_t> frames_written = written.frames;
+  std::vector<uint64_t> samples_written = written.samples_at;
+
+  printf("%s at %i baud:\n", name, baud);
+  printf("  %-16s %9s %9s %8s %16s %10s %17s %17s\n", "", "bytes", "underruns", "skipped",
+         "error p50/p99/max", "silence", "audio lag avg/max", "frame lag avg/max");
+
+  static const char *modes[3] = {"as written", "scheduled", "scheduled+split"};
+  static sim_result res[3];
+  bool ok = true;
+  for(int m=0; m<3; m++)
+    {
+      sim_result *r = &res[m];
+      r->samples = r->skipped = r->underruns = r->silence_lines = r->bytes = 0;
+      r->errors.clear();
+      r->frames.clear();
+      r->samples_at.clear();
+      run(src, baud, m, slice_us, r);
+
+      double lag_sum = 0, lag_max = 0;
+      size_t nf = std::min(r->frames.size(), frames_written.size());
+      for(size_t i=0; i<nf; i++)
+        {
+          double lag = (double) (r->frames[i] - frames_written[i]) / 1000;
+          lag_sum += lag;
+          if( lag>lag_max ) lag_max = lag;
+        }
+
+      // from writing a sample to playing it
+      double alag_sum = 0, alag_max = 0;
+      size_t ns = std::min(r->samples_at.size(), samples_written.size());
+      for(size_t i=0; i<ns; i++)
+        {
+          double lag = ((double) r->samples_at[i] - (double) samples_written[i]) / 1000;
+          alag_sum += lag;
+          if( lag>alag_max ) alag_max = lag;
+        }
+
+      printf("  %-16s %9lu %9lu %8lu %6u/%4u/%5u %7.1f ms %7.1f/%6.1f ms %7.1f/%6.1f ms\n", modes[m],
+             (unsigned long) r->bytes, (unsigned long) r->underruns, (unsigned long) r->skipped,
+             percentile(r->errors, 0.5), percentile(r->errors, 0.99), percentile(r->errors, 1.0),
+             r->silence_lines * 26.417 / 1000, ns ? alag_sum/ns : 0.0, alag_max,
+             nf ? lag_sum/nf : 0.0, lag_max);
+
+      if( memcmp(r->mem, res[0].mem, sizeof(r->mem))!=0 || r->ctrl!=res[0].ctrl || r->picture_ctrl!=res[0].picture_ctrl )
+        {
+          printf("  %s: final display state differs\n", modes[m]);
+          ok = false;
+        }
+    }
+
+  return ok;
+}
+
+
+int main(int argc, char **argv)
+{
+  int baud = 1050000, seconds = 10;
+  uint32_t slice_us = 2000;
+
+  int i;
+  for(i=1; i<argc && argv[i][0]=='-'; i++)
+    {
+      if( strcmp(argv[i], "-b")==0 && i+1<argc )
+        baud = atoi(argv[++i]);
+      else if( strcmp(argv[i], "-s")==0 && i+1<argc )
+        slice_us = atoi(argv[++i]);
+      else if( strcmp(argv[i], "-d")==0 && i+1<argc )
+        seconds = atoi(argv[++i]);
+      else
+        {
+          fprintf(stderr, "usage: %s [-b baud] [-s slice_us] [-d seconds] [trace ...]\n", argv[0]);
+          return 1;
+        }
+    }
+  if( baud<300 ) baud = 300;
+
+  bool ok = true;
+  if( i<argc )
+    {
+      for(; i<argc; i++)
+        {
+          std::vector<record> src;
+          if( read_trace(argv[i], src) )
+            ok = report(argv[i], src, baud, slice_us) && ok;
+          else
+            fprintf(stderr, "can not read trace %s\n", argv[i]);
+        }
+    }
+  else
+    {
+      std::vector<record> src;
+      srand(1);
+      gen_program(src, seconds);
+      ok = report("synthetic program", src, baud, slice_us);
+    }
+
+  return ok ? 0 : 1;
+}
@@ -150,6 +150,10 @@ volatile uint32_t g_current_line = 0, g_frame_ctr = 0;
 // flag to indicate to main function that VSYNC should be sent
 volatile bool send_vsync = false;
 
+// flag to indicate to main function that DAZ_STATE_REQUEST should be sent
+// (after the USB connection was reset)
+volatile bool send_state_request = false;
+
 // Dazzler control register:
 // D7: on/off
 // D6-D0: screen memory location (not used in client)
@@ -166,6 +170,16 @@ uint8_t dazzler_picture_ctrl = 0x10;
 // dazzler video memory, keeping two buffers plus one current-frame buffer
 uint8_t dazzler_mem[2 * 2048], dazzler_mem_buf[2048];
 
+// DAZ_CHUNK: slices collect in a copy of buffer chunk_buffer (-1 if no
+// frame is open). The last slice sets chunk_commit (buffer+1), the
+// interrupt routine then copies the frame into dazzler_mem right before
+// taking the next display frame from it and clears chunk_commit. The
+// copy takes two scan lines, chunk_latch holds the commit being copied.
+uint8_t chunk_mem[2048];
+int chunk_buffer = -1;
+volatile uint8_t chunk_commit = 0;
+volatile uint8_t chunk_latch = 0;
+
 // test mode (see function draw_test_screen)
 int test_mode = 0;
 
@@ -173,12 +187,28 @@ int test_mode = 0;
 #define DAZZLER_VERSION 0x02
 int computer_version =  0x00;
 
+// version of the computer before the connection was reset (see usbTasks),
+// version 4 and later can restore our state with DAZ_STATE
+int resume_version = 0x00;
+
+// after DAZ_STATE_REQUEST: number of bytes we may still skip while
+// waiting for the computer's DAZ_STATE (0 if not waiting)
+uint32_t state_wait = 0;
+
 // dazzler commands received from the Altair simulator
 #define DAZ_MEMBYTE   0x10
 #define DAZ_FULLFRAME 0x20
 #define DAZ_CTRL      0x30
 #define DAZ_CTRLPIC   0x40
 #define DAZ_DAC       0x50
+#define DAZ_MEMBLOCK  0x60
+#define DAZ_DELTA     0x70
+#define DAZ_DACBURST  0x80
+#define DAZ_RECT      0x90
+#define DAZ_CHUNK     0xA0
+#define DAZ_PING      0xB0
+#define DAZ_FRAMED    0xC0
+#define DAZ_STATE     0xD0
 #define DAZ_VERSION   0xF0
 
 // dazzler commands sent to the Altair simulator
@@ -186,6 +216,29 @@ int computer_version =  0x00;
 #define DAZ_JOY2      0x20
 #define DAZ_KEY       0x30
 #define DAZ_VSYNC     0x40
+#define DAZ_CREDIT    0x50
+#define DAZ_RESEND    0x60
+#define DAZ_PONG      0x70
+#define DAZ_STATE_REQUEST 0x80
+
+// DAZ_STATE: 0xDV, 0xA5, 0x5A, CC, PP, 4096 bytes of video memory. After
+// asking for it we skip everything up to these three bytes (or the start
+// of a DAZ_FRAMED sequence) but at most DAZ_STATE_WAIT bytes
+#define DAZ_STATE_SYNC1 0xA5
+#define DAZ_STATE_SYNC2 0x5A
+#define DAZ_STATE_WAIT  16384
+
+// flow control: computers of version 3 or later may have at most
+// DAZ_CREDIT_WINDOW bytes in flight that we have not reported as consumed
+// (by a DAZ_CREDIT message) yet, we report every DAZ_CREDIT_STEP bytes
+#define DAZ_CREDIT_WINDOW 3840
+#define DAZ_CREDIT_STEP   256
+
+// framed mode: 0xC0/0xC1 (bit 0: start new sequence), 0xA5, sequence number,
+// payload size NN (0=256), NN payload bytes, CRC-16 (high, low)
+#define DAZ_FRAMED_SYNC   0xA5
+#define DAZ_FRAMED_START  0x01
+#define DAZ_RESEND_REPEAT 16
 
 // features
 #define FEAT_VIDEO    0x01
@@ -193,6 +246,17 @@ int computer_version =  0x00;
 #define FEAT_DUAL_BUF 0x04
 #define FEAT_VSYNC    0x08
 #define FEAT_DAC      0x10
+#define FEAT_STATE    0x80
+
+// features reported in the third byte of the DAZ_VERSION reply
+#define FEAT_MEMBLOCK 0x0100
+#define FEAT_DELTA    0x0200
+#define FEAT_CREDIT   0x0400
+#define FEAT_FRAMED   0x0800
+#define FEAT_PING     0x1000
+#define FEAT_DACBURST 0x2000
+#define FEAT_RECT     0x4000
+#define FEAT_CHUNK    0x8000
 
 
 
@@ -215,6 +279,7 @@ volatile uint32_t audiobuffer_start[2] = {0, 0}, audiobuffer_end[2] = {0, 0};
 uint32_t audiobuffer[2][AUDIOBUFFER_SIZE];
 #define audiobuffer_empty(N) (audiobuffer_start[N]==audiobuffer_end[N])
 #define audiobuffer_available_for_write(N) (((audiobuffer_start[N]+AUDIOBUFFER_SIZE)-audiobuffer_end[N]-1)&(AUDIOBUFFER_SIZE-1))
+#define audiobuffer_available_for_read(N) (((audiobuffer_end[N]+AUDIOBUFFER_SIZE)-audiobuffer_start[N])&(AUDIOBUFFER_SIZE-1))
 
 inline void audiobuffer_enqueue(int N, uint32_t b)
 {
@@ -240,6 +305,11 @@ inline uint32_t audiobuffer_dequeue(int N)
 volatile uint32_t ringbuffer_start = 0, ringbuffer_end = 0;
 uint8_t ringbuffer[RINGBUFFER_SIZE];
 
+// ringbuffer_start at the computer's DAZ_VERSION command and at the last
+// DAZ_CREDIT message (the ring buffer size is 4096 so the difference of
+// ringbuffer_start values is the 12-bit number of bytes consumed)
+uint32_t credit_base = 0, credit_sent = 0;
+
 #define ringbuffer_full()                (((ringbuffer_end+1)&(RINGBUFFER_SIZE-1)) == ringbuffer_start)
 #define ringbuffer_empty()                 (ringbuffer_start==ringbuffer_end)
 #define ringbuffer_available_for_read()  (((ringbuffer_end+RINGBUFFER_SIZE)-ringbuffer_start)&(RINGBUFFER_SIZE-1))
@@ -260,16 +330,328 @@ inline uint8_t ringbuffer_dequeue()
   return data;
 }
 
+
+// Framed mode (DAZ_FRAMED): frames are checked while they sit in the ring
+// buffer. For a good frame the header and CRC are removed by moving the
+// unprocessed rest of the previous payload (at most one incomplete command)
+// up against the new payload, so ringbuffer_process_data sees one
+// contiguous command stream. Only the first "frame_left" bytes of the
+// ring buffer have been checked and may be processed.
+
+// the next frame is joined once less than this many checked bytes are left,
+// the longest command that must be complete before it is processed
+// (DAZ_RECT SCROLL) has to fit
+#define FRAME_JOIN 8
+
+// CRC-16 with polynomial 0x1021, initial value 0xFFFF (CRC-16/CCITT-FALSE)
+static const uint16_t crc16_table[256] = {
+  0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+  0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF,
+  0x1231, 0x0210, 0x3273, 0x2252, 0x52B5, 0x4294, 0x72F7, 0x62D6,
+  0x9339, 0x8318, 0xB37B, 0xA35A, 0xD3BD, 0xC39C, 0xF3FF, 0xE3DE,
+  0x2462, 0x3443, 0x0420, 0x1401, 0x64E6, 0x74C7, 0x44A4, 0x5485,
+  0xA56A, 0xB54B, 0x8528, 0x9509, 0xE5EE, 0xF5CF, 0xC5AC, 0xD58D,
+  0x3653, 0x2672, 0x1611, 0x0630, 0x76D7, 0x66F6, 0x5695, 0x46B4,
+  0xB75B, 0xA77A, 0x9719, 0x8738, 0xF7DF, 0xE7FE, 0xD79D, 0xC7BC,
+  0x48C4, 0x58E5, 0x6886, 0x78A7, 0x0840, 0x1861, 0x2802, 0x3823,
+  0xC9CC, 0xD9ED, 0xE98E, 0xF9AF, 0x8948, 0x9969, 0xA90A, 0xB92B,
+  0x5AF5, 0x4AD4, 0x7AB7, 0x6A96, 0x1A71, 0x0A50, 0x3A33, 0x2A12,
+  0xDBFD, 0xCBDC, 0xFBBF, 0xEB9E, 0x9B79, 0x8B58, 0xBB3B, 0xAB1A,
+  0x6CA6, 0x7C87, 0x4CE4, 0x5CC5, 0x2C22, 0x3C03, 0x0C60, 0x1C41,
+  0xEDAE, 0xFD8F, 0xCDEC, 0xDDCD, 0xAD2A, 0xBD0B, 0x8D68, 0x9D49,
+  0x7E97, 0x6EB6, 0x5ED5, 0x4EF4, 0x3E13, 0x2E32, 0x1E51, 0x0E70,
+  0xFF9F, 0xEFBE, 0xDFDD, 0xCFFC, 0xBF1B, 0xAF3A, 0x9F59, 0x8F78,
+  0x9188, 0x81A9, 0xB1CA, 0xA1EB, 0xD10C, 0xC12D, 0xF14E, 0xE16F,
+  0x1080, 0x00A1, 0x30C2, 0x20E3, 0x5004, 0x4025, 0x7046, 0x6067,
+  0x83B9, 0x9398, 0xA3FB, 0xB3DA, 0xC33D, 0xD31C, 0xE37F, 0xF35E,
+  0x02B1, 0x1290, 0x22F3, 0x32D2, 0x4235, 0x5214, 0x6277, 0x7256,
+  0xB5EA, 0xA5CB, 0x95A8, 0x8589, 0xF56E, 0xE54F, 0xD52C, 0xC50D,
+  0x34E2, 0x24C3, 0x14A0, 0x0481, 0x7466, 0x6447, 0x5424, 0x4405,
+  0xA7DB, 0xB7FA, 0x8799, 0x97B8, 0xE75F, 0xF77E, 0xC71D, 0xD73C,
+  0x26D3, 0x36F2, 0x0691, 0x16B0, 0x6657, 0x7676, 0x4615, 0x5634,
+  0xD94C, 0xC96D, 0xF90E, 0xE92F, 0x99C8, 0x89E9, 0xB98A, 0xA9AB,
+  0x5844, 0x4865, 0x7806, 0x6827, 0x18C0, 0x08E1, 0x3882, 0x28A3,
+  0xCB7D, 0xDB5C, 0xEB3F, 0xFB1E, 0x8BF9, 0x9BD8, 0xABBB, 0xBB9A,
+  0x4A75, 0x5A54, 0x6A37, 0x7A16, 0x0AF1, 0x1AD0, 0x2AB3, 0x3A92,
+  0xFD2E, 0xED0F, 0xDD6C, 0xCD4D, 0xBDAA, 0xAD8B, 0x9DE8, 0x8DC9,
+  0x7C26, 0x6C07, 0x5C64, 0x4C45, 0x3CA2, 0x2C83, 0x1CE0, 0x0CC1,
+  0xEF1F, 0xFF3E, 0xCF5D, 0xDF7C, 0xAF9B, 0xBFBA, 0x8FD9, 0x9FF8,
+  0x6E17, 0x7E36, 0x4E55, 0x5E74, 0x2E93, 0x3EB2, 0x0ED1, 0x1EF0
+};
+
+bool     framed     = false; // a frame was seen => ignore anything outside of frames
+uint32_t frame_left = 0;     // checked payload bytes at the start of the ring buffer
+uint8_t  frame_seq  = 0;     // next expected sequence number
+uint32_t frame_lost = 0;     // frames discarded since the last good one
+
+#define ringbuffer_at(i) (ringbuffer[(ringbuffer_start+(i)) & (RINGBUFFER_SIZE-1)])
+
+
+// move the first "n" bytes of the ring buffer "by" bytes towards its end
+// (over a frame header or CRC or a byte that does not belong to a frame)
+void ringbuffer_shift(uint32_t n, uint32_t by)
+{
+  uint32_t src = ringbuffer_start+n, dst = src+by;
+  while( n-- > 0 )
+    {
+      src--; dst--;
+      ringbuffer[dst & (RINGBUFFER_SIZE-1)] = ringbuffer[src & (RINGBUFFER_SIZE-1)];
+    }
+
+  ringbuffer_start = (ringbuffer_start+by) & (RINGBUFFER_SIZE-1);
+}
+
+
+void frame_lost_report()
+{
+  // ask for the frames from the expected one on, again after 1, 2, 4...
+  // times DAZ_RESEND_REPEAT discarded frames in case the request got lost
+  static uint8_t buf[2];
+  uint32_t n = frame_lost++ / DAZ_RESEND_REPEAT;
+  if( (frame_lost-1) % DAZ_RESEND_REPEAT==0 && (n & (n-1))==0 )
+    {
+      buf[0] = DAZ_RESEND;
+      buf[1] = frame_seq;
+      dazzler_send(buf, 2);
+    }
+}
+
+
+// Check the frame following the checked payload bytes (if it is complete),
+// at most one CRC calculation per call. Returns true if the frame started
+// a new sequence (=> forget any partially processed command).
+bool frame_process()
+{
+  uint32_t available = ringbuffer_available_for_read();
+  uint32_t p, i, len;
+  uint16_t crc;
+  bool restart = false;
+
+  // only join the next frame once the current payload is (almost) used
+  // up, then there is little to move
+  while( frame_left<FRAME_JOIN && available>frame_left )
+    {
+      p = frame_left;
+      if( (ringbuffer_at(p) & 0xFE)!=DAZ_FRAMED || (available>p+1 && ringbuffer_at(p+1)!=DAZ_FRAMED_SYNC) )
+        {
+          // not the start of a frame => drop the byte
+          ringbuffer_shift(p, 1);
+          available--;
+          continue;
+        }
+
+      // wait until the frame is complete
+      if( available<p+4 ) break;
+      len = ringbuffer_at(p+3)==0 ? 256 : ringbuffer_at(p+3);
+      if( available<p+4+len+2 ) break;
+
+      crc = 0xFFFF;
+      for(i=p; i<p+4+len; i++)
+        crc = (crc << 8) ^ crc16_table[(crc >> 8) ^ ringbuffer_at(i)];
+
+      if( crc != ringbuffer_at(p+4+len)*256 + ringbuffer_at(p+5+len) )
+        {
+          // damaged frame (maybe its length too) => search for the
+          // next frame starting with the byte after this one's first
+          ringbuffer_shift(p, 1);
+          frame_lost_report();
+          break;
+        }
+
+      if( ringbuffer_at(p) & DAZ_FRAMED_START )
+        {
+          // new sequence => drop the rest of the previous payload
+          ringbuffer_start = (ringbuffer_start+p) & (RINGBUFFER_SIZE-1);
+          frame_left = p = 0;
+          frame_seq = ringbuffer_at(2);
+          restart = true;
+        }
+
+      if( ringbuffer_at(p+2)==frame_seq )
+        {
+          // remove the header, then the CRC
+          ringbuffer_shift(p, 4);
+          ringbuffer_shift(p+len, 2);
+          frame_left = p+len;
+          frame_seq++;
+          frame_lost = 0;
+        }
+      else
+        {
+          // out of sequence => discard, frames before the expected
+          // one are repeats after DAZ_RESEND
+          if( (uint8_t) (ringbuffer_at(p+2)-frame_seq) < 128 ) frame_lost_report();
+          ringbuffer_shift(p, 4+len+2);
+        }
+      break;
+    }
+
+  return restart;
+}
+
+// DAZ_RECT: each buffer is a grid of 32x64 bytes made of four quadrants
+// of 16x32 (see get_pixel_128x128). The operation is done a few rows per
+// call so the main loop keeps up with the incoming data. Destination row
+// r comes from source row r-rect_shift_y, shifted right by rect_shift_x
+// bytes, bytes from outside the source are rect_v.
+#define RECT_ROWS_PER_PASS 8
+#define rect_addr(x, y) (((y)&31)*16 + ((x)&15) + (((x)&16) ? 512 : 0) + (((y)&32) ? 1024 : 0))
+
+uint32_t rect_rows = 0;
+int rect_i, rect_w, rect_h, rect_db, rect_dx, rect_dy, rect_sb, rect_sx, rect_sy;
+int rect_shift_x, rect_shift_y;
+bool rect_source, rect_up;
+uint8_t rect_v;
+
+void rect_start(uint8_t op, const uint8_t *p)
+{
+  rect_db = (p[0] & 0x80) ? 2048 : 0;
+  rect_dx = p[0] & 31;
+  rect_dy = p[1] & 63;
+  rect_w  = p[2];
+  rect_h  = p[3];
+  rect_sb = rect_db; rect_sx = rect_dx; rect_sy = rect_dy;
+  rect_shift_x = rect_shift_y = 0;
+  rect_source  = true;
+  rect_v = 0;
+
+  if( op==0 )
+    {
+      // FILL
+      rect_v = p[4];
+      rect_source = false;
+    }
+  else if( op==1 )
+    {
+      // COPY
+      rect_db = (p[4] & 0x80) ? 2048 : 0;
+      rect_dx = p[4] & 31;
+      rect_dy = p[5] & 63;
+      rect_w  = min(rect_w, 32-rect_sx);
+      rect_h  = min(rect_h, 64-rect_sy);
+    }
+  else
+    {
+      // SCROLL
+      rect_shift_x = (int8_t) p[4];
+      rect_shift_y = (int8_t) p[5];
+      rect_v = p[6];
+    }
+
+  rect_w = min(rect_w, 32-rect_dx);
+  rect_h = min(rect_h, 64-rect_dy);
+
+  // go bottom up if a destination row could overwrite a source row
+  // that is still needed
+  rect_up = rect_source && rect_sb==rect_db && rect_dy-rect_sy+rect_shift_y > 0;
+  rect_i  = 0;
+  rect_rows = rect_w>0 ? rect_h : 0;
+}
+
+void rect_process()
+{
+  static uint8_t src[32], row[32];
+  int n = RECT_ROWS_PER_PASS;
+  int r, sr, c, c0, c1;
+
+  for(; rect_rows>0 && n>0; rect_rows--, n--)
+    {
+      r  = rect_up ? rect_h-1-rect_i : rect_i;
+      sr = r-rect_shift_y;
+      rect_i++;
+
+      memset(row, rect_v, rect_w);
+      if( rect_source && sr>=0 && sr<rect_h )
+        {
+          for(c=0; c<rect_w; c++)
+            src[c] = dazzler_mem[rect_sb + rect_addr(rect_sx+c, rect_sy+sr)];
+          c0 = rect_shift_x>0 ? rect_shift_x : 0;
+          c1 = rect_shift_x<0 ? rect_w+rect_shift_x : rect_w;
+          if( c1>c0 ) memcpy(row+c0, src+c0-rect_shift_x, c1-c0);
+        }
+
+      for(c=0; c<rect_w; c++)
+        dazzler_mem[rect_db + rect_addr(rect_dx+c, rect_dy+r)] = row[c];
+    }
+}
+
 uint8_t ringbuffer_process_data()
 {
-  static uint32_t addr = 0, cnt = 0;
-  uint32_t available;
+  static uint32_t addr = 0, cnt = 0, delta = 0, run = 0, chunk = 0;
+  static uint8_t token = 0, chunk_last = 0;
+#if HAVE_AUDIO>0
+  static uint32_t burst = 0, burst_step = 0;
+  static uint32_t burst_frac[2] = {0x8000, 0x8000};
+  static int burst_N = 0;
+#else
+  static const uint32_t burst = 0;
+#endif
+  uint32_t available, start;
   uint8_t cmd;
 
+  // in framed mode only checked bytes may be processed
+  if( framed && frame_process() )
+    {
+      cnt = delta = chunk = 0;
+      chunk_buffer = -1;
+#if HAVE_AUDIO>0
+      burst = 0;
+#endif
+    }
+
+  if( state_wait>0 && !framed )
+    {
+      // after DAZ_STATE_REQUEST: what arrives first may be the rest of a
+      // command we lost the start of, skip everything up to the DAZ_STATE
+      // header or the start of a DAZ_FRAMED sequence
+      cnt = delta = chunk = rect_rows = 0;
+      chunk_buffer = -1;
+#if HAVE_AUDIO>0
+      burst = 0;
+#endif
+      while( state_wait>0 && ringbuffer_available_for_read()>=3 )
+        {
+          uint8_t b0 = ringbuffer_peek();
+          uint8_t b1 = ringbuffer[(ringbuffer_start+1) & (RINGBUFFER_SIZE-1)];
+          uint8_t b2 = ringbuffer[(ringbuffer_start+2) & (RINGBUFFER_SIZE-1)];
+          if( (b0==(DAZ_STATE | resume_version) && b1==DAZ_STATE_SYNC1 && b2==DAZ_STATE_SYNC2) ||
+              (b0==(DAZ_FRAMED | DAZ_FRAMED_START) && b1==DAZ_FRAMED_SYNC) )
+            state_wait = 0;
+          else
+            {
+              ringbuffer_dequeue();
+              state_wait--;
+            }
+        }
+    }
+
   available = ringbuffer_available_for_read();
+  if( framed ) available = min(available, frame_left);
+  if( state_wait>0 ) available = 0;
+  start = ringbuffer_start;
   cmd = ringbuffer_peek();
 
-  if( cnt==0 && available>0 )
+#if ALWAYS_ON==0
+  if( chunk_commit && !(dazzler_ctrl & 0x80) )
+    {
+      // no output signal => no interrupt to commit the frame
+      memcpy(dazzler_mem + (chunk_commit-1) * 2048, chunk_mem, 2048);
+      chunk_commit = 0;
+    }
+#endif
+
+  // until a DAZ_CHUNK frame is committed only commands that do not touch
+  // the display may pass it (audio keeps flowing)
+  if( chunk_commit && cnt==0 && delta==0 && burst==0 && chunk==0 && rect_rows==0 )
+    switch( cmd & 0xF0 )
+      {
+      case DAZ_DAC: case DAZ_DACBURST: case DAZ_PING: case DAZ_FRAMED: case DAZ_VERSION:
+        break;
+      default:
+        available = 0;
+      }
+
+  if( cnt==0 && delta==0 && burst==0 && chunk==0 && rect_rows==0 && available>0 )
     {
       switch( cmd & 0xF0 )
         {
@@ -284,6 +666,20 @@ uint8_t ringbuffer_process_data()
             break;
           }
 
+        case DAZ_MEMBLOCK:
+          {
+            // 0x6H, LL, NN => NN (0=256) bytes of data for address HLL follow
+            if( available>=3 )
+              {
+                ringbuffer_dequeue();
+                addr = (cmd & 0x0F) * 256 + ringbuffer_dequeue();
+                cnt  = ringbuffer_dequeue();
+                if( cnt==0 ) cnt = 256;
+                available -= 3;
+              }
+            break;
+          }
+
 #if HAVE_AUDIO>0        
         case DAZ_DAC:
           {
@@ -331,6 +727,30 @@ uint8_t ringbuffer_process_data()
 
             break;
           }
+
+        case DAZ_DACBURST:
+          {
+            // 0x8C, DL, DH, NN => NN (0=256) samples for channel C follow,
+            // one every DH/DL microseconds
+            if( available>=4 )
+              {
+                uint32_t interval_us;
+                burst_N = (cmd&0x0f)==0 ? 0 : 1;
+                ringbuffer_dequeue();
+                interval_us  = ringbuffer_dequeue();
+                interval_us += ringbuffer_dequeue() * 256;
+                burst = ringbuffer_dequeue();
+                if( burst==0 ) burst = 256;
+                available -= 4;
+
+                // convert the interval to lines of video output (26.417
+                // microseconds, see DAZ_DAC) once for the whole burst, as
+                // 16.16 fixed point. The fraction carries over from sample
+                // to sample (and burst to burst) so we stay in sync.
+                burst_step = (uint32_t) ((((uint64_t) interval_us) << 16) * 1000 / 26417);
+              }
+            break;
+          }
 #endif
         
         case DAZ_CTRL:
@@ -389,18 +809,153 @@ uint8_t ringbuffer_process_data()
             break;
           }
 
+        case DAZ_DELTA:
+          {
+            ringbuffer_dequeue();
+
+            // same parameter bits as FULLFRAME
+            if( (cmd&0x06)==0 )
+              {
+                addr  = (cmd & 0x08) * 256;
+                delta = (cmd & 0x01) ? 2048 : 512;
+                run   = 0;
+              }
+            break;
+          }
+
+        case DAZ_CHUNK:
+          {
+            // 0xAB, OH, OL, NN => NN (0=256) bytes for offset HL of the
+            // frame copy follow, bit 0 of B: last slice
+            if( available>=4 )
+              {
+                uint8_t b = (cmd & 0x08) ? 1 : 0;
+                ringbuffer_dequeue();
+                addr  = (ringbuffer_dequeue() & 0x07) * 256;
+                addr += ringbuffer_dequeue();
+                chunk = ringbuffer_dequeue();
+                if( chunk==0 ) chunk = 256;
+                chunk_last = cmd & 0x01;
+                available -= 4;
+
+                // the first slice (or one for the other buffer) starts
+                // a new frame
+                if( chunk_buffer!=b )
+                  {
+                    memcpy(chunk_mem, dazzler_mem + b * 2048, 2048);
+                    chunk_buffer = b;
+                  }
+              }
+            break;
+          }
+
+        case DAZ_RECT:
+          {
+            // 0x90 FILL: X, Y, W, H, V
+            // 0x91 COPY: X, Y, W, H, X2, Y2
+            // 0x92 SCROLL: X, Y, W, H, DX, DY, V
+            static const uint8_t size[3] = {6, 7, 8};
+            uint8_t op = cmd & 0x0F, i, p[7];
+            if( op>2 )
+              {
+                // illegal command
+                ringbuffer_dequeue();
+              }
+            else if( available>=size[op] )
+              {
+                ringbuffer_dequeue();
+                for(i=1; i<size[op]; i++) p[i-1] = ringbuffer_dequeue();
+                rect_start(op, p);
+              }
+            break;
+          }
+
+        case DAZ_PING:
+          {
+            // 0xB0, T0-T3 => send the four bytes straight back (DAZ_PONG)
+            if( available>=5 )
+              {
+                static uint8_t pong[5];
+                ringbuffer_dequeue();
+                pong[0] = DAZ_PONG;
+                pong[1] = ringbuffer_dequeue();
+                pong[2] = ringbuffer_dequeue();
+                pong[3] = ringbuffer_dequeue();
+                pong[4] = ringbuffer_dequeue();
+                dazzler_send(pong, 5);
+              }
+            break;
+          }
+
+        case DAZ_STATE:
+          {
+            // 0xDV, 0xA5, 0x5A, CC, PP => computer version V, control and
+            // picture control register, then both buffers (4096 bytes) follow
+            if( available>=5 )
+              {
+                ringbuffer_dequeue();
+                if( ringbuffer_peek()==DAZ_STATE_SYNC1 && ringbuffer[(ringbuffer_start+1) & (RINGBUFFER_SIZE-1)]==DAZ_STATE_SYNC2 )
+                  {
+                    ringbuffer_dequeue();
+                    ringbuffer_dequeue();
+                    computer_version = cmd & 0x0F;
+                    dazzler_ctrl = ringbuffer_dequeue();
+                    if( computer_version==0 ) dazzler_ctrl &= 0xFE;
+                    dazzler_picture_ctrl = ringbuffer_dequeue();
+
+                    // start counting consumed bytes for DAZ_CREDIT again
+                    credit_base = credit_sent = ringbuffer_start;
+
+                    test_mode    = 0;
+                    chunk_buffer = -1;
+                    addr = 0;
+                    cnt  = sizeof(dazzler_mem);
+                    available -= 5;
+#if ALWAYS_ON==0
+                    g_current_line = 0;
+                    if( dazzler_ctrl & 0x80 )
+                      PLIB_TMR_Start(TMR_ID_2);
+                    else
+                      PLIB_TMR_Stop(TMR_ID_2);
+#endif      
+                  }
+                else
+                  {
+                    // wrong sync bytes => drop the whole 5-byte header
+                    uint8_t i;
+                    for(i=0; i<4; i++) ringbuffer_dequeue();
+                  }
+              }
+            break;
+          }
+
+        case DAZ_FRAMED:
+          {
+            if( !framed && (cmd & 0x0E)==0 )
+              {
+                // switch to framed mode, frame_process() takes it from here
+                framed     = true;
+                frame_left = 0;
+              }
+            else
+              ringbuffer_dequeue();
+            break;
+          }
+
         case DAZ_VERSION:
           {
             ringbuffer_dequeue();
             computer_version = cmd & 0x0F;
+            credit_base = credit_sent = ringbuffer_start;
 
             // respond by sending our version to the computer
             static uint8_t buf[3];
             buf[0] = DAZ_VERSION | (DAZZLER_VERSION&0x0F);
-            buf[1] = FEAT_VIDEO | FEAT_JOYSTICK | FEAT_DUAL_BUF | FEAT_VSYNC;
-            buf[2] = 0;
+            buf[1] = FEAT_VIDEO | FEAT_JOYSTICK | FEAT_DUAL_BUF | FEAT_VSYNC | FEAT_STATE;
+            buf[2] = (FEAT_MEMBLOCK | FEAT_DELTA | FEAT_CREDIT | FEAT_FRAMED | FEAT_PING | FEAT_RECT | FEAT_CHUNK) >> 8;
 #if HAVE_AUDIO>0
             buf[1] |= FEAT_DAC;
+            buf[2] |= FEAT_DACBURST >> 8;
 #endif
             
             // only computer version 2 or later expects feature information
@@ -421,14 +976,113 @@ uint8_t ringbuffer_process_data()
 
   if( cnt>0 && available>0 )
     {
-      // receiving fullframe data
+      // receiving fullframe or memblock data (memory blocks wrap around
+      // at the end of video memory)
       uint32_t n = ringbuffer_start<=ringbuffer_end ? ringbuffer_end-ringbuffer_start : RINGBUFFER_SIZE-ringbuffer_start;
       n = min(n, cnt);
+      n = min(n, available);
+      n = min(n, sizeof(dazzler_mem)-addr);
       memcpy(dazzler_mem+addr, ringbuffer+ringbuffer_start, n);
-      addr += n;
+      addr  = (addr + n) & (sizeof(dazzler_mem)-1);
       cnt  -= n;
       ringbuffer_start = (ringbuffer_start+n) & (RINGBUFFER_SIZE-1);
    }
+
+  if( chunk>0 && available>0 )
+    {
+      // receiving DAZ_CHUNK slice data (wraps around at the end of the buffer)
+      uint32_t n = ringbuffer_start<=ringbuffer_end ? ringbuffer_end-ringbuffer_start : RINGBUFFER_SIZE-ringbuffer_start;
+      n = min(n, chunk);
+      n = min(n, available);
+      n = min(n, sizeof(chunk_mem)-addr);
+      memcpy(chunk_mem+addr, ringbuffer+ringbuffer_start, n);
+      addr   = (addr + n) & (sizeof(chunk_mem)-1);
+      chunk -= n;
+      ringbuffer_start = (ringbuffer_start+n) & (RINGBUFFER_SIZE-1);
+
+      if( chunk==0 && chunk_last )
+        {
+          chunk_commit = chunk_buffer+1;
+          chunk_buffer = -1;
+        }
+   }
+
+#if HAVE_AUDIO>0
+  if( burst>0 && available>0 )
+    {
+      // receiving DAZ_DACBURST samples
+      uint32_t n = min(burst, available);
+      uint32_t frac = burst_frac[burst_N];
+      burst -= n;
+      while( n-- > 0 )
+        {
+          uint8_t v = 128 + ((int8_t) ringbuffer_dequeue());
+          uint32_t delay_samples;
+          frac += burst_step;
+          delay_samples = frac >> 16;
+          frac &= 0xFFFF;
+
+          // delay too short => skip sample
+          if( delay_samples==0 ) continue;
+
+          audiobuffer_enqueue(burst_N, v + 256 * delay_samples);
+          if( g_next_audio_sample[burst_N]==0xffffffff )
+            {
+              // not playing => start in 5ms, as for DAZ_DAC
+              uint32_t data = audiobuffer_dequeue(burst_N);
+              g_next_audio_sample[burst_N] = g_audio_sample_ctr+190;
+              g_next_audio_sample_val[burst_N] = data & 0xff;
+            }
+        }
+      burst_frac[burst_N] = frac;
+    }
+#endif
+
+  if( delta>0 )
+    {
+      // receiving delta frame tokens, "delta" is the number of frame bytes
+      // not yet covered by a token, "run" the bytes left in the current one:
+      // 0x00 skip to end, 0x01-0x7F skip N bytes, 0x80-0xBF XOR the next
+      // N-0x7F bytes into memory, 0xC0-0xFF XOR the next byte into N-0xBF bytes
+      available = ringbuffer_available_for_read();
+      if( framed ) available = min(available, frame_left - ((ringbuffer_start-start) & (RINGBUFFER_SIZE-1)));
+      while( delta>0 && available>0 )
+        {
+          if( run==0 )
+            {
+              token = ringbuffer_dequeue();
+              available--;
+              if( token & 0x80 )
+                run = min((token & 0x3F) + 1, delta);
+              else
+                {
+                  uint32_t n = (token==0 || token>delta) ? delta : token;
+                  addr  += n;
+                  delta -= n;
+                }
+            }
+          else if( token & 0x40 )
+            {
+              uint8_t v = ringbuffer_dequeue();
+              available--;
+              delta -= run;
+              for(; run>0; run--) dazzler_mem[addr++] ^= v;
+            }
+          else
+            {
+              dazzler_mem[addr++] ^= ringbuffer_dequeue();
+              available--;
+              run--;
+              delta--;
+            }
+        }
+    }
+
+  if( rect_rows>0 )
+    rect_process();
+
+  if( framed )
+    frame_left -= (ringbuffer_start-start) & (RINGBUFFER_SIZE-1);
 }
 
 
@@ -1071,6 +1725,19 @@ void __ISR(_TIMER_2_VECTOR, ipl7AUTO) IntHandlerTimer2(void)
         }
 #endif      
     }
+  else if( g_current_line==NUM_LINES-5 && chunk_commit )
+    {
+      // latch the commit so a commit set between the two halves waits
+      // for the next frame instead of copying only the second half
+      chunk_latch = chunk_commit;
+      memcpy(dazzler_mem + (chunk_latch-1) * 2048, chunk_mem, 1024);
+    }
+  else if( g_current_line==NUM_LINES-4 && chunk_latch )
+    {
+      memcpy(dazzler_mem + (chunk_latch-1) * 2048 + 1024, chunk_mem + 1024, 1024);
+      chunk_latch = 0;
+      chunk_commit = 0;
+    }
   else if( g_current_line==NUM_LINES-3)
     memcpy(dazzler_mem_buf, dazzler_mem + (dazzler_ctrl & 1) * 2048, 1024);
   else if( g_current_line==NUM_LINES-2)
@@ -1269,9 +1936,16 @@ void usbTasks()
               static USB_CDC_LINE_CODING coding = {115200, 0, 0, 8};
               USB_HOST_CDC_ACM_LineCodingSet(usbCdcHostHandle, NULL, &coding);
               
-              // initialize ringbuffer
+              // initialize ringbuffer, whatever was in it (and anything the
+              // computer sent while disconnected) is lost, so remember the
+              // computer's version to ask it for the display state
               ringbuffer_start = ringbuffer_end = 0;
+              if( computer_version>0 ) resume_version = computer_version;
               computer_version = 0;
+              state_wait = resume_version>=4 ? DAZ_STATE_WAIT : 0;
+              framed = false;
+              frame_left = 0;
+              chunk_buffer = -1;
               lineStateSet = false;
               usbBusy = false;
             }
@@ -1281,6 +1955,7 @@ void usbTasks()
     {
       USB_CDC_CONTROL_LINE_STATE state = {1, 1};
       lineStateSet = USB_HOST_CDC_ACM_ControlLineStateSet(usbCdcHostHandle, NULL, &state)==USB_HOST_RESULT_SUCCESS;
+      if( lineStateSet && resume_version>=4 ) send_state_request = true;
     }
   else
     {
@@ -1457,6 +2132,17 @@ void APP_Tasks ( void )
   // process received data    
   ringbuffer_process_data();
 
+  // tell the computer how much of the ring buffer it may fill
+  if( computer_version>=3 && ((ringbuffer_start-credit_sent) & (RINGBUFFER_SIZE-1))>=DAZ_CREDIT_STEP )
+    {
+      static uint8_t credit[2];
+      uint32_t n = (ringbuffer_start-credit_base) & (RINGBUFFER_SIZE-1);
+      credit[0] = DAZ_CREDIT | (n >> 8);
+      credit[1] = n & 0xFF;
+      dazzler_send(credit, 2);
+      credit_sent = ringbuffer_start;
+    }
+
 #if USE_USB>0
   // handle USB tasks
   usbTasks();
@@ -1467,6 +2153,7 @@ void APP_Tasks ( void )
   // when the ring buffer is full. Overwriting the beginning of the buffer
   // is about as bad as dropping the newly received byte. So we save
   // the time to check whether the buffer is full and just overwrite.
+  // Computers that use DAZ_CREDIT flow control never overrun the buffer.
   while( PLIB_USART_ReceiverDataIsAvailable(USART_ID_2) ) 
     ringbuffer_enqueue(PLIB_USART_ReceiverByteReceive(USART_ID_2));
 #endif
@@ -1478,6 +2165,21 @@ void APP_Tasks ( void )
      dazzler_send(&vsync, 1);
      send_vsync = false;
   }
+
+  // ask the computer to restore the display state after a reconnect
+  // (DAZ_STATE_REQUEST with the number of audio samples still queued)
+  if( send_state_request )
+  {
+     static uint8_t req[2];
+     uint32_t n = 0;
+#if HAVE_AUDIO>0
+     n = audiobuffer_available_for_read(0) + audiobuffer_available_for_read(1);
+#endif
+     req[0] = DAZ_STATE_REQUEST | (n >> 8);
+     req[1] = n & 0xFF;
+     dazzler_send(req, 2);
+     send_state_request = false;
+  }
   
   if( test_mode>10 ) 
   {
@@ -31,39 +31,16 @@
 #include <sys/timeb.h>
 #include <d2d1.h>
 #include <d2d1helper.h>
+#include <commdlg.h>
 
-
-#define DAZ_MEMBYTE   0x10
-#define DAZ_FULLFRAME 0x20
-#define DAZ_CTRL      0x30
-#define DAZ_CTRLPIC   0x40
-#define DAZ_DAC       0x50
-#define DAZ_VERSION   0xF0
-
-#define DAZ_JOY1      0x10
-#define DAZ_JOY2      0x20
-#define DAZ_KEY       0x30
-
-// features
-#define FEAT_VIDEO    0x01
-#define FEAT_JOYSTICK 0x02
-#define FEAT_DUAL_BUF 0x04
-#define FEAT_VSYNC    0x08
-#define FEAT_DAC      0x10
-#define FEAT_KEYBOARD 0x20
-#define FEAT_FRAMEBUF 0x40
-
-// computer/dazzler version
-#define DAZZLER_VERSION 0x02
-int computer_version =  0x00;
-
-
-COLORREF colors[16] = {RGB(0x00,0x00,0x00), RGB(0x80,0x00,0x00), RGB(0x00,0x80,0x00), RGB(0x80,0x80,0x00),
-                       RGB(0x00,0x00,0x80), RGB(0x80,0x00,0x80), RGB(0x00,0x80,0x80), RGB(0x80,0x80,0x80),
-                       RGB(0x00,0x00,0x00), RGB(0xff,0x00,0x00), RGB(0x00,0xff,0x00), RGB(0xff,0xff,0x00),
-                       RGB(0x00,0x00,0xff), RGB(0xff,0x00,0xff), RGB(0x00,0xff,0xff), RGB(0xff,0xff,0xff)};
-
-#define RGB2BGR(v) ((((v)&0xFF0000)>>16) | ((v) & 0x00FF00) | (((v) & 0x0000FF)<<16))
+#include "../Common/dazzler_proto.h"
+#include "../Common/dazzler_decoder.h"
+#include "../Common/dazzler_render.h"
+#include "../Common/dazzler_handoff.h"
+#include "../Common/dazzler_sched.h"
+#include "../Common/dazzler_scale.h"
+#include "../Common/dazzler_trace.h"
+#include "../Common/dazzler_capture.h"
 
 
 // D7: not used
@@ -78,6 +55,7 @@ byte dazzler_picture_ctrl = 0;
 byte dazzler_ctrl = 0;
 
 // dazzler video memory, keeping two buffers
+// (written by the decoder, the video thread renders from published copies)
 byte dazzler_mem[2*2048];
 
 // joystick 
@@ -120,6 +98,7 @@ unsigned int  g_audiobuffer_start[2] = {0, 0}, g_audiobuffer_end[2] = {0, 0};
 unsigned int  g_audiobuffer[2][AUDIOBUFFER_SIZE];
 #define audiobuffer_empty(N) (g_audiobuffer_start[N]==g_audiobuffer_end[N])
 #define audiobuffer_available_for_write(N) (((g_audiobuffer_start[N]+AUDIOBUFFER_SIZE)-g_audiobuffer_end[N]-1)&(AUDIOBUFFER_SIZE-1))
+#define audiobuffer_available_for_read(N) (((g_audiobuffer_end[N]+AUDIOBUFFER_SIZE)-g_audiobuffer_start[N])&(AUDIOBUFFER_SIZE-1))
 
 static bool    audio_thread_stop   = false;
 static HANDLE  audio_sample_event  = NULL;
@@ -349,6 +328,39 @@ static void audio_add_sample(int channel, unsigned short delay_us, byte sample)
 }
 
 
+static void audio_add_samples(int channel, unsigned short interval_us, const byte *samples, int n)
+{
+  if( audio_thread_handle )
+    {
+      static unsigned int frac[2] = { 0x8000, 0x8000 };
+
+      // same as audio_add_sample() for each sample but the interval is
+      // converted to 48k sample frames only once, as 16.16 fixed point,
+      // and the fraction carries over from sample to sample
+      unsigned int step = (unsigned int) ((((unsigned long long) interval_us) << 16) * 1000 / 20833);
+      unsigned int f = frac[channel];
+
+      // enqueue the whole burst at once
+      WaitForSingleObject(audio_mutex, INFINITE);
+      for(int i=0; i<n; i++)
+        {
+          f += step;
+          unsigned int delay_samples = f >> 16;
+          f &= 0xFFFF;
+
+          if( delay_samples > 0 )
+            {
+              g_audiobuffer[channel][g_audiobuffer_end[channel]] = samples[i] + 256 * delay_samples;
+              g_audiobuffer_end[channel] = (g_audiobuffer_end[channel]+1) & (AUDIOBUFFER_SIZE-1);
+            }
+        }
+      ReleaseMutex(audio_mutex);
+
+      frac[channel] = f;
+    }
+}
+
+
 static int audio_start(void)
 {
   int res = 0;
@@ -403,172 +415,148 @@ static void audio_stop(void)
 
 HANDLE video_redraw = INVALID_HANDLE_VALUE;
 HANDLE video_mutex = INVALID_HANDLE_VALUE;
-double border_topbottom = 0, border_leftright = 0;
-double byte_width, byte_height;
 
-__int64 performanceFreq, performanceCount;
 ID2D1Factory* pDirect2dFactory = NULL;
 ID2D1HwndRenderTarget* pRenderTarget = NULL;
-ID2D1SolidColorBrush *brushes_color[16], *brushes_grayscale[16];
-ID2D1Bitmap *palette[128];
+ID2D1Bitmap *frame_bitmap = NULL;
 
+// the picture is rendered on the CPU into "framebuffer" (only the memory
+// bytes that changed are re-rendered), the changed rows are then uploaded
+// into "frame_bitmap" which is drawn scaled to the window
+dazzler_renderer renderer;
+uint32_t framebuffer[DAZ_WIDTH*DAZ_HEIGHT];
+int framebuffer_contents = -1; // buffer+picture control the framebuffer holds (-1=none)
+int frame_cells_redrawn = 0;
 
-#define P_PIXEL_SIZE 16
-static void draw_palette_pixel(ID2D1BitmapRenderTarget *target, byte pc, int x, int y, int s, byte color)
-{
-  D2D1_RECT_F r;
-  r.left   = (float) (x     * P_PIXEL_SIZE * s);
-  r.right  = (float) ((x+1) * P_PIXEL_SIZE * s);
-  r.top    = (float) (y     * P_PIXEL_SIZE * s);
-  r.bottom = (float) ((y+1) * P_PIXEL_SIZE * s);
-  target->FillRectangle(&r, (pc & 0x10) ? (brushes_color[color & 15]) : (brushes_grayscale[color & 15]));
-}
 
+// integer scaling geometry for the current window size (see adjust_render_area_size)
+dazzler_scaler g_scaler;
 
-static void init_palette(byte pc)
-{
-  ID2D1BitmapRenderTarget *target;
-  if( S_OK == pRenderTarget->CreateCompatibleRenderTarget(D2D1::SizeF(4*P_PIXEL_SIZE*256, 2*P_PIXEL_SIZE), &target) )
-    {
-      // palette for this graphics mode is not yet initialized => initialize now
-      target->BeginDraw();
+// frames published by the receiving thread (see publish_frame)
+dazzler_handoff g_handoff;
 
-      if( pc & 0x40 )
-        {
-          // 4x resolution, common color
-          byte color = pc & 0x0f;
-          for (int i = 0; i < 256; i++)
-            {
-              draw_palette_pixel(target, pc, (i*4),   0, 1, i & 0x01 ? color : 0);
-              draw_palette_pixel(target, pc, (i*4)+1, 0, 1, i & 0x02 ? color : 0);
-              draw_palette_pixel(target, pc, (i*4)+2, 0, 1, i & 0x10 ? color : 0);
-              draw_palette_pixel(target, pc, (i*4)+3, 0, 1, i & 0x20 ? color : 0);
-              draw_palette_pixel(target, pc, (i*4),   1, 1, i & 0x04 ? color : 0);
-              draw_palette_pixel(target, pc, (i*4)+1, 1, 1, i & 0x08 ? color : 0);
-              draw_palette_pixel(target, pc, (i*4)+2, 1, 1, i & 0x40 ? color : 0);
-              draw_palette_pixel(target, pc, (i*4)+3, 1, 1, i & 0x80 ? color : 0);
-            }
-        }
-      else
-        {
-          // normal resolution, individual color
-          for (int i = 0; i < 256; i++)
-            {
-              draw_palette_pixel(target, pc, i*2,   0, 2, i & 0x0f);
-              draw_palette_pixel(target, pc, i*2+1, 0, 2, i >> 4);
-            }
-        }
-
-      target->EndDraw();
-      target->GetBitmap(&(palette[pc]));
-      target->Release();
-    }
-  else
-    palette[pc] = NULL;
-}
+// video capture (File/Capture Video), only changed with video_mutex held
+dazzler_capture *g_capture = NULL;
 
 
-inline void update_byte(byte pc, int x, int y, int b)
+static uint64_t time_us()
 {
-  D2D1_RECT_F rsrc, rdst;
-  rsrc.left   = (float) (4*P_PIXEL_SIZE*b);
-  rsrc.right  = (float) (rsrc.left + 4*P_PIXEL_SIZE);
-  rsrc.top    = (float) 0.0;
-  rsrc.bottom = (float) 2*P_PIXEL_SIZE;
-
-  rdst.left   = (float) (border_leftright + x * byte_width);
-  rdst.right  = (float) (rdst.left + byte_width);
-  rdst.top    = (float) (border_topbottom + y * byte_height);
-  rdst.bottom = (float) (rdst.top + byte_height);
-
-  pRenderTarget->DrawBitmap(palette[pc], rdst, 1.0, D2D1_BITMAP_INTERPOLATION_MODE_NEAREST_NEIGHBOR, rsrc);
+  static LARGE_INTEGER freq = {0};
+  LARGE_INTEGER ctr;
+  if( freq.QuadPart==0 ) QueryPerformanceFrequency(&freq);
+  QueryPerformanceCounter(&ctr);
+  return (uint64_t) (ctr.QuadPart / freq.QuadPart) * 1000000 + (uint64_t) (ctr.QuadPart % freq.QuadPart) * 1000000 / freq.QuadPart;
 }
 
 
-static void render_frame_smallmem(byte pc, byte *mem, int xo = 0, int yo = 0)
+static void render_frame(const dazzler_frame *f)
 {
-  // render one quadrant (or full screen for small memory)
-  int y = yo, x = xo;
-  for(int i=0; i<512; i++)
+  int buffer = f->ctrl & 1;
+  byte pc = f->picture_ctrl;
+  const byte *mem = f->mem + DAZ_MEMSIZE * buffer;
+
+  if( framebuffer_contents != buffer*256+pc )
     {
-      update_byte(pc, x++, y, *mem++);
-      if( (i&0x0f)==0x0f ) { x = xo; y++; }
+      dazzler_render_frame(&renderer, mem, pc, framebuffer, DAZ_WIDTH);
+      framebuffer_contents = buffer*256+pc;
     }
-}
+  else
+    dazzler_render_update(&renderer, mem, pc, f->dirty + DAZ_DIRTY_WORDS * buffer, framebuffer, DAZ_WIDTH);
 
+  frame_cells_redrawn = renderer.cells_redrawn;
 
-static void render_frame_bigmem(byte pc, byte *mem)
-{
-  // 2k memory => render the four quadrants
-  render_frame_smallmem(pc, mem,        0,  0);
-  render_frame_smallmem(pc, mem+0x200, 16,  0);
-  render_frame_smallmem(pc, mem+0x400,  0, 32);
-  render_frame_smallmem(pc, mem+0x600, 16, 32);
+  // upload changed rows
+  if( renderer.dirty_y1 > renderer.dirty_y0 )
+    {
+      D2D1_RECT_U r = D2D1::RectU(0, renderer.dirty_y0, DAZ_WIDTH, renderer.dirty_y1);
+      frame_bitmap->CopyFromMemory(&r, framebuffer + renderer.dirty_y0*DAZ_WIDTH, DAZ_WIDTH*sizeof(uint32_t));
+    }
 }
 
 
 static void update_frame()
 {
+  static byte frame_ctrl = 0;
+  static const dazzler_frame *shown = NULL;
+
+  // get the newest complete frame, never waits for the receiving thread
+  // (NULL if there is none, then we just redraw the previous one)
+  const dazzler_frame *f = dazzler_handoff_take(&g_handoff);
+
   WaitForSingleObject(video_mutex, INFINITE);
   pRenderTarget->BeginDraw();
 
-  if( WaitForSingleObject(video_redraw, 0)==WAIT_TIMEOUT )
+  if( f!=NULL )
     {
-      // nothing has changed since last time we rendered the frame
+      shown = f;
+      frame_ctrl = f->ctrl;
+      if( frame_ctrl & 0x80 )
+        render_frame(f);
+      else
+        {
+          // changes while off are not tracked => redraw all when turned on
+          framebuffer_contents = -1;
+          frame_cells_redrawn  = 0;
+        }
     }
-  else if( dazzler_ctrl & 0x80 )
+
+  // the capture gets palette indices, encoding happens on its own thread
+  // (a capture that just started also gets the picture currently shown)
+  if( g_capture!=NULL && shown!=NULL && (f!=NULL || !g_capture->have_last) )
     {
-      // make copy of memory and graphics mode 
-      // so updates while drawing don't affect the rendering
-      byte mem[2048], pc = dazzler_picture_ctrl;
-      memcpy(mem, dazzler_mem + 2048 * (dazzler_ctrl & 1), 2048);
-      
-      // determine on-screen pixel size of one memory byte (4x2 pixels per byte)
-      // if using small memory then scale up pixel size by factor 2
-      bool bigmem = pc & 0x20;
-      byte_width  = P_PIXEL_SIZE * (bigmem ? 4 : 8);
-      byte_height = P_PIXEL_SIZE * (bigmem ? 2 : 4);
-
-      // make sure the palette for this graphics mode is initialized
-      if( palette[pc]==NULL ) init_palette(pc);
-
-      // render screen memory (only draw if palette is initialized)
-	  pRenderTarget->Clear(D2D1::ColorF(D2D1::ColorF::Black));
-	  if( palette[pc]==NULL )
-        {}
-      else if (pc & 0x20)
-        render_frame_bigmem(pc, mem);
+      static byte pixels[DAZ_WIDTH*DAZ_HEIGHT];
+      if( frame_ctrl & 0x80 )
+        dazzler_render_indexed(&renderer, shown->mem + DAZ_MEMSIZE*(frame_ctrl & 1), shown->picture_ctrl, pixels);
       else
-        render_frame_smallmem(pc, mem);
+        memset(pixels, 0, sizeof(pixels));
+      dazzler_capture_add(g_capture, pixels, time_us());
     }
-  else
-	pRenderTarget->Clear(D2D1::ColorF(D2D1::ColorF::Black));
 
+  pRenderTarget->Clear(D2D1::ColorF(D2D1::ColorF::Black));
+  if( frame_ctrl & 0x80 )
+    {
+      // whole-number scale factors => nearest neighbour scaling replicates
+      // each Dazzler pixel into exactly sx*sy window pixels
+      D2D1_RECT_F rdst, rsrc;
+      rdst.left   = (float) g_scaler.x0;
+      rdst.top    = (float) g_scaler.y0;
+      rdst.right  = (float) (g_scaler.x0 + g_scaler.w);
+      rdst.bottom = (float) (g_scaler.y0 + g_scaler.h);
+      rsrc.left   = 0;
+      rsrc.top    = 0;
+      rsrc.right  = (float) g_scaler.w / g_scaler.sx;
+      rsrc.bottom = (float) g_scaler.h / g_scaler.sy;
+      pRenderTarget->DrawBitmap(frame_bitmap, rdst, 1.0, D2D1_BITMAP_INTERPOLATION_MODE_NEAREST_NEIGHBOR, rsrc);
+    }
 
   pRenderTarget->EndDraw();
   ReleaseMutex(video_mutex);
 }
 
 
+// video frame pacing, the refresh rate setting is g_refresh_rate
+dazzler_sched g_sched;
+int g_refresh_rate = DAZ_SCHED_GRID;
+
+
 static unsigned long WINAPI video_thread(void *h)
 {
-  LARGE_INTEGER ctr1, ctr2;
-  QueryPerformanceFrequency(&ctr1);
-  performanceFreq = ctr1.QuadPart;
-  QueryPerformanceCounter(&ctr1);
-  
   while( true )
     {
-      // render screen
-      update_frame();
+      // sleep until there is a new frame or a redraw request (resize etc.)
+      WaitForSingleObject(video_redraw, INFINITE);
 
-      // measure time (for fps display)
-      QueryPerformanceCounter(&ctr2);
-      if (performanceCount == 0)
-        performanceCount = ctr2.QuadPart - ctr1.QuadPart;
-      else
-        performanceCount = (performanceCount*3 + ctr2.QuadPart-ctr1.QuadPart)/4;
-      ctr1 = ctr2;
+      // wait for the next frame slot according to the refresh rate,
+      // frames published in the meantime are collapsed into one
+      uint32_t wait = dazzler_sched_wait_us(&g_sched, time_us());
+      if( wait>0 ) Sleep((wait+999)/1000);
+
+      // anything requested until now is covered by the frame we draw now
+      ResetEvent(video_redraw);
+
+      uint64_t start = time_us();
+      update_frame();
+      dazzler_sched_frame(&g_sched, start, time_us());
    }
 }
 
@@ -583,25 +571,29 @@ static void video_start(HWND hwnd)
 
       if ( S_OK==pDirect2dFactory->CreateHwndRenderTarget(D2D1::RenderTargetProperties(), D2D1::HwndRenderTargetProperties(hwnd, D2D1::SizeU(w, h)), &pRenderTarget))
         {
-          // set initial pixel scaling
+          // set initial pixel scaling (one DIP is one pixel)
           pRenderTarget->SetTransform(D2D1::Matrix3x2F::Identity());
+          pRenderTarget->SetDpi(96.0f, 96.0f);
 
-          // initialize color brushes
-          for(int i = 0; i < 16; i++)
-            {
-              pRenderTarget->CreateSolidColorBrush(D2D1::ColorF(RGB2BGR(colors[i])), &(brushes_color[i]));
-              pRenderTarget->CreateSolidColorBrush(D2D1::ColorF(RGB(17*i,17*i,17*i)), &(brushes_grayscale[i]));
-            }
+          // create the bitmap holding the rendered picture
+          D2D1_BITMAP_PROPERTIES props = D2D1::BitmapProperties(D2D1::PixelFormat(DXGI_FORMAT_B8G8R8A8_UNORM, D2D1_ALPHA_MODE_IGNORE));
+          pRenderTarget->CreateBitmap(D2D1::SizeU(DAZ_WIDTH, DAZ_HEIGHT), props, &frame_bitmap);
+          dazzler_render_init(&renderer);
+          dazzler_render_use_bgra(&renderer);
+          dazzler_scale_init(&g_scaler, &renderer.palette[0][0]);
+          dazzler_scale_set_geometry(&g_scaler, w, h, g_aspect_ratio);
+          framebuffer_contents = -1;
 
-          // set all palette pointers to "not initialized"
-          memset(palette, 0, 128 * sizeof(ID2D1Bitmap *));
-          
           // initialize mutex (necessary since WM_SIZE and video thread can not
           // access the renterTarget simultaneously)
           video_mutex  = CreateMutex(NULL, FALSE, NULL);
           
           // initialize event to signal that video needs to be redrawn
           video_redraw = CreateEvent(0, 0, 0, 0);
+
+          // frame pacing, Sleep() needs 1ms resolution to hit the frame slots
+          dazzler_sched_init(&g_sched, g_refresh_rate);
+          timeBeginPeriod(1);
           
           // Create the video thread
           HANDLE h = CreateThread(0, 0, video_thread, hwnd, 0, NULL);
@@ -635,135 +627,102 @@ void dazzler_send(HWND hwnd, byte *data, int size)
 }
 
 
-void dazzler_receive(HWND hwnd, byte *data, int size)
+// protocol decoder, receives commands from the computer
+dazzler_decoder g_decoder;
+
+
+static void publish_frame(bool force);
+
+
+static void decoder_fullframe(void *ctx, int addr, int len)
 {
-  static int recv_status = 0, recv_bytes = 0, recv_ptr = 0;
-  static byte buf[10];
+  publish_frame(true);
+}
 
-  int i = 0;
-  while( i<size )
-    {
-      if( recv_bytes>0 )
-        {
-          int n = recv_bytes > (size-i) ? (size-i) : recv_bytes;
 
-          if( recv_status==DAZ_FULLFRAME )
-            memcpy(dazzler_mem+recv_ptr, data+i, n);
-          else
-            memcpy(buf+recv_ptr, data+i, n);
+static void decoder_ctrl(void *ctx, uint8_t ctrl)
+{
+  // only redraw title if on/off status has changed
+  bool setTitle = (dazzler_ctrl&0x80) != (ctrl&0x80);
+  dazzler_ctrl = ctrl;
+  if( setTitle ) set_window_title((HWND) ctx);
+  publish_frame(true);
+}
 
-          recv_bytes -= n;
-          recv_ptr   += n;
-          i          += n;
 
-          if( recv_bytes == 0 )
-            {
-              switch( recv_status )
-                {
-                case DAZ_MEMBYTE:
-                  {
-                    int a = buf[0]*256+buf[1];
-                    dazzler_mem[a] = buf[2];
-                    SetEvent(video_redraw);
-                    break;
-                  }
-
-                case DAZ_DAC:
-                  {
-                    audio_add_sample(buf[0] == 0 ? 0 : 1, buf[1] + buf[2] * 256, buf[3]);
-                    break;
-                  }
-
-                case DAZ_CTRL:
-                  {
-                    // computer version 0 only supports a single buffer but bit 0
-                    // may be on or off
-                    if (computer_version < 1) buf[0] &= 0x80;
-
-                    if( (dazzler_ctrl&0x81) != (buf[0]&0x81) )
-                      {
-                        // only redraw title if on/off status has changed
-                        bool setTitle = (dazzler_ctrl&0x80) != (buf[0]&0x80);
-                        dazzler_ctrl = buf[0];
-                        if( setTitle ) set_window_title(hwnd);
-                        SetEvent(video_redraw);
-                      }
-                    break;
-                  }
-
-                case DAZ_CTRLPIC:
-                  {
-                    // bit 7 is unused, bits 0-3 (color) are only used if bit 6 (high-res) is set
-                    buf[0] = (buf[0] & 0x40) ? (buf[0] & 0x7f) : (buf[0] & 0x70);
-                    if( buf[0]!=dazzler_picture_ctrl ) 
-                      { 
-                        dazzler_picture_ctrl=buf[0]; 
-                        SetEvent(video_redraw); 
-                      }
-                    break;
-                  }
-
-                case DAZ_FULLFRAME:
-                  SetEvent(video_redraw);
-                  break;
-                }
+static void decoder_ctrlpic(void *ctx, uint8_t picture_ctrl)
+{
+  dazzler_picture_ctrl = picture_ctrl;
+  publish_frame(true);
+}
 
-              recv_status = 0;
-            }
-        }
-      else
-        {
-          recv_status = data[i] & 0xf0;
-          recv_bytes = 0;
-          recv_ptr   = 0;
 
-          switch( recv_status )
-            {
-            case DAZ_MEMBYTE:
-              recv_bytes = 2;
-              buf[recv_ptr++] = data[i]&0x0F;
-              break;
+static void decoder_dac(void *ctx, int channel, uint16_t delay_us, uint8_t sample)
+{
+  audio_add_sample(channel, delay_us, sample);
+}
 
-            case DAZ_DAC:
-              recv_bytes = 3;
-              buf[recv_ptr++] = data[i]&0x0F;
-              break;
 
-            case DAZ_CTRL:
-            case DAZ_CTRLPIC:
-              recv_bytes = 1;
-              break;
+static void decoder_dacburst(void *ctx, int channel, uint16_t interval_us, const uint8_t *samples, int n)
+{
+  audio_add_samples(channel, interval_us, samples, n);
+}
 
-            case DAZ_VERSION:
-              {
-                computer_version = data[i] & 0x0F;
-                
-                // respond by sending our version to the computer
-                unsigned char b[3];
-                b[0] = DAZ_VERSION | (DAZZLER_VERSION&0x0F);
-                b[1] = FEAT_VIDEO | FEAT_DUAL_BUF | FEAT_JOYSTICK | FEAT_KEYBOARD | FEAT_DAC;
-                b[2] = 0;
-                
-                // only computer version 2 or later expects feature information
-                // (computer version 0 does not send DAZ_VERSION)
-                dazzler_send(hwnd, b, computer_version<2 ? 1 : 3);
-                recv_status = 0;
-                break;
-              }
 
-            case DAZ_FULLFRAME: 
-              recv_bytes = (data[i] & 0x01) ? 2048 : 512;
-              recv_ptr   = (data[i] & 0x08) * 256;
-              break;
+static void decoder_send(void *ctx, const uint8_t *data, int size)
+{
+  dazzler_send((HWND) ctx, (byte *) data, size);
+}
 
-            default:
-              recv_status = 0;
-              break;
-            }
 
-          i++;
-        }
+static const dazzler_decoder_callbacks decoder_callbacks = 
+  {NULL, decoder_fullframe, decoder_ctrl, decoder_ctrlpic, decoder_dac, NULL, decoder_send, NULL, decoder_dacburst};
+
+
+// hand the decoded state over to the video thread. Happens at frame
+// boundaries (full frame received, control registers changed), when
+// the data stream pauses and otherwise at most at 60Hz.
+// Only called from the thread that receives data.
+static void publish_frame(bool force)
+{
+  static LARGE_INTEGER freq = {0}, last = {0};
+  LARGE_INTEGER now;
+
+  // nothing changed since the last publish
+  if( !dazzler_dirty_any(&g_decoder.dirty) ) return;
+
+  if( freq.QuadPart==0 ) QueryPerformanceFrequency(&freq);
+  QueryPerformanceCounter(&now);
+
+  if( !force )
+    {
+      // never publish a partially received full frame
+      if( dazzler_decoder_in_frame(&g_decoder) ) return;
+      if( now.QuadPart-last.QuadPart < freq.QuadPart/60 ) return;
     }
+
+  dazzler_handoff_publish(&g_handoff, &g_decoder);
+  last = now;
+  SetEvent(video_redraw);
+}
+
+
+// protocol trace recording (File/Record Trace)
+dazzler_trace_writer g_trace = {NULL};
+HANDLE trace_mutex = INVALID_HANDLE_VALUE;
+
+
+void dazzler_receive(HWND hwnd, byte *data, int size)
+{
+  if( g_trace.f!=NULL )
+    {
+      WaitForSingleObject(trace_mutex, INFINITE);
+      dazzler_trace_write(&g_trace, time_us(), data, size);
+      ReleaseMutex(trace_mutex);
+    }
+
+  dazzler_decoder_receive(&g_decoder, data, size);
+  publish_frame(false);
 }
 
 
@@ -871,6 +830,11 @@ DWORD WINAPI serial_thread(void *data)
                   timeouts.WriteTotalTimeoutMultiplier = 0;
                   timeouts.WriteTotalTimeoutConstant = 0;
                   SetCommTimeouts(serial_conn, &timeouts);
+                  dazzler_decoder_reset(&g_decoder);
+
+                  // re-connected: we may have missed commands, ask a
+                  // computer that supports it for the display state
+                  dazzler_decoder_request_state(&g_decoder, audiobuffer_available_for_read(0) + audiobuffer_available_for_read(1));
                   set_window_title(hwnd);
                   current_port = g_com_port;
                   current_baud = g_com_baud;
@@ -887,6 +851,9 @@ DWORD WINAPI serial_thread(void *data)
           if( ReadFile(serial_conn, buf, 100, &dwRead, NULL) )
             {
               if( dwRead>0 ) dazzler_receive(hwnd, buf, dwRead);
+
+              // a short read means the read timed out => data stream paused
+              if( dwRead<100 && !dazzler_decoder_in_frame(&g_decoder) ) publish_frame(true);
             }
           else
             {
@@ -905,12 +872,19 @@ DWORD WINAPI serial_thread(void *data)
 enum
 {
   ID_SOCKET = WM_USER,
+  ID_FILE_RECORD,
+  ID_FILE_CAPTURE,
   ID_FILE_EXIT,
   ID_VIEW_FULLSCREEN,
   ID_VIEW_NORMAL,
   ID_VIEW_ASPECT_11,
   ID_VIEW_ASPECT_43,
   ID_VIEW_ASPECT_WIN,
+  ID_VIEW_RATE_GRID,
+  ID_VIEW_RATE_30,
+  ID_VIEW_RATE_60,
+  ID_VIEW_RATE_120,
+  ID_VIEW_RATE_UNLIMITED,
   ID_SETTINGS_JOY_SWAP,
   ID_SETTINGS_JOY_SHOW,
   ID_SETTINGS_JOY_KEYS,
@@ -946,6 +920,110 @@ void set_baud_rate(HWND hwnd, int baud)
 }
 
 
+void set_refresh_rate(HWND hwnd, int rate)
+{
+  int id;
+  if( rate==DAZ_SCHED_GRID )           id = ID_VIEW_RATE_GRID;
+  else if( rate==DAZ_SCHED_UNLIMITED ) id = ID_VIEW_RATE_UNLIMITED;
+  else if( rate<=30 )                  { id = ID_VIEW_RATE_30;  rate = 30; }
+  else if( rate<=60 )                  { id = ID_VIEW_RATE_60;  rate = 60; }
+  else                                 { id = ID_VIEW_RATE_120; rate = 120; }
+
+  g_refresh_rate = rate;
+  dazzler_sched_set_rate(&g_sched, rate);
+  CheckMenuRadioItem(GetSubMenu(GetMenu(hwnd), 1), ID_VIEW_RATE_GRID, ID_VIEW_RATE_UNLIMITED, id, MF_BYCOMMAND);
+  write_settings();
+}
+
+
+static void trace_toggle(HWND hwnd)
+{
+  if( trace_mutex==INVALID_HANDLE_VALUE ) trace_mutex = CreateMutex(NULL, FALSE, NULL);
+
+  if( g_trace.f!=NULL )
+    {
+      WaitForSingleObject(trace_mutex, INFINITE);
+      dazzler_trace_stop(&g_trace);
+      ReleaseMutex(trace_mutex);
+    }
+  else
+    {
+      wchar_t fname[MAX_PATH] = L"dazzler.daztrc";
+      OPENFILENAME ofn;
+      memset(&ofn, 0, sizeof(ofn));
+      ofn.lStructSize = sizeof(ofn);
+      ofn.hwndOwner   = hwnd;
+      ofn.lpstrFilter = L"Dazzler trace (*.daztrc)\0*.daztrc\0All files\0*.*\0";
+      ofn.lpstrFile   = fname;
+      ofn.nMaxFile    = MAX_PATH;
+      ofn.lpstrDefExt = L"daztrc";
+      ofn.Flags       = OFN_OVERWRITEPROMPT | OFN_PATHMUSTEXIST;
+
+      FILE *f;
+      if( GetSaveFileName(&ofn) && _wfopen_s(&f, fname, L"wb")==0 )
+        {
+          WaitForSingleObject(trace_mutex, INFINITE);
+          if( !dazzler_trace_start(&g_trace, f, time_us()) ) dazzler_trace_stop(&g_trace);
+          ReleaseMutex(trace_mutex);
+        }
+    }
+
+  CheckMenuItem(GetSubMenu(GetMenu(hwnd), 0), ID_FILE_RECORD, MF_BYCOMMAND | (g_trace.f!=NULL ? MF_CHECKED : MF_UNCHECKED));
+}
+
+
+static void capture_toggle(HWND hwnd)
+{
+  if( g_capture!=NULL )
+    {
+      WaitForSingleObject(video_mutex, INFINITE);
+      dazzler_capture *c = g_capture;
+      g_capture = NULL;
+      ReleaseMutex(video_mutex);
+
+      // writes out all frames still queued
+      dazzler_capture_stop(c, time_us());
+    }
+  else
+    {
+      wchar_t fname[MAX_PATH] = L"dazzler.gif";
+      OPENFILENAME ofn;
+      memset(&ofn, 0, sizeof(ofn));
+      ofn.lStructSize = sizeof(ofn);
+      ofn.hwndOwner   = hwnd;
+      ofn.lpstrFilter = L"Animated GIF (*.gif)\0*.gif\0YUV4MPEG2 video (*.y4m)\0*.y4m\0PNG sequence (*.png)\0*.png\0";
+      ofn.lpstrFile   = fname;
+      ofn.nMaxFile    = MAX_PATH;
+      ofn.lpstrDefExt = L"gif";
+      ofn.Flags       = OFN_OVERWRITEPROMPT | OFN_PATHMUSTEXIST;
+
+      char name[MAX_PATH];
+      size_t n;
+      if( GetSaveFileName(&ofn) && wcstombs_s(&n, name, MAX_PATH, fname, _TRUNCATE)==0 )
+        {
+          int format = dazzler_capture_format(name);
+          uint32_t palette[32];
+          dazzler_render_palette(palette);
+
+          dazzler_capture *c = dazzler_capture_start(name, format<0 ? DAZ_CAPTURE_GIF : format, palette, 60);
+          if( c==NULL )
+            MessageBox(hwnd, L"Can not create capture file.", L"Error", MB_OK | MB_ICONERROR);
+          else
+            {
+              WaitForSingleObject(video_mutex, INFINITE);
+              g_capture = c;
+              ReleaseMutex(video_mutex);
+
+              // capture the current picture as first frame
+              SetEvent(video_redraw);
+            }
+        }
+    }
+
+  CheckMenuItem(GetSubMenu(GetMenu(hwnd), 0), ID_FILE_CAPTURE, MF_BYCOMMAND | (g_capture!=NULL ? MF_CHECKED : MF_UNCHECKED));
+}
+
+
 void set_com_port(HWND hwnd, int port)
 {
   g_com_port = port;
@@ -1046,14 +1124,17 @@ void set_window_title(HWND hwnd)
   bool on = (dazzler_ctrl & 0x80)!=0;
   wchar_t buf[100];
 
-  int fps = performanceCount==0 ? 0 : (int) ((((double) performanceFreq)/((double) performanceCount)) + 0.5);
-  
+  dazzler_sched_stats stats;
+  dazzler_sched_get_stats(&g_sched, time_us(), &stats);
+  int fps = (int) (stats.fps + 0.5);
+  int p99 = (stats.p99_us + 50) / 100; // in 0.1ms
+
   if( peer!=NULL )
-    wsprintf(buf, L"Dazzler Display (%s, %sconnected, %s, %i fps)",
-             peer, connected ? L"" : L"not ", on ? L"on" : L"off", fps);
+    wsprintf(buf, L"Dazzler Display (%s, %sconnected, %s, %i fps, p99 %i.%ims, %i cells)",
+             peer, connected ? L"" : L"not ", on ? L"on" : L"off", fps, p99/10, p99%10, frame_cells_redrawn);
   else if( g_com_port>0 )
-    wsprintf(buf, L"Dazzler Display (COM%i, %sconnected, %s, %i fps)",
-             g_com_port, connected ? L"" : L"not ", on ? L"on" : L"off", fps);
+    wsprintf(buf, L"Dazzler Display (COM%i, %sconnected, %s, %i fps, p99 %i.%ims, %i cells)",
+             g_com_port, connected ? L"" : L"not ", on ? L"on" : L"off", fps, p99/10, p99%10, frame_cells_redrawn);
   else
     wsprintf(buf, L"Dazzler Display");
 
@@ -1086,6 +1167,7 @@ void write_settings()
       RegSetValueEx(key, L"JoystickKeys", 0, REG_DWORD, (const LPBYTE) &g_joy_keys, 4);
       RegSetValueEx(key, L"MuteAudio", 0, REG_DWORD, (const LPBYTE) &g_audio_mute, 4);
       RegSetValueEx(key, L"AspectRatio", 0, REG_DWORD, (const LPBYTE) &g_aspect_ratio, 4);
+      RegSetValueEx(key, L"RefreshRate", 0, REG_DWORD, (const LPBYTE) &g_refresh_rate, 4);
       RegCloseKey(key);
     }
 }
@@ -1106,6 +1188,7 @@ bool read_settings(int *port, int *baud)
       RegQueryValueEx(key, L"JoystickKeys", 0, &tp, (LPBYTE) &g_joy_keys, &l);
       RegQueryValueEx(key, L"MuteAudio", 0, &tp, (LPBYTE) &g_audio_mute, &l);
       RegQueryValueEx(key, L"AspectRatio", 0, &tp, (LPBYTE) &g_aspect_ratio, &l);
+      RegQueryValueEx(key, L"RefreshRate", 0, &tp, (LPBYTE) &g_refresh_rate, &l);
       RegCloseKey(key);
       
       if( RegCreateKeyEx(HKEY_CURRENT_USER, L"Software\\DazzlerDisplay\\JoyKeys", 0, NULL, REG_OPTION_NON_VOLATILE, KEY_SET_VALUE|KEY_QUERY_VALUE, NULL, &key, NULL) == ERROR_SUCCESS )
@@ -1150,51 +1233,18 @@ void adjust_render_area_size(HWND hwnd)
   if( pRenderTarget != NULL )
     {
       WaitForSingleObject(video_mutex, INFINITE);
-      
-      if( g_aspect_ratio==ASPECT_WIN )
-        {
-          // aspect ratio is set to "stretch" so set a virtual
-          // width/height of 128 pixels regardless of window size
-          pRenderTarget->Resize(D2D1::SizeU(P_PIXEL_SIZE*128, P_PIXEL_SIZE*128));
-          border_topbottom = border_leftright = 0;
-        }
-      else
-        {
-          // get window (client) size
-          RECT r;
-          GetClientRect(hwnd, &r);
-          int width  = r.right-r.left;
-          int height = r.bottom-r.top;
 
-          // if aspect ratio is 4:3 then widen pixels by reducing 
-          // virtual width ov window
-          if (g_aspect_ratio == ASPECT_43) width = (width * 3) / 4;
+      // get window (client) size
+      RECT r;
+      GetClientRect(hwnd, &r);
+      int width  = r.right-r.left;
+      int height = r.bottom-r.top;
 
-          if( width>0 && height>0)
-            {
-              // fix maximum virtual width or height to 128 pixels and scale 
-              // other dimension according to current window width:height ratio
-              // this will scale up the pixel size
-              if (width < height)
-                {
-                  height = (height * P_PIXEL_SIZE * 128) / width;
-                  width = P_PIXEL_SIZE * 128;
-                }
-              else
-                {
-                  width = (width * P_PIXEL_SIZE * 128) / height;
-                  height = P_PIXEL_SIZE * 128;
-                }
-            }
-              
-          // set virtual width of render area
-          pRenderTarget->Resize(D2D1::SizeU(width, height));
+      // render area is the window in actual pixels (render target is at 96 DPI),
+      // the scaler picks the largest whole-number pixel size that fits
+      if( dazzler_scale_set_geometry(&g_scaler, width, height, g_aspect_ratio) )
+        pRenderTarget->Resize(D2D1::SizeU(width, height));
 
-          // set borders to center picture
-          border_topbottom = height > width  ? (height-width)/2: 0;
-          border_leftright = width  > height ? (width-height)/2: 0;
-        }
-      
       ReleaseMutex(video_mutex);
       SetEvent(video_redraw);
     }
@@ -1267,6 +1317,14 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
         // Test for the identifier of a command item. 
         switch( id )
           { 
+          case ID_FILE_RECORD:
+            trace_toggle(hwnd);
+            break;
+
+          case ID_FILE_CAPTURE:
+            capture_toggle(hwnd);
+            break;
+
           case ID_FILE_EXIT: 
             PostQuitMessage(0); 
             break;
@@ -1298,6 +1356,12 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
               break;
             }
 
+          case ID_VIEW_RATE_GRID:        set_refresh_rate(hwnd, DAZ_SCHED_GRID); break;
+          case ID_VIEW_RATE_30:          set_refresh_rate(hwnd, 30); break;
+          case ID_VIEW_RATE_60:          set_refresh_rate(hwnd, 60); break;
+          case ID_VIEW_RATE_120:         set_refresh_rate(hwnd, 120); break;
+          case ID_VIEW_RATE_UNLIMITED:   set_refresh_rate(hwnd, DAZ_SCHED_UNLIMITED); break;
+
           case ID_SETTINGS_BAUD_9600:    set_baud_rate(hwnd, 9600); break;
           case ID_SETTINGS_BAUD_38400:   set_baud_rate(hwnd, 38400); break;
           case ID_SETTINGS_BAUD_115200:  set_baud_rate(hwnd, 115200); break;
@@ -1555,6 +1619,8 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
               }
             else
               dazzler_receive(hwnd, data, size);
+
+            if( !dazzler_decoder_in_frame(&g_decoder) ) publish_frame(true);
           }
         else
           {
@@ -1600,15 +1666,24 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE, PWSTR pCmdLine, int nCmdShow
   // create the window menu
   HMENU menu = CreateMenu();
   HMENU menuFile = CreateMenu();
+  AppendMenu(menuFile, MF_BYPOSITION | MF_STRING, ID_FILE_RECORD, L"&Record Trace...");
+  AppendMenu(menuFile, MF_BYPOSITION | MF_STRING, ID_FILE_CAPTURE, L"&Capture Video...");
   AppendMenu(menuFile, MF_BYPOSITION | MF_STRING, ID_FILE_EXIT, L"E&xit");
   HMENU menuAspect = CreateMenu();
   AppendMenu(menuAspect, MF_BYPOSITION | MF_STRING, ID_VIEW_ASPECT_11, L"&1:1");
   AppendMenu(menuAspect, MF_BYPOSITION | MF_STRING, ID_VIEW_ASPECT_43, L"&4:3");
   AppendMenu(menuAspect, MF_BYPOSITION | MF_STRING, ID_VIEW_ASPECT_WIN, L"&Stretch");
+  HMENU menuRate = CreateMenu();
+  AppendMenu(menuRate, MF_BYPOSITION | MF_STRING, ID_VIEW_RATE_GRID, L"&Fixed grid (~60.3 Hz)");
+  AppendMenu(menuRate, MF_BYPOSITION | MF_STRING, ID_VIEW_RATE_30, L"&30 Hz");
+  AppendMenu(menuRate, MF_BYPOSITION | MF_STRING, ID_VIEW_RATE_60, L"&60 Hz");
+  AppendMenu(menuRate, MF_BYPOSITION | MF_STRING, ID_VIEW_RATE_120, L"&120 Hz");
+  AppendMenu(menuRate, MF_BYPOSITION | MF_STRING, ID_VIEW_RATE_UNLIMITED, L"&Unlimited");
   HMENU menuView = CreateMenu();
   AppendMenu(menuView, MF_BYPOSITION | MF_STRING, ID_VIEW_FULLSCREEN, L"&Full Screen\tCtrl+F");
   AppendMenu(menuView, MF_BYPOSITION | MF_STRING, ID_VIEW_NORMAL,     L"&Normal\tCtrl+N");
   AppendMenu(menuView, MF_POPUP, (UINT_PTR) menuAspect, L"&Pixel Aspect Ratio");
+  AppendMenu(menuView, MF_POPUP, (UINT_PTR) menuRate, L"&Refresh Rate");
   HMENU menuPort = CreateMenu();
   AppendMenu(menuPort, MF_BYPOSITION | MF_STRING, ID_SETTINGS_PORT_NONE, L"None");
   HMENU menuBaud = CreateMenu();
@@ -1652,11 +1727,15 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE, PWSTR pCmdLine, int nCmdShow
   CheckMenuItem(GetSubMenu(GetMenu(hwnd), 2), ID_SETTINGS_JOY_KEYS, MF_BYCOMMAND | (g_joy_keys ? MF_CHECKED : MF_UNCHECKED));
   CheckMenuItem(GetSubMenu(GetMenu(hwnd), 2), ID_SETTINGS_AUDIO_MUTE, MF_BYCOMMAND | (g_audio_mute ? MF_CHECKED : MF_UNCHECKED));
   CheckMenuRadioItem(menuAspect, ID_VIEW_ASPECT_11, ID_VIEW_ASPECT_WIN, ID_VIEW_ASPECT_11+g_aspect_ratio, MF_BYCOMMAND);
+  set_refresh_rate(hwnd, g_refresh_rate);
 
   // initialize joystick and main memory data
   g_joy1[0]=DAZ_JOY1 | 0x0f; g_joy1[1]=0x00; g_joy1[2]=0x00;
   g_joy2[0]=DAZ_JOY2 | 0x0f; g_joy2[1]=0x00; g_joy2[2]=0x00;
   memset(dazzler_mem, 0, 2*2048);
+  dazzler_decoder_init(&g_decoder, dazzler_mem, FEAT_VIDEO | FEAT_DUAL_BUF | FEAT_JOYSTICK | FEAT_KEYBOARD | FEAT_DAC | FEAT_STATE | FEAT_MEMBLOCK | FEAT_DELTA | FEAT_CREDIT | FEAT_FRAMED | FEAT_PING | FEAT_DACBURST | FEAT_RECT | FEAT_CHUNK,
+                       &decoder_callbacks, hwnd);
+  dazzler_handoff_init(&g_handoff);
 
   if( g_com_port>0 || wcslen(pCmdLine)==0 )
     {